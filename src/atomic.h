@@ -265,6 +265,19 @@ public:
         return value;
     }
 
+    /**
+     * Get the pointer while a lock holder may be changing it, for readers
+     * which validate what they read afterwards (e.g. seqlock readers); it
+     * is only safe to use once validated.
+     */
+    T* getRelaxed() const {
+        static_assert(sizeof(std::atomic<T*>) == sizeof(T*),
+                      "getRelaxed: std::atomic<T*> must have the layout of "
+                      "T*");
+        return reinterpret_cast<const std::atomic<T*>&>(value).load(
+                std::memory_order_relaxed);
+    }
+
     SingleThreadedRCPtr<T> & operator =(const SingleThreadedRCPtr<T> &other) {
         reset(other);
         return *this;
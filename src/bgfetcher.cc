@@ -25,33 +25,42 @@
 #include "executorthread.h"
 #include "kv_bucket.h"
 #include "kvshard.h"
+#include "statwriter.h"
 
 const double BgFetcher::sleepInterval = MIN_SLEEP_TIME;
 
 BgFetcher::BgFetcher(KVBucket& s, KVShard& k)
-    : BgFetcher(&s, &k, s.getEPEngine().getEpStats()) {
+    : BgFetcher(&s,
+                &k,
+                s.getEPEngine().getEpStats(),
+                s.getEPEngine().getConfiguration().getBgfetcherTasksPerShard()) {
 }
 
 void BgFetcher::start() {
-    bool inverse = false;
-    pendingFetch.compare_exchange_strong(inverse, true);
     ExecutorPool* iom = ExecutorPool::get();
-    ExTask task = new MultiBGFetcherTask(&(store->getEPEngine()), this, false);
-    this->setTaskId(task->getId());
-    iom->schedule(task, READER_TASK_IDX);
+    for (size_t ii = 0; ii < lanes.size(); ++ii) {
+        bool inverse = false;
+        lanes[ii].pendingFetch.compare_exchange_strong(inverse, true);
+        ExTask task = new MultiBGFetcherTask(&(store->getEPEngine()), this, ii);
+        lanes[ii].taskId = task->getId();
+        iom->schedule(task, READER_TASK_IDX);
+    }
 }
 
 void BgFetcher::stop() {
-    bool inverse = true;
-    pendingFetch.compare_exchange_strong(inverse, false);
-    ExecutorPool::get()->cancel(taskId);
+    for (auto& lane : lanes) {
+        bool inverse = true;
+        lane.pendingFetch.compare_exchange_strong(inverse, false);
+        ExecutorPool::get()->cancel(lane.taskId);
+    }
 }
 
-void BgFetcher::notifyBGEvent(void) {
+void BgFetcher::notifyBGEvent(VBucket::id_type vbId) {
     ++stats.numRemainingBgItems;
+    Lane& lane = getLane(vbId);
     bool inverse = false;
-    if (pendingFetch.compare_exchange_strong(inverse, true)) {
-        ExecutorPool::get()->wake(taskId);
+    if (lane.pendingFetch.compare_exchange_strong(inverse, true)) {
+        ExecutorPool::get()->wake(lane.taskId);
     }
 }
 
@@ -78,8 +87,17 @@ size_t BgFetcher::doFetch(VBucket::id_type vbId,
 
     if (fetchedItems.size() > 0) {
         store->completeBGFetchMulti(vbId, fetchedItems, startTime);
-        stats.getMultiHisto.add((gethrtime() - startTime) / 1000,
+        const hrtime_t stopTime = gethrtime();
+        stats.getMultiHisto.add((stopTime - startTime) / 1000,
                                 fetchedItems.size());
+
+        for (const auto& fetched : fetchedItems) {
+            const hrtime_t initTime = fetched.second->initTime;
+            if (stopTime >= startTime && startTime >= initTime) {
+                bgWaitHisto.add((startTime - initTime) / 1000);
+                bgLoadHisto.add((stopTime - startTime) / 1000);
+            }
+        }
     }
 
     clearItems(vbId, itemsToFetch);
@@ -95,16 +113,17 @@ void BgFetcher::clearItems(VBucket::id_type vbId,
     }
 }
 
-bool BgFetcher::run(GlobalTask *task) {
+bool BgFetcher::run(GlobalTask *task, size_t laneId) {
+    Lane& lane = lanes.at(laneId);
     size_t num_fetched_items = 0;
     bool inverse = true;
-    pendingFetch.compare_exchange_strong(inverse, false);
+    lane.pendingFetch.compare_exchange_strong(inverse, false);
 
-    std::vector<uint16_t> bg_vbs(pendingVbs.size());
+    std::vector<uint16_t> bg_vbs;
     {
         LockHolder lh(queueMutex);
-        bg_vbs.assign(pendingVbs.begin(), pendingVbs.end());
-        pendingVbs.clear();
+        bg_vbs.assign(lane.pendingVbs.begin(), lane.pendingVbs.end());
+        lane.pendingVbs.clear();
     }
 
     for (const uint16_t vbId : bg_vbs) {
@@ -114,10 +133,10 @@ bool BgFetcher::run(GlobalTask *task) {
             if (vb->isBucketCreation()) {
                 {
                     LockHolder lh(queueMutex);
-                    pendingVbs.insert(vbId);
+                    lane.pendingVbs.insert(vbId);
                 }
                 bool inverse = false;
-                pendingFetch.compare_exchange_strong(inverse, true);
+                lane.pendingFetch.compare_exchange_strong(inverse, true);
                 continue;
             }
 
@@ -130,12 +149,12 @@ bool BgFetcher::run(GlobalTask *task) {
 
     stats.numRemainingBgItems.fetch_sub(num_fetched_items);
 
-    if (!pendingFetch.load()) {
+    if (!lane.pendingFetch.load()) {
         // wait a bit until next fetch request arrives
         double sleep = std::max(store->getBGFetchDelay(), sleepInterval);
         task->snooze(sleep);
 
-        if (pendingFetch.load()) {
+        if (lane.pendingFetch.load()) {
             // check again a new fetch request could have arrived
             // right before calling above snooze()
             task->snooze(0);
@@ -153,3 +172,11 @@ bool BgFetcher::pendingJob() const {
     }
     return false;
 }
+
+void BgFetcher::addTimingStats(ADD_STAT add_stat, const void* cookie) {
+    const std::string prefix = "bgfetcher_" + std::to_string(shard->getId());
+    add_casted_stat((prefix + ":bg_wait").c_str(), bgWaitHisto, add_stat,
+                    cookie);
+    add_casted_stat((prefix + ":bg_load").c_str(), bgLoadHisto, add_stat,
+                    cookie);
+}
@@ -20,9 +20,11 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <list>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "item.h"
 #include "kvstore.h"
@@ -37,6 +39,11 @@ class GlobalTask;
 /**
  * Dispatcher job responsible for batching data reads and push to
  * underlying storage
+ *
+ * The shard's vbuckets are divided between a number of lanes, each with its
+ * own reader task, so that fetches for different vbuckets of a shard can be
+ * made concurrently. All of a vbucket's fetches are made by its lane's task,
+ * so remain in order.
  */
 class BgFetcher {
 public:
@@ -47,15 +54,17 @@ public:
      * @param s  The store
      * @param k  The shard to which this background fetcher belongs
      * @param st reference to statistics
+     * @param concurrency number of lanes (reader tasks) to fetch with
      */
-    BgFetcher(KVBucket* s, KVShard* k, EPStats &st) :
-        store(s), shard(k), taskId(0), stats(st), pendingFetch(false) {}
+    BgFetcher(KVBucket* s, KVShard* k, EPStats &st, size_t concurrency = 1) :
+        store(s), shard(k), stats(st),
+        lanes(std::max(concurrency, size_t(1))) {}
 
     /**
      * Construct a BgFetcher
      *
-     * Equivalent to above constructor except stats reference is obtained
-     * from KVBucket's reference to EPEngine's epstats.
+     * Equivalent to above constructor except stats reference and
+     * concurrency are obtained from KVBucket's reference to EPEngine.
      *
      * @param s The store
      * @param k The shard to which this background fetcher belongs
@@ -64,37 +73,68 @@ public:
 
     ~BgFetcher() {
         LockHolder lh(queueMutex);
-        if (!pendingVbs.empty()) {
+        size_t pending = 0;
+        for (auto& lane : lanes) {
+            pending += lane.pendingVbs.size();
+            lane.pendingVbs.clear();
+        }
+        if (pending != 0) {
             LOG(EXTENSION_LOG_DEBUG,
                     "Terminating database reader without completing "
-                    "background fetches for %ld vbuckets.\n", pendingVbs.size());
-            pendingVbs.clear();
+                    "background fetches for %ld vbuckets.\n", pending);
         }
     }
 
     void start(void);
     void stop(void);
-    bool run(GlobalTask *task);
+
+    /**
+     * Fetch the pending items of the given lane's vbuckets.
+     */
+    bool run(GlobalTask *task, size_t lane = 0);
     bool pendingJob(void) const;
-    void notifyBGEvent(void);
-    void setTaskId(size_t newId) { taskId = newId; }
+    void notifyBGEvent(VBucket::id_type vbId);
     void addPendingVB(VBucket::id_type vbId) {
+        Lane& lane = getLane(vbId);
         LockHolder lh(queueMutex);
-        pendingVbs.insert(vbId);
+        lane.pendingVbs.insert(vbId);
+    }
+
+    size_t getConcurrency() const {
+        return lanes.size();
     }
 
+    /**
+     * Add this shard's background fetch wait and load time histograms.
+     */
+    void addTimingStats(ADD_STAT add_stat, const void* cookie);
+
 private:
+    struct Lane {
+        Lane() : taskId(0), pendingFetch(false) {}
+
+        size_t taskId;
+        std::atomic<bool> pendingFetch;
+        std::set<VBucket::id_type> pendingVbs;
+    };
+
+    Lane& getLane(VBucket::id_type vbId) {
+        return lanes[vbId % lanes.size()];
+    }
+
     size_t doFetch(VBucket::id_type vbId, vb_bgfetch_queue_t& items);
     void clearItems(VBucket::id_type vbId, vb_bgfetch_queue_t& items);
 
     KVBucket* store;
     KVShard* shard;
-    size_t taskId;
-    std::mutex queueMutex;
+    std::mutex queueMutex; // guards each lane's pendingVbs
     EPStats &stats;
 
-    std::atomic<bool> pendingFetch;
-    std::set<VBucket::id_type> pendingVbs;
+    std::vector<Lane> lanes;
+
+    //! Histograms of this shard's background fetch wait and load times.
+    Histogram<hrtime_t> bgWaitHisto;
+    Histogram<hrtime_t> bgLoadHisto;
 };
 
 #endif  // SRC_BGFETCHER_H_
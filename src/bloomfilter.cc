@@ -19,18 +19,75 @@
 
 #include "bloomfilter.h"
 
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+std::unique_ptr<BloomFilter> BloomFilter::create(Type type,
+                                                 size_t key_count,
+                                                 double false_positive_prob,
+                                                 bfilter_status_t newStatus) {
+    switch (type) {
+    case Type::Standard:
+        return std::make_unique<BloomFilter>(key_count, false_positive_prob,
+                                             newStatus);
+    case Type::Blocked:
+        return std::make_unique<BlockedBloomFilter>(
+                key_count, false_positive_prob, newStatus);
+    case Type::Counting:
+        return std::make_unique<CountingBloomFilter>(
+                key_count, false_positive_prob, newStatus);
+    }
+    throw std::invalid_argument("BloomFilter::create: unknown type " +
+                                std::to_string(int(type)));
+}
+
+BloomFilter::Type BloomFilter::typeFromString(const std::string& type) {
+    if (type == "standard") {
+        return Type::Standard;
+    } else if (type == "blocked") {
+        return Type::Blocked;
+    } else if (type == "counting") {
+        return Type::Counting;
+    }
+    throw std::invalid_argument("BloomFilter::typeFromString: unknown "
+                                "type '" + type + "'");
+}
+
+const char* BloomFilter::typeToString(Type type) {
+    switch (type) {
+    case Type::Standard:
+        return "standard";
+    case Type::Blocked:
+        return "blocked";
+    case Type::Counting:
+        return "counting";
+    }
+    return "<unknown>";
+}
 
 BloomFilter::BloomFilter(size_t key_count, double false_positive_prob,
                          bfilter_status_t new_status) {
 
     status = new_status;
     filterSize = estimateFilterSize(key_count, false_positive_prob);
-    noOfHashes = estimateNoOfHashes(key_count);
+    noOfHashes = estimateNoOfHashes(filterSize, key_count);
     keyCounter = 0;
     bitArray.assign(filterSize, false);
 }
 
+BloomFilter::BloomFilter(bfilter_status_t new_status, size_t filterSize,
+                         size_t noOfHashes)
+    : filterSize(filterSize),
+      noOfHashes(noOfHashes),
+      keyCounter(0),
+      status(new_status) {
+}
+
 BloomFilter::~BloomFilter() {
     status = BFILTER_DISABLED;
     bitArray.clear();
@@ -42,8 +99,8 @@ size_t BloomFilter::estimateFilterSize(size_t key_count,
                                                     / (pow(log(2.0), 2))));
 }
 
-size_t BloomFilter::estimateNoOfHashes(size_t key_count) {
-    return round(((double) filterSize / key_count) * (log(2.0)));
+size_t BloomFilter::estimateNoOfHashes(size_t filter_size, size_t key_count) {
+    return round(((double) filter_size / key_count) * (log(2.0)));
 }
 
 void BloomFilter::setStatus(bfilter_status_t to) {
@@ -56,7 +113,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_PENDING:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_COMPACTING) {
                 status = to;
             }
@@ -64,7 +121,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_COMPACTING:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_ENABLED) {
                 status = to;
             }
@@ -72,7 +129,7 @@ void BloomFilter::setStatus(bfilter_status_t to) {
         case BFILTER_ENABLED:
             if (to == BFILTER_DISABLED) {
                 status = to;
-                bitArray.clear();
+                clearBits();
             } else if (to == BFILTER_COMPACTING) {
                 status = to;
             }
@@ -80,6 +137,11 @@ void BloomFilter::setStatus(bfilter_status_t to) {
     }
 }
 
+void BloomFilter::clearBits() {
+    // Keep the filter's size, as it may be re-enabled.
+    bitArray.assign(filterSize, false);
+}
+
 bfilter_status_t BloomFilter::getStatus() {
     return status;
 }
@@ -143,3 +205,399 @@ size_t BloomFilter::getFilterSize() {
         return 0;
     }
 }
+
+size_t BloomFilter::getKeyCapacity() const {
+    // The inverse of estimateNoOfHashes().
+    if (noOfHashes == 0) {
+        return 0;
+    }
+    return size_t(filterSize * log(2.0) / noOfHashes);
+}
+
+void BloomFilter::checkMergeable(const BloomFilter& other) const {
+    if (getType() != other.getType()) {
+        throw std::invalid_argument(std::string("BloomFilter::merge: can't "
+                                                "merge a ") +
+                                    typeToString(other.getType()) +
+                                    " filter into a " +
+                                    typeToString(getType()) + " filter");
+    }
+    if (filterSize != other.filterSize || noOfHashes != other.noOfHashes) {
+        throw std::invalid_argument("BloomFilter::merge: filters differ in "
+                                    "size");
+    }
+}
+
+std::unique_ptr<BloomFilter> BloomFilter::clone() const {
+    return std::make_unique<BloomFilter>(*this);
+}
+
+std::unique_ptr<BloomFilter> BloomFilter::cloneEmpty() const {
+    auto filter = clone();
+    filter->clearBits();
+    filter->keyCounter = 0;
+    return filter;
+}
+
+void BloomFilter::merge(const BloomFilter& other) {
+    checkMergeable(other);
+    for (size_t i = 0; i < filterSize; i++) {
+        if (other.bitArray[i]) {
+            bitArray[i] = true;
+        }
+    }
+    keyCounter = std::max(keyCounter, other.keyCounter);
+}
+
+namespace {
+// The fields preceding a serialised filter's bits.
+struct SerialisedHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t filterSize;
+    uint64_t noOfHashes;
+    uint64_t keyCounter;
+};
+
+const uint32_t serialisedMagic = 0x45504246; // "EPBF"
+}
+
+std::string BloomFilter::serialise() const {
+    SerialisedHeader header;
+    header.magic = serialisedMagic;
+    header.type = uint32_t(getType());
+    header.filterSize = filterSize;
+    header.noOfHashes = noOfHashes;
+    header.keyCounter = keyCounter;
+
+    std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    serialiseBits(out);
+    return out;
+}
+
+std::unique_ptr<BloomFilter> BloomFilter::deserialise(
+        const std::string& data) {
+    SerialisedHeader header;
+    if (data.size() < sizeof(header)) {
+        throw std::invalid_argument("BloomFilter::deserialise: data is too "
+                                    "short");
+    }
+    std::copy(data.data(), data.data() + sizeof(header),
+              reinterpret_cast<char*>(&header));
+    if (header.magic != serialisedMagic) {
+        throw std::invalid_argument("BloomFilter::deserialise: bad magic");
+    }
+
+    std::unique_ptr<BloomFilter> filter;
+    switch (Type(header.type)) {
+    case Type::Standard:
+        filter.reset(new BloomFilter(BFILTER_ENABLED, header.filterSize,
+                                     header.noOfHashes));
+        break;
+    case Type::Blocked:
+        filter = std::make_unique<BlockedBloomFilter>(
+                BFILTER_ENABLED, header.filterSize, header.noOfHashes);
+        break;
+    case Type::Counting:
+        filter = std::make_unique<CountingBloomFilter>(
+                BFILTER_ENABLED, header.filterSize, header.noOfHashes);
+        break;
+    default:
+        throw std::invalid_argument("BloomFilter::deserialise: unknown "
+                                    "type " + std::to_string(header.type));
+    }
+    filter->deserialiseBits(data.data() + sizeof(header),
+                            data.size() - sizeof(header));
+    filter->keyCounter = header.keyCounter;
+    return filter;
+}
+
+void BloomFilter::serialiseBits(std::string& out) const {
+    std::string bytes((filterSize + 7) / 8, '\0');
+    for (size_t i = 0; i < filterSize; i++) {
+        if (bitArray[i]) {
+            bytes[i / 8] |= char(1 << (i % 8));
+        }
+    }
+    out.append(bytes);
+}
+
+void BloomFilter::deserialiseBits(const char* data, size_t size) {
+    if (size != (filterSize + 7) / 8) {
+        throw std::invalid_argument("BloomFilter::deserialiseBits: expected " +
+                                    std::to_string((filterSize + 7) / 8) +
+                                    " bytes, got " + std::to_string(size));
+    }
+    bitArray.assign(filterSize, false);
+    for (size_t i = 0; i < filterSize; i++) {
+        bitArray[i] = (data[i / 8] >> (i % 8)) & 1;
+    }
+}
+
+/**
+ * Round a filter size up to whole blocks.
+ */
+static size_t roundUpToBlocks(size_t size) {
+    const size_t bits = BlockedBloomFilter::blockBits;
+    return std::max(size_t(1), (size + bits - 1) / bits) * bits;
+}
+
+BlockedBloomFilter::BlockedBloomFilter(size_t key_count,
+                                       double false_positive_prob,
+                                       bfilter_status_t new_status)
+    : BlockedBloomFilter(new_status,
+                         roundUpToBlocks(estimateFilterSize(
+                                 key_count, false_positive_prob)),
+                         1) {
+    noOfHashes = std::max(size_t(1),
+                          std::min(size_t(blockBits),
+                                   estimateNoOfHashes(filterSize, key_count)));
+}
+
+BlockedBloomFilter::BlockedBloomFilter(bfilter_status_t new_status,
+                                       size_t filterSize,
+                                       size_t noOfHashes)
+    : BloomFilter(new_status, filterSize, noOfHashes),
+      numBlocks(filterSize / blockBits) {
+    if (filterSize == 0 || filterSize % blockBits != 0) {
+        throw std::invalid_argument("BlockedBloomFilter: filterSize (which "
+                                    "is " + std::to_string(filterSize) +
+                                    ") must be a non-zero multiple of " +
+                                    std::to_string(blockBits));
+    }
+    if (noOfHashes == 0 || noOfHashes > blockBits) {
+        throw std::invalid_argument("BlockedBloomFilter: noOfHashes (which "
+                                    "is " + std::to_string(noOfHashes) +
+                                    ") must be between 1 and " +
+                                    std::to_string(blockBits));
+    }
+    allocateBlocks();
+}
+
+BlockedBloomFilter::BlockedBloomFilter(const BlockedBloomFilter& other)
+    : BloomFilter(other.status, other.filterSize, other.noOfHashes),
+      numBlocks(other.numBlocks) {
+    keyCounter = other.keyCounter;
+    allocateBlocks();
+    std::copy(other.blocks, other.blocks + numBlocks * blockWords, blocks);
+}
+
+void BlockedBloomFilter::allocateBlocks() {
+    // Over-allocate by a block's worth of words so that the blocks can
+    // start on a cache line.
+    words.assign((numBlocks + 1) * blockWords, 0);
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(words.data());
+    blocks = words.data() + ((64 - addr % 64) % 64) / sizeof(uint64_t);
+}
+
+BlockedBloomFilter::Probe BlockedBloomFilter::probeDocKey(
+        const DocKey& key) const {
+    uint64_t hash = 0;
+    MURMURHASH_3(key.data(), key.size(), uint32_t(key.getDocNamespace()),
+                 &hash);
+
+    // The upper half of the hash picks the block, and the lower half the
+    // bits within it.
+    Probe probe;
+    probe.block = (hash >> 32) % numBlocks;
+    std::fill(std::begin(probe.mask), std::end(probe.mask), 0);
+
+    // As blockBits is a power of two, an odd stride visits distinct bits
+    // for the first blockBits hashes.
+    uint32_t bit = uint32_t(hash);
+    const uint32_t stride = (uint32_t(hash) / blockBits) | 1;
+    for (size_t i = 0; i < noOfHashes; i++) {
+        const uint32_t pos = bit % blockBits;
+        probe.mask[pos / 64] |= uint64_t(1) << (pos % 64);
+        bit += stride;
+    }
+    return probe;
+}
+
+/**
+ * Returns true if all the bits of mask are set in block.
+ */
+static bool blockContains(const uint64_t* block, const uint64_t* mask) {
+    static_assert(BlockedBloomFilter::blockBits % 128 == 0,
+                  "blockContains: blocks must be whole vectors");
+#if defined(__SSE2__)
+    __m128i missing = _mm_setzero_si128();
+    for (size_t i = 0; i < BlockedBloomFilter::blockBits / 64; i += 2) {
+        const __m128i b = _mm_load_si128(
+                reinterpret_cast<const __m128i*>(block + i));
+        const __m128i m = _mm_load_si128(
+                reinterpret_cast<const __m128i*>(mask + i));
+        missing = _mm_or_si128(missing, _mm_andnot_si128(b, m));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) ==
+           0xffff;
+#else
+    uint64_t missing = 0;
+    for (size_t i = 0; i < BlockedBloomFilter::blockBits / 64; i++) {
+        missing |= mask[i] & ~block[i];
+    }
+    return missing == 0;
+#endif
+}
+
+void BlockedBloomFilter::addKey(const DocKey& key) {
+    if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        const Probe probe = probeDocKey(key);
+        uint64_t* block = getBlock(probe.block);
+        if (!blockContains(block, probe.mask)) {
+            keyCounter++;
+            for (size_t i = 0; i < blockWords; i++) {
+                block[i] |= probe.mask[i];
+            }
+        }
+    }
+}
+
+bool BlockedBloomFilter::maybeKeyExists(const DocKey& key) {
+    if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        const Probe probe = probeDocKey(key);
+        return blockContains(getBlock(probe.block), probe.mask);
+    }
+    // The key may exist.
+    return true;
+}
+
+void BlockedBloomFilter::clearBits() {
+    std::fill(words.begin(), words.end(), 0);
+}
+
+std::unique_ptr<BloomFilter> BlockedBloomFilter::clone() const {
+    return std::make_unique<BlockedBloomFilter>(*this);
+}
+
+void BlockedBloomFilter::merge(const BloomFilter& other) {
+    checkMergeable(other);
+    const auto& blocked = static_cast<const BlockedBloomFilter&>(other);
+    for (size_t i = 0; i < numBlocks * blockWords; i++) {
+        blocks[i] |= blocked.blocks[i];
+    }
+    keyCounter = std::max(keyCounter, blocked.keyCounter);
+}
+
+void BlockedBloomFilter::serialiseBits(std::string& out) const {
+    out.append(reinterpret_cast<const char*>(blocks),
+               numBlocks * blockWords * sizeof(uint64_t));
+}
+
+void BlockedBloomFilter::deserialiseBits(const char* data, size_t size) {
+    if (size != numBlocks * blockWords * sizeof(uint64_t)) {
+        throw std::invalid_argument("BlockedBloomFilter::deserialiseBits: "
+                                    "expected " +
+                                    std::to_string(numBlocks * blockWords *
+                                                   sizeof(uint64_t)) +
+                                    " bytes, got " + std::to_string(size));
+    }
+    std::copy(data, data + size, reinterpret_cast<char*>(blocks));
+}
+
+CountingBloomFilter::CountingBloomFilter(size_t key_count,
+                                         double false_positive_prob,
+                                         bfilter_status_t new_status)
+    : CountingBloomFilter(new_status,
+                          estimateFilterSize(key_count, false_positive_prob),
+                          0) {
+    noOfHashes = estimateNoOfHashes(filterSize, key_count);
+}
+
+CountingBloomFilter::CountingBloomFilter(bfilter_status_t new_status,
+                                         size_t filterSize,
+                                         size_t noOfHashes)
+    : BloomFilter(new_status, filterSize, noOfHashes),
+      counters((filterSize + 1) / 2, 0) {
+}
+
+void CountingBloomFilter::addKey(const DocKey& key) {
+    if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        bool overlap = true;
+        for (uint32_t i = 0; i < noOfHashes; i++) {
+            const size_t pos = hashDocKey(key, i) % filterSize;
+            const uint8_t count = getCounter(pos);
+            if (count == 0) {
+                overlap = false;
+            }
+            if (count < maxCount) {
+                setCounter(pos, count + 1);
+            }
+        }
+        if (!overlap) {
+            keyCounter++;
+        }
+    }
+}
+
+bool CountingBloomFilter::maybeKeyExists(const DocKey& key) {
+    if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        for (uint32_t i = 0; i < noOfHashes; i++) {
+            if (getCounter(hashDocKey(key, i) % filterSize) == 0) {
+                // The key does NOT exist.
+                return false;
+            }
+        }
+    }
+    // The key may exist.
+    return true;
+}
+
+bool CountingBloomFilter::removeKey(const DocKey& key) {
+    if (status != BFILTER_COMPACTING && status != BFILTER_ENABLED) {
+        return false;
+    }
+    // A key which isn't in the filter can't have been added; decrementing
+    // its counters would remove other keys.
+    if (noOfHashes == 0 || !maybeKeyExists(key)) {
+        return false;
+    }
+    bool emptied = false;
+    for (uint32_t i = 0; i < noOfHashes; i++) {
+        const size_t pos = hashDocKey(key, i) % filterSize;
+        const uint8_t count = getCounter(pos);
+        if (count < maxCount) {
+            setCounter(pos, count - 1);
+            if (count == 1) {
+                emptied = true;
+            }
+        }
+    }
+    if (emptied && keyCounter > 0) {
+        keyCounter--;
+    }
+    return true;
+}
+
+void CountingBloomFilter::clearBits() {
+    std::fill(counters.begin(), counters.end(), 0);
+}
+
+std::unique_ptr<BloomFilter> CountingBloomFilter::clone() const {
+    return std::make_unique<CountingBloomFilter>(*this);
+}
+
+void CountingBloomFilter::merge(const BloomFilter& other) {
+    checkMergeable(other);
+    const auto& counting = static_cast<const CountingBloomFilter&>(other);
+    for (size_t i = 0; i < filterSize; i++) {
+        const uint8_t sum = getCounter(i) + counting.getCounter(i);
+        setCounter(i, sum < maxCount ? sum : maxCount);
+    }
+    keyCounter = std::max(keyCounter, counting.keyCounter);
+}
+
+void CountingBloomFilter::serialiseBits(std::string& out) const {
+    out.append(reinterpret_cast<const char*>(counters.data()),
+               counters.size());
+}
+
+void CountingBloomFilter::deserialiseBits(const char* data, size_t size) {
+    if (size != counters.size()) {
+        throw std::invalid_argument("CountingBloomFilter::deserialiseBits: "
+                                    "expected " +
+                                    std::to_string(counters.size()) +
+                                    " bytes, got " + std::to_string(size));
+    }
+    std::copy(data, data + size, counters.begin());
+}
@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -48,23 +49,148 @@ enum bfilter_status_t {
  */
 class BloomFilter {
 public:
+    /**
+     * The kinds of filter which may be created (the bfilter_type
+     * configuration):
+     *  - Standard: each of a key's hashes sets a bit anywhere in the filter.
+     *  - Blocked: all of a key's bits are set within one cache line, found
+     *    from a single hash of the key (see BlockedBloomFilter).
+     *  - Counting: a small counter per position rather than a bit, so that
+     *    keys can be removed (see CountingBloomFilter).
+     */
+    enum class Type {
+        Standard,
+        Blocked,
+        Counting
+    };
+
+    /**
+     * Create a filter of the given type.
+     */
+    static std::unique_ptr<BloomFilter> create(Type type,
+                                               size_t key_count,
+                                               double false_positive_prob,
+                                               bfilter_status_t newStatus);
+
+    /**
+     * Convert the bfilter_type configuration string to a Type.
+     */
+    static Type typeFromString(const std::string& type);
+
+    /**
+     * Convert a Type to its configuration string.
+     */
+    static const char* typeToString(Type type);
+
     BloomFilter(size_t key_count, double false_positive_prob,
                 bfilter_status_t newStatus = BFILTER_DISABLED);
-    ~BloomFilter();
+    virtual ~BloomFilter();
 
     void setStatus(bfilter_status_t to);
     bfilter_status_t getStatus();
     std::string getStatusString();
 
-    void addKey(const DocKey& key);
-    bool maybeKeyExists(const DocKey& key);
+    virtual void addKey(const DocKey& key);
+    virtual bool maybeKeyExists(const DocKey& key);
+
+    /**
+     * Whether keys can be removed from the filter with removeKey().
+     */
+    virtual bool supportsRemoval() const {
+        return false;
+    }
+
+    /**
+     * Remove a key which was added to the filter.
+     *
+     * Only call this for keys which were added; removing any other key may
+     * remove keys which share its positions. Does nothing for filters which
+     * don't support removal.
+     *
+     * @return true if the key was removed
+     */
+    virtual bool removeKey(const DocKey& key) {
+        return false;
+    }
 
     size_t getNumOfKeysInFilter();
     size_t getFilterSize();
 
+    /**
+     * Returns the number of keys the filter can hold at the false positive
+     * probability it was sized for, estimated from its sizes.
+     */
+    size_t getKeyCapacity() const;
+
+    virtual Type getType() const {
+        return Type::Standard;
+    }
+
+    /**
+     * Returns a copy of the filter, including its keys.
+     */
+    virtual std::unique_ptr<BloomFilter> clone() const;
+
+    /**
+     * Returns an empty filter of the same type, size and status.
+     */
+    std::unique_ptr<BloomFilter> cloneEmpty() const;
+
+    /**
+     * Add the keys of another filter to this one. The key count becomes the
+     * larger of the two, as keys in both filters can't be told apart.
+     *
+     * @throws std::invalid_argument if the filters differ in type or size
+     */
+    virtual void merge(const BloomFilter& other);
+
+    /**
+     * Returns the filter's type, sizes, key count and bits as a string of
+     * bytes in host byte order, for storing on the local disk.
+     */
+    std::string serialise() const;
+
+    /**
+     * Recreate a filter from the output of serialise(), with status
+     * ENABLED.
+     *
+     * @throws std::invalid_argument if data isn't a serialised filter
+     */
+    static std::unique_ptr<BloomFilter> deserialise(const std::string& data);
+
 protected:
-    size_t estimateFilterSize(size_t key_count, double false_positive_prob);
-    size_t estimateNoOfHashes(size_t key_count);
+    /**
+     * For subclasses which keep their own storage for the filter's bits;
+     * only the status and sizes are set.
+     */
+    BloomFilter(bfilter_status_t newStatus, size_t filterSize,
+                size_t noOfHashes);
+
+    static size_t estimateFilterSize(size_t key_count,
+                                     double false_positive_prob);
+    static size_t estimateNoOfHashes(size_t filter_size, size_t key_count);
+
+    /**
+     * Clear all the filter's bits, when it is disabled.
+     */
+    virtual void clearBits();
+
+    /**
+     * Throws if other differs from this filter in type or size.
+     */
+    void checkMergeable(const BloomFilter& other) const;
+
+    /**
+     * Append the filter's bits to out.
+     */
+    virtual void serialiseBits(std::string& out) const;
+
+    /**
+     * Set the filter's bits from the output of serialiseBits().
+     *
+     * @throws std::invalid_argument if size is wrong for the filter
+     */
+    virtual void deserialiseBits(const char* data, size_t size);
 
     uint64_t hashDocKey(const DocKey& key, uint32_t iteration) {
         uint64_t result = 0;
@@ -82,4 +208,138 @@ protected:
     std::vector<bool> bitArray;
 };
 
+/**
+ * A bloom filter whose bits for each key all lie within one 64 byte block
+ * (a cache line). A single hash of the key is computed: its upper half
+ * picks the block, and the key's noOfHashes bits within the block are
+ * derived from its lower half by double hashing. A lookup therefore costs
+ * one hash and at most one cache miss, rather than noOfHashes of each, in
+ * exchange for a slightly higher false positive rate than a standard
+ * filter of the same size. The block is compared against the key's bits a
+ * vector at a time where SSE2 is available.
+ */
+class BlockedBloomFilter : public BloomFilter {
+public:
+    BlockedBloomFilter(size_t key_count, double false_positive_prob,
+                       bfilter_status_t newStatus = BFILTER_DISABLED);
+
+    /**
+     * Create an empty filter of filterSize bits (a whole number of blocks)
+     * which sets noOfHashes bits per key.
+     *
+     * @throws std::invalid_argument if the sizes are out of range
+     */
+    BlockedBloomFilter(bfilter_status_t newStatus, size_t filterSize,
+                       size_t noOfHashes);
+
+    BlockedBloomFilter(const BlockedBloomFilter& other);
+
+    void addKey(const DocKey& key) override;
+    bool maybeKeyExists(const DocKey& key) override;
+
+    Type getType() const override {
+        return Type::Blocked;
+    }
+
+    std::unique_ptr<BloomFilter> clone() const override;
+
+    void merge(const BloomFilter& other) override;
+
+    static const size_t blockBits = 512;
+
+protected:
+    static const size_t blockWords = blockBits / 64;
+
+    // The block a key's bits are in, and those bits.
+    struct Probe {
+        size_t block;
+        alignas(16) uint64_t mask[blockWords];
+    };
+
+    Probe probeDocKey(const DocKey& key) const;
+
+    uint64_t* getBlock(size_t block) {
+        return blocks + block * blockWords;
+    }
+
+    // Allocate zeroed storage for numBlocks blocks.
+    void allocateBlocks();
+
+    void clearBits() override;
+
+    void serialiseBits(std::string& out) const override;
+
+    void deserialiseBits(const char* data, size_t size) override;
+
+    size_t numBlocks;
+
+    // Storage for the blocks, with room to align the first to 64 bytes.
+    std::vector<uint64_t> words;
+    uint64_t* blocks;
+};
+
+/**
+ * A bloom filter holding a 4 bit counter at each position rather than a
+ * bit, so that a key can be removed by decrementing its counters. Keys are
+ * hashed to positions as in a standard filter, and a position is set while
+ * its counter is non-zero. A counter which reaches its maximum sticks there,
+ * as it no longer knows how many keys share it; this keeps removal from
+ * ever introducing false negatives. Takes four times the memory of a
+ * standard filter of the same size.
+ */
+class CountingBloomFilter : public BloomFilter {
+public:
+    CountingBloomFilter(size_t key_count, double false_positive_prob,
+                        bfilter_status_t newStatus = BFILTER_DISABLED);
+
+    /**
+     * Create an empty filter of filterSize counters which uses noOfHashes
+     * per key.
+     */
+    CountingBloomFilter(bfilter_status_t newStatus, size_t filterSize,
+                        size_t noOfHashes);
+
+    void addKey(const DocKey& key) override;
+    bool maybeKeyExists(const DocKey& key) override;
+
+    bool supportsRemoval() const override {
+        return true;
+    }
+
+    bool removeKey(const DocKey& key) override;
+
+    Type getType() const override {
+        return Type::Counting;
+    }
+
+    std::unique_ptr<BloomFilter> clone() const override;
+
+    /**
+     * Add the counters of another filter to this one (saturating).
+     */
+    void merge(const BloomFilter& other) override;
+
+    static const uint8_t maxCount = 15;
+
+protected:
+    uint8_t getCounter(size_t pos) const {
+        return (counters[pos / 2] >> (4 * (pos % 2))) & 0xf;
+    }
+
+    void setCounter(size_t pos, uint8_t value) {
+        const int shift = 4 * (pos % 2);
+        counters[pos / 2] = (counters[pos / 2] & ~(0xf << shift)) |
+                            (value << shift);
+    }
+
+    void clearBits() override;
+
+    void serialiseBits(std::string& out) const override;
+
+    void deserialiseBits(const char* data, size_t size) override;
+
+    // Two counters per byte, the even position in the low nibble.
+    std::vector<uint8_t> counters;
+};
+
 #endif // SRC_BLOOMFILTER_H_
@@ -0,0 +1,164 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "bloomfilter_file.h"
+
+#include "crc32.h"
+#include "utility.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// The fields preceding the serialised filter in a filter file.
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t uuid;
+    int64_t highSeqno;
+    uint64_t filterLength;
+    uint32_t filterCrc;
+    uint32_t padding;
+};
+
+const uint32_t fileMagic = 0x45504246; // "EPBF"
+const uint32_t fileVersion = 1;
+}
+
+std::string BloomFilterFile::getPath(const std::string& dbname,
+                                     uint16_t vbid) {
+    return dbname + "/" + std::to_string(vbid) + ".bloomfilter";
+}
+
+bool BloomFilterFile::save(const std::string& path,
+                           const BloomFilter& filter,
+                           uint64_t uuid,
+                           int64_t highSeqno) {
+    std::string data = filter.serialise();
+
+    FileHeader header = {};
+    header.magic = fileMagic;
+    header.version = fileVersion;
+    header.uuid = uuid;
+    header.highSeqno = highSeqno;
+    header.filterLength = data.size();
+    header.filterCrc = crc32buf(reinterpret_cast<uint8_t*>(&data[0]),
+                                data.size());
+
+    // Write to a new file and rename it over the old, so a crash part way
+    // through leaves either the old file or a complete new one.
+    const std::string next = path + ".new";
+    FILE* file = fopen(next.c_str(), "wb");
+    if (file == nullptr) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::save: Failed to open '%s': %s",
+            next.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool rv = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(data.data(), data.size(), 1, file) == 1;
+    if (fclose(file) != 0) {
+        rv = false;
+    }
+    if (!rv) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::save: Failed to write '%s': %s",
+            next.c_str(), strerror(errno));
+        ::remove(next.c_str());
+        return false;
+    }
+
+    if (rename(next.c_str(), path.c_str()) != 0) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::save: Failed to rename '%s' to '%s': %s",
+            next.c_str(), path.c_str(), strerror(errno));
+        ::remove(next.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<BloomFilter> BloomFilterFile::load(const std::string& path,
+                                                   uint64_t uuid,
+                                                   int64_t highSeqno) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        if (errno != ENOENT) {
+            LOG(EXTENSION_LOG_WARNING,
+                "BloomFilterFile::load: Failed to open '%s': %s",
+                path.c_str(), strerror(errno));
+        }
+        return nullptr;
+    }
+
+    FileHeader header;
+    std::string data;
+    bool rv = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == fileMagic && header.version == fileVersion;
+    if (rv) {
+        // Check the file holds exactly the filter before allocating for it.
+        const long start = ftell(file);
+        rv = fseek(file, 0, SEEK_END) == 0 &&
+             uint64_t(ftell(file) - start) == header.filterLength &&
+             fseek(file, start, SEEK_SET) == 0;
+    }
+    if (rv) {
+        data.resize(header.filterLength);
+        rv = fread(&data[0], 1, data.size(), file) == data.size();
+    }
+    fclose(file);
+
+    if (!rv ||
+        crc32buf(reinterpret_cast<uint8_t*>(&data[0]), data.size()) !=
+                header.filterCrc) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::load: Ignoring '%s', which is corrupt",
+            path.c_str());
+        return nullptr;
+    }
+
+    if (header.uuid != uuid || header.highSeqno != highSeqno) {
+        LOG(EXTENSION_LOG_NOTICE,
+            "BloomFilterFile::load: Ignoring '%s', which was saved at "
+            "uuid:%" PRIu64 " seqno:%" PRId64 " but the vbucket is at "
+            "uuid:%" PRIu64 " seqno:%" PRId64,
+            path.c_str(), header.uuid, header.highSeqno, uuid, highSeqno);
+        return nullptr;
+    }
+
+    try {
+        return BloomFilter::deserialise(data);
+    } catch (const std::invalid_argument& e) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::load: Ignoring '%s': %s", path.c_str(),
+            e.what());
+        return nullptr;
+    }
+}
+
+void BloomFilterFile::remove(const std::string& path) {
+    if (::remove(path.c_str()) != 0 && errno != ENOENT) {
+        LOG(EXTENSION_LOG_WARNING,
+            "BloomFilterFile::remove: Failed to remove '%s': %s",
+            path.c_str(), strerror(errno));
+    }
+}
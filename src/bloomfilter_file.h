@@ -0,0 +1,73 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "bloomfilter.h"
+
+#include <memory>
+#include <string>
+
+/**
+ * Saves a vbucket's bloom filter to a file alongside its couch file, so that
+ * after a restart the filter can be loaded rather than waiting for the next
+ * compaction to rebuild it.
+ *
+ * The file records the vbucket's failover UUID and persisted high seqno at
+ * the time the filter was saved. It is only loaded if the vbucket on disk
+ * still has the same UUID and high seqno, i.e. nothing has been persisted to
+ * the vbucket since, so the filter still holds every key on disk. A checksum
+ * guards against a partially written or corrupt file.
+ */
+class BloomFilterFile {
+public:
+    /**
+     * Returns the path of the filter file of the given vbucket.
+     */
+    static std::string getPath(const std::string& dbname, uint16_t vbid);
+
+    /**
+     * Write the filter to path, replacing any existing file.
+     *
+     * @param uuid the vbucket's latest failover UUID
+     * @param highSeqno the vbucket's persisted high seqno; every key on disk
+     *        up to this seqno must be in the filter
+     * @return true if the file was written
+     */
+    static bool save(const std::string& path,
+                     const BloomFilter& filter,
+                     uint64_t uuid,
+                     int64_t highSeqno);
+
+    /**
+     * Read the filter from path, if it was saved with the given UUID and
+     * high seqno.
+     *
+     * @return the filter (with status ENABLED), or nullptr if there is no
+     *         file or it is corrupt or out of date
+     */
+    static std::unique_ptr<BloomFilter> load(const std::string& path,
+                                             uint64_t uuid,
+                                             int64_t highSeqno);
+
+    /**
+     * Remove the file at path, if any.
+     */
+    static void remove(const std::string& path);
+};
@@ -18,6 +18,8 @@
 #include "config.h"
 
 #include <platform/checked_snprintf.h>
+#include <algorithm>
+#include <limits>
 #include <string>
 #include <utility>
 #include <vector>
@@ -30,6 +32,9 @@
 #include "vbucket.h"
 
 const std::string CheckpointManager::pCursorName("persistence");
+const CursorId CheckpointManager::pCursorId = 1;
+const CursorId CheckpointManager::invalidCursorId = 0;
+std::atomic<CursorId> CheckpointManager::nextCursorId(2);
 
 const char* to_string(enum checkpoint_state s) {
     switch (s) {
@@ -52,6 +57,8 @@ public:
             config.setCheckpointPeriod(value);
         } else if (key.compare("chk_max_items") == 0) {
             config.setCheckpointMaxItems(value);
+        } else if (key.compare("chk_max_size") == 0) {
+            config.setCheckpointMaxSize(value);
         } else if (key.compare("max_checkpoints") == 0) {
             config.setMaxCheckpoints(value);
         }
@@ -64,6 +71,8 @@ public:
             config.allowKeepClosedCheckpoints(value);
         } else if (key.compare("enable_chk_merge") == 0) {
             config.allowCheckpointMerge(value);
+        } else if (key.compare("chk_expel_enabled") == 0) {
+            config.allowCheckpointExpel(value);
         }
     }
 
@@ -98,6 +107,7 @@ size_t CheckpointCursor::getCurrentCkptMetaItemsRead() const {
 
 std::ostream& operator<<(std::ostream& os, const CheckpointCursor& c) {
     os << "CheckpointCursor[" << &c << "] with"
+       << " id:" << c.id
        << " name:" << c.name
        << " currentCkpt:{id:" << (*c.currentCheckpoint)->getId()
        << " state:" << to_string((*c.currentCheckpoint)->getState())
@@ -112,6 +122,7 @@ Checkpoint::~Checkpoint() {
         "Checkpoint %" PRIu64 " for vbucket %d is purged from memory",
         checkpointId, vbucketId);
     stats.memOverhead->fetch_sub(memorySize());
+    stats.checkpointMemUsage->fetch_sub(effectiveMemUsage);
     if (stats.memOverhead->load() >= GIGANTOR) {
         LOG(EXTENSION_LOG_WARNING,
             "Checkpoint::~Checkpoint: stats.memOverhead (which is %" PRId64
@@ -137,7 +148,7 @@ void Checkpoint::popBackCheckpointEndItem() {
 }
 
 bool Checkpoint::keyExists(const DocKey& key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(key) != nullptr;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
@@ -148,7 +159,9 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                         ") is not OPEN");
     }
     queue_dirty_t rv;
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    const size_t indexMemUsage = keyIndex.getMemoryUsage() +
+                                 metaKeyIndex.getMemoryUsage();
+    index_entry* existing = keyIndex.find(qi->getKey());
     // Check if the item is a meta item
     if (qi->isCheckPointMetaItem()) {
         // empty items act only as a dummy element for the start of the
@@ -161,10 +174,10 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         toWrite.push_back(qi);
     } else {
         // Check if this checkpoint already had an item for the same key
-        if (it != keyIndex.end()) {
+        if (existing) {
             rv = EXISTING_ITEM;
-            CheckpointQueue::iterator currPos = it->second.position;
-            const int64_t currMutationId{it->second.mutation_id};
+            CheckpointQueue::iterator currPos = existing->position;
+            const int64_t currMutationId{existing->mutation_id};
 
             // Given the key already exists, need to check all cursors in this
             // Checkpoint and see if the existing item for this key is to
@@ -183,12 +196,12 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                                                                 : keyIndex;
 
                     auto cursor_item_idx = index.find(cursor_item->getKey());
-                    if (cursor_item_idx == keyIndex.end()) {
+                    if (!cursor_item_idx) {
                         throw std::logic_error("Checkpoint::queueDirty: Unable "
                                 "to find key with"
                                 " op:" + to_string(cursor_item->getOperation()) +
                                 " seqno:" + std::to_string(cursor_item->getBySeqno()) +
-                                "for cursor:" + cursor.first + " in current checkpoint.");
+                                "for cursor:" + cursor.second.name + " in current checkpoint.");
                     }
 
                     // If the cursor item is non-meta, then we need to decrement
@@ -198,7 +211,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                     // decrement if the the existing item is strictly less than
                     // the cursor, as meta-items can share a seqno with
                     // a non-meta item but are logically before them.
-                    int64_t cursor_mutation_id{cursor_item_idx->second.mutation_id};
+                    int64_t cursor_mutation_id{cursor_item_idx->mutation_id};
                     if (cursor_item->isCheckPointMetaItem()) {
                         --cursor_mutation_id;
                     }
@@ -208,7 +221,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                         // backwards one so it will pick up the new value for
                         // this key.
                         cursor.second.decrOffset(1);
-                        if (cursor.second.name == CheckpointManager::pCursorName) {
+                        if (cursor.first == CheckpointManager::pCursorId) {
                             rv = PERSIST_AGAIN;
                         }
                     }
@@ -221,7 +234,12 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             }
 
             toWrite.push_back(qi);
-            // Remove the existing item for the same key from the list.
+            // Point the index at the new item before removing the existing
+            // one, as index lookups check keys against the queued items.
+            *existing = {std::prev(toWrite.end()), qi->getBySeqno()};
+            // Remove the existing item for the same key from the queue. The
+            // new item's size is accounted for by the caller.
+            decrementMemConsumption((*currPos)->size());
             toWrite.erase(currPos);
         } else {
             ++numItems;
@@ -239,13 +257,17 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         // the list.
         if (qi->isCheckPointMetaItem()) {
             // We add a meta item only once to a checkpoint
-            metaKeyIndex[qi->getKey()] = entry;
-        } else {
-            keyIndex[qi->getKey()] = entry;
+            metaKeyIndex.set(qi->getKey(), entry);
+        } else if (rv == NEW_ITEM) {
+            keyIndex.insert(qi->getKey(), entry);
         }
         if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() +
-                                  sizeof(index_entry) + sizeof(queued_item);
+            // Keys aren't copied into the index, so the overhead is the
+            // queued item plus any growth of the index.
+            size_t newEntrySize = sizeof(queued_item) +
+                                  keyIndex.getMemoryUsage() +
+                                  metaKeyIndex.getMemoryUsage() -
+                                  indexMemUsage;
             memOverhead += newEntrySize;
             stats.memOverhead->fetch_add(newEntrySize);
             if (stats.memOverhead->load() >= GIGANTOR) {
@@ -282,15 +304,31 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         " for vbucket %d",
         pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
+    const size_t indexMemUsage = keyIndex.getMemoryUsage() +
+                                 metaKeyIndex.getMemoryUsage();
+
     CheckpointQueue::iterator itr = toWrite.begin();
-    uint64_t seqno = pPrevCheckpoint->getMutationIdForKey(Checkpoint::DummyKey, true);
-    metaKeyIndex[Checkpoint::DummyKey].mutation_id = seqno;
-    (*itr)->setBySeqno(seqno);
+    const int64_t dummySeqno =
+            pPrevCheckpoint->getMutationIdForKey(Checkpoint::DummyKey, true);
+    (*itr)->setBySeqno(dummySeqno);
 
-    seqno = pPrevCheckpoint->getMutationIdForKey(Checkpoint::CheckpointStartKey, true);
-    metaKeyIndex[Checkpoint::CheckpointStartKey].mutation_id = seqno;
+    const int64_t chkStartSeqno = pPrevCheckpoint->getMutationIdForKey(
+            Checkpoint::CheckpointStartKey, true);
     ++itr;
-    (*itr)->setBySeqno(seqno);
+    (*itr)->setBySeqno(chkStartSeqno);
+
+    // Items from the previous checkpoint belong after our first two meta
+    // items (empty & checkpoint start). The queue can only be added to at
+    // either end, so take those two off the front while the previous
+    // checkpoint's items are pushed onto it, and then put them back.
+    // Their index entries are removed first, as lookups check keys
+    // against the queued items.
+    metaKeyIndex.erase(Checkpoint::DummyKey);
+    metaKeyIndex.erase(Checkpoint::CheckpointStartKey);
+    queued_item dummyItem = toWrite.front();
+    toWrite.pop_front();
+    queued_item chkStartItem = toWrite.front();
+    toWrite.pop_front();
 
     // Iterate in reverse over the previous checkpoints' items, inserting them
     // into the current checkpoint as necessary.
@@ -304,14 +342,13 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
                 // checkpoint if the key isn't already present (if it is already
                 // present then it must be an older revision and hence we can
                 // safely discard it).
-                if (keyIndex.find(key) == keyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
-                    index_entry entry = {--pos, static_cast<int64_t>(pPrevCheckpoint->
+                if (!keyIndex.find(key)) {
+                    toWrite.push_front(*rit);
+                    index_entry entry = {toWrite.begin(),
+                                         static_cast<int64_t>(pPrevCheckpoint->
                                                     getMutationIdForKey(key, false))};
-                    keyIndex[key] = entry;
-                    newEntryMemOverhead += key.size() + sizeof(index_entry);
+                    keyIndex.insert(key, entry);
+                    newEntryMemOverhead += sizeof(queued_item);
                     ++numItems;
                     ++numNewItems;
 
@@ -342,14 +379,12 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
             case queue_op::set_vbucket_state:
             case queue_op::system_event:
                 // Need to re-insert these into the correct place in the index.
-                if (metaKeyIndex.find(key) == metaKeyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
+                if (!metaKeyIndex.find(key)) {
+                    toWrite.push_front(*rit);
                     auto mutationId = static_cast<int64_t>(
                             pPrevCheckpoint->getMutationIdForKey(key, true));
-                    metaKeyIndex[key] = {--pos, mutationId};
-                    newEntryMemOverhead += key.size() + sizeof(index_entry);
+                    metaKeyIndex.insert(key, {toWrite.begin(), mutationId});
+                    newEntryMemOverhead += sizeof(queued_item);
                     ++numMetaItems;
                     ++numNewItems;
 
@@ -360,6 +395,14 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         }
     }
 
+    toWrite.push_front(chkStartItem);
+    metaKeyIndex.insert(Checkpoint::CheckpointStartKey,
+                        {toWrite.begin(), chkStartSeqno});
+    toWrite.push_front(dummyItem);
+    metaKeyIndex.insert(Checkpoint::DummyKey, {toWrite.begin(), dummySeqno});
+    newEntryMemOverhead += keyIndex.getMemoryUsage() +
+                           metaKeyIndex.getMemoryUsage() - indexMemUsage;
+
     /**
      * Update snapshot start of current checkpoint to the first
      * item's sequence number, after merge completed, as items
@@ -377,13 +420,58 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     return numNewItems;
 }
 
+CheckpointExpelResult Checkpoint::expelItems(CheckpointQueue::iterator last) {
+    CheckpointExpelResult rv{0, 0, 0};
+    size_t numExpelled = 0;
+
+    // Keep the dummy and checkpoint_start items.
+    auto it = std::next(toWrite.begin(), 2);
+    while (it != last) {
+        if (it == toWrite.end()) {
+            throw std::logic_error("Checkpoint::expelItems: last is not in "
+                                   "the checkpoint");
+        }
+        const queued_item& qi = *it;
+        // Remove the index entry before the item, as lookups check keys
+        // against the queued items. Meta items aren't de-duplicated (every
+        // set_vbucket_state shares a key), so the entry may belong to a
+        // later item with the same key, which must keep it.
+        auto& index = qi->isCheckPointMetaItem() ? metaKeyIndex : keyIndex;
+        const index_entry* entry = index.find(qi->getKey());
+        if (entry && entry->position == it) {
+            index.erase(qi->getKey());
+        }
+        if (qi->isCheckPointMetaItem()) {
+            if (qi->isNonEmptyCheckpointMetaItem()) {
+                --numMetaItems;
+                ++rv.numMetaItems;
+            }
+        } else {
+            --numItems;
+            ++rv.numItems;
+        }
+        highestExpelledSeqno = std::max(highestExpelledSeqno,
+                                        uint64_t(qi->getBySeqno()));
+        const size_t itemSize = qi->size();
+        decrementMemConsumption(itemSize);
+        rv.memory += itemSize + sizeof(queued_item);
+        ++numExpelled;
+        it = toWrite.erase(it);
+    }
+
+    const size_t overhead = numExpelled * sizeof(queued_item);
+    memOverhead -= overhead;
+    stats.memOverhead->fetch_sub(overhead);
+    return rv;
+}
+
 uint64_t Checkpoint::getMutationIdForKey(const DocKey& key, bool isMeta) {
     uint64_t mid = 0;
-    checkpoint_index& chkIdx = isMeta ? metaKeyIndex : keyIndex;
+    CheckpointIndex& chkIdx = isMeta ? metaKeyIndex : keyIndex;
 
-    checkpoint_index::iterator it = chkIdx.find(key);
-    if (it != chkIdx.end()) {
-        mid = it->second.mutation_id;
+    const index_entry* entry = chkIdx.find(key);
+    if (entry) {
+        mid = entry->mutation_id;
     } else {
         throw std::invalid_argument("key{" +
                                     std::string(reinterpret_cast<const char*>(key.data())) +
@@ -395,15 +483,8 @@ uint64_t Checkpoint::getMutationIdForKey(const DocKey& key, bool isMeta) {
 }
 
 bool Checkpoint::isEligibleToBeUnreferenced() {
-    const std::set<std::string> &cursors = getCursorNameList();
-    std::set<std::string>::const_iterator cit = cursors.begin();
-    for (; cit != cursors.end(); ++cit) {
-        if ((*cit).compare(CheckpointManager::pCursorName) == 0) {
-            // Persistence cursor is on current checkpoint
-            return false;
-        }
-    }
-    return true;
+    // Not if the persistence cursor is on current checkpoint
+    return !hasCursorId(CheckpointManager::pCursorId);
 }
 
 std::ostream& operator <<(std::ostream& os, const Checkpoint& c) {
@@ -439,8 +520,8 @@ CheckpointManager::CheckpointManager(EPStats& st,
     LockHolder lh(queueLock);
     addNewCheckpoint_UNLOCKED(1, lastSnapStart, lastSnapEnd);
     if (checkpointConfig.isPersistenceEnabled()) {
-        registerCursor_UNLOCKED(
-                "persistence", 1, false, MustSendCheckpointEnd::NO);
+        registerCursor_UNLOCKED(pCursorId, pCursorName, 1, false,
+                                MustSendCheckpointEnd::NO);
     }
 }
 
@@ -622,7 +703,8 @@ bool CheckpointManager::registerCursor(
                             bool alwaysFromBeginning,
                             MustSendCheckpointEnd needsCheckpointEndMetaItem) {
     LockHolder lh(queueLock);
-    return registerCursor_UNLOCKED(name, checkpointId, alwaysFromBeginning,
+    return registerCursor_UNLOCKED(getCursorId_UNLOCKED(name), name,
+                                   checkpointId, alwaysFromBeginning,
                                    needsCheckpointEndMetaItem);
 }
 
@@ -644,12 +726,17 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
                         ")");
     }
 
-    removeCursor_UNLOCKED(name);
+    // A cursor being re-registered keeps its id.
+    const CursorId id = getCursorId_UNLOCKED(name);
+    removeCursor_UNLOCKED(id);
 
     size_t skipped = 0;
+    bool expelledItemsNeeded = false;
     CursorRegResult result;
-    result.first = std::numeric_limits<uint64_t>::max();
-    result.second = false;
+    result.seqno = std::numeric_limits<uint64_t>::max();
+    result.tryBackfill = false;
+    result.highestExpelledSeqno = 0;
+    result.cursorId = id;
 
     std::list<Checkpoint*>::iterator itr = checkpointList.begin();
     for (; itr != checkpointList.end(); ++itr) {
@@ -659,12 +746,12 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
         if (startBySeqno < st) {
             // Requested sequence number is before the start of this
             // checkpoint, position cursor at the checkpoint start.
-            connCursors[name] = CheckpointCursor(name, itr, (*itr)->begin(),
-                                                 skipped, /*meta_offset*/0,
-                                                 false,
-                                                 needsCheckPointEndMetaItem);
-            (*itr)->registerCursorName(name);
-            result.first = (*itr)->getLowSeqno();
+            setCursor_UNLOCKED(CheckpointCursor(id, name, itr,
+                                                (*itr)->begin(), skipped,
+                                                /*meta_offset*/0, false,
+                                                needsCheckPointEndMetaItem));
+            result.seqno = (*itr)->getLowSeqno();
+            result.highestExpelledSeqno = (*itr)->getHighestExpelledSeqno();
             break;
         } else if (startBySeqno <= en) {
             // Requested sequence number lies within this checkpoint.
@@ -682,16 +769,19 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
 
             if (iitr == (*itr)->end()) {
                 --iitr;
-                result.first = static_cast<uint64_t>((*iitr)->getBySeqno()) + 1;
+                result.seqno = static_cast<uint64_t>((*iitr)->getBySeqno()) + 1;
             } else {
-                result.first = static_cast<uint64_t>((*iitr)->getBySeqno());
+                result.seqno = static_cast<uint64_t>((*iitr)->getBySeqno());
                 --iitr;
             }
 
-            connCursors[name] = CheckpointCursor(name, itr, iitr, skipped,
-                                                 ckpt_meta_skipped, false,
-                                                 needsCheckPointEndMetaItem);
-            (*itr)->registerCursorName(name);
+            setCursor_UNLOCKED(CheckpointCursor(id, name, itr, iitr, skipped,
+                                                ckpt_meta_skipped, false,
+                                                needsCheckPointEndMetaItem));
+            // Items after startBySeqno may have been expelled from this
+            // checkpoint, in which case they need to be backfilled.
+            result.highestExpelledSeqno = (*itr)->getHighestExpelledSeqno();
+            expelledItemsNeeded = startBySeqno < result.highestExpelledSeqno;
             break;
         } else {
             // Whole (closed) checkpoint skipped, increment by it's number
@@ -700,10 +790,11 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
         }
     }
 
-    result.second = (result.first == checkpointList.front()->getLowSeqno()) ?
-                    true : false;
+    result.tryBackfill =
+            (result.seqno == checkpointList.front()->getLowSeqno() ||
+             expelledItemsNeeded) ? true : false;
 
-    if (result.first == std::numeric_limits<uint64_t>::max()) {
+    if (result.seqno == std::numeric_limits<uint64_t>::max()) {
         /*
          * We should never get here since this would mean that the sequence
          * number we are looking for is higher than anything currently assigned
@@ -717,6 +808,7 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
 }
 
 bool CheckpointManager::registerCursor_UNLOCKED(
+                            CursorId id,
                             const std::string &name,
                             uint64_t checkpointId,
                             bool alwaysFromBeginning,
@@ -728,7 +820,7 @@ bool CheckpointManager::registerCursor_UNLOCKED(
     }
 
     bool resetOnCollapse = true;
-    if (name.compare(pCursorName) == 0) {
+    if (id == pCursorId) {
         resetOnCollapse = false;
     }
 
@@ -745,11 +837,11 @@ bool CheckpointManager::registerCursor_UNLOCKED(
         "Register the cursor with name \"%s\" for vbucket %d",
         name.c_str(), vbucketId);
 
-    // If the cursor exists, remove its name from the checkpoint that is
+    // If the cursor exists, remove its id from the checkpoint that is
     // currently referenced by it.
-    cursor_index::iterator map_it = connCursors.find(name);
+    cursor_index::iterator map_it = connCursors.find(id);
     if (map_it != connCursors.end()) {
-        (*(map_it->second.currentCheckpoint))->removeCursorName(name);
+        (*(map_it->second.currentCheckpoint))->removeCursorId(id);
     }
 
     if (!found) {
@@ -779,11 +871,10 @@ bool CheckpointManager::registerCursor_UNLOCKED(
             offset += (*pos)->getNumItems() + (*pos)->getNumMetaItems();
         }
 
-        connCursors[name] = CheckpointCursor(name, it, (*it)->begin(), offset,
-                                             /*meta_offset*/0,
-                                             resetOnCollapse,
-                                             needsCheckpointEndMetaItem);
-        (*it)->registerCursorName(name);
+        setCursor_UNLOCKED(CheckpointCursor(id, name, it, (*it)->begin(),
+                                            offset, /*meta_offset*/0,
+                                            resetOnCollapse,
+                                            needsCheckpointEndMetaItem));
     } else {
         size_t offset = 0, meta_offset = 0;
         CheckpointQueue::iterator curr;
@@ -814,52 +905,81 @@ bool CheckpointManager::registerCursor_UNLOCKED(
             }
         }
 
-        connCursors[name] = CheckpointCursor(name, it, curr, offset,
-                                             meta_offset,
-                                             resetOnCollapse,
-                                             needsCheckpointEndMetaItem);
-        // Register the cursor's name to the checkpoint.
-        (*it)->registerCursorName(name);
+        setCursor_UNLOCKED(CheckpointCursor(id, name, it, curr, offset,
+                                            meta_offset,
+                                            resetOnCollapse,
+                                            needsCheckpointEndMetaItem));
     }
 
     return found;
 }
 
+CursorId CheckpointManager::getCursorId_UNLOCKED(
+                                            const std::string& name) const {
+    auto it = cursorIds.find(name);
+    if (it != cursorIds.end()) {
+        return it->second;
+    }
+    return name == pCursorName ? pCursorId : nextCursorId++;
+}
+
+cursor_index::iterator CheckpointManager::findCursor_UNLOCKED(
+                                                    const std::string& name) {
+    auto it = cursorIds.find(name);
+    if (it == cursorIds.end()) {
+        return connCursors.end();
+    }
+    return connCursors.find(it->second);
+}
+
+void CheckpointManager::setCursor_UNLOCKED(const CheckpointCursor& cursor) {
+    connCursors[cursor.id] = cursor;
+    cursorIds[cursor.name] = cursor.id;
+    (*cursor.currentCheckpoint)->registerCursorId(cursor.id);
+}
+
 bool CheckpointManager::removeCursor(const std::string &name) {
     LockHolder lh(queueLock);
-    return removeCursor_UNLOCKED(name);
+    auto it = cursorIds.find(name);
+    return it != cursorIds.end() && removeCursor_UNLOCKED(it->second);
 }
 
-bool CheckpointManager::removeCursor_UNLOCKED(const std::string &name) {
-    cursor_index::iterator it = connCursors.find(name);
+bool CheckpointManager::removeCursor(CursorId id) {
+    LockHolder lh(queueLock);
+    return removeCursor_UNLOCKED(id);
+}
+
+bool CheckpointManager::removeCursor_UNLOCKED(CursorId id) {
+    cursor_index::iterator it = connCursors.find(id);
     if (it == connCursors.end()) {
         return false;
     }
 
     LOG(EXTENSION_LOG_INFO,
         "Remove the checkpoint cursor with the name \"%s\" from vbucket %d",
-        name.c_str(), vbucketId);
+        it->second.name.c_str(), vbucketId);
 
-    // We can simply remove the cursor's name from the checkpoint to which it
+    // We can simply remove the cursor's id from the checkpoint to which it
     // currently belongs,
     // by calling
-    // (*(it->second.currentCheckpoint))->removeCursorName(name);
+    // (*(it->second.currentCheckpoint))->removeCursorId(id);
     // However, we just want to do more sanity checks by looking at each
     // checkpoint. This won't
     // cause much overhead because the max number of checkpoints allowed per
     // vbucket is small.
     std::list<Checkpoint*>::iterator cit = checkpointList.begin();
     for (; cit != checkpointList.end(); ++cit) {
-        (*cit)->removeCursorName(name);
+        (*cit)->removeCursorId(id);
     }
 
+    cursorIds.erase(it->second.name);
     connCursors.erase(it);
     return true;
 }
 
 uint64_t CheckpointManager::getCheckpointIdForCursor(const std::string &name) {
     LockHolder lh(queueLock);
-    cursor_index::iterator it = connCursors.find(name);
+    cursor_index::iterator it = findCursor_UNLOCKED(name);
     if (it == connCursors.end()) {
         return 0;
     }
@@ -881,9 +1001,9 @@ checkpointCursorInfoList CheckpointManager::getAllCursors() {
     LockHolder lh(queueLock);
     checkpointCursorInfoList cursorInfo;
     for (auto& cur_it : connCursors) {
-        cursorInfo.push_back(std::make_pair(
-                        (cur_it.first),
-                        (cur_it.second.shouldSendCheckpointEndMetaItem())));
+        cursorInfo.push_back(CheckpointCursorInfo{
+                        cur_it.first, cur_it.second.name,
+                        cur_it.second.shouldSendCheckpointEndMetaItem()});
     }
     return cursorInfo;
 }
@@ -896,7 +1016,15 @@ bool CheckpointManager::isCheckpointCreationForHighMemUsage(
     bool allCursorsInOpenCheckpoint =
         (connCursors.size() + 1) == checkpointList.back()->getNumberOfCursors();
 
-    if (memoryUsed > stats.mem_high_wat && allCursorsInOpenCheckpoint &&
+    // Either the bucket or just its checkpoints are using too much memory
+    // (a zero checkpoint memory threshold means there is no limit).
+    const size_t chkMemThreshold =
+            stats.cursorDroppingCheckpointMemUThreshold.load();
+    bool highMemUsage = memoryUsed > stats.mem_high_wat ||
+                        (chkMemThreshold > 0 &&
+                         stats.checkpointMemUsage->load() > chkMemThreshold);
+
+    if (highMemUsage && allCursorsInOpenCheckpoint &&
         (checkpointList.back()->getNumItems() >= MIN_CHECKPOINT_ITEMS ||
          checkpointList.back()->getNumItems() ==
                  vbucket.ht.getNumInMemoryItems())) {
@@ -986,9 +1114,9 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
     if (checkpointConfig.isCheckpointMergeSupported() &&
         !checkpointConfig.canKeepClosedCheckpoints() &&
         vbucket.getState() == vbucket_state_replica) {
-        size_t curr_remains = getNumItemsForCursor_UNLOCKED(pCursorName);
+        size_t curr_remains = getNumItemsForCursor_UNLOCKED(pCursorId);
         collapseClosedCheckpoints(unrefCheckpointList);
-        size_t new_remains = getNumItemsForCursor_UNLOCKED(pCursorName);
+        size_t new_remains = getNumItemsForCursor_UNLOCKED(pCursorId);
         updateDiskQueueStats(vbucket, curr_remains, new_remains);
     }
     lh.unlock();
@@ -1001,22 +1129,83 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
     return numUnrefItems;
 }
 
+CheckpointExpelResult CheckpointManager::expelUnreferencedCheckpointItems() {
+    LockHolder lh(queueLock);
+    CheckpointExpelResult rv{0, 0, 0};
+
+    Checkpoint* openCkpt = checkpointList.back();
+    if (connCursors.empty() || openCkpt->getState() != CHECKPOINT_OPEN) {
+        return rv;
+    }
+
+    // Items can only be expelled once every cursor has moved past them, so
+    // all of the cursors must be in the open checkpoint.
+    std::vector<CheckpointQueue::iterator> positions;
+    for (const auto& cursor : connCursors) {
+        if (*cursor.second.currentCheckpoint != openCkpt) {
+            return rv;
+        }
+        positions.push_back(cursor.second.currentPos);
+    }
+
+    // Find the earliest item a cursor is positioned at. A cursor's position
+    // is the last item it processed, which must be kept - the cursor is
+    // advanced from it, and its key is looked up when the same key is
+    // queued again.
+    auto earliest = openCkpt->begin();
+    size_t index = 0;
+    while (std::find(positions.begin(), positions.end(), earliest) ==
+           positions.end()) {
+        ++earliest;
+        ++index;
+        if (earliest == openCkpt->end()) {
+            throw std::logic_error("CheckpointManager::"
+                    "expelUnreferencedCheckpointItems: no cursor is "
+                    "positioned in the open checkpoint of vb:" +
+                    std::to_string(vbucketId));
+        }
+    }
+
+    // Nothing to expel if the earliest cursor is no further along than the
+    // first item after checkpoint_start.
+    if (index <= 2) {
+        return rv;
+    }
+
+    rv = openCkpt->expelItems(earliest);
+    const size_t numExpelled = rv.numItems + rv.numMetaItems;
+    numItems.fetch_sub(numExpelled);
+    for (auto& cursor : connCursors) {
+        cursor.second.decrOffset(numExpelled);
+        cursor.second.setMetaItemOffset(
+                cursor.second.getCurrentCkptMetaItemsRead() -
+                rv.numMetaItems);
+    }
+
+    LOG(EXTENSION_LOG_INFO,
+        "Expelled %" PRIu64 " items (%" PRIu64 " bytes) from the open "
+        "checkpoint %" PRIu64 " of vbucket %d",
+        uint64_t(numExpelled), uint64_t(rv.memory), openCkpt->getId(),
+        vbucketId);
+    return rv;
+}
+
 void CheckpointManager::removeInvalidCursorsOnCheckpoint(
                                                      Checkpoint *pCheckpoint) {
-    std::list<std::string> invalidCursorNames;
-    const std::set<std::string> &cursors = pCheckpoint->getCursorNameList();
-    std::set<std::string>::const_iterator cit = cursors.begin();
+    std::list<CursorId> invalidCursorIds;
+    const std::set<CursorId> &cursors = pCheckpoint->getCursorIdList();
+    std::set<CursorId>::const_iterator cit = cursors.begin();
     for (; cit != cursors.end(); ++cit) {
         cursor_index::iterator mit = connCursors.find(*cit);
         if (mit == connCursors.end() ||
             pCheckpoint != *(mit->second.currentCheckpoint)) {
-            invalidCursorNames.push_back(*cit);
+            invalidCursorIds.push_back(*cit);
         }
     }
 
-    std::list<std::string>::iterator it = invalidCursorNames.begin();
-    for (; it != invalidCursorNames.end(); ++it) {
-        pCheckpoint->removeCursorName(*it);
+    std::list<CursorId>::iterator it = invalidCursorIds.begin();
+    for (; it != invalidCursorIds.end(); ++it) {
+        pCheckpoint->removeCursorId(*it);
     }
 }
 
@@ -1027,17 +1216,17 @@ void CheckpointManager::collapseClosedCheckpoints(
     // closed checkpoints into one checkpoint to reduce the memory overhead.
     if (checkpointList.size() > 2) {
         CursorIdToPositionMap slowCursors;
-        std::set<std::string> fastCursors;
+        std::set<CursorId> fastCursors;
         std::list<Checkpoint*>::iterator lastClosedChk = checkpointList.end();
         --lastClosedChk; --lastClosedChk; // Move to the last closed chkpt.
-        std::set<std::string>::iterator nitr =
-                (*lastClosedChk)->getCursorNameList().begin();
+        std::set<CursorId>::iterator nitr =
+                (*lastClosedChk)->getCursorIdList().begin();
         // Check if there are any cursors in the last closed checkpoint, which
         // haven't yet visited any regular items belonging to the last closed
         // checkpoint. If so, then we should skip collapsing checkpoints until
         // those cursors move to the first regular item. Otherwise, those cursors will
         // visit old items from collapsed checkpoints again.
-        for (; nitr != (*lastClosedChk)->getCursorNameList().end(); ++nitr) {
+        for (; nitr != (*lastClosedChk)->getCursorIdList().end(); ++nitr) {
             cursor_index::iterator cc = connCursors.find(*nitr);
             if (cc == connCursors.end()) {
                 continue;
@@ -1048,8 +1237,8 @@ void CheckpointManager::collapseClosedCheckpoints(
             }
         }
 
-        fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
-                           (*lastClosedChk)->getCursorNameList().end());
+        fastCursors.insert((*lastClosedChk)->getCursorIdList().begin(),
+                           (*lastClosedChk)->getCursorIdList().end());
         std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
         ++rit; ++rit; //Move to the second last closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
@@ -1058,10 +1247,10 @@ void CheckpointManager::collapseClosedCheckpoints(
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += (*rit)->getNumMetaItems();
 
-            std::set<std::string>::iterator nameItr =
-                (*rit)->getCursorNameList().begin();
-            for (; nameItr != (*rit)->getCursorNameList().end(); ++nameItr) {
-                cursor_index::iterator cc = connCursors.find(*nameItr);
+            std::set<CursorId>::iterator idItr =
+                (*rit)->getCursorIdList().begin();
+            for (; idItr != (*rit)->getCursorIdList().end(); ++idItr) {
+                cursor_index::iterator cc = connCursors.find(*idItr);
                 const auto key = (*(cc->second.currentPos))->getKey();
                 bool isMetaItem =
                             (*(cc->second.currentPos))->isCheckPointMetaItem();
@@ -1070,7 +1259,7 @@ void CheckpointManager::collapseClosedCheckpoints(
                     queue_op::checkpoint_start) {
                     cursor_on_chk_start = true;
                 }
-                slowCursors[*nameItr] =
+                slowCursors[*idItr] =
                     CursorPosition{(*rit)->getMutationIdForKey(key, isMetaItem),
                                    cursor_on_chk_start};
             }
@@ -1080,11 +1269,11 @@ void CheckpointManager::collapseClosedCheckpoints(
         size_t total_items = numDuplicatedItems + numMetaItems;
         numItems.fetch_sub(total_items);
         Checkpoint *pOpenCheckpoint = checkpointList.back();
-        const std::set<std::string> &openCheckpointCursors =
-                                    pOpenCheckpoint->getCursorNameList();
+        const std::set<CursorId> &openCheckpointCursors =
+                                    pOpenCheckpoint->getCursorIdList();
         fastCursors.insert(openCheckpointCursors.begin(),
                            openCheckpointCursors.end());
-        std::set<std::string>::const_iterator cit = fastCursors.begin();
+        std::set<CursorId>::const_iterator cit = fastCursors.begin();
         // Update the offset of each fast cursor.
         for (; cit != fastCursors.end(); ++cit) {
             cursor_index::iterator mit = connCursors.find(*cit);
@@ -1116,8 +1305,12 @@ std::vector<std::string> CheckpointManager::getListOfCursorsToDrop() {
     std::list<Checkpoint*>::const_iterator it = checkpointList.begin();
     while (num_checkpoints_to_unref != 0 && it != checkpointList.end()) {
         if ((*it)->isEligibleToBeUnreferenced()) {
-            const std::set<std::string> &cursors = (*it)->getCursorNameList();
-            cursorsToDrop.insert(cursorsToDrop.end(), cursors.begin(), cursors.end());
+            for (const auto id : (*it)->getCursorIdList()) {
+                cursor_index::iterator mit = connCursors.find(id);
+                if (mit != connCursors.end()) {
+                    cursorsToDrop.push_back(mit->second.name);
+                }
+            }
         } else {
             break;
         }
@@ -1211,6 +1404,10 @@ bool CheckpointManager::queueDirty(VBucket& vb, queued_item& qi,
 
     if (result != EXISTING_ITEM) {
         updateStatsForNewQueuedItem_UNLOCKED(lh, vb, qi);
+    } else {
+        // The item replaced one whose memory usage has been released, so
+        // only the checkpoint's memory usage needs updating.
+        checkpointList.back()->incrementMemConsumption(qi->size());
     }
 
     return result != EXISTING_ITEM;
@@ -1240,18 +1437,41 @@ snapshot_range_t CheckpointManager::getAllItemsForCursor(
                                              const std::string& name,
                                              std::vector<queued_item> &items) {
     LockHolder lh(queueLock);
+    return getItemsForCursor_UNLOCKED(findCursor_UNLOCKED(name), items,
+                                      std::numeric_limits<size_t>::max());
+}
+
+snapshot_range_t CheckpointManager::getAllItemsForCursor(
+                                             CursorId id,
+                                             std::vector<queued_item> &items) {
+    LockHolder lh(queueLock);
+    return getItemsForCursor_UNLOCKED(connCursors.find(id), items,
+                                      std::numeric_limits<size_t>::max());
+}
+
+snapshot_range_t CheckpointManager::getItemsForCursor(
+                                             CursorId id,
+                                             std::vector<queued_item> &items,
+                                             size_t limit) {
+    LockHolder lh(queueLock);
+    return getItemsForCursor_UNLOCKED(connCursors.find(id), items, limit);
+}
+
+snapshot_range_t CheckpointManager::getItemsForCursor_UNLOCKED(
+                                             cursor_index::iterator it,
+                                             std::vector<queued_item> &items,
+                                             size_t limit) {
     snapshot_range_t range;
-    cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
         range.start = 0;
         range.end = 0;
         return range;
     }
 
-    bool moreItems;
+    const size_t initialSize = items.size();
     range.start = (*it->second.currentCheckpoint)->getSnapshotStartSeqno();
     range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
-    while ((moreItems = incrCursor(it->second))) {
+    while (items.size() - initialSize < limit && incrCursor(it->second)) {
         queued_item& qi = *(it->second.currentPos);
         items.push_back(qi);
 
@@ -1261,13 +1481,14 @@ snapshot_range_t CheckpointManager::getAllItemsForCursor(
         }
     }
 
-    if (!moreItems) {
-        range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
-    }
+    // Either the cursor has reached the end of the open checkpoint or it has
+    // stopped part way through the current checkpoint; in both cases the
+    // items are part of that checkpoint's snapshot.
+    range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
 
-    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getAllItemsForCursor() "
+    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getItemsForCursor() "
             "cursor:%s range:{%" PRIu64 ", %" PRIu64 "}",
-            name.c_str(), range.start, range.end);
+            it->second.name.c_str(), range.start, range.end);
 
     it->second.numVisits++;
 
@@ -1277,7 +1498,7 @@ snapshot_range_t CheckpointManager::getAllItemsForCursor(
 queued_item CheckpointManager::nextItem(const std::string &name,
                                         bool &isLastMutationItem) {
     LockHolder lh(queueLock);
-    cursor_index::iterator it = connCursors.find(name);
+    cursor_index::iterator it = findCursor_UNLOCKED(name);
     if (it == connCursors.end()) {
         LOG(EXTENSION_LOG_WARNING,
         "The cursor with name \"%s\" is not found in the checkpoint of vbucket"
@@ -1356,7 +1577,7 @@ void CheckpointManager::clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno)
 
 void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
     for (auto& cit : connCursors) {
-        if (cit.second.name.compare(pCursorName) == 0) {
+        if (cit.first == pCursorId) {
             if (!resetPersistenceCursor) {
                 continue;
             } else {
@@ -1368,7 +1589,7 @@ void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
         cit.second.currentPos = checkpointList.front()->begin();
         cit.second.offset = 0;
         cit.second.setMetaItemOffset(0);
-        checkpointList.front()->registerCursorName(cit.second.name);
+        checkpointList.front()->registerCursorId(cit.first);
     }
 }
 
@@ -1376,8 +1597,8 @@ void CheckpointManager::resetCursors(checkpointCursorInfoList &cursors) {
     LockHolder lh(queueLock);
 
     for (auto& it : cursors) {
-        registerCursor_UNLOCKED(it.first, getOpenCheckpointId_UNLOCKED(), true,
-                                it.second);
+        registerCursor_UNLOCKED(it.id, it.name, getOpenCheckpointId_UNLOCKED(),
+                                true, it.sendCheckpointEndMetaItem);
     }
 }
 
@@ -1393,13 +1614,13 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
         }
     }
 
-    // Remove the cursor's name from its current checkpoint.
-    (*(cursor.currentCheckpoint))->removeCursorName(cursor.name);
+    // Remove the cursor's id from its current checkpoint.
+    (*(cursor.currentCheckpoint))->removeCursorId(cursor.id);
     // Move the cursor to the next checkpoint.
     ++(cursor.currentCheckpoint);
     cursor.currentPos = (*(cursor.currentCheckpoint))->begin();
-    // Register the cursor's name to its new current checkpoint.
-    (*(cursor.currentCheckpoint))->registerCursorName(cursor.name);
+    // Register the cursor's id to its new current checkpoint.
+    (*(cursor.currentCheckpoint))->registerCursorId(cursor.id);
 
     // Reset metaItemOffset as we're entering a new checkpoint.
     cursor.setMetaItemOffset(0);
@@ -1426,12 +1647,14 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation,
     // satisfied:
     // (1) force creation due to online update or high memory usage
     // (2) current checkpoint is reached to the max number of items allowed.
-    // (3) time elapsed since the creation of the current checkpoint is greater
+    // (3) the items in the current checkpoint use the max memory allowed.
+    // (4) time elapsed since the creation of the current checkpoint is greater
     //     than the threshold
     if (forceCreation ||
         (checkpointConfig.isItemNumBasedNewCheckpoint() &&
          checkpointList.back()->getNumItems() >=
          checkpointConfig.getCheckpointMaxItems()) ||
+        isCheckpointMaxSizeReached_UNLOCKED() ||
         (checkpointList.back()->getNumItems() > 0 && timeBound)) {
 
         checkpoint_id = checkpointList.back()->getId();
@@ -1440,15 +1663,27 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation,
     return checkpoint_id;
 }
 
+bool CheckpointManager::isCheckpointMaxSizeReached_UNLOCKED() {
+    const size_t maxSize = checkpointConfig.getCheckpointMaxSize();
+    Checkpoint* openCkpt = checkpointList.back();
+    return maxSize > 0 && openCkpt->getNumItems() > 0 &&
+           openCkpt->getMemConsumption() >= maxSize;
+}
+
 size_t CheckpointManager::getNumItemsForCursor(const std::string &name) const {
     LockHolder lh(queueLock);
-    return getNumItemsForCursor_UNLOCKED(name);
+    auto it = cursorIds.find(name);
+    return it == cursorIds.end() ? 0 : getNumItemsForCursor_UNLOCKED(it->second);
+}
+
+size_t CheckpointManager::getNumItemsForCursor(CursorId id) const {
+    LockHolder lh(queueLock);
+    return getNumItemsForCursor_UNLOCKED(id);
 }
 
-size_t CheckpointManager::getNumItemsForCursor_UNLOCKED(
-                                                const std::string &name) const {
+size_t CheckpointManager::getNumItemsForCursor_UNLOCKED(CursorId id) const {
     size_t remains = 0;
-    cursor_index::const_iterator it = connCursors.find(name);
+    cursor_index::const_iterator it = connCursors.find(id);
     if (it != connCursors.end()) {
         size_t offset = it->second.offset + getNumOfMetaItemsFromCursor(it->second);
         remains = (numItems > offset) ? numItems - offset : 0;
@@ -1481,7 +1716,7 @@ size_t CheckpointManager::getNumOfMetaItemsFromCursor(const CheckpointCursor &cu
 
 void CheckpointManager::decrCursorFromCheckpointEnd(const std::string &name) {
     LockHolder lh(queueLock);
-    cursor_index::iterator it = connCursors.find(name);
+    cursor_index::iterator it = findCursor_UNLOCKED(name);
     if (it != connCursors.end() &&
         (*(it->second.currentPos))->getOperation() ==
         queue_op::checkpoint_end) {
@@ -1641,8 +1876,8 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id,
             // Reposition all the cursors in the open checkpoint to the
             // begining position so that a checkpoint_start message can be
             // sent again with the correct id.
-            for (const auto& cit : checkpointList.back()->getCursorNameList()) {
-                if (cit == pCursorName) {
+            for (const auto& cit : checkpointList.back()->getCursorIdList()) {
+                if (cit == pCursorId) {
                     // Persistence cursor
                     continue;
                 } else { // Dcp/Tap cursors
@@ -1654,9 +1889,9 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id,
             addNewCheckpoint_UNLOCKED(id);
         }
     } else {
-        size_t curr_remains = getNumItemsForCursor_UNLOCKED(pCursorName);
+        size_t curr_remains = getNumItemsForCursor_UNLOCKED(pCursorId);
         collapseCheckpoints(id);
-        size_t new_remains = getNumItemsForCursor_UNLOCKED(pCursorName);
+        size_t new_remains = getNumItemsForCursor_UNLOCKED(pCursorId);
         updateDiskQueueStats(vbucket, curr_remains, new_remains);
     }
 }
@@ -1747,7 +1982,7 @@ putCursorsInCollapsedChk(CursorIdToPositionMap& cursors,
                 cc->second.offset = (i > 0) ? i - 1 : 0;
                 cc->second.setMetaItemOffset(last_meta_item_count);
 
-                chk->registerCursorName(cc->second.name);
+                chk->registerCursorId(cc->first);
                 cursors.erase(mit++);
             } else {
                 ++mit;
@@ -1782,13 +2017,13 @@ putCursorsInCollapsedChk(CursorIdToPositionMap& cursors,
             cc->second.offset = (i > 0) ? i - 1 : 0;
             cc->second.setMetaItemOffset(chk->getNumMetaItems());
         }
-        chk->registerCursorName(cc->second.name);
+        chk->registerCursorId(cc->first);
     }
 }
 
 bool CheckpointManager::hasNext(const std::string &name) {
     LockHolder lh(queueLock);
-    cursor_index::iterator it = connCursors.find(name);
+    cursor_index::iterator it = findCursor_UNLOCKED(name);
     if (it == connCursors.end() || getOpenCheckpointId_UNLOCKED() == 0) {
         return false;
     }
@@ -1854,7 +2089,7 @@ uint64_t CheckpointManager::getPersistenceCursorPreChkId() {
 
 void CheckpointManager::itemsPersisted() {
     LockHolder lh(queueLock);
-    auto persistenceCursor = connCursors.find(pCursorName);
+    auto persistenceCursor = connCursors.find(pCursorId);
     if (persistenceCursor != connCursors.end()) {
         auto itr = persistenceCursor->second.currentCheckpoint;
         pCursorPreCheckpointId = ((*itr)->getId() > 0) ? (*itr)->getId() - 1 : 0;
@@ -1905,6 +2140,8 @@ void CheckpointConfig::addConfigChangeListener(
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("chk_max_items",
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_max_size",
+             new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("max_checkpoints",
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("item_num_based_new_chk",
@@ -1913,17 +2150,21 @@ void CheckpointConfig::addConfigChangeListener(
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("enable_chk_merge",
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_expel_enabled",
+             new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
 }
 
 CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     Configuration &config = e.getConfiguration();
     checkpointPeriod = config.getChkPeriod();
     checkpointMaxItems = config.getChkMaxItems();
+    checkpointMaxSize = config.getChkMaxSize();
     maxCheckpoints = config.getMaxCheckpoints();
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
     enableChkMerge = config.isEnableChkMerge();
     persistenceEnabled = config.getBucketType() == "persistent";
+    expelEnabled = config.isChkExpelEnabled();
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t
@@ -2017,7 +2258,7 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
         add_casted_stat(buf, checkpointList.size(), add_stat, cookie);
         checked_snprintf(buf, sizeof(buf), "vb_%d:num_items_for_persistence",
                          vbucketId);
-        add_casted_stat(buf, getNumItemsForCursor_UNLOCKED(pCursorName),
+        add_casted_stat(buf, getNumItemsForCursor_UNLOCKED(pCursorId),
                         add_stat, cookie);
         checked_snprintf(buf, sizeof(buf), "vb_%d:mem_usage", vbucketId);
         add_casted_stat(buf, getMemoryUsage_UNLOCKED(), add_stat, cookie);
@@ -2026,17 +2267,17 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
         for (; cur_it != connCursors.end(); ++cur_it) {
             checked_snprintf(buf, sizeof(buf),
                              "vb_%d:%s:cursor_checkpoint_id", vbucketId,
-                             cur_it->first.c_str());
+                             cur_it->second.name.c_str());
             add_casted_stat(buf, (*(cur_it->second.currentCheckpoint))->getId(),
                             add_stat, cookie);
             checked_snprintf(buf, sizeof(buf), "vb_%d:%s:cursor_seqno",
                              vbucketId,
-                             cur_it->first.c_str());
+                             cur_it->second.name.c_str());
             add_casted_stat(buf, (*(cur_it->second.currentPos))->getBySeqno(),
                             add_stat, cookie);
             checked_snprintf(buf, sizeof(buf), "vb_%d:%s:num_visits",
                              vbucketId,
-                             cur_it->first.c_str());
+                             cur_it->second.name.c_str());
             add_casted_stat(buf, cur_it->second.numVisits.load(),
                             add_stat, cookie);
         }
@@ -2056,7 +2297,7 @@ std::ostream& operator <<(std::ostream& os, const CheckpointManager& m) {
     }
     os << "    connCursors:[" << std::endl;
     for (const auto cur : m.connCursors) {
-        os << "        " << cur.first << ": " << cur.second << std::endl;
+        os << "        " << cur.second.name << ": " << cur.second << std::endl;
     }
     os << "    ]" << std::endl;
     return os;
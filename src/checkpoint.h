@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <list>
 #include <map>
 #include <set>
@@ -28,6 +29,7 @@
 #include <vector>
 
 #include <atomic>
+#include "checkpoint_index.h"
 #include "ep_types.h"
 #include "item.h"
 #include "locks.h"
@@ -43,6 +45,8 @@
 #define MAX_CHECKPOINT_PERIOD 3600 // 3600 sec.
 #define DEFAULT_CHECKPOINT_PERIOD 5 // 5 sec.
 
+#define DEFAULT_CHECKPOINT_MAX_SIZE (10 * 1024 * 1024) // 10 MB.
+
 #define DEFAULT_MAX_CHECKPOINTS 2
 #define MAX_CHECKPOINTS_UPPER_BOUND 5
 
@@ -56,18 +60,6 @@ enum checkpoint_state {
 
 const char* to_string(enum checkpoint_state);
 
-// List is used for queueing mutations as vector incurs shift operations for
-// deduplication.
-typedef std::list<queued_item> CheckpointQueue;
-
-/**
- * A checkpoint index entry.
- */
-struct index_entry {
-    CheckpointQueue::iterator position;
-    int64_t mutation_id;
-};
-
 typedef struct {
     uint64_t start;
     uint64_t end;
@@ -87,16 +79,24 @@ enum class MustSendCheckpointEnd {
 };
 
 /**
- * The checkpoint index maps a key to a checkpoint index_entry.
+ * Numeric handle for a checkpoint cursor. Cursor operations look cursors up by
+ * id rather than by name; the name is kept for logging and stats. Ids are
+ * unique across all CheckpointManagers and never reused, so a handle held
+ * for a cursor which has since been removed simply finds no cursor.
  */
-typedef std::unordered_map<StoredDocKey, index_entry> checkpoint_index;
+typedef uint64_t CursorId;
 
 /**
- * List of pairs containing checkpoint cursor name and corresponding flag
- * indicating whether we must send checkpoint end meta item for the cursor
+ * Checkpoint cursor id, name and corresponding flag indicating whether we
+ * must send checkpoint end meta item for the cursor
  */
-typedef std::list<std::pair<std::string, MustSendCheckpointEnd>>
-                                                    checkpointCursorInfoList;
+struct CheckpointCursorInfo {
+    CursorId id;
+    std::string name;
+    MustSendCheckpointEnd sendCheckpointEndMetaItem;
+};
+
+typedef std::list<CheckpointCursorInfo> checkpointCursorInfoList;
 
 class Checkpoint;
 class CheckpointManager;
@@ -137,7 +137,8 @@ public:
     CheckpointCursor() { }
 
     CheckpointCursor(const std::string &n)
-        : name(n),
+        : id(),
+          name(n),
           currentCheckpoint(),
           currentPos(),
           offset(0),
@@ -151,14 +152,16 @@ public:
      * @param meta_items_read Count of meta_items already read for the
      *                        given checkpoint.
      */
-    CheckpointCursor(const std::string &n,
+    CheckpointCursor(CursorId id_,
+                     const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
                      CheckpointQueue::iterator pos,
                      size_t offset_,
                      size_t meta_items_read,
                      bool beginningOnChkCollapse,
                      MustSendCheckpointEnd needsCheckpointEndMetaItem) :
-        name(n), currentCheckpoint(checkpoint), currentPos(pos), numVisits(0),
+        id(id_), name(n), currentCheckpoint(checkpoint), currentPos(pos),
+        numVisits(0),
         offset(offset_),
         ckptMetaItemsRead(meta_items_read),
         fromBeginningOnChkCollapse(beginningOnChkCollapse),
@@ -167,7 +170,8 @@ public:
     // We need to define the copy construct explicitly due to the fact
     // that std::atomic implicitly deleted the assignment operator
     CheckpointCursor(const CheckpointCursor &other) :
-        name(other.name), currentCheckpoint(other.currentCheckpoint),
+        id(other.id), name(other.name),
+        currentCheckpoint(other.currentCheckpoint),
         currentPos(other.currentPos), numVisits(other.numVisits.load()),
         offset(other.offset.load()),
         ckptMetaItemsRead(other.ckptMetaItemsRead),
@@ -175,6 +179,7 @@ public:
         sendCheckpointEndMetaItem(other.sendCheckpointEndMetaItem) { }
 
     CheckpointCursor &operator=(const CheckpointCursor &other) {
+        id = other.id;
         name.assign(other.name);
         currentCheckpoint = other.currentCheckpoint;
         currentPos = other.currentPos;
@@ -217,6 +222,7 @@ protected:
     }
 
 private:
+    CursorId                         id;
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
     CheckpointQueue::iterator currentPos;
@@ -241,9 +247,9 @@ private:
 std::ostream& operator<<(std::ostream& os, const CheckpointCursor& c);
 
 /**
- * The cursor index maps checkpoint cursor names to checkpoint cursors
+ * The cursor index maps checkpoint cursor ids to checkpoint cursors
  */
-typedef std::map<const std::string, CheckpointCursor> cursor_index;
+typedef std::unordered_map<CursorId, CheckpointCursor> cursor_index;
 
 /**
  * Result from invoking queueDirty in the current open checkpoint.
@@ -272,6 +278,19 @@ enum queue_dirty_t {
     NEW_ITEM
 };
 
+/**
+ * The items removed from a checkpoint by Checkpoint::expelItems().
+ */
+struct CheckpointExpelResult {
+    // Number of non-meta items expelled.
+    size_t numItems;
+    // Number of (non-empty) meta items expelled.
+    size_t numMetaItems;
+    // Memory released by the checkpoint - the size of the items plus their
+    // queue overhead.
+    size_t memory;
+};
+
 /**
  * Representation of a checkpoint used in the unified queue for persistence and
  * replication.
@@ -350,7 +369,8 @@ public:
         numItems(0),
         numMetaItems(0),
         memOverhead(0),
-        effectiveMemUsage(0) {
+        effectiveMemUsage(0),
+        highestExpelledSeqno(0) {
         stats.memOverhead->fetch_add(memorySize());
         if (stats.memOverhead->load() >= GIGANTOR) {
             LOG(EXTENSION_LOG_WARNING,
@@ -420,30 +440,30 @@ public:
     }
 
     /**
-     * Register a cursor's name to this checkpoint
+     * Register a cursor's id to this checkpoint
      */
-    void registerCursorName(const std::string &name) {
-        cursors.insert(name);
+    void registerCursorId(CursorId id) {
+        cursors.insert(id);
     }
 
     /**
-     * Remove a cursor's name from this checkpoint
+     * Remove a cursor's id from this checkpoint
      */
-    void removeCursorName(const std::string &name) {
-        cursors.erase(name);
+    void removeCursorId(CursorId id) {
+        cursors.erase(id);
     }
 
     /**
-     * Return true if the cursor with a given name exists in this checkpoint
+     * Return true if the cursor with a given id exists in this checkpoint
      */
-    bool hasCursorName(const std::string &name) const {
-        return cursors.find(name) != cursors.end();
+    bool hasCursorId(CursorId id) const {
+        return cursors.find(id) != cursors.end();
     }
 
     /**
-     * Return the list of all cursor names in this checkpoint
+     * Return the list of all cursor ids in this checkpoint
      */
-    const std::set<std::string> &getCursorNameList() const {
+    const std::set<CursorId> &getCursorIdList() const {
         return cursors;
     }
 
@@ -528,6 +548,28 @@ public:
      */
     size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
 
+    /**
+     * Expel the items between the checkpoint_start item and the given
+     * position (exclusive) from this checkpoint. This releases the items at
+     * the start of an open checkpoint which every cursor has already
+     * processed; the caller must ensure no cursor is positioned before
+     * `last`. The checkpoint's index entries for the expelled keys are
+     * removed, so a later mutation of one of those keys is queued as a new
+     * item.
+     * @param last the first item to keep.
+     * @return the number of items expelled and the memory released.
+     */
+    CheckpointExpelResult expelItems(CheckpointQueue::iterator last);
+
+    /**
+     * Return the highest seqno expelled from this checkpoint, or zero if no
+     * items have been expelled. Cursors registered at or below this seqno
+     * cannot get all the items they need from the checkpoint.
+     */
+    uint64_t getHighestExpelledSeqno() const {
+        return highestExpelledSeqno;
+    }
+
     /**
      * Get the mutation id for a given key in this checkpoint
      * @param key a key to retrieve its mutation id
@@ -550,6 +592,18 @@ public:
      */
     void incrementMemConsumption(size_t by) {
         effectiveMemUsage += by;
+        stats.checkpointMemUsage->fetch_add(by);
+    }
+
+    /**
+     * Invoked whenever an item is removed from the given checkpoint before
+     * the checkpoint itself is destroyed (deduplication or expelling).
+     * @param Amount of memory being released from current usage
+     */
+    void decrementMemConsumption(size_t by) {
+        by = std::min(effectiveMemUsage, by);
+        effectiveMemUsage -= by;
+        stats.checkpointMemUsage->fetch_sub(by);
     }
 
     /**
@@ -577,21 +631,38 @@ private:
     size_t                         numItems;
     /// Number of meta items (see Item::isCheckPointMetaItem).
     size_t numMetaItems;
-    std::set<std::string>          cursors; // List of cursors with their unique names.
+    std::set<CursorId>             cursors; // List of cursors with their unique ids.
     CheckpointQueue                toWrite;
-    checkpoint_index               keyIndex;
+    CheckpointIndex                keyIndex;
     /* Index for meta keys like "dummy_key" */
-    checkpoint_index               metaKeyIndex;
+    CheckpointIndex                metaKeyIndex;
     size_t                         memOverhead;
 
     // The following stat is to contain the memory consumption of all
     // the queued items in the given checkpoint.
     size_t                         effectiveMemUsage;
 
+    uint64_t                       highestExpelledSeqno;
+
     friend std::ostream& operator <<(std::ostream& os, const Checkpoint& m);
 };
 
-typedef std::pair<uint64_t, bool> CursorRegResult;
+/**
+ * Result of registering a cursor by seqno.
+ */
+struct CursorRegResult {
+    // The bySeqno with which the cursor can start.
+    uint64_t seqno;
+    // True if the cursor starts with the first item on a checkpoint, or if
+    // items the cursor needs have been expelled (in both cases a backfill
+    // may be needed).
+    bool tryBackfill;
+    // The highest seqno expelled from the checkpoint the cursor starts in,
+    // or zero if none have been.
+    uint64_t highestExpelledSeqno;
+    // Handle for the registered cursor.
+    CursorId cursorId;
+};
 
 /**
  * Representation of a checkpoint manager that maintains the list of checkpoints
@@ -639,6 +710,15 @@ public:
     size_t removeClosedUnrefCheckpoints(VBucket& vbucket,
                                         bool& newOpenCheckpointCreated);
 
+    /**
+     * Expel the items at the start of the open checkpoint which every cursor
+     * has already processed, so that a long-lived open checkpoint doesn't
+     * hold them in memory until it is closed and removed. Nothing is
+     * expelled unless every cursor is in the open checkpoint.
+     * @return the number of items expelled and the memory released.
+     */
+    CheckpointExpelResult expelUnreferencedCheckpointItems();
+
     /**
      * Register the cursor for getting items whose bySeqno values are between
      * startBySeqno and endBySeqno, and close the open checkpoint if endBySeqno
@@ -646,9 +726,8 @@ public:
      * @param startBySeqno start bySeqno.
      * @param needsCheckpointEndMetaItem indicates the CheckpointEndMetaItem
      *        must not be skipped for the cursor.
-     * @return Cursor registration result which consists of (1) the bySeqno with
-     * which the cursor can start and (2) flag indicating if the cursor starts
-     * with the first item on a checkpoint.
+     * @return Cursor registration result, including the cursor's id which
+     *         stays the same if the cursor was already registered.
      */
     CursorRegResult registerCursorBySeqno(
                             const std::string &name,
@@ -677,6 +756,8 @@ public:
      */
     bool removeCursor(const std::string &name);
 
+    bool removeCursor(CursorId id);
+
     /**
      * Get the Id of the checkpoint where the given connections cursor is currently located.
      * If the cursor is not found, return 0 as a checkpoint Id.
@@ -727,6 +808,21 @@ public:
     snapshot_range_t getAllItemsForCursor(const std::string& name,
                                           std::vector<queued_item> &items);
 
+    snapshot_range_t getAllItemsForCursor(CursorId id,
+                                          std::vector<queued_item> &items);
+
+    /**
+     * Move the given cursor forward over at most limit items (including
+     * meta items), appending them to items.
+     *
+     * @return the snapshot range of the items returned; when the cursor stops
+     *         part way through a checkpoint this is the whole of the
+     *         checkpoint's snapshot.
+     */
+    snapshot_range_t getItemsForCursor(CursorId id,
+                                       std::vector<queued_item> &items,
+                                       size_t limit);
+
     /**
      * Return the total number of items (including meta items) that belong to
      * this checkpoint manager.
@@ -745,6 +841,8 @@ public:
      */
     size_t getNumItemsForCursor(const std::string &name) const;
 
+    size_t getNumItemsForCursor(CursorId id) const;
+
     void clear(vbucket_state_t vbState) {
         LockHolder lh(queueLock);
         clear_UNLOCKED(vbState, lastBySeqno);
@@ -867,6 +965,12 @@ public:
 
     static const std::string pCursorName;
 
+    // Id of the persistence cursor.
+    static const CursorId pCursorId;
+
+    // An id which never refers to a cursor.
+    static const CursorId invalidCursorId;
+
 protected:
 
     // Helper method for queueing methods - update the global and per-VBucket
@@ -898,19 +1002,42 @@ private:
         bool onCpktStart;
     };
 
-    // Map of cursor name to position. Used when updating cursor positions
+    // Map of cursor id to position. Used when updating cursor positions
     // when collapsing checkpoints.
-    using CursorIdToPositionMap = std::map<std::string, CursorPosition>;
+    using CursorIdToPositionMap = std::map<CursorId, CursorPosition>;
+
+    /**
+     * @return the id of the cursor with the given name, or a newly allocated
+     *         id if there is no such cursor.
+     */
+    CursorId getCursorId_UNLOCKED(const std::string& name) const;
 
-    bool removeCursor_UNLOCKED(const std::string &name);
+    /**
+     * @return the cursor with the given name, or connCursors.end().
+     */
+    cursor_index::iterator findCursor_UNLOCKED(const std::string& name);
+
+    /**
+     * Add (or replace) a cursor in the cursor index and register it to the
+     * checkpoint it is positioned in.
+     */
+    void setCursor_UNLOCKED(const CheckpointCursor& cursor);
+
+    bool removeCursor_UNLOCKED(CursorId id);
 
     bool registerCursor_UNLOCKED(
+                            CursorId id,
                             const std::string &name,
                             uint64_t checkpointId,
                             bool alwaysFromBeginning,
                             MustSendCheckpointEnd needsCheckpointEndMetaItem);
 
-    size_t getNumItemsForCursor_UNLOCKED(const std::string &name) const;
+    size_t getNumItemsForCursor_UNLOCKED(CursorId id) const;
+
+    snapshot_range_t getItemsForCursor_UNLOCKED(
+                                            cursor_index::iterator it,
+                                            std::vector<queued_item> &items,
+                                            size_t limit);
 
     void clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno);
 
@@ -951,6 +1078,12 @@ private:
 
     bool isCheckpointCreationForHighMemUsage(const VBucket& vbucket);
 
+    /**
+     * @return true if the items queued in the open checkpoint use at least
+     * the max memory allowed for a checkpoint (see chk_max_size).
+     */
+    bool isCheckpointMaxSizeReached_UNLOCKED();
+
     void collapseClosedCheckpoints(std::list<Checkpoint*> &collapsedChks);
 
     void collapseCheckpoints(uint64_t id);
@@ -983,9 +1116,15 @@ private:
     uint64_t                 lastClosedCheckpointId;
     uint64_t                 pCursorPreCheckpointId;
     cursor_index             connCursors;
+    // Ids of the cursors in connCursors, by name.
+    std::unordered_map<std::string, CursorId> cursorIds;
 
     FlusherCallback          flusherCB;
 
+    // The next id to allocate to a cursor, shared by all CheckpointManagers
+    // so that cursors keep their ids when moved between them.
+    static std::atomic<CursorId> nextCursorId;
+
     friend std::ostream& operator<<(std::ostream& os, const CheckpointManager& m);
 };
 
@@ -1001,23 +1140,28 @@ public:
     CheckpointConfig()
         : checkpointPeriod(DEFAULT_CHECKPOINT_PERIOD),
           checkpointMaxItems(DEFAULT_CHECKPOINT_ITEMS),
+          checkpointMaxSize(DEFAULT_CHECKPOINT_MAX_SIZE),
           maxCheckpoints(DEFAULT_MAX_CHECKPOINTS),
           itemNumBasedNewCheckpoint(true),
           keepClosedCheckpoints(false),
           enableChkMerge(false),
-          persistenceEnabled(true)
+          persistenceEnabled(true),
+          expelEnabled(true)
     { /* empty */ }
 
     CheckpointConfig(rel_time_t period, size_t max_items, size_t max_ckpts,
                      bool item_based_new_ckpt, bool keep_closed_ckpts,
-                     bool enable_ckpt_merge, bool persistence_enabled)
+                     bool enable_ckpt_merge, bool persistence_enabled,
+                     size_t max_size)
         : checkpointPeriod(period),
           checkpointMaxItems(max_items),
+          checkpointMaxSize(max_size),
           maxCheckpoints(max_ckpts),
           itemNumBasedNewCheckpoint(item_based_new_ckpt),
           keepClosedCheckpoints(keep_closed_ckpts),
           enableChkMerge(enable_ckpt_merge),
-          persistenceEnabled(persistence_enabled) {}
+          persistenceEnabled(persistence_enabled),
+          expelEnabled(true) {}
 
     CheckpointConfig(EventuallyPersistentEngine &e);
 
@@ -1029,6 +1173,10 @@ public:
         return checkpointMaxItems;
     }
 
+    size_t getCheckpointMaxSize() const {
+        return checkpointMaxSize;
+    }
+
     size_t getMaxCheckpoints() const {
         return maxCheckpoints;
     }
@@ -1049,6 +1197,10 @@ public:
         return persistenceEnabled;
     }
 
+    bool isCheckpointExpelEnabled() const {
+        return expelEnabled;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -1059,6 +1211,9 @@ protected:
 
     void setCheckpointPeriod(size_t value);
     void setCheckpointMaxItems(size_t value);
+    void setCheckpointMaxSize(size_t value) {
+        checkpointMaxSize = value;
+    }
     void setMaxCheckpoints(size_t value);
 
     void allowItemNumBasedNewCheckpoint(bool value) {
@@ -1073,6 +1228,10 @@ protected:
         enableChkMerge = value;
     }
 
+    void allowCheckpointExpel(bool value) {
+        expelEnabled = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -1080,6 +1239,9 @@ private:
     rel_time_t checkpointPeriod;
     // Number of max items allowed in each checkpoint
     size_t checkpointMaxItems;
+    // Max memory (in bytes) which the items queued in the open checkpoint
+    // may use before a new checkpoint is created; zero for no limit.
+    size_t checkpointMaxSize;
     // Number of max checkpoints allowed
     size_t     maxCheckpoints;
     // Flag indicating if a new checkpoint is created once the number of items in the current
@@ -1093,6 +1255,10 @@ private:
 
     // Flag indicating if persistence is enabled.
     bool persistenceEnabled;
+
+    // Flag indicating if items which every cursor has processed may be
+    // expelled from the open checkpoint.
+    bool expelEnabled;
 };
 
 #endif  // SRC_CHECKPOINT_H_
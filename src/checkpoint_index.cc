@@ -0,0 +1,136 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "checkpoint_index.h"
+
+#include "murmurhash3.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static bool keysEqual(const StoredDocKey& queued, const DocKey& key) {
+    return queued.size() == key.size() &&
+           queued.getDocNamespace() == key.getDocNamespace() &&
+           std::memcmp(queued.data(), key.data(), key.size()) == 0;
+}
+
+CheckpointIndex::CheckpointIndex() : mask(0), count(0) {
+}
+
+uint64_t CheckpointIndex::hashKey(const DocKey& key) {
+    uint64_t hash;
+    MurmurHash3_x64_128(key.data(), static_cast<int>(key.size()),
+                        static_cast<uint32_t>(key.getDocNamespace()), &hash);
+    return hash == 0 ? 1 : hash;
+}
+
+size_t CheckpointIndex::findSlot(uint64_t hash, const DocKey& key) const {
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.hash == 0 ||
+            (slot.hash == hash &&
+             keysEqual((*slot.entry.position)->getKey(), key))) {
+            return i;
+        }
+    }
+}
+
+index_entry* CheckpointIndex::find(const DocKey& key) {
+    if (count == 0) {
+        return nullptr;
+    }
+    Slot& slot = slots[findSlot(hashKey(key), key)];
+    return slot.hash == 0 ? nullptr : &slot.entry;
+}
+
+const index_entry* CheckpointIndex::find(const DocKey& key) const {
+    return const_cast<CheckpointIndex*>(this)->find(key);
+}
+
+void CheckpointIndex::insert(const DocKey& key, const index_entry& entry) {
+    // Keep the load factor at or below 3/4 so probe sequences stay short.
+    if ((count + 1) * 4 > capacity() * 3) {
+        grow();
+    }
+    const uint64_t hash = hashKey(key);
+    Slot& slot = slots[findSlot(hash, key)];
+    if (slot.hash != 0) {
+        throw std::logic_error("CheckpointIndex::insert: key is already "
+                               "in the index");
+    }
+    slot.hash = hash;
+    slot.entry = entry;
+    ++count;
+}
+
+void CheckpointIndex::set(const DocKey& key, const index_entry& entry) {
+    index_entry* existing = find(key);
+    if (existing) {
+        *existing = entry;
+    } else {
+        insert(key, entry);
+    }
+}
+
+bool CheckpointIndex::erase(const DocKey& key) {
+    if (count == 0) {
+        return false;
+    }
+    size_t hole = findSlot(hashKey(key), key);
+    if (slots[hole].hash == 0) {
+        return false;
+    }
+
+    // Shift back any following entries which would no longer be reachable
+    // from their home slot across the hole, so no tombstones are needed.
+    for (size_t i = (hole + 1) & mask; slots[i].hash != 0;
+         i = (i + 1) & mask) {
+        const size_t home = slots[i].hash & mask;
+        // Can the entry at i stay put? Only if its home slot lies
+        // (cyclically) in (hole, i].
+        const bool reachable = (hole < i) ? (home > hole && home <= i)
+                                          : (home > hole || home <= i);
+        if (!reachable) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole].hash = 0;
+    slots[hole].entry = index_entry();
+    --count;
+    return true;
+}
+
+void CheckpointIndex::grow() {
+    const size_t newCapacity =
+            capacity() == 0 ? initialCapacity : capacity() * 2;
+    std::unique_ptr<Slot[]> old(std::move(slots));
+    const size_t oldCapacity = old ? mask + 1 : 0;
+
+    slots.reset(new Slot[newCapacity]());
+    mask = newCapacity - 1;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (old[i].hash != 0) {
+            // Every key is distinct, so just find the first free slot.
+            size_t j = old[i].hash & mask;
+            while (slots[j].hash != 0) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = old[i];
+        }
+    }
+}
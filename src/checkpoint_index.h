@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "chunked_queue.h"
+#include "item.h"
+#include "utility.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Mutations are queued in contiguous chunks rather than a list, so queueing
+// doesn't allocate per item and cursors walk through memory sequentially.
+// Deduplication erases from the middle of the queue, so the queue must keep
+// iterators stable (as a vector or deque can't) - cursors and index_entry
+// hold iterators into it.
+typedef ChunkedQueue<queued_item> CheckpointQueue;
+
+/**
+ * A checkpoint index entry.
+ */
+struct index_entry {
+    CheckpointQueue::iterator position;
+    int64_t mutation_id;
+};
+
+/**
+ * Index from key to the checkpoint index_entry of the item queued for that
+ * key.
+ *
+ * An open addressing (linear probing) hash table keyed on a 64-bit hash of
+ * the key. The key itself is not stored: a hash match is confirmed by
+ * comparing with the key of the queued item the entry points at. Hence
+ * every entry's position must refer to an item still in the queue, with
+ * the entry's key, whenever the index is accessed - an entry must be
+ * updated or erased *before* its item is removed from the queue.
+ *
+ * Slots are stored inline in a single array, so inserting a key only
+ * allocates when the table grows.
+ */
+class CheckpointIndex {
+public:
+    CheckpointIndex();
+
+    /**
+     * @return the entry for the given key, or nullptr if there is none. The
+     *         pointer is invalidated by the next insert() or erase().
+     */
+    index_entry* find(const DocKey& key);
+
+    const index_entry* find(const DocKey& key) const;
+
+    /**
+     * Add an entry for a key which isn't already in the index.
+     *
+     * @param key the key, which must match the key of the item at
+     *        entry.position
+     */
+    void insert(const DocKey& key, const index_entry& entry);
+
+    /**
+     * Set the entry for the given key, replacing any existing entry.
+     */
+    void set(const DocKey& key, const index_entry& entry);
+
+    /**
+     * Remove the entry for the given key.
+     *
+     * @return true if there was an entry for the key.
+     */
+    bool erase(const DocKey& key);
+
+    size_t size() const {
+        return count;
+    }
+
+    /// @return the bytes allocated for the index's slots.
+    size_t getMemoryUsage() const {
+        return capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        // Zero for an empty slot; hashKey() never returns zero.
+        uint64_t hash;
+        index_entry entry;
+    };
+
+    // Capacity allocated by the first insert.
+    static const size_t initialCapacity = 8;
+
+    static uint64_t hashKey(const DocKey& key);
+
+    size_t capacity() const {
+        return slots ? mask + 1 : 0;
+    }
+
+    /**
+     * @return the index of the slot holding key, or of the empty slot
+     *         where it would be inserted. The table must not be empty.
+     */
+    size_t findSlot(uint64_t hash, const DocKey& key) const;
+
+    /// Double the capacity (or allocate the initial slots).
+    void grow();
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    size_t count;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointIndex);
+};
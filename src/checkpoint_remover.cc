@@ -28,8 +28,12 @@
 #include "connmap.h"
 #include "tapconnmap.h"
 
+#include <algorithm>
+
 /**
- * Remove all the closed unreferenced checkpoints for each vbucket.
+ * Remove all the closed unreferenced checkpoints for each vbucket, and expel
+ * the processed items from each open checkpoint if memory usage is above
+ * the low water mark.
  */
 class CheckpointVisitor : public VBucketVisitor {
 public:
@@ -63,6 +67,16 @@ public:
                 removed, vb->getId());
         }
         removed = 0;
+
+        if (vb->checkpointManager.getCheckpointConfig()
+                    .isCheckpointExpelEnabled() &&
+            stats.getTotalMemoryUsed() > stats.mem_low_wat.load()) {
+            const auto expelled =
+                    vb->checkpointManager.expelUnreferencedCheckpointItems();
+            stats.itemsExpelledFromCheckpoints.fetch_add(
+                    expelled.numItems + expelled.numMetaItems);
+            stats.memFreedByCheckpointItemExpel.fetch_add(expelled.memory);
+        }
     }
 
     void complete() override {
@@ -89,16 +103,38 @@ private:
 
 void ClosedUnrefCheckpointRemoverTask::cursorDroppingIfNeeded(void) {
     /**
-     * Cursor dropping will commence only if the total memory used is
-     * greater than the upper threshold which is a percentage of the
-     * quota, specified by cursor_dropping_upper_mark. Once cursor
-     * dropping starts, it will continue until memory usage is projected
-     * to go under the lower threshold which is a percentage of the quota,
-     * specified by cursor_dropping_lower_mark.
+     * Cursor dropping will commence if either:
+     * (1) the total memory used is greater than the upper threshold which
+     *     is a percentage of the quota, specified by
+     *     cursor_dropping_upper_mark. Once cursor dropping starts, it will
+     *     continue until memory usage is projected to go under the lower
+     *     threshold which is a percentage of the quota, specified by
+     *     cursor_dropping_lower_mark.
+     * (2) the memory used by the items queued in all checkpoints is greater
+     *     than the upper threshold specified (as a percentage of the quota)
+     *     by cursor_dropping_checkpoint_mem_upper_mark, in which case it
+     *     continues until checkpoint memory usage is projected to go under
+     *     cursor_dropping_checkpoint_mem_lower_mark.
      */
+    size_t amountOfMemoryToClear = 0;
     if (stats.getTotalMemoryUsed() > stats.cursorDroppingUThreshold.load()) {
-        size_t amountOfMemoryToClear = stats.getTotalMemoryUsed() -
-                                          stats.cursorDroppingLThreshold.load();
+        amountOfMemoryToClear = stats.getTotalMemoryUsed() -
+                                stats.cursorDroppingLThreshold.load();
+    }
+    const size_t checkpointMemUsed = stats.checkpointMemUsage->load();
+    const size_t checkpointMemThreshold =
+            stats.cursorDroppingCheckpointMemUThreshold.load();
+    if (checkpointMemThreshold > 0 &&
+        checkpointMemUsed > checkpointMemThreshold) {
+        amountOfMemoryToClear = std::max(
+                amountOfMemoryToClear,
+                checkpointMemUsed -
+                        std::min(checkpointMemUsed,
+                                 stats.cursorDroppingCheckpointMemLThreshold
+                                         .load()));
+    }
+
+    if (amountOfMemoryToClear > 0) {
         size_t memoryCleared = 0;
         KVBucketIface* kvBucket = engine->getKVBucket();
         // Get a list of active vbuckets sorted by memory usage
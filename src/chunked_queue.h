@@ -0,0 +1,386 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "utility.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A double-ended queue stored in fixed size chunks of contiguous slots,
+ * with list-like iterator stability.
+ *
+ * Elements never move once queued: iterators (and pointers) to an element
+ * remain valid until that element is erased, whatever else is pushed,
+ * popped or erased - as with std::list, and unlike std::deque. end() is a
+ * fixed sentinel, so an iterator equal to end() stays equal to end() as
+ * elements are pushed.
+ *
+ * Erasing an element from the middle of the queue leaves a hole in its
+ * chunk which iteration skips; a chunk is released once every element in
+ * it has been erased. The most recently released chunk is kept to be
+ * reused by the next push which needs a new chunk, so a queue which is
+ * drained from the front as it is filled at the back (the usual case)
+ * cycles through its chunks like a ring buffer without allocating.
+ *
+ * An element equal to T() (i.e. one which converts to false) marks a hole,
+ * so such values cannot be queued.
+ */
+template <typename T, size_t ChunkSize = 64>
+class ChunkedQueue {
+    static_assert(ChunkSize > 0 && ChunkSize <= UINT32_MAX,
+                  "ChunkedQueue: invalid ChunkSize");
+
+    /**
+     * A link in the circular list of chunks; the queue's own link is the
+     * sentinel, which has an empty slot range.
+     */
+    struct Link {
+        Link* prev;
+        Link* next;
+        // Range of slots [first, last) which may hold elements. Always
+        // non-empty for a chunk in the list, and kept tight, so slots first
+        // and last - 1 hold elements.
+        uint32_t first;
+        uint32_t last;
+    };
+
+    struct Chunk : Link {
+        size_t numElements;
+        std::array<T, ChunkSize> slots;
+    };
+
+    template <bool Const>
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = typename std::conditional<Const, const T*, T*>::type;
+        using reference = typename std::conditional<Const, const T&, T&>::type;
+
+        Iterator() : link(nullptr), index(0) {
+        }
+
+        // Allow conversion from iterator to const_iterator.
+        template <bool WasConst,
+                  typename = typename std::enable_if<Const && !WasConst>::type>
+        Iterator(const Iterator<WasConst>& other)
+            : link(other.link), index(other.index) {
+        }
+
+        reference operator*() const {
+            return static_cast<Chunk*>(link)->slots[index];
+        }
+
+        pointer operator->() const {
+            return &static_cast<Chunk*>(link)->slots[index];
+        }
+
+        Iterator& operator++() {
+            ++index;
+            for (;;) {
+                if (index < link->last) {
+                    if (static_cast<Chunk*>(link)->slots[index]) {
+                        return *this;
+                    }
+                    ++index;
+                    continue;
+                }
+                link = link->next;
+                if (link->first == link->last) {
+                    // Reached the sentinel, i.e. end().
+                    index = 0;
+                    return *this;
+                }
+                index = link->first;
+            }
+        }
+
+        Iterator operator++(int) {
+            Iterator rv(*this);
+            ++*this;
+            return rv;
+        }
+
+        Iterator& operator--() {
+            for (;;) {
+                if (index > link->first) {
+                    --index;
+                    if (static_cast<Chunk*>(link)->slots[index]) {
+                        return *this;
+                    }
+                    continue;
+                }
+                link = link->prev;
+                index = link->last;
+            }
+        }
+
+        Iterator operator--(int) {
+            Iterator rv(*this);
+            --*this;
+            return rv;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return link == other.link && index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Iterator(Link* link, uint32_t index) : link(link), index(index) {
+        }
+
+        Link* link;
+        uint32_t index;
+
+        friend class ChunkedQueue;
+        friend class Iterator<!Const>;
+    };
+
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    ChunkedQueue() : numElements(0), numChunks(0), spare(nullptr) {
+        sentinel.prev = &sentinel;
+        sentinel.next = &sentinel;
+        sentinel.first = 0;
+        sentinel.last = 0;
+    }
+
+    ~ChunkedQueue() {
+        clear();
+        delete spare;
+    }
+
+    bool empty() const {
+        return numElements == 0;
+    }
+
+    size_t size() const {
+        return numElements;
+    }
+
+    /// @return the number of chunks currently holding elements.
+    size_t getNumChunks() const {
+        return numChunks;
+    }
+
+    /**
+     * @return the memory used by the queue's chunks, including free slots
+     * and holes (but not anything the elements themselves point to).
+     */
+    size_t getMemoryUsage() const {
+        return sizeof(*this) + (numChunks + (spare ? 1 : 0)) * sizeof(Chunk);
+    }
+
+    T& front() {
+        return *begin();
+    }
+
+    const T& front() const {
+        return *begin();
+    }
+
+    T& back() {
+        return *std::prev(end());
+    }
+
+    const T& back() const {
+        return *std::prev(end());
+    }
+
+    iterator begin() {
+        if (empty()) {
+            return end();
+        }
+        return iterator(sentinel.next, sentinel.next->first);
+    }
+
+    const_iterator begin() const {
+        return const_cast<ChunkedQueue*>(this)->begin();
+    }
+
+    iterator end() {
+        return iterator(&sentinel, 0);
+    }
+
+    const_iterator end() const {
+        return const_cast<ChunkedQueue*>(this)->end();
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    void push_back(T value) {
+        checkValue(value);
+        Chunk* tail = static_cast<Chunk*>(sentinel.prev);
+        if (empty() || tail->last == ChunkSize) {
+            tail = newChunk(0);
+            linkBefore(tail, &sentinel);
+        }
+        tail->slots[tail->last++] = std::move(value);
+        ++tail->numElements;
+        ++numElements;
+    }
+
+    void push_front(T value) {
+        checkValue(value);
+        Chunk* head = static_cast<Chunk*>(sentinel.next);
+        if (empty() || head->first == 0) {
+            head = newChunk(ChunkSize);
+            linkBefore(head, sentinel.next);
+        }
+        head->slots[--head->first] = std::move(value);
+        ++head->numElements;
+        ++numElements;
+    }
+
+    void pop_back() {
+        erase(std::prev(end()));
+    }
+
+    void pop_front() {
+        erase(begin());
+    }
+
+    /**
+     * Remove the element at pos. Only iterators to that element are
+     * invalidated.
+     *
+     * @return an iterator to the element which followed pos.
+     */
+    iterator erase(iterator pos) {
+        iterator next = std::next(pos);
+        Chunk* chunk = static_cast<Chunk*>(pos.link);
+        chunk->slots[pos.index] = T();
+        --numElements;
+        if (--chunk->numElements == 0) {
+            unlink(chunk);
+            releaseChunk(chunk);
+            return next;
+        }
+        while (!chunk->slots[chunk->first]) {
+            ++chunk->first;
+        }
+        while (!chunk->slots[chunk->last - 1]) {
+            --chunk->last;
+        }
+        return next;
+    }
+
+    void clear() {
+        Link* link = sentinel.next;
+        while (link != &sentinel) {
+            Link* next = link->next;
+            delete static_cast<Chunk*>(link);
+            link = next;
+        }
+        sentinel.prev = &sentinel;
+        sentinel.next = &sentinel;
+        numElements = 0;
+        numChunks = 0;
+    }
+
+private:
+    static void checkValue(const T& value) {
+        if (!value) {
+            throw std::invalid_argument(
+                    "ChunkedQueue: Cannot queue an empty value");
+        }
+    }
+
+    /**
+     * Get a chunk (reusing the spare if there is one) with an empty slot
+     * range starting at the given slot.
+     */
+    Chunk* newChunk(uint32_t start) {
+        Chunk* chunk = spare;
+        if (chunk) {
+            spare = nullptr;
+        } else {
+            chunk = new Chunk();
+        }
+        chunk->first = start;
+        chunk->last = start;
+        chunk->numElements = 0;
+        ++numChunks;
+        return chunk;
+    }
+
+    /// Keep an emptied chunk as the spare, or free it if we have one.
+    void releaseChunk(Chunk* chunk) {
+        --numChunks;
+        if (spare) {
+            delete chunk;
+        } else {
+            spare = chunk;
+        }
+    }
+
+    static void linkBefore(Link* link, Link* pos) {
+        link->prev = pos->prev;
+        link->next = pos;
+        pos->prev->next = link;
+        pos->prev = link;
+    }
+
+    static void unlink(Link* link) {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+    }
+
+    Link sentinel;
+    size_t numElements;
+    size_t numChunks;
+    Chunk* spare;
+
+    DISALLOW_COPY_AND_ASSIGN(ChunkedQueue);
+};
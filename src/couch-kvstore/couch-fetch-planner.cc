@@ -0,0 +1,80 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fetch-planner.h"
+
+#include <algorithm>
+
+// Size of the header couchstore writes before each chunk.
+static const cs_off_t chunkHeaderSize = 8;
+
+FetchPlanner::FetchPlanner(size_t maxGap, size_t maxReadSize)
+    : maxGap(maxGap), maxReadSize(maxReadSize) {
+}
+
+void FetchPlanner::sortByOffset(std::vector<DocInfo*>& docinfos) {
+    std::sort(docinfos.begin(), docinfos.end(),
+              [](const DocInfo* a, const DocInfo* b) {
+                  return a->bp < b->bp;
+              });
+}
+
+FetchPlanner::Range FetchPlanner::bodyBlocks(const DocInfo& docinfo) {
+    const cs_off_t block = blockSize;
+    const cs_off_t length = chunkHeaderSize + docinfo.size;
+    const cs_off_t start = docinfo.bp - docinfo.bp % block;
+    cs_off_t end = docinfo.bp + length + length / (block - 1) + 1;
+    end += (block - end % block) % block;
+    return {start, size_t(end - start)};
+}
+
+std::vector<FetchPlanner::Range> FetchPlanner::coalesce(
+        std::vector<Range> ranges) const {
+    std::sort(ranges.begin(), ranges.end(),
+              [](const Range& a, const Range& b) {
+                  return a.offset < b.offset;
+              });
+
+    std::vector<Range> reads;
+    for (const auto& range : ranges) {
+        if (range.size == 0) {
+            continue;
+        }
+        if (!reads.empty()) {
+            Range& last = reads.back();
+            const cs_off_t end = std::max(last.end(), range.end());
+            if (range.offset <= last.end() + cs_off_t(maxGap) &&
+                size_t(end - last.offset) <= maxReadSize) {
+                last.size = end - last.offset;
+                continue;
+            }
+            if (range.offset < last.end()) {
+                // Only read the part of the range the last read doesn't
+                // cover.
+                if (range.end() > last.end()) {
+                    reads.push_back({last.end(),
+                                     size_t(range.end() - last.end())});
+                }
+                continue;
+            }
+        }
+        reads.push_back(range);
+    }
+    return reads;
+}
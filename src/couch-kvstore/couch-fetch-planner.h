@@ -0,0 +1,83 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <libcouchstore/couch_db.h>
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Plans the disk reads of a batch of BGFetches from one couchstore file.
+ *
+ * Once the DocInfos of a batch have been looked up, the documents are read
+ * in file offset order, and the blocks holding their bodies are read with
+ * as few (larger) reads as possible: reads separated by no more than
+ * maxGap bytes are coalesced, up to maxReadSize bytes per read. Reading a
+ * gap is usually cheaper than issuing another read, particularly on
+ * spinning disks and network block storage.
+ */
+class FetchPlanner {
+public:
+    struct Range {
+        cs_off_t offset;
+        size_t size;
+
+        cs_off_t end() const {
+            return offset + size;
+        }
+
+        bool operator==(const Range& other) const {
+            return offset == other.offset && size == other.size;
+        }
+    };
+
+    // couchstore's block size; reads are aligned to it.
+    static const size_t blockSize = 4096;
+
+    FetchPlanner(size_t maxGap = 4 * blockSize,
+                 size_t maxReadSize = 256 * blockSize);
+
+    /**
+     * Sort the DocInfos by the offset of their body, the order in which
+     * they should be read.
+     */
+    static void sortByOffset(std::vector<DocInfo*>& docinfos);
+
+    /**
+     * Returns the block-aligned range of the file holding the body of the
+     * given document. The body is stored as a chunk with an 8 byte header,
+     * and couchstore inserts a marker byte at each block boundary the chunk
+     * crosses.
+     */
+    static Range bodyBlocks(const DocInfo& docinfo);
+
+    /**
+     * Returns the reads covering the given ranges (in any order), in offset
+     * order, coalescing ranges which overlap or are within maxGap bytes of
+     * each other into one read of at most maxReadSize bytes (a single range
+     * larger than that is still read whole).
+     */
+    std::vector<Range> coalesce(std::vector<Range> ranges) const;
+
+private:
+    const size_t maxGap;
+    const size_t maxReadSize;
+};
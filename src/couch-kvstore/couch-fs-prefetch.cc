@@ -0,0 +1,229 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fs-prefetch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+struct PrefetchFileOps::File {
+    struct Block {
+        cs_off_t offset;
+        std::vector<char> data;
+        // True if the read stopped short at the end of the file.
+        bool eof;
+    };
+
+    File(couch_file_handle handle) : handle(handle) {
+    }
+
+    couch_file_handle handle;
+    std::string path;
+    bool registered = false;
+
+    // The thread which last used the handle, and when.
+    std::atomic<std::thread::id> user;
+    std::atomic<uint64_t> lastUse{0};
+
+    // Data read by prefetch(), sorted by offset.
+    std::vector<Block> prefetched;
+};
+
+PrefetchFileOps::PrefetchFileOps(FileOpsInterface& ops)
+    : wrapped_ops(ops), useCounter(0) {
+}
+
+couch_file_handle PrefetchFileOps::constructor(
+        couchstore_error_info_t* errinfo) {
+    couch_file_handle handle = wrapped_ops.constructor(errinfo);
+    if (!handle) {
+        return nullptr;
+    }
+    return reinterpret_cast<couch_file_handle>(new File(handle));
+}
+
+couchstore_error_t PrefetchFileOps::open(couchstore_error_info_t* errinfo,
+                                         couch_file_handle* handle,
+                                         const char* path,
+                                         int oflag) {
+    File* file = reinterpret_cast<File*>(*handle);
+    couchstore_error_t rv =
+            wrapped_ops.open(errinfo, &file->handle, path, oflag);
+    if (rv == COUCHSTORE_SUCCESS) {
+        file->path = path;
+        file->user = std::this_thread::get_id();
+        file->lastUse = ++useCounter;
+        registerFile(*file);
+    }
+    return rv;
+}
+
+couchstore_error_t PrefetchFileOps::close(couchstore_error_info_t* errinfo,
+                                          couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    unregisterFile(*file);
+    file->prefetched.clear();
+    return wrapped_ops.close(errinfo, file->handle);
+}
+
+ssize_t PrefetchFileOps::pread(couchstore_error_info_t* errinfo,
+                               couch_file_handle handle,
+                               void* buf,
+                               size_t nbytes,
+                               cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+    file->user = std::this_thread::get_id();
+    file->lastUse = ++useCounter;
+
+    auto block = std::upper_bound(
+            file->prefetched.begin(), file->prefetched.end(), offset,
+            [](cs_off_t off, const File::Block& b) { return off < b.offset; });
+    if (block != file->prefetched.begin()) {
+        --block;
+        const cs_off_t blockEnd = block->offset + block->data.size();
+        const cs_off_t end = offset + nbytes;
+        if (end <= blockEnd || (block->eof && offset <= blockEnd)) {
+            const size_t n = std::min(end, blockEnd) - offset;
+            std::memcpy(buf, block->data.data() + (offset - block->offset), n);
+            return n;
+        }
+    }
+
+    return wrapped_ops.pread(errinfo, file->handle, buf, nbytes, offset);
+}
+
+ssize_t PrefetchFileOps::pwrite(couchstore_error_info_t* errinfo,
+                                couch_file_handle handle,
+                                const void* buf,
+                                size_t nbytes,
+                                cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+    file->prefetched.clear();
+    return wrapped_ops.pwrite(errinfo, file->handle, buf, nbytes, offset);
+}
+
+cs_off_t PrefetchFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                   couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    return wrapped_ops.goto_eof(errinfo, file->handle);
+}
+
+couchstore_error_t PrefetchFileOps::sync(couchstore_error_info_t* errinfo,
+                                         couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    return wrapped_ops.sync(errinfo, file->handle);
+}
+
+couchstore_error_t PrefetchFileOps::advise(couchstore_error_info_t* errinfo,
+                                           couch_file_handle handle,
+                                           cs_off_t offset,
+                                           cs_off_t len,
+                                           couchstore_file_advice_t advice) {
+    File* file = reinterpret_cast<File*>(handle);
+    return wrapped_ops.advise(errinfo, file->handle, offset, len, advice);
+}
+
+void PrefetchFileOps::destructor(couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    // Not closed by couchstore.
+    unregisterFile(*file);
+    wrapped_ops.destructor(file->handle);
+    delete file;
+}
+
+bool PrefetchFileOps::prefetch(const std::string& path,
+                               const std::vector<Range>& ranges) {
+    File* file = nullptr;
+    {
+        std::lock_guard<std::mutex> lh(openFilesMutex);
+        auto found = openFiles.equal_range(path);
+        for (auto it = found.first; it != found.second; ++it) {
+            File* candidate = it->second;
+            if (candidate->user.load() == std::this_thread::get_id() &&
+                (!file || candidate->lastUse > file->lastUse)) {
+                file = candidate;
+            }
+        }
+    }
+    if (!file) {
+        return false;
+    }
+
+    file->prefetched.clear();
+    std::vector<File::Block> blocks;
+    size_t total = 0;
+    for (const auto& range : ranges) {
+        if (range.size == 0) {
+            continue;
+        }
+        if (total + range.size > maxPrefetchBytes) {
+            break;
+        }
+        total += range.size;
+
+        File::Block block{range.offset, std::vector<char>(range.size), false};
+        couchstore_error_info_t errinfo;
+        const ssize_t rv = wrapped_ops.pread(&errinfo, file->handle,
+                                             block.data.data(),
+                                             block.data.size(), block.offset);
+        if (rv < 0) {
+            return false;
+        }
+        if (size_t(rv) < block.data.size()) {
+            block.data.resize(rv);
+            block.eof = true;
+        }
+        blocks.push_back(std::move(block));
+    }
+    std::sort(blocks.begin(), blocks.end(),
+              [](const File::Block& a, const File::Block& b) {
+                  return a.offset < b.offset;
+              });
+    file->prefetched = std::move(blocks);
+    return true;
+}
+
+void PrefetchFileOps::registerFile(File& file) {
+    std::lock_guard<std::mutex> lh(openFilesMutex);
+    if (!file.registered) {
+        openFiles.emplace(file.path, &file);
+        file.registered = true;
+    }
+}
+
+void PrefetchFileOps::unregisterFile(File& file) {
+    std::lock_guard<std::mutex> lh(openFilesMutex);
+    if (!file.registered) {
+        return;
+    }
+    auto found = openFiles.equal_range(file.path);
+    for (auto it = found.first; it != found.second; ++it) {
+        if (it->second == &file) {
+            openFiles.erase(it);
+            break;
+        }
+    }
+    file.registered = false;
+}
+
+PrefetchFileOps& getCouchstorePrefetchOps() {
+    static PrefetchFileOps ops(*couchstore_get_default_file_ops());
+    return ops;
+}
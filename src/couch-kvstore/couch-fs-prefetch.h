@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fetch-planner.h"
+
+#include <libcouchstore/couch_db.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * FileOpsInterface implementation for couchstore which wraps other file ops
+ * (by default couchstore's own) to add prefetch(): each of a set of ranges
+ * of an open file is read with a single pread, after which pread()s falling
+ * within those ranges are served from memory.
+ *
+ * This lets the reads FetchPlanner coalesces for a BGFetch batch be made
+ * whatever the underlying ops; UringFileOps provides its own prefetch(),
+ * submitting the reads together.
+ */
+class PrefetchFileOps : public FileOpsInterface {
+public:
+    using Range = FetchPlanner::Range;
+
+    // Most bytes read by one prefetch(); later ranges are read on demand.
+    static const size_t maxPrefetchBytes = 16 * 1024 * 1024;
+
+    PrefetchFileOps(FileOpsInterface& ops);
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    /**
+     * Read the given ranges of the file at path, through the handle to it
+     * the calling thread used most recently. Until the next prefetch(), a
+     * write to the file or its close, pread()s within a range are served
+     * from the data read.
+     *
+     * @return false if the calling thread hasn't used a handle to the file
+     *         or a read failed, in which case nothing is held.
+     */
+    bool prefetch(const std::string& path, const std::vector<Range>& ranges);
+
+private:
+    struct File;
+
+    void registerFile(File& file);
+
+    void unregisterFile(File& file);
+
+    FileOpsInterface& wrapped_ops;
+
+    // Orders the uses of handles, so prefetch() can pick the latest.
+    std::atomic<uint64_t> useCounter;
+
+    // Files currently open, by path, for prefetch() to find.
+    std::mutex openFilesMutex;
+    std::unordered_multimap<std::string, File*> openFiles;
+};
+
+/**
+ * Returns the process-wide PrefetchFileOps instance wrapping couchstore's
+ * default file ops.
+ */
+PrefetchFileOps& getCouchstorePrefetchOps();
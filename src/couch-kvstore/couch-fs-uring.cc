@@ -0,0 +1,606 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fs-uring.h"
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+struct UringFileOps::File {
+    struct Write {
+        cs_off_t offset;
+        std::vector<char> data;
+    };
+
+    struct Block {
+        cs_off_t offset;
+        std::vector<char> data;
+        // True if the read stopped short at the end of the file.
+        bool eof;
+    };
+
+    int fd = -1;
+    std::string path;
+    std::thread::id opener;
+
+    // Queued writes, in the order made; contiguous writes are merged.
+    std::vector<Write> writes;
+    size_t queuedBytes = 0;
+
+    // Data read by prefetch(), sorted by offset.
+    std::vector<Block> prefetched;
+};
+
+namespace {
+
+struct IoOp {
+    enum class Type { Read, Write, Sync };
+
+    Type type;
+    int fd;
+    char* buf;
+    size_t size;
+    cs_off_t offset;
+    // Bytes transferred (zero for a sync), or -errno on failure.
+    ssize_t result;
+};
+
+ssize_t readFully(int fd, char* buf, size_t size, cs_off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rv = ::pread(fd, buf + done, size - done, offset + done);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (rv == 0) {
+            break; // End of file.
+        }
+        done += rv;
+    }
+    return done;
+}
+
+ssize_t writeFully(int fd, const char* buf, size_t size, cs_off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t rv = ::pwrite(fd, buf + done, size - done, offset + done);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (rv == 0) {
+            return -EIO;
+        }
+        done += rv;
+    }
+    return done;
+}
+
+int syncFile(int fd) {
+    int rv;
+    do {
+        rv = ::fdatasync(fd);
+    } while (rv == -1 && errno == EINTR);
+    return rv == 0 ? 0 : -errno;
+}
+
+/**
+ * Perform the op with plain system calls, carrying on from any bytes already
+ * transferred.
+ */
+void completeOp(IoOp& op) {
+    const size_t done = op.result > 0 ? op.result : 0;
+    ssize_t rv;
+    switch (op.type) {
+    case IoOp::Type::Read:
+        rv = readFully(op.fd, op.buf + done, op.size - done, op.offset + done);
+        op.result = rv < 0 ? rv : done + rv;
+        return;
+    case IoOp::Type::Write:
+        rv = writeFully(op.fd, op.buf + done, op.size - done,
+                        op.offset + done);
+        op.result = rv < 0 ? rv : done + rv;
+        return;
+    case IoOp::Type::Sync:
+        op.result = syncFile(op.fd);
+        return;
+    }
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * An io_uring owned by one thread.
+ */
+class ThreadRing {
+public:
+    static const unsigned depth = 64;
+
+    ThreadRing() : usable(io_uring_queue_init(depth, &ring, 0) == 0) {
+    }
+
+    ~ThreadRing() {
+        if (usable) {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    bool isUsable() const {
+        return usable;
+    }
+
+    /**
+     * Submit count (at most depth) ops with one system call, and wait for
+     * them all to complete. A sync only starts once the ops before it have
+     * completed.
+     *
+     * @return false if the ring failed, in which case the ring is no longer
+     *         used and the ops may be incomplete.
+     */
+    bool submit(IoOp* ops, size_t count) {
+        for (size_t ii = 0; ii < count; ++ii) {
+            IoOp& op = ops[ii];
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            switch (op.type) {
+            case IoOp::Type::Read:
+                io_uring_prep_read(sqe, op.fd, op.buf, op.size, op.offset);
+                break;
+            case IoOp::Type::Write:
+                io_uring_prep_write(sqe, op.fd, op.buf, op.size, op.offset);
+                break;
+            case IoOp::Type::Sync:
+                io_uring_prep_fsync(sqe, op.fd, IORING_FSYNC_DATASYNC);
+                sqe->flags |= IOSQE_IO_DRAIN;
+                break;
+            }
+            io_uring_sqe_set_data(sqe, &op);
+        }
+
+        int submitted;
+        do {
+            submitted = io_uring_submit_and_wait(&ring, count);
+        } while (submitted == -EINTR);
+        if (submitted < 0) {
+            disable();
+            return false;
+        }
+
+        // Reap everything submitted before the ring may be torn down, as the
+        // kernel writes to the ops' buffers until then.
+        for (int ii = 0; ii < submitted; ++ii) {
+            io_uring_cqe* cqe;
+            int rv;
+            do {
+                rv = io_uring_wait_cqe(&ring, &cqe);
+            } while (rv == -EINTR);
+            if (rv < 0) {
+                disable();
+                return false;
+            }
+            static_cast<IoOp*>(io_uring_cqe_get_data(cqe))->result = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+        }
+        if (size_t(submitted) != count) {
+            disable();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void disable() {
+        io_uring_queue_exit(&ring);
+        usable = false;
+    }
+
+    struct io_uring ring;
+    bool usable;
+};
+
+ThreadRing& threadRing() {
+    // A thread_local object (rather than ThreadLocal) so that each ring is
+    // torn down when its thread exits.
+    static thread_local ThreadRing ring;
+    return ring;
+}
+#endif
+
+/**
+ * Perform the ops, through the calling thread's ring where possible. Ops are
+ * submitted in groups of at most the ring's depth, and a sync only starts
+ * once the ops before it have completed.
+ */
+void performOps(std::vector<IoOp>& ops) {
+    size_t done = 0;
+#ifdef HAVE_LIBURING
+    ThreadRing& ring = threadRing();
+    while (ops.size() > 1 && done < ops.size() && ring.isUsable()) {
+        const size_t count =
+                std::min(ops.size() - done, size_t(ThreadRing::depth));
+        if (!ring.submit(&ops[done], count)) {
+            break;
+        }
+        // Finish any short or failed ops. A sync must also be redone if a
+        // write before it had to be finished.
+        bool resync = false;
+        for (size_t ii = done; ii < done + count; ++ii) {
+            IoOp& op = ops[ii];
+            switch (op.type) {
+            case IoOp::Type::Read:
+            case IoOp::Type::Write:
+                if (op.result < 0 || size_t(op.result) < op.size) {
+                    completeOp(op);
+                    resync |= op.type == IoOp::Type::Write;
+                }
+                break;
+            case IoOp::Type::Sync:
+                if (op.result < 0 || resync) {
+                    completeOp(op);
+                }
+                break;
+            }
+        }
+        done += count;
+    }
+#endif
+    for (; done < ops.size(); ++done) {
+        completeOp(ops[done]);
+    }
+}
+
+void setError(couchstore_error_info_t* errinfo, int error) {
+    if (errinfo) {
+        errinfo->error = error;
+    }
+}
+
+bool overlaps(cs_off_t offset, size_t size, cs_off_t otherOffset,
+              size_t otherSize) {
+    return offset < otherOffset + cs_off_t(otherSize) &&
+           otherOffset < offset + cs_off_t(size);
+}
+
+} // anonymous namespace
+
+bool UringFileOps::isUringBuilt() {
+#ifdef HAVE_LIBURING
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool UringFileOps::isUringAvailable() {
+#ifdef HAVE_LIBURING
+    return threadRing().isUsable();
+#else
+    return false;
+#endif
+}
+
+couch_file_handle UringFileOps::constructor(couchstore_error_info_t* errinfo) {
+    return reinterpret_cast<couch_file_handle>(new File());
+}
+
+couchstore_error_t UringFileOps::open(couchstore_error_info_t* errinfo,
+                                      couch_file_handle* handle,
+                                      const char* path,
+                                      int oflag) {
+    File* file = reinterpret_cast<File*>(*handle);
+    int fd;
+    do {
+        fd = ::open(path, oflag, 0666);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1) {
+        const int error = errno;
+        setError(errinfo, error);
+        return error == ENOENT ? COUCHSTORE_ERROR_NO_SUCH_FILE
+                               : COUCHSTORE_ERROR_OPEN_FILE;
+    }
+
+    file->fd = fd;
+    file->path = path;
+    file->opener = std::this_thread::get_id();
+    registerFile(*file);
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t UringFileOps::close(couchstore_error_info_t* errinfo,
+                                       couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    couchstore_error_t rv = COUCHSTORE_SUCCESS;
+    const int error = flushWrites(*file, false);
+    if (error) {
+        setError(errinfo, error);
+        rv = COUCHSTORE_ERROR_WRITE;
+    }
+
+    unregisterFile(*file);
+    file->prefetched.clear();
+    // Not retried on EINTR, as the descriptor is released regardless.
+    if (::close(file->fd) == -1 && rv == COUCHSTORE_SUCCESS) {
+        setError(errinfo, errno);
+        rv = COUCHSTORE_ERROR_FILE_CLOSE;
+    }
+    file->fd = -1;
+    return rv;
+}
+
+ssize_t UringFileOps::pread(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle,
+                            void* buf,
+                            size_t nbytes,
+                            cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+
+    // The read must see any queued write of the range.
+    for (const auto& write : file->writes) {
+        if (overlaps(offset, nbytes, write.offset, write.data.size())) {
+            const int error = flushWrites(*file, false);
+            if (error) {
+                setError(errinfo, error);
+                return COUCHSTORE_ERROR_READ;
+            }
+            break;
+        }
+    }
+
+    auto block = std::upper_bound(
+            file->prefetched.begin(), file->prefetched.end(), offset,
+            [](cs_off_t off, const File::Block& b) { return off < b.offset; });
+    if (block != file->prefetched.begin()) {
+        --block;
+        const cs_off_t blockEnd = block->offset + block->data.size();
+        const cs_off_t end = offset + nbytes;
+        if (end <= blockEnd || (block->eof && offset <= blockEnd)) {
+            const size_t n = std::min(end, blockEnd) - offset;
+            std::memcpy(buf, block->data.data() + (offset - block->offset), n);
+            return n;
+        }
+    }
+
+    const ssize_t rv =
+            readFully(file->fd, static_cast<char*>(buf), nbytes, offset);
+    if (rv < 0) {
+        setError(errinfo, -rv);
+        return COUCHSTORE_ERROR_READ;
+    }
+    return rv;
+}
+
+ssize_t UringFileOps::pwrite(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle,
+                             const void* buf,
+                             size_t nbytes,
+                             cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+    file->prefetched.clear();
+
+    // Writes in one submission may complete in any order, so one which
+    // overlaps a queued write must wait for it.
+    bool append = false;
+    for (const auto& write : file->writes) {
+        if (overlaps(offset, nbytes, write.offset, write.data.size())) {
+            const int error = flushWrites(*file, false);
+            if (error) {
+                setError(errinfo, error);
+                return COUCHSTORE_ERROR_WRITE;
+            }
+            break;
+        }
+    }
+    if (!file->writes.empty()) {
+        const auto& last = file->writes.back();
+        append = last.offset + cs_off_t(last.data.size()) == offset;
+    }
+
+    const char* data = static_cast<const char*>(buf);
+    if (append) {
+        auto& last = file->writes.back().data;
+        last.insert(last.end(), data, data + nbytes);
+    } else {
+        file->writes.push_back({offset, std::vector<char>(data, data + nbytes)});
+    }
+    file->queuedBytes += nbytes;
+
+    if (file->queuedBytes >= maxQueuedWriteBytes) {
+        const int error = flushWrites(*file, false);
+        if (error) {
+            setError(errinfo, error);
+            return COUCHSTORE_ERROR_WRITE;
+        }
+    }
+    return nbytes;
+}
+
+cs_off_t UringFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    cs_off_t end = ::lseek(file->fd, 0, SEEK_END);
+    if (end < 0) {
+        setError(errinfo, errno);
+        return COUCHSTORE_ERROR_READ;
+    }
+    // Queued writes may extend the file.
+    for (const auto& write : file->writes) {
+        end = std::max(end, write.offset + cs_off_t(write.data.size()));
+    }
+    return end;
+}
+
+couchstore_error_t UringFileOps::sync(couchstore_error_info_t* errinfo,
+                                      couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    const int error = flushWrites(*file, true);
+    if (error) {
+        setError(errinfo, error);
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t UringFileOps::advise(couchstore_error_info_t* errinfo,
+                                        couch_file_handle handle,
+                                        cs_off_t offset,
+                                        cs_off_t len,
+                                        couchstore_file_advice_t advice) {
+#ifdef POSIX_FADV_NORMAL
+    File* file = reinterpret_cast<File*>(handle);
+    // couchstore's advice values are the POSIX ones.
+    const int error = posix_fadvise(file->fd, offset, len, int(advice));
+    if (error) {
+        setError(errinfo, error);
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+#endif
+    return COUCHSTORE_SUCCESS;
+}
+
+void UringFileOps::destructor(couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    if (file->fd != -1) {
+        // Not closed by couchstore; there's nowhere to report errors.
+        flushWrites(*file, false);
+        unregisterFile(*file);
+        ::close(file->fd);
+    }
+    delete file;
+}
+
+bool UringFileOps::prefetch(const std::string& path,
+                            const std::vector<Range>& ranges) {
+    File* file = nullptr;
+    {
+        std::lock_guard<std::mutex> lh(openFilesMutex);
+        auto found = openFiles.equal_range(path);
+        for (auto it = found.first; it != found.second; ++it) {
+            if (it->second->opener == std::this_thread::get_id()) {
+                file = it->second;
+                break;
+            }
+        }
+    }
+    if (!file) {
+        return false;
+    }
+
+    file->prefetched.clear();
+    if (flushWrites(*file, false) != 0) {
+        return false;
+    }
+
+    std::vector<File::Block> blocks;
+    size_t total = 0;
+    for (const auto& range : ranges) {
+        if (range.size == 0) {
+            continue;
+        }
+        if (total + range.size > maxPrefetchBytes) {
+            break;
+        }
+        total += range.size;
+        blocks.push_back({range.offset, std::vector<char>(range.size), false});
+    }
+
+    std::vector<IoOp> ops;
+    ops.reserve(blocks.size());
+    for (auto& block : blocks) {
+        ops.push_back({IoOp::Type::Read, file->fd, block.data.data(),
+                       block.data.size(), block.offset, 0});
+    }
+    performOps(ops);
+
+    for (size_t ii = 0; ii < blocks.size(); ++ii) {
+        if (ops[ii].result < 0) {
+            return false;
+        }
+        if (size_t(ops[ii].result) < blocks[ii].data.size()) {
+            blocks[ii].data.resize(ops[ii].result);
+            blocks[ii].eof = true;
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(),
+              [](const File::Block& a, const File::Block& b) {
+                  return a.offset < b.offset;
+              });
+    file->prefetched = std::move(blocks);
+    return true;
+}
+
+int UringFileOps::flushWrites(File& file, bool sync) {
+    if (file.writes.empty() && !sync) {
+        return 0;
+    }
+
+    std::vector<IoOp> ops;
+    ops.reserve(file.writes.size() + 1);
+    for (auto& write : file.writes) {
+        ops.push_back({IoOp::Type::Write, file.fd, write.data.data(),
+                       write.data.size(), write.offset, 0});
+    }
+    if (sync) {
+        ops.push_back({IoOp::Type::Sync, file.fd, nullptr, 0, 0, 0});
+    }
+    performOps(ops);
+
+    // Failed writes aren't retried, as couchstore rewrites after an error.
+    file.writes.clear();
+    file.queuedBytes = 0;
+    for (const auto& op : ops) {
+        if (op.result < 0) {
+            return -op.result;
+        }
+    }
+    return 0;
+}
+
+void UringFileOps::registerFile(File& file) {
+    std::lock_guard<std::mutex> lh(openFilesMutex);
+    openFiles.emplace(file.path, &file);
+}
+
+void UringFileOps::unregisterFile(File& file) {
+    std::lock_guard<std::mutex> lh(openFilesMutex);
+    auto found = openFiles.equal_range(file.path);
+    for (auto it = found.first; it != found.second; ++it) {
+        if (it->second == &file) {
+            openFiles.erase(it);
+            return;
+        }
+    }
+}
+
+UringFileOps& getCouchstoreUringOps() {
+    static UringFileOps ops;
+    return ops;
+}
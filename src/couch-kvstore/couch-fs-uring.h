@@ -0,0 +1,124 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <libcouchstore/couch_db.h>
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * FileOpsInterface implementation for couchstore which submits groups of
+ * file operations together through io_uring, so a group costs one system
+ * call rather than one per operation:
+ *
+ * - pwrite() only queues the write (copying the data). Queued writes are
+ *   submitted together, followed by the fdatasync, when the file is synced;
+ *   or earlier if the queue grows large or an overlapping range is read. As
+ *   with a write to the page cache, an error writing may only be reported by
+ *   the next sync.
+ * - prefetch() reads a set of ranges of an open file in one submission,
+ *   after which pread()s falling within those ranges are served from memory.
+ *
+ * io_uring is used where liburing was available at build time and the kernel
+ * allows a ring to be set up (each thread has its own ring). Otherwise, or
+ * if the ring fails, operations fall back to the pread / pwrite / fdatasync
+ * system calls made by couchstore's default file ops. Single reads always
+ * use pread, as a ring gains nothing for one operation.
+ */
+class UringFileOps : public FileOpsInterface {
+public:
+    struct Range {
+        cs_off_t offset;
+        size_t size;
+    };
+
+    // Most bytes of queued writes per file before they are submitted.
+    static const size_t maxQueuedWriteBytes = 4 * 1024 * 1024;
+
+    // Most bytes read by one prefetch(); later ranges are read on demand.
+    static const size_t maxPrefetchBytes = 16 * 1024 * 1024;
+
+    /// @return true if liburing was available at build time.
+    static bool isUringBuilt();
+
+    /// @return true if the calling thread performs IO through io_uring.
+    static bool isUringAvailable();
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    /**
+     * Read the given ranges of the file at path, which must be open (through
+     * these ops) by the calling thread, submitting the reads together. Until
+     * the next prefetch(), a write to the file or its close, pread()s within
+     * a range are served from the data read.
+     *
+     * @return false if the calling thread doesn't have the file open or the
+     *         reads failed, in which case nothing is held.
+     */
+    bool prefetch(const std::string& path, const std::vector<Range>& ranges);
+
+private:
+    struct File;
+
+    /**
+     * Submit the file's queued writes, and then fdatasync the file if
+     * sync is true.
+     *
+     * @return zero on success, else the errno of the failure.
+     */
+    int flushWrites(File& file, bool sync);
+
+    void registerFile(File& file);
+
+    void unregisterFile(File& file);
+
+    // Files currently open, by path, for prefetch() to find.
+    std::mutex openFilesMutex;
+    std::unordered_multimap<std::string, File*> openFiles;
+};
+
+/**
+ * Returns the process-wide UringFileOps instance.
+ */
+UringFileOps& getCouchstoreUringOps();
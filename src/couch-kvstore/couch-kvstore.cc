@@ -44,7 +44,12 @@
 #include <platform/dirutils.h>
 
 #include "common.h"
+#include "couch-kvstore/couch-fetch-planner.h"
+#include "couch-kvstore/couch-fs-prefetch.h"
 #include "couch-kvstore/couch-kvstore.h"
+#ifdef __linux__
+#include "couch-kvstore/couch-fs-uring.h"
+#endif
 #define STATWRITER_NAMESPACE couchstore_engine
 #include "statwriter.h"
 #undef STATWRITER_NAMESPACE
@@ -70,6 +75,28 @@ extern "C" {
     }
 }
 
+extern "C" {
+    /**
+     * Appends a copy of the DocInfo to the std::vector<DocInfo*> ctx. Each
+     * copy is a single allocation, to be freed by couchstore_free_docinfo().
+     */
+    static int collectDocInfoC(Db *db, DocInfo *docinfo, void *ctx)
+    {
+        char* buffer = static_cast<char*>(cb_calloc(1, sizeof(DocInfo) +
+                                                    docinfo->id.size +
+                                                    docinfo->rev_meta.size));
+        DocInfo* copy = reinterpret_cast<DocInfo*>(buffer);
+        *copy = *docinfo;
+        copy->id.buf = buffer + sizeof(DocInfo);
+        std::memcpy(copy->id.buf, docinfo->id.buf, docinfo->id.size);
+        copy->rev_meta.buf = copy->id.buf + copy->id.size;
+        std::memcpy(copy->rev_meta.buf, docinfo->rev_meta.buf,
+                    docinfo->rev_meta.size);
+        static_cast<std::vector<DocInfo*>*>(ctx)->push_back(copy);
+        return 0;
+    }
+}
+
 static std::string getStrError(Db *db) {
     const size_t max_msg_len = 256;
     char msg[max_msg_len];
@@ -272,8 +299,22 @@ CouchRequest::CouchRequest(const Item& it,
     dbDocInfo.content_meta = getContentMeta(it);
 }
 
+/**
+ * Returns the file ops CouchKVStore performs IO through unless given others.
+ */
+static FileOpsInterface& getBaseFileOps(const KVStoreConfig& config) {
+#ifdef __linux__
+    // Without a ring the io_uring ops only add copying and delay write
+    // errors, so use the default ops.
+    if (config.getIoUring() && UringFileOps::isUringAvailable()) {
+        return getCouchstoreUringOps();
+    }
+#endif
+    return getCouchstorePrefetchOps();
+}
+
 CouchKVStore::CouchKVStore(KVStoreConfig &config, bool read_only)
-    : CouchKVStore(config, *couchstore_get_default_file_ops(), read_only) {
+    : CouchKVStore(config, getBaseFileOps(config), read_only) {
 
 }
 
@@ -284,7 +325,13 @@ CouchKVStore::CouchKVStore(KVStoreConfig &config, FileOpsInterface& ops,
       intransaction(false),
       scanCounter(0),
       logger(config.getLogger()),
-      base_ops(ops)
+      base_ops(ops),
+#ifdef __linux__
+      uringOps(dynamic_cast<UringFileOps*>(&ops)),
+#else
+      uringOps(nullptr),
+#endif
+      prefetchOps(dynamic_cast<PrefetchFileOps*>(&ops))
 {
     createDataDir(dbname);
     statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, base_ops);
@@ -303,6 +350,7 @@ CouchKVStore::CouchKVStore(KVStoreConfig &config, FileOpsInterface& ops,
     cachedFileSize.assign(numDbFiles, Couchbase::RelaxedAtomic<uint64_t>(0));
     cachedSpaceUsed.assign(numDbFiles, Couchbase::RelaxedAtomic<uint64_t>(0));
     cachedVBStates.assign(numDbFiles, nullptr);
+    dbHandleGenerations.assign(numDbFiles, 0);
 
     initialize();
 }
@@ -314,9 +362,12 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom)
       numDbFiles(copyFrom.numDbFiles),
       intransaction(false),
       logger(copyFrom.logger),
-      base_ops(copyFrom.base_ops)
+      base_ops(copyFrom.base_ops),
+      uringOps(copyFrom.uringOps),
+      prefetchOps(copyFrom.prefetchOps)
 {
     createDataDir(dbname);
+    dbHandleGenerations.assign(numDbFiles, 0);
     statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, base_ops);
     statCollectingFileOpsCompaction = getCouchstoreStatsOps(
         st.fsStatsCompaction, base_ops);
@@ -360,6 +411,10 @@ void CouchKVStore::initialize() {
 CouchKVStore::~CouchKVStore() {
     close();
 
+    for (auto& cached : dbHandleCache) {
+        closeDatabaseHandle(cached.db);
+    }
+
     for (std::vector<vbucket_state *>::iterator it = cachedVBStates.begin();
          it != cachedVBStates.end(); it++) {
         vbucket_state *vbstate = *it;
@@ -422,12 +477,11 @@ void CouchKVStore::set(const Item &itm, Callback<mutation_result> &cb) {
 
 void CouchKVStore::get(const DocKey& key, uint16_t vb,
                        Callback<GetValue> &cb, bool fetchDelete) {
-    Db *db = NULL;
+    CachedDb handle;
     GetValue rv;
     uint64_t fileRev = dbFileRevMap[vb];
 
-    couchstore_error_t errCode = openDB(vb, fileRev, &db,
-                                        COUCHSTORE_OPEN_FLAG_RDONLY);
+    couchstore_error_t errCode = openCachedDB(vb, fileRev, handle);
     if (errCode != COUCHSTORE_SUCCESS) {
         ++st.numGetFailure;
         logger.log(EXTENSION_LOG_WARNING,
@@ -438,8 +492,8 @@ void CouchKVStore::get(const DocKey& key, uint16_t vb,
         return;
     }
 
-    getWithHeader(db, key, vb, cb, fetchDelete);
-    closeDatabaseHandle(db);
+    getWithHeader(handle.db, key, vb, cb, fetchDelete);
+    releaseCachedDB(handle);
 }
 
 void CouchKVStore::getWithHeader(void *dbHandle, const DocKey& key,
@@ -504,9 +558,9 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
     int numItems = itms.size();
     uint64_t fileRev = dbFileRevMap[vb];
 
-    Db *db = NULL;
-    couchstore_error_t errCode = openDB(vb, fileRev, &db,
-                                        COUCHSTORE_OPEN_FLAG_RDONLY);
+    CachedDb handle;
+    couchstore_error_t errCode = openCachedDB(vb, fileRev, handle);
+    Db* db = handle.db;
     if (errCode != COUCHSTORE_SUCCESS) {
         logger.log(EXTENSION_LOG_WARNING,
                    "CouchKVStore::getMulti: openDB error:%s, "
@@ -537,10 +591,13 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
         ++idx;
     }
 
-    GetMultiCbCtx ctx(*this, vb, itms);
-
-    errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
-                                        0, getMultiCbC, &ctx);
+    if (itms.size() > 1) {
+        errCode = getMultiPlanned(db, vb, fileRev, ids, itms);
+    } else {
+        GetMultiCbCtx ctx(*this, vb, itms);
+        errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
+                                            0, getMultiCbC, &ctx);
+    }
     if (errCode != COUCHSTORE_SUCCESS) {
         st.numGetFailure += numItems;
         logger.log(EXTENSION_LOG_WARNING, "CouchKVStore::getMulti: "
@@ -552,8 +609,9 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
                 fetch->value.setStatus(couchErr2EngineErr(errCode));
             }
         }
+        handle.cacheable = false;
     }
-    closeDatabaseHandle(db);
+    releaseCachedDB(handle);
     delete []ids;
 }
 
@@ -748,6 +806,15 @@ static int edit_docinfo_hook(DocInfo **info, const sized_buf *item) {
     return 1;
 }
 
+static void notify_purged_key(compaction_ctx* ctx, const DocInfo* info) {
+    if (ctx->purgedKeyCallback) {
+        // Collections: TODO: Permanently restore to stored namespace
+        DocKey key = makeDocKey(
+                info->id, ctx->config->shouldPersistDocNamespace());
+        ctx->purgedKeyCallback->callback(ctx->db_file_id, key);
+    }
+}
+
 static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
     compaction_ctx* ctx = (compaction_ctx*) ctx_p;
     DbInfo infoDb;
@@ -777,6 +844,7 @@ static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
                     if (max_purge_seq < info->db_seq) {
                         ctx->max_purged_seq[vbid] = info->db_seq; // track max_purged_seq
                     }
+                    notify_purged_key(ctx, info);
                     return COUCHSTORE_COMPACT_DROP_ITEM;      // ...unconditionally
                 }
                 if (exptime < ctx->purge_before_ts &&
@@ -785,6 +853,7 @@ static int time_purge_hook(Db* d, DocInfo* info, void* ctx_p) {
                     if (max_purge_seq < info->db_seq) {
                         ctx->max_purged_seq[vbid] = info->db_seq;
                     }
+                    notify_purged_key(ctx, info);
                     return COUCHSTORE_COMPACT_DROP_ITEM;
                 }
             }
@@ -1351,6 +1420,7 @@ void CouchKVStore::updateDbFileMap(uint16_t vbucketId, uint64_t newFileRev) {
     }
 
     dbFileRevMap[vbucketId] = newFileRev;
+    invalidateCachedDBs(vbucketId);
 }
 
 couchstore_error_t CouchKVStore::openDB(uint16_t vbucketId,
@@ -1484,6 +1554,112 @@ couchstore_error_t CouchKVStore::openDB_retry(std::string &dbfile,
     return errCode;
 }
 
+couchstore_error_t CouchKVStore::openCachedDB(uint16_t vbucketId,
+                                              uint64_t fileRev,
+                                              CachedDb& handle) {
+    handle = {vbucketId, fileRev, std::this_thread::get_id(), nullptr, false,
+              0, 0, 0};
+    if (configuration.getDbHandleCacheSize() == 0) {
+        return openDB(vbucketId, fileRev, &handle.db,
+                      COUCHSTORE_OPEN_FLAG_RDONLY);
+    }
+
+    // Stat the file before opening it, so that a commit made in between can
+    // only make the handle look stale, never fresh.
+    std::string dbFileName = getDBFileName(dbname, vbucketId, fileRev);
+    struct stat fileStat;
+    if (stat(dbFileName.c_str(), &fileStat) == 0) {
+        handle.cacheable = true;
+        handle.fileSize = fileStat.st_size;
+        handle.fileInode = fileStat.st_ino;
+    }
+
+    Db* stale = nullptr;
+    {
+        LockHolder lh(dbHandleCacheMutex);
+        handle.generation = dbHandleGenerations[vbucketId];
+        for (auto it = dbHandleCache.begin(); it != dbHandleCache.end(); ++it) {
+            if (it->vbucketId == vbucketId && it->owner == handle.owner) {
+                if (handle.cacheable && it->fileRev == fileRev &&
+                    it->fileSize == handle.fileSize &&
+                    it->fileInode == handle.fileInode) {
+                    handle.db = it->db;
+                } else {
+                    stale = it->db;
+                }
+                dbHandleCache.erase(it);
+                break;
+            }
+        }
+    }
+
+    if (handle.db) {
+        ++st.numDbHandleCacheHits;
+        return COUCHSTORE_SUCCESS;
+    }
+    if (stale) {
+        closeDatabaseHandle(stale);
+    }
+
+    ++st.numDbHandleCacheMisses;
+    uint64_t newFileRev = fileRev;
+    couchstore_error_t errCode = openDB(vbucketId, fileRev, &handle.db,
+                                        COUCHSTORE_OPEN_FLAG_RDONLY,
+                                        &newFileRev);
+    if (newFileRev != fileRev) {
+        // A later revision of the file was opened than the one stat'd.
+        handle.cacheable = false;
+    }
+    return errCode;
+}
+
+void CouchKVStore::releaseCachedDB(CachedDb& handle) {
+    const size_t cacheSize = configuration.getDbHandleCacheSize();
+    if (cacheSize == 0 || !handle.cacheable) {
+        closeDatabaseHandle(handle.db);
+        handle.db = nullptr;
+        return;
+    }
+
+    std::vector<Db*> evicted;
+    {
+        LockHolder lh(dbHandleCacheMutex);
+        if (handle.generation != dbHandleGenerations[handle.vbucketId]) {
+            // The file was replaced while the handle was in use.
+            evicted.push_back(handle.db);
+        } else {
+            dbHandleCache.push_front(handle);
+        }
+        while (dbHandleCache.size() > cacheSize) {
+            evicted.push_back(dbHandleCache.back().db);
+            dbHandleCache.pop_back();
+        }
+    }
+    for (Db* db : evicted) {
+        closeDatabaseHandle(db);
+    }
+    handle.db = nullptr;
+}
+
+void CouchKVStore::invalidateCachedDBs(uint16_t vbucketId) {
+    std::vector<Db*> invalidated;
+    {
+        LockHolder lh(dbHandleCacheMutex);
+        ++dbHandleGenerations[vbucketId];
+        for (auto it = dbHandleCache.begin(); it != dbHandleCache.end();) {
+            if (it->vbucketId == vbucketId) {
+                invalidated.push_back(it->db);
+                it = dbHandleCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (Db* db : invalidated) {
+        closeDatabaseHandle(db);
+    }
+}
+
 void CouchKVStore::populateFileNameMap(std::vector<std::string> &filenames,
                                        std::vector<uint16_t> *vbids) {
     std::vector<std::string>::iterator fileItr;
@@ -1780,15 +1956,10 @@ bool CouchKVStore::commit2couchstore() {
         return success;
     }
 
-    Doc **docs = new Doc *[pendingCommitCnt];
-    DocInfo **docinfos = new DocInfo *[pendingCommitCnt];
-
-    if (pendingReqsQ[0] == nullptr) {
-        throw std::logic_error("CouchKVStore::commit2couchstore: "
-                        "pendingReqsQ[0] is NULL");
-    }
-    uint16_t vbucket2flush = pendingReqsQ[0]->getVBucketId();
-    uint64_t fileRev = pendingReqsQ[0]->getRevNum();
+    // The requests of a vbucket are queued together; with group commit the
+    // queue may hold several vbuckets' requests, whose files are saved and
+    // committed in turn.
+    std::vector<CouchRequest *> reqs;
     for (size_t i = 0; i < pendingCommitCnt; ++i) {
         CouchRequest *req = pendingReqsQ[i];
         if (req == nullptr) {
@@ -1796,39 +1967,51 @@ bool CouchKVStore::commit2couchstore() {
                                        "pendingReqsQ["
                                        + std::to_string(i) + "] is NULL");
         }
-        docs[i] = (Doc *)req->getDbDoc();
-        docinfos[i] = req->getDbDocInfo();
-        if (vbucket2flush != req->getVBucketId()) {
-            throw std::logic_error(
-                    "CouchKVStore::commit2couchstore: "
-                    "mismatch between vbucket2flush (which is "
-                    + std::to_string(vbucket2flush) + ") and pendingReqsQ["
-                    + std::to_string(i) + "] (which is "
-                    + std::to_string(req->getVBucketId()) + ")");
+        if (!reqs.empty() &&
+            reqs.front()->getVBucketId() != req->getVBucketId()) {
+            success = commitVBucket(reqs) && success;
+            reqs.clear();
         }
+        reqs.push_back(req);
+    }
+    success = commitVBucket(reqs) && success;
+
+    // clean up
+    for (size_t i = 0; i < pendingCommitCnt; ++i) {
+        delete pendingReqsQ[i];
+    }
+    pendingReqsQ.clear();
+    return success;
+}
+
+bool CouchKVStore::commitVBucket(std::vector<CouchRequest *> &reqs) {
+    bool success = true;
+    size_t reqCnt = reqs.size();
+    Doc **docs = new Doc *[reqCnt];
+    DocInfo **docinfos = new DocInfo *[reqCnt];
+
+    uint16_t vbucket2flush = reqs[0]->getVBucketId();
+    uint64_t fileRev = reqs[0]->getRevNum();
+    for (size_t i = 0; i < reqCnt; ++i) {
+        docs[i] = (Doc *)reqs[i]->getDbDoc();
+        docinfos[i] = reqs[i]->getDbDocInfo();
     }
 
     kvstats_ctx kvctx(configuration);
     kvctx.vbucket = vbucket2flush;
     // flush all
     couchstore_error_t errCode = saveDocs(vbucket2flush, fileRev, docs,
-                                          docinfos, pendingCommitCnt,
-                                          kvctx);
+                                          docinfos, reqCnt, kvctx);
     if (errCode) {
         success = false;
         logger.log(EXTENSION_LOG_WARNING,
-                   "CouchKVStore::commit2couchstore: saveDocs error:%s, "
+                   "CouchKVStore::commitVBucket: saveDocs error:%s, "
                    "vb:%" PRIu16 ", rev:%" PRIu64, couchstore_strerror(errCode),
                    vbucket2flush, fileRev);
     }
 
-    commitCallback(pendingReqsQ, kvctx, errCode);
+    commitCallback(reqs, kvctx, errCode);
 
-    // clean up
-    for (size_t i = 0; i < pendingCommitCnt; ++i) {
-        delete pendingReqsQ[i];
-    }
-    pendingReqsQ.clear();
     delete [] docs;
     delete [] docinfos;
     return success;
@@ -2239,6 +2422,67 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx) {
     return 0;
 }
 
+couchstore_error_t CouchKVStore::getMultiPlanned(Db* db, uint16_t vb,
+                                                 uint64_t fileRev,
+                                                 sized_buf* ids,
+                                                 vb_bgfetch_queue_t& itms) {
+    std::vector<DocInfo*> docinfos;
+    couchstore_error_t errCode = couchstore_docinfos_by_id(
+            db, ids, itms.size(), 0, collectDocInfoC, &docinfos);
+
+    if (errCode == COUCHSTORE_SUCCESS) {
+        FetchPlanner::sortByOffset(docinfos);
+
+        const auto path = getDBFileName(dbname, vb, fileRev);
+        if (uringOps || prefetchOps) {
+            std::vector<FetchPlanner::Range> bodies;
+            for (const DocInfo* docinfo : docinfos) {
+                auto it = itms.find(makeDocKey(
+                        docinfo->id,
+                        configuration.shouldPersistDocNamespace()));
+                if (it != itms.end() && !it->second.isMetaOnly &&
+                    docinfo->size != 0) {
+                    bodies.push_back(FetchPlanner::bodyBlocks(*docinfo));
+                }
+            }
+
+            const auto reads = FetchPlanner().coalesce(bodies);
+#ifdef __linux__
+            if (uringOps) {
+                std::vector<UringFileOps::Range> uringReads;
+                for (const auto& read : reads) {
+                    uringReads.push_back({read.offset, read.size});
+                }
+                uringOps->prefetch(path, uringReads);
+            }
+#endif
+            if (prefetchOps) {
+                prefetchOps->prefetch(path, reads);
+            }
+        }
+
+        GetMultiCbCtx ctx(*this, vb, itms);
+        for (DocInfo* docinfo : docinfos) {
+            getMultiCb(db, docinfo, &ctx);
+        }
+
+        // Don't hold on to the data read while the handle's cached.
+#ifdef __linux__
+        if (uringOps) {
+            uringOps->prefetch(path, {});
+        }
+#endif
+        if (prefetchOps) {
+            prefetchOps->prefetch(path, {});
+        }
+    }
+
+    for (DocInfo* docinfo : docinfos) {
+        couchstore_free_docinfo(docinfo);
+    }
+    return errCode;
+}
+
 
 void CouchKVStore::closeDatabaseHandle(Db *db) {
     couchstore_error_t ret = couchstore_close_file(db);
@@ -22,9 +22,12 @@
 #include "libcouchstore/couch_db.h"
 #include <relaxed_atomic.h>
 
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "configuration.h"
@@ -41,6 +44,8 @@
 #define COUCHSTORE_NO_OPTIONS 0
 
 class EventuallyPersistentEngine;
+class PrefetchFileOps;
+class UringFileOps;
 
 /**
  * Class representing a document to be persisted in couchstore.
@@ -317,6 +322,12 @@ public:
      */
     bool compactDB(compaction_ctx *ctx) override;
 
+    /**
+     * Close all the cached handles of the given vbucket, and stop handles
+     * opened before now from being cached.
+     */
+    void invalidateCachedDBs(uint16_t vbucketId) override;
+
     /**
      * Return the database file id from the compaction request
      * @param compact_req request structure for compaction
@@ -389,6 +400,16 @@ public:
     static int recordDbDump(Db *db, DocInfo *docinfo, void *ctx);
     static int recordDbStat(Db *db, DocInfo *docinfo, void *ctx);
     static int getMultiCb(Db *db, DocInfo *docinfo, void *ctx);
+
+    /**
+     * getMulti() for a batch of several documents: looks up all the
+     * DocInfos first, then reads the documents in file offset order. The
+     * blocks holding the bodies are first read with as few reads as
+     * FetchPlanner can coalesce them into, through uringOps or prefetchOps.
+     */
+    couchstore_error_t getMultiPlanned(Db* db, uint16_t vb,
+                                       uint64_t fileRev, sized_buf* ids,
+                                       vb_bgfetch_queue_t& itms);
     ENGINE_ERROR_CODE readVBState(Db *db, uint16_t vbId);
 
     couchstore_error_t fetchDoc(Db *db, DocInfo *docinfo,
@@ -434,6 +455,12 @@ protected:
     void close();
     bool commit2couchstore();
 
+    /**
+     * Save the given requests, all for the same vbucket, to the vbucket's
+     * file and commit it.
+     */
+    bool commitVBucket(std::vector<CouchRequest *> &reqs);
+
     uint64_t checkNewRevNum(std::string &dbname, bool newFile = false);
     void populateFileNameMap(std::vector<std::string> &filenames,
                              std::vector<uint16_t> *vbids);
@@ -445,6 +472,39 @@ protected:
     couchstore_error_t openDB_retry(std::string &dbfile, uint64_t options,
                                     FileOpsInterface *ops,
                                     Db **db, uint64_t *newFileRev);
+
+    /**
+     * A read-only handle on a vbucket's file, as kept for reuse by gets.
+     * Handles are only reused by the thread which opened them (so
+     * per-thread file ops state, such as UringFileOps prefetches, stays
+     * with its thread), and only while the file's size and inode are
+     * unchanged since the handle was opened: a handle doesn't see later
+     * commits, and compaction replaces the file.
+     */
+    struct CachedDb {
+        uint16_t vbucketId;
+        uint64_t fileRev;
+        std::thread::id owner;
+        Db* db;
+        bool cacheable;
+        uint64_t fileSize;
+        uint64_t fileInode;
+        uint64_t generation;
+    };
+
+    /**
+     * Open the given vbucket's file read-only for a get, reusing a cached
+     * handle where possible.
+     */
+    couchstore_error_t openCachedDB(uint16_t vbucketId, uint64_t fileRev,
+                                    CachedDb& handle);
+
+    /**
+     * Finish with a handle from openCachedDB(): cache it for reuse, or close
+     * it if handles aren't cached.
+     */
+    void releaseCachedDB(CachedDb& handle);
+
     couchstore_error_t saveDocs(uint16_t vbid, uint64_t rev, Doc **docs,
                                 DocInfo **docinfos, size_t docCount,
                                 kvstats_ctx &kvctx);
@@ -519,6 +579,22 @@ protected:
      */
     FileOpsInterface& base_ops;
 
+    /**
+     * base_ops if they're the io_uring based ops, else nullptr
+     */
+    UringFileOps* uringOps;
+
+    /**
+     * base_ops if they're the default, prefetching ops, else nullptr
+     */
+    PrefetchFileOps* prefetchOps;
+
+    //! Read-only handles kept for reuse by gets, most recently used first.
+    std::list<CachedDb> dbHandleCache;
+    //! Per vbucket, the number of invalidateCachedDBs() calls so far.
+    std::vector<uint64_t> dbHandleGenerations;
+    std::mutex dbHandleCacheMutex;
+
 private:
     class DbHolder {
     public:
@@ -141,11 +141,19 @@ BackfillManager::~BackfillManager() {
 
 
 void BackfillManager::schedule(stream_t stream, uint64_t start, uint64_t end) {
+    // Ephemeral buckets have nothing on disk; backfill from memory.
+    DCPBackfill* backfill;
+    if (engine->getConfiguration().getBucketType() == "ephemeral") {
+        backfill = new DCPBackfillMemory(engine, stream, start, end);
+    } else {
+        backfill = new DCPBackfill(engine, stream, start, end);
+    }
+
     LockHolder lh(lock);
     if (engine->getDcpConnMap().canAddBackfillToActiveQ()) {
-        activeBackfills.push_back(new DCPBackfill(engine, stream, start, end));
+        activeBackfills.push_back(backfill);
     } else {
-        pendingBackfills.push_back(new DCPBackfill(engine, stream, start, end));
+        pendingBackfills.push_back(backfill);
     }
 
     if (managerTask && !managerTask->isdead()) {
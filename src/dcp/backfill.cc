@@ -18,9 +18,15 @@
 #include "config.h"
 
 #include "ep_engine.h"
+#include "ephemeral_vb.h"
 #include "dcp/backfill.h"
+#include "dcp/dcpconnmap.h"
 #include "dcp/stream.h"
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+
 static std::string backfillStateToString(backfill_state_t state) {
     switch (state) {
         case backfill_state_init:
@@ -84,6 +90,144 @@ void CacheCallback::callback(CacheLookup &lookup) {
     }
 }
 
+/**
+ * Checks whether a vbucket's HashTable holds every item from startSeqno
+ * onwards, and reads the high seqno a resident snapshot would end at. Run
+ * with HashTable::visitAtomically(), so no new seqno can be assigned while
+ * the check is made; no items are visited.
+ */
+class ResidentBoundsVisitor : public HashTableVisitor {
+public:
+    ResidentBoundsVisitor(VBucket& vb,
+                          item_eviction_policy_t policy,
+                          uint64_t startSeqno)
+        : vb(vb),
+          policy(policy),
+          startSeqno(startSeqno),
+          endSeqno(0),
+          complete(false) {
+    }
+
+    void visit(StoredValue* v) override {
+    }
+
+    bool shouldContinue() override {
+        endSeqno = vb.getHighSeqno();
+        const bool unpersisted = startSeqno > vb.getPersistenceSeqno();
+        const bool fullyResident =
+                startSeqno <= 1 && vb.getNumNonResidentItems(policy) == 0;
+        complete = unpersisted || fullyResident;
+        return false;
+    }
+
+    bool isComplete() const {
+        return complete;
+    }
+
+    uint64_t getEndSeqno() const {
+        return endSeqno;
+    }
+
+private:
+    VBucket& vb;
+    const item_eviction_policy_t policy;
+    const uint64_t startSeqno;
+    uint64_t endSeqno;
+    bool complete;
+};
+
+/**
+ * Copies the items with the lowest seqnos in [from, to] out of a vbucket's
+ * HashTable, up to an item and byte limit. Run with
+ * HashTable::pauseResumeVisit(), so only one lock is held at a time.
+ */
+class ResidentChunkVisitor : public PauseResumeHashTableVisitor {
+public:
+    ResidentChunkVisitor(uint16_t vbid,
+                         uint64_t from,
+                         uint64_t to,
+                         size_t maxItems,
+                         size_t maxBytes)
+        : vbid(vbid),
+          from(from),
+          to(to),
+          maxItems(std::max(maxItems, size_t(1))),
+          maxBytes(maxBytes),
+          bytes(0),
+          inRange(0),
+          truncated(false),
+          complete(true) {
+    }
+
+    bool visit(StoredValue& v) override {
+        const int64_t seqno = v.getBySeqno();
+        if (v.isTempItem() || seqno < 0 ||
+            static_cast<uint64_t>(seqno) < from ||
+            static_cast<uint64_t>(seqno) > to) {
+            return true;
+        }
+        ++inRange;
+        if (!v.isResident() && !v.isDeleted()) {
+            complete = false;
+            return true;
+        }
+        if (isFull() && seqno > items.rbegin()->first) {
+            truncated = true;
+            return true;
+        }
+
+        std::unique_ptr<Item> item(v.toItem(false, vbid));
+        bytes += item->size();
+        items.emplace(seqno, std::move(item));
+        while (items.size() > 1 && isOverLimit()) {
+            auto last = std::prev(items.end());
+            bytes -= last->second->size();
+            items.erase(last);
+            truncated = true;
+        }
+        return true;
+    }
+
+    /// False if an item in the range was not resident.
+    bool isComplete() const {
+        return complete;
+    }
+
+    /// True if items in the range above the last one copied were skipped.
+    bool isTruncated() const {
+        return truncated;
+    }
+
+    /// Number of items seen in [from, to], copied or not.
+    size_t getNumInRange() const {
+        return inRange;
+    }
+
+    std::map<int64_t, std::unique_ptr<Item>>& getItems() {
+        return items;
+    }
+
+private:
+    bool isOverLimit() const {
+        return items.size() > maxItems || bytes > maxBytes;
+    }
+
+    bool isFull() const {
+        return items.size() >= maxItems || bytes >= maxBytes;
+    }
+
+    const uint16_t vbid;
+    const uint64_t from;
+    const uint64_t to;
+    const size_t maxItems;
+    const size_t maxBytes;
+    size_t bytes;
+    size_t inRange;
+    bool truncated;
+    bool complete;
+    std::map<int64_t, std::unique_ptr<Item>> items;
+};
+
 DiskCallback::DiskCallback(stream_t &s)
     : stream_(s) {
     if (stream_.get() == nullptr) {
@@ -112,7 +256,8 @@ void DiskCallback::callback(GetValue &val) {
 DCPBackfill::DCPBackfill(EventuallyPersistentEngine* e, stream_t s,
                          uint64_t start_seqno, uint64_t end_seqno)
     : engine(e), stream(s),startSeqno(start_seqno), endSeqno(end_seqno),
-      scanCtx(NULL), state(backfill_state_init) {
+      scanCtx(NULL), state(backfill_state_init), fromMemory(false),
+      residentPin(0), residentReadPos(0), residentEndSeqno(0) {
     if (stream->getType() != STREAM_ACTIVE) {
         throw std::invalid_argument("DCPBackfill(): stream->getType() "
                 "(which is " + std::to_string(stream->getType()) +
@@ -120,6 +265,10 @@ DCPBackfill::DCPBackfill(EventuallyPersistentEngine* e, stream_t s,
     }
 }
 
+DCPBackfill::~DCPBackfill() {
+    releaseResidentVBucket();
+}
+
 backfill_status_t DCPBackfill::run() {
     LockHolder lh(lock);
     switch (state) {
@@ -155,6 +304,11 @@ void DCPBackfill::cancel() {
 backfill_status_t DCPBackfill::create() {
     uint16_t vbid = stream->getVBucket();
 
+    if (engine->getConfiguration().isDcpBackfillInMemory() &&
+        createFromMemory()) {
+        return backfill_success;
+    }
+
     uint64_t lastPersistedSeqno =
         engine->getKVBucket()->getLastPersistedSeqno(vbid);
 
@@ -181,6 +335,7 @@ backfill_status_t DCPBackfill::create() {
     if (scanCtx) {
         as->incrBackfillRemaining(scanCtx->documentCount);
         as->markDiskSnapshot(startSeqno, scanCtx->maxSeqno);
+        engine->getDcpConnMap().incrNumBackfills(BACKFILL_FROM_DISK);
         transitionState(backfill_state_scanning);
     } else {
         transitionState(backfill_state_done);
@@ -196,6 +351,10 @@ backfill_status_t DCPBackfill::scan() {
         return complete(true);
     }
 
+    if (fromMemory) {
+        return scanMemory();
+    }
+
     KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
     scan_error_t error = kvstore->scan(scanCtx);
 
@@ -210,8 +369,13 @@ backfill_status_t DCPBackfill::scan() {
 
 backfill_status_t DCPBackfill::complete(bool cancelled) {
     uint16_t vbid = stream->getVBucket();
-    KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
-    kvstore->destroyScanContext(scanCtx);
+    if (fromMemory) {
+        residentItems.clear();
+        releaseResidentVBucket();
+    } else {
+        KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
+        kvstore->destroyScanContext(scanCtx);
+    }
 
     ActiveStream* as = static_cast<ActiveStream*>(stream.get());
     as->completeBackfill();
@@ -219,8 +383,9 @@ backfill_status_t DCPBackfill::complete(bool cancelled) {
     EXTENSION_LOG_LEVEL severity = cancelled ? EXTENSION_LOG_NOTICE
                                              : EXTENSION_LOG_INFO;
     as->getLogger().log(severity,
-        "(vb %d) Backfill task (%" PRIu64 " to %" PRIu64 ") %s",
-        vbid, startSeqno, endSeqno,
+        "(vb %d) %s task (%" PRIu64 " to %" PRIu64 ") %s",
+        vbid, fromMemory ? "Resident backfill" : "Backfill",
+        startSeqno, endSeqno,
         cancelled ? "cancelled" : "finished");
 
     transitionState(backfill_state_done);
@@ -228,6 +393,119 @@ backfill_status_t DCPBackfill::complete(bool cancelled) {
     return backfill_success;
 }
 
+bool DCPBackfill::createFromMemory() {
+    uint16_t vbid = stream->getVBucket();
+    RCPtr<VBucket> vb = engine->getVBucket(vbid);
+    if (!vb) {
+        return false;
+    }
+
+    // Pin before checking the bounds, so nothing found resident can be
+    // ejected (or, if deleted, removed once persisted) before it's copied.
+    residentPin = vb->pinForResidentBackfill(startSeqno);
+    residentVb = vb;
+
+    ResidentBoundsVisitor bounds(
+            *vb, engine->getKVBucket()->getItemEvictionPolicy(), startSeqno);
+    vb->ht.visitAtomically(bounds);
+    if (!bounds.isComplete()) {
+        releaseResidentVBucket();
+        return false;
+    }
+
+    residentReadPos = startSeqno;
+    residentEndSeqno = bounds.getEndSeqno();
+    size_t numInRange = 0;
+    if (!readResidentChunk(numInRange) || residentItems.empty()) {
+        residentItems.clear();
+        releaseResidentVBucket();
+        return false;
+    }
+    fromMemory = true;
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    as->getLogger().log(EXTENSION_LOG_INFO, "(vb %d) Backfilling %" PRIu64
+        " resident items from memory", vbid,
+        static_cast<uint64_t>(numInRange));
+    as->incrBackfillRemaining(numInRange);
+    as->markDiskSnapshot(startSeqno, residentEndSeqno);
+    engine->getDcpConnMap().incrNumBackfills(BACKFILL_FROM_MEMORY);
+    transitionState(backfill_state_scanning);
+
+    return true;
+}
+
+bool DCPBackfill::readResidentChunk(size_t& numInRange) {
+    const Configuration& config = engine->getConfiguration();
+    ResidentChunkVisitor visitor(stream->getVBucket(),
+                                 residentReadPos,
+                                 residentEndSeqno,
+                                 config.getDcpScanItemLimit(),
+                                 config.getDcpScanByteLimit());
+    HashTable::Position start;
+    if (residentVb->ht.pauseResumeVisit(visitor, start) !=
+                residentVb->ht.endPosition() ||
+        !visitor.isComplete()) {
+        return false;
+    }
+
+    auto& items = visitor.getItems();
+    if (visitor.isTruncated()) {
+        residentReadPos = items.rbegin()->first + 1;
+    } else {
+        residentReadPos = residentEndSeqno + 1;
+    }
+    // What has been copied no longer needs to stay resident.
+    residentVb->updateResidentBackfillPin(residentPin, residentReadPos,
+                                          residentEndSeqno);
+    for (auto& item : items) {
+        residentItems.push_back(std::move(item.second));
+    }
+    numInRange = visitor.getNumInRange();
+    return true;
+}
+
+void DCPBackfill::releaseResidentVBucket() {
+    if (residentVb) {
+        residentVb->unpinForResidentBackfill(residentPin);
+        residentVb.reset();
+    }
+}
+
+backfill_status_t DCPBackfill::scanMemory() {
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    if (residentItems.empty() && residentReadPos <= residentEndSeqno) {
+        size_t numInRange = 0;
+        if (!readResidentChunk(numInRange)) {
+            // Only possible if the HashTable was cleared under us; what was
+            // sent can't be completed as a snapshot, so end the stream.
+            as->getLogger().log(EXTENSION_LOG_WARNING,
+                "(vb %d) Resident backfill could not read from seqno %"
+                PRIu64 "; ending stream", stream->getVBucket(),
+                residentReadPos);
+            as->setDead(END_STREAM_STATE);
+            return complete(true);
+        }
+    }
+
+    while (!residentItems.empty()) {
+        // backfillReceived() takes ownership of the item even when it is
+        // refused, so hand over a copy (sharing the value) and keep ours
+        // to retry once the stream has buffer space again.
+        if (!as->backfillReceived(new Item(*residentItems.front()),
+                                  BACKFILL_FROM_MEMORY)) {
+            return backfill_success;
+        }
+        residentItems.pop_front();
+    }
+
+    if (residentReadPos > residentEndSeqno) {
+        transitionState(backfill_state_completing);
+    }
+
+    return backfill_success;
+}
+
 void DCPBackfill::transitionState(backfill_state_t newState) {
     if (state == newState) {
         return;
@@ -266,3 +544,89 @@ void DCPBackfill::transitionState(backfill_state_t newState) {
 
     state = newState;
 }
+
+DCPBackfillMemory::DCPBackfillMemory(EventuallyPersistentEngine* e,
+                                     stream_t s,
+                                     uint64_t start_seqno,
+                                     uint64_t end_seqno)
+    : DCPBackfill(e, s, start_seqno, end_seqno), readId(0) {
+}
+
+DCPBackfillMemory::~DCPBackfillMemory() {
+    // Don't leave the vbucket holding stale items for us if we were
+    // destroyed without completing.
+    if (vb) {
+        static_cast<EphemeralVBucket&>(*vb).endRangeRead(readId);
+    }
+}
+
+backfill_status_t DCPBackfillMemory::create() {
+    uint16_t vbid = stream->getVBucket();
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+
+    RCPtr<VBucket> vbucket = engine->getVBucket(vbid);
+    if (!vbucket) {
+        as->getLogger().log(EXTENSION_LOG_WARNING, "(vb %d) Memory backfill "
+            "not started as the vbucket no longer exists", vbid);
+        return complete(true);
+    }
+
+    auto& ephVb = static_cast<EphemeralVBucket&>(*vbucket);
+    readId = ephVb.beginRangeRead(startSeqno, endSeqno);
+    vb = vbucket;
+
+    as->incrBackfillRemaining(std::min<uint64_t>(endSeqno - startSeqno + 1,
+                                                 ephVb.getSeqListNumItems()));
+    as->markDiskSnapshot(startSeqno, endSeqno);
+    engine->getDcpConnMap().incrNumBackfills(BACKFILL_FROM_MEMORY);
+    transitionState(backfill_state_scanning);
+
+    return backfill_success;
+}
+
+backfill_status_t DCPBackfillMemory::scan() {
+    if (!(stream->isActive())) {
+        return complete(true);
+    }
+
+    auto& ephVb = static_cast<EphemeralVBucket&>(*vb);
+    auto items = ephVb.rangeRead(readId, scanChunkSize);
+    if (items.empty()) {
+        transitionState(backfill_state_completing);
+        return backfill_success;
+    }
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    for (auto& item : items) {
+        const int64_t seqno = item->getBySeqno();
+        if (!as->backfillReceived(item.release(), BACKFILL_FROM_MEMORY)) {
+            // Out of buffer space; resume from this item next time.
+            return backfill_success;
+        }
+        ephVb.advanceRangeRead(readId, seqno);
+    }
+
+    return backfill_success;
+}
+
+backfill_status_t DCPBackfillMemory::complete(bool cancelled) {
+    uint16_t vbid = stream->getVBucket();
+    if (vb) {
+        static_cast<EphemeralVBucket&>(*vb).endRangeRead(readId);
+        vb.reset();
+    }
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    as->completeBackfill();
+
+    EXTENSION_LOG_LEVEL severity = cancelled ? EXTENSION_LOG_NOTICE
+                                             : EXTENSION_LOG_INFO;
+    as->getLogger().log(severity,
+        "(vb %d) Memory backfill task (%" PRIu64 " to %" PRIu64 ") %s",
+        vbid, startSeqno, endSeqno,
+        cancelled ? "cancelled" : "finished");
+
+    transitionState(backfill_state_done);
+
+    return backfill_success;
+}
@@ -22,6 +22,10 @@
 
 #include "callbacks.h"
 #include "dcp/stream.h"
+#include "seqlist.h"
+
+#include <deque>
+#include <memory>
 
 class EventuallyPersistentEngine;
 class ScanContext;
@@ -60,11 +64,25 @@ private:
     stream_t stream_;
 };
 
+/**
+ * Backfills a DCP stream from disk.
+ *
+ * If dcp_backfill_in_memory is enabled and every item the backfill needs is
+ * resident, the snapshot is instead copied out of the HashTable in chunks
+ * (see createFromMemory()); the stream's checkpoint cursor picks up from
+ * the end of that snapshot exactly as it would after a disk snapshot.
+ *
+ * A backfill moves through the states init -> scanning -> completing ->
+ * done; subclasses provide the create(), scan() and complete() steps to
+ * backfill from elsewhere (see DCPBackfillMemory).
+ */
 class DCPBackfill {
 public:
     DCPBackfill(EventuallyPersistentEngine* e, stream_t s,
                 uint64_t start_seqno, uint64_t end_seqno);
 
+    virtual ~DCPBackfill();
+
     backfill_status_t run();
 
     uint16_t getVBucketId();
@@ -77,16 +95,56 @@ public:
 
     void cancel();
 
-private:
+protected:
 
-    backfill_status_t create();
+    virtual backfill_status_t create();
 
-    backfill_status_t scan();
+    virtual backfill_status_t scan();
 
-    backfill_status_t complete(bool cancelled);
+    virtual backfill_status_t complete(bool cancelled);
 
     void transitionState(backfill_state_t newState);
 
+    /**
+     * Try to build the backfill snapshot from the vbucket's HashTable.
+     *
+     * This is only possible when the HashTable holds every item in the
+     * range: either nothing from startSeqno onwards has been persisted yet
+     * (so nothing in the range can have been ejected or, for deletes,
+     * removed), or the stream starts from scratch and the vbucket is fully
+     * resident. In the latter case deletes which have already been
+     * persisted (and so removed from memory) are not sent; a consumer
+     * starting from scratch has nothing for them to delete.
+     *
+     * The snapshot ends at the high seqno when the check is made. The
+     * snapshot is read a chunk at a time: each chunk is one pass over the
+     * HashTable a lock at a time, copying the lowest seqnos not yet read
+     * up to dcp_scan_item_limit items or dcp_scan_byte_limit bytes. Only
+     * the seqnos not yet read are pinned (see
+     * VBucket::pinForResidentBackfill()), so the pager can eject the rest
+     * while a slow stream drains. Items updated since the snapshot began
+     * are skipped; the checkpoint cursor sends their new versions.
+     *
+     * @return true if the first chunk was read and the backfill is now
+     *         scanning, false if the backfill must read from disk.
+     */
+    bool createFromMemory();
+
+    /**
+     * Read the next chunk of the resident snapshot into residentItems.
+     *
+     * @param numInRange set to the number of items left in the snapshot
+     * @return false if an item in the snapshot wasn't resident or the
+     *         HashTable couldn't be visited in full.
+     */
+    bool readResidentChunk(size_t& numInRange);
+
+    /// Unpin the vbucket pinned by createFromMemory(), if any.
+    void releaseResidentVBucket();
+
+    /// Send the next chunk of the snapshot started by createFromMemory().
+    backfill_status_t scanMemory();
+
     EventuallyPersistentEngine *engine;
     stream_t                    stream;
     uint64_t                    startSeqno;
@@ -94,6 +152,44 @@ private:
     ScanContext*                scanCtx;
     backfill_state_t            state;
     std::mutex                       lock;
+
+    // Chunk of the resident snapshot read but not yet sent, in seqno
+    // order; items are removed from the front as they are sent.
+    std::deque<std::unique_ptr<Item>> residentItems;
+    bool fromMemory;
+    // The vbucket pinned for the resident snapshot and the id of the pin,
+    // the next seqno to read from it, and the seqno the snapshot ends at.
+    RCPtr<VBucket> residentVb;
+    uint64_t residentPin;
+    uint64_t residentReadPos;
+    uint64_t residentEndSeqno;
+};
+
+/**
+ * Backfills a DCP stream from an ephemeral vbucket's in-memory sequence
+ * list, without touching disk.
+ */
+class DCPBackfillMemory : public DCPBackfill {
+public:
+    DCPBackfillMemory(EventuallyPersistentEngine* e, stream_t s,
+                      uint64_t start_seqno, uint64_t end_seqno);
+
+    ~DCPBackfillMemory();
+
+protected:
+    backfill_status_t create() override;
+
+    backfill_status_t scan() override;
+
+    backfill_status_t complete(bool cancelled) override;
+
+private:
+    // Items read from the sequence list per scan() step.
+    static const size_t scanChunkSize = 512;
+
+    // The vbucket whose range read we hold, if any, and the read's id.
+    RCPtr<VBucket> vb;
+    SequenceList::RangeReadId readId;
 };
 
 #endif  // SRC_DCP_BACKFILL_H_
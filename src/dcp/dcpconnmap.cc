@@ -35,7 +35,9 @@ const uint8_t DcpConnMap::numBackfillsMemThreshold = 1;
 
 DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     : ConnMap(e),
-      aggrDcpConsumerBufferSize(0) {
+      aggrDcpConsumerBufferSize(0),
+      numMemoryBackfills(0),
+      numDiskBackfills(0) {
     backfills.numActiveSnoozing = 0;
     updateMaxActiveSnoozingBackfills(engine.getEpStats().getMaxDataSize());
     minCompressionRatioForProducer.store(
@@ -428,6 +430,10 @@ void DcpConnMap::addStats(ADD_STAT add_stat, const void *c) {
     LockHolder lh(connsLock);
     add_casted_stat("ep_dcp_dead_conn_count", deadConnections.size(), add_stat,
                     c);
+    add_casted_stat("ep_dcp_backfills_memory", numMemoryBackfills.load(),
+                    add_stat, c);
+    add_casted_stat("ep_dcp_backfills_disk", numDiskBackfills.load(),
+                    add_stat, c);
 }
 
 void DcpConnMap::updateMinCompressionRatioForProducers(float value) {
@@ -106,6 +106,18 @@ public:
         return backfills.maxActiveSnoozing;
     }
 
+    /**
+     * Count a backfill which has started sending its snapshot, by where
+     * the snapshot is read from.
+     */
+    void incrNumBackfills(backfill_source_t source) {
+        if (source == BACKFILL_FROM_MEMORY) {
+            ++numMemoryBackfills;
+        } else {
+            ++numDiskBackfills;
+        }
+    }
+
     ENGINE_ERROR_CODE addPassiveStream(ConnHandler& conn, uint32_t opaque,
                                        uint16_t vbucket, uint32_t flags);
 
@@ -187,6 +199,10 @@ protected:
     /* Total memory used by all DCP consumer buffers */
     std::atomic<size_t> aggrDcpConsumerBufferSize;
 
+    /* Number of backfills served from memory and from disk */
+    std::atomic<size_t> numMemoryBackfills;
+    std::atomic<size_t> numDiskBackfills;
+
     class DcpConfigChangeListener : public ValueChangedListener {
     public:
         DcpConfigChangeListener(DcpConnMap& connMap);
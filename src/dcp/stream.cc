@@ -199,7 +199,8 @@ ActiveStream::ActiveStream(EventuallyPersistentEngine* e, dcp_producer_t p,
        itemsFromMemoryPhase(0), firstMarkerSent(false), waitForSnapshot(0),
        engine(e), producer(p), isBackfillTaskRunning(false),
        pendingBackfill(false),
-       lastSentSnapEndSeqno(0), chkptItemsExtractionInProgress(false) {
+       lastSentSnapEndSeqno(0), chkptItemsExtractionInProgress(false),
+       cursorId(CheckpointManager::invalidCursorId) {
 
     const char* type = "";
     if (flags_ & DCP_ADD_STREAM_FLAG_TAKEOVER) {
@@ -350,7 +351,14 @@ void ActiveStream::markDiskSnapshot(uint64_t startSeqno, uint64_t endSeqno) {
                 vb->checkpointManager.registerCursorBySeqno(
                                                     name_, chkCursorSeqno,
                                                     MustSendCheckpointEnd::NO);
-            curChkSeqno = result.first;
+            curChkSeqno = result.seqno;
+            cursorId = result.cursorId;
+            if (chkCursorSeqno + 1 <= result.highestExpelledSeqno) {
+                // Items after the end of this backfill have been expelled
+                // from the checkpoint the cursor starts in - backfill them
+                // too. Other gaps (e.g. de-duplicated items) need nothing.
+                pendingBackfill = true;
+            }
         }
     }
     bool inverse = false;
@@ -671,7 +679,7 @@ void ActiveStream::addTakeoverStats(ADD_STAT add_stat, const void *cookie,
     item_eviction_policy_t iep = engine->getKVBucket()->getItemEvictionPolicy();
     size_t vb_items = vb.getNumItems(iep);
     size_t chk_items = vb_items > 0 ?
-                vb.checkpointManager.getNumItemsForCursor(name_) : 0;
+                vb.checkpointManager.getNumItemsForCursor(cursorId) : 0;
 
     size_t del_items = 0;
     try {
@@ -722,7 +730,7 @@ DcpResponse* ActiveStream::nextQueuedItem() {
 
 bool ActiveStream::nextCheckpointItem() {
     RCPtr<VBucket> vbucket = engine->getVBucket(vb_);
-    if (vbucket && vbucket->checkpointManager.getNumItemsForCursor(name_) > 0) {
+    if (vbucket && vbucket->checkpointManager.getNumItemsForCursor(cursorId) > 0) {
         // schedule this stream to build the next checkpoint
         producer->scheduleCheckpointProcessorTask(this);
         return true;
@@ -810,7 +818,7 @@ void ActiveStream::getOutstandingItems(RCPtr<VBucket> &vb,
     chkptItemsExtractionInProgress.store(true);
 
     hrtime_t _begin_ = gethrtime();
-    vb->checkpointManager.getAllItemsForCursor(name_, items);
+    vb->checkpointManager.getAllItemsForCursor(cursorId, items);
     engine->getEpStats().dcpCursorsGetItemsHisto.add(
                                             (gethrtime() - _begin_) / 1000);
 
@@ -1016,8 +1024,9 @@ void ActiveStream::scheduleBackfill_UNLOCKED(bool reschedule) {
                                                 name_,
                                                 lastReadSeqno.load(),
                                                 MustSendCheckpointEnd::NO);
-        curChkSeqno = result.first;
-        tryBackfill = result.second;
+        curChkSeqno = result.seqno;
+        tryBackfill = result.tryBackfill;
+        cursorId = result.cursorId;
 
         if (lastReadSeqno.load() > curChkSeqno) {
             throw std::logic_error("ActiveStream::scheduleBackfill_UNLOCKED: "
@@ -1224,7 +1233,7 @@ void ActiveStream::transitionState(stream_state_t newState) {
             {
                 RCPtr<VBucket> vb = engine->getVBucket(vb_);
                 if (vb) {
-                    vb->checkpointManager.removeCursor(name_);
+                    vb->checkpointManager.removeCursor(cursorId);
                 }
                 break;
             }
@@ -1247,7 +1256,7 @@ size_t ActiveStream::getItemsRemaining() {
     // Items remaining is the sum of:
     // (a) Items outstanding in checkpoints
     // (b) Items pending in our readyQ, excluding any meta items.
-    return vbucket->checkpointManager.getNumItemsForCursor(name_) +
+    return vbucket->checkpointManager.getNumItemsForCursor(cursorId) +
             readyQ_non_meta_items;
 }
 
@@ -1289,7 +1298,7 @@ void ActiveStream::dropCheckpointCursor_UNLOCKED()
         }
     }
     /* Drop the existing cursor */
-    vbucket->checkpointManager.removeCursor(name_);
+    vbucket->checkpointManager.removeCursor(cursorId);
 }
 
 NotifierStream::NotifierStream(EventuallyPersistentEngine* e, dcp_producer_t p,
@@ -261,6 +261,12 @@ protected:
 
     DcpResponse* nextQueuedItem();
 
+    // Returns true if another backfill must follow the running one.
+    bool hasPendingBackfill() {
+        LockHolder lh(streamMutex);
+        return pendingBackfill;
+    }
+
 private:
 
     DcpResponse* next(std::lock_guard<std::mutex>& lh);
@@ -364,6 +370,9 @@ private:
        items are added to the readyQ */
     std::atomic<bool> chkptItemsExtractionInProgress;
 
+    //! Id of this stream's checkpoint cursor, set on each registration
+    std::atomic<CursorId> cursorId;
+
 };
 
 
@@ -52,6 +52,7 @@ DefragmentVisitor::DefragmentVisitor(uint8_t age_threshold_)
     progressTracker(NULL),
     resume_vbucket_id(0),
     hashtable_position(),
+    current_ht(nullptr),
     defrag_count(0),
     visited_count(0) {
     progressTracker = new ProgressTracker(*this);
@@ -74,7 +75,9 @@ bool DefragmentVisitor::visit(uint16_t vbucket_id, HashTable& ht) {
         ht_start = hashtable_position;
     }
 
+    current_ht = &ht;
     hashtable_position = ht.pauseResumeVisit(*this, ht_start);
+    current_ht = nullptr;
 
     if (hashtable_position != ht.endPosition()) {
         // We didn't get to the end of this hashtable. Record the vbucket_id
@@ -92,11 +95,11 @@ bool DefragmentVisitor::visit(StoredValue& v) {
     // value must be at least non-zero (also covers Items with null Blobs)
     // and no larger than the biggest size class the allocator
     // supports, so it can be successfully reallocated to a run with other
-    // objects of the same size.
-    if (value_len > 0 && value_len <= max_size_class) {
+    // objects of the same size. Inline values have no Blob to reallocate.
+    if (value_len > 0 && value_len <= max_size_class && !v.isValueInline()) {
         // If sufficiently old reallocate, otherwise increment it's age.
         if (v.getValue()->getAge() >= age_threshold) {
-            v.reallocate();
+            v.reallocate(*current_ht);
             defrag_count++;
         } else {
             v.getValue()->incrementAge();
@@ -73,6 +73,9 @@ private:
     // When pausing / resuming, hashtable position to use.
     HashTable::Position hashtable_position;
 
+    // HashTable currently being visited.
+    HashTable* current_ht;
+
     /* Statistics */
     // Count of how many documents have been defrag'd.
     size_t defrag_count;
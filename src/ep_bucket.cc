@@ -42,6 +42,17 @@ void EPBucket::deinitialize() {
     stopFlusher();
     stopBgFetcher();
 
+    if (!stats.forceShutdown) {
+        // Everything has been flushed; save the bloom filters so warmup
+        // needn't wait for compaction to rebuild them.
+        for (auto vbid : vbMap.getBuckets()) {
+            RCPtr<VBucket> vb = getVBucket(vbid);
+            if (vb) {
+                saveFilter(*vb);
+            }
+        }
+    }
+
     KVBucket::deinitialize();
 }
 
@@ -59,6 +70,10 @@ protocol_binary_response_status EPBucket::evictKey(const DocKey& key,
 void EPBucket::reset() {
     KVBucket::reset();
 
+    for (auto vbid : vbMap.getBuckets()) {
+        removeSavedFilter(vbid);
+    }
+
     // Need to additionally update disk state
     bool inverse = true;
     deleteAllTaskCtx.delay.compare_exchange_strong(inverse, false);
@@ -231,20 +246,22 @@ RCPtr<VBucket> EPBucket::makeVBucket(
         uint64_t purgeSeqno,
         uint64_t maxCas) {
     auto flusherCb = std::make_shared<NotifyFlusherCB>(shard);
-    return RCPtr<VBucket>(new VBucket(id,
-                                      state,
-                                      stats,
-                                      engine.getCheckpointConfig(),
-                                      shard,
-                                      lastSeqno,
-                                      lastSnapStart,
-                                      lastSnapEnd,
-                                      std::move(table),
-                                      flusherCb,
-                                      std::move(newSeqnoCb),
-                                      engine.getConfiguration(),
-                                      eviction_policy,
-                                      initState,
-                                      purgeSeqno,
-                                      maxCas));
+    RCPtr<VBucket> vb(new VBucket(id,
+                                  state,
+                                  stats,
+                                  engine.getCheckpointConfig(),
+                                  shard,
+                                  lastSeqno,
+                                  lastSnapStart,
+                                  lastSnapEnd,
+                                  std::move(table),
+                                  flusherCb,
+                                  std::move(newSeqnoCb),
+                                  engine.getConfiguration(),
+                                  eviction_policy,
+                                  initState,
+                                  purgeSeqno,
+                                  maxCas));
+    vb->ht.setFrequencySketch(frequencySketch);
+    return vb;
 }
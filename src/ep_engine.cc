@@ -70,6 +70,27 @@ static size_t percentOf(size_t val, double percent) {
     return static_cast<size_t>(static_cast<double>(val) * percent);
 }
 
+/**
+ * @return the upper bound of the histogram bin holding the given percentile
+ *         (0-1) of the samples, or zero if there are none.
+ */
+template <typename T>
+static T histogramPercentile(const Histogram<T>& histo, double percentile) {
+    size_t total = 0;
+    for (const auto& bin : histo) {
+        total += bin->count();
+    }
+    const size_t target = std::max(size_t(1), percentOf(total, percentile));
+    size_t seen = 0;
+    for (const auto& bin : histo) {
+        seen += bin->count();
+        if (total > 0 && seen >= target) {
+            return bin->end();
+        }
+    }
+    return 0;
+}
+
 struct EPHandleReleaser {
     void operator()(EventuallyPersistentEngine*) {
         ObjectRegistry::onSwitchThread(nullptr);
@@ -398,6 +419,8 @@ static protocol_binary_response_status setCheckpointParam(
             validate(v, size_t(MIN_CHECKPOINT_ITEMS),
                      size_t(MAX_CHECKPOINT_ITEMS));
             e->getConfiguration().setChkMaxItems(v);
+        } else if (strcmp(keyz, "chk_max_size") == 0) {
+            e->getConfiguration().setChkMaxSize(std::stoull(valz));
         } else if (strcmp(keyz, "chk_period") == 0) {
             size_t v = std::stoull(valz);
             validate(v, size_t(MIN_CHECKPOINT_PERIOD),
@@ -414,6 +437,8 @@ static protocol_binary_response_status setCheckpointParam(
             e->getConfiguration().setKeepClosedChks(cb_stob(valz));
         } else if (strcmp(keyz, "enable_chk_merge") == 0) {
             e->getConfiguration().setEnableChkMerge(cb_stob(valz));
+        } else if (strcmp(keyz, "chk_expel_enabled") == 0) {
+            e->getConfiguration().setChkExpelEnabled(cb_stob(valz));
         } else {
             msg = "Unknown config param";
             rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -459,6 +484,9 @@ static protocol_binary_response_status setFlushParam(
             e->getConfiguration().setBgFetchDelay(std::stoull(valz));
         } else if (strcmp(keyz, "flushall_enabled") == 0) {
             e->getConfiguration().setFlushallEnabled(cb_stob(valz));
+        } else if (strcmp(keyz, "flusher_batch_latency_target") == 0) {
+            e->getConfiguration().setFlusherBatchLatencyTarget(
+                std::stoull(valz));
         } else if (strcmp(keyz, "max_size") == 0) {
             size_t vsize = std::stoull(valz);
 
@@ -516,6 +544,8 @@ static protocol_binary_response_status setFlushParam(
             e->getConfiguration().setAlogTaskTime(std::stoull(valz));
         } else if (strcmp(keyz, "pager_active_vb_pcnt") == 0) {
             e->getConfiguration().setPagerActiveVbPcnt(std::stoull(valz));
+        } else if (strcmp(keyz, "pager_concurrency") == 0) {
+            e->getConfiguration().setPagerConcurrency(std::stoull(valz));
         } else if (strcmp(keyz, "warmup_min_memory_threshold") == 0) {
             e->getConfiguration().setWarmupMinMemoryThreshold(
                 std::stoull(valz));
@@ -543,6 +573,10 @@ static protocol_binary_response_status setFlushParam(
         } else if (strcmp(keyz, "bfilter_residency_threshold") == 0) {
             e->getConfiguration().setBfilterResidencyThreshold(
                 std::stof(valz));
+        } else if (strcmp(keyz, "bfilter_persist") == 0) {
+            e->getConfiguration().setBfilterPersist(cb_stob(valz));
+        } else if (strcmp(keyz, "bfilter_type") == 0) {
+            e->getConfiguration().setBfilterType(valz);
         } else if (strcmp(keyz, "defragmenter_enabled") == 0) {
             e->getConfiguration().setDefragmenterEnabled(cb_stob(valz));
         } else if (strcmp(keyz, "defragmenter_interval") == 0) {
@@ -3015,6 +3049,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                         epstats.flushExpired, add_stat, cookie);
         add_casted_stat("ep_item_flush_failed",
                         epstats.flushFailed, add_stat, cookie);
+        add_casted_stat("ep_flush_batch_size",
+                        epstats.flushBatchSize, add_stat, cookie);
+        add_casted_stat("ep_flush_batch_target_misses",
+                        epstats.flushBatchTargetMisses, add_stat, cookie);
         add_casted_stat("ep_flusher_state",
                         flusher->stateName(), add_stat, cookie);
         add_casted_stat("ep_flusher_todo",
@@ -3023,6 +3061,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                         epstats.totalPersisted, add_stat, cookie);
         add_casted_stat("ep_uncommitted_items",
                         epstats.flusher_todo, add_stat, cookie);
+        add_casted_stat("ep_persistence_latency_p50",
+                        histogramPercentile(epstats.persistenceLatencyHisto,
+                                            0.5),
+                        add_stat, cookie);
+        add_casted_stat("ep_persistence_latency_p90",
+                        histogramPercentile(epstats.persistenceLatencyHisto,
+                                            0.9),
+                        add_stat, cookie);
+        add_casted_stat("ep_persistence_latency_p99",
+                        histogramPercentile(epstats.persistenceLatencyHisto,
+                                            0.99),
+                        add_stat, cookie);
     }
     add_casted_stat("ep_vbucket_del",
                     epstats.vbucketDeletions, add_stat, cookie);
@@ -3302,11 +3352,25 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_num_pager_runs", epstats.pagerRuns,
                     add_stat, cookie);
+    add_casted_stat("ep_pager_high_to_low_wat_time",
+                    epstats.pagerHighToLowWatTime, add_stat, cookie);
     add_casted_stat("ep_num_expiry_pager_runs", epstats.expiryPagerRuns,
                     add_stat, cookie);
+    add_casted_stat("ep_expiry_index_size", epstats.expiryIndexSize,
+                    add_stat, cookie);
+    add_casted_stat("ep_expiry_pager_last_visited",
+                    epstats.expiryPagerLastVisited, add_stat, cookie);
+    add_casted_stat("ep_expiry_pager_last_expired",
+                    epstats.expiryPagerLastExpired, add_stat, cookie);
     add_casted_stat("ep_items_rm_from_checkpoints",
                     epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_items_expelled_from_checkpoints",
+                    epstats.itemsExpelledFromCheckpoints,
+                    add_stat, cookie);
+    add_casted_stat("ep_mem_freed_by_checkpoint_item_expel",
+                    epstats.memFreedByCheckpointItemExpel,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects,
                     add_stat, cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects,
@@ -3479,8 +3543,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.cursorDroppingLThreshold, add_stat, cookie);
     add_casted_stat("ep_cursor_dropping_upper_threshold",
                     epstats.cursorDroppingUThreshold, add_stat, cookie);
+    add_casted_stat("ep_cursor_dropping_checkpoint_mem_lower_threshold",
+                    epstats.cursorDroppingCheckpointMemLThreshold,
+                    add_stat, cookie);
+    add_casted_stat("ep_cursor_dropping_checkpoint_mem_upper_threshold",
+                    epstats.cursorDroppingCheckpointMemUThreshold,
+                    add_stat, cookie);
     add_casted_stat("ep_cursors_dropped",
                     epstats.cursorsDropped, add_stat, cookie);
+    add_casted_stat("ep_checkpoint_memory",
+                    epstats.checkpointMemUsage, add_stat, cookie);
 
 
     // Note: These are also reported per-shard in 'kvstore' stats, however
@@ -3715,6 +3787,49 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
                 checked_snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted",
                                  vbid);
                 add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf), "vb_%d:layout", vbid);
+                add_casted_stat(buf,
+                                HashTable::layoutToString(vb->ht.getLayout()),
+                                add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf), "vb_%d:overflow_buckets",
+                                 vbid);
+                add_casted_stat(buf, vb->ht.getNumOverflowBuckets(), add_stat,
+                                cookie);
+                checked_snprintf(buf, sizeof(buf),
+                                 "vb_%d:resize_in_progress", vbid);
+                add_casted_stat(buf, vb->ht.isResizing(), add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf),
+                                 "vb_%d:resize_buckets_remaining", vbid);
+                add_casted_stat(buf, vb->ht.getResizeBucketsRemaining(),
+                                add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf), "vb_%d:resize_steps", vbid);
+                add_casted_stat(buf, vb->ht.getNumResizeSteps(), add_stat,
+                                cookie);
+                checked_snprintf(buf, sizeof(buf),
+                                 "vb_%d:resize_pause_total_us", vbid);
+                add_casted_stat(buf, vb->ht.getResizePauseTotal(), add_stat,
+                                cookie);
+                checked_snprintf(buf, sizeof(buf),
+                                 "vb_%d:resize_pause_max_us", vbid);
+                add_casted_stat(buf, vb->ht.getResizePauseMax(), add_stat,
+                                cookie);
+                checked_snprintf(buf, sizeof(buf), "vb_%d:retired_bytes",
+                                 vbid);
+                add_casted_stat(buf, vb->ht.getRetiredBytes(), add_stat,
+                                cookie);
+                if (const SlabAllocator* slabs = vb->ht.getSlabAllocator()) {
+                    checked_snprintf(buf, sizeof(buf), "vb_%d:slabs", vbid);
+                    add_casted_stat(buf, slabs->getNumSlabs(), add_stat,
+                                    cookie);
+                    checked_snprintf(buf, sizeof(buf), "vb_%d:slab_bytes",
+                                     vbid);
+                    add_casted_stat(buf, slabs->getSlabBytes(), add_stat,
+                                    cookie);
+                    checked_snprintf(buf, sizeof(buf),
+                                     "vb_%d:slab_used_bytes", vbid);
+                    add_casted_stat(buf, slabs->getUsedBytes(), add_stat,
+                                    cookie);
+                }
             } catch (std::exception& error) {
                 LOG(EXTENSION_LOG_WARNING,
                     "StatVBucketVisitor::visitBucket: Failed to build stat: %s",
@@ -4241,6 +4356,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("access_scanner", stats.accessScannerHisto, add_stat, cookie);
     add_casted_stat("checkpoint_remover", stats.checkpointRemoverHisto, add_stat, cookie);
     add_casted_stat("item_pager", stats.itemPagerHisto, add_stat, cookie);
+    add_casted_stat("pager_high_to_low_wat", stats.pagerHighToLowWatHisto,
+                    add_stat, cookie);
     add_casted_stat("expiry_pager", stats.expiryPagerHisto, add_stat, cookie);
 
     add_casted_stat("storage_age", stats.dirtyAgeHisto, add_stat, cookie);
@@ -4271,6 +4388,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("disk_del", stats.diskDelHisto, add_stat, cookie);
     add_casted_stat("disk_vb_del", stats.diskVBDelHisto, add_stat, cookie);
     add_casted_stat("disk_commit", stats.diskCommitHisto, add_stat, cookie);
+    add_casted_stat("persistence_latency", stats.persistenceLatencyHisto,
+                    add_stat, cookie);
 
     add_casted_stat("item_alloc_sizes", stats.itemAllocSizeHisto,
                     add_stat, cookie);
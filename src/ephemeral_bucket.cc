@@ -18,11 +18,41 @@
 #include "ephemeral_bucket.h"
 
 #include "ep_engine.h"
+#include "ephemeral_tombstone_purger.h"
 #include "ephemeral_vb.h"
 
 EphemeralBucket::EphemeralBucket(EventuallyPersistentEngine& theEngine)
     : KVBucket(theEngine) {}
 
+bool EphemeralBucket::initialize() {
+    KVBucket::initialize();
+
+    ExTask purgerTask = make_STRCPtr<EphTombstonePurgerTask>(*this);
+    ExecutorPool::get()->schedule(purgerTask, NONIO_TASK_IDX);
+
+    return true;
+}
+
+void EphemeralBucket::reset() {
+    KVBucket::reset();
+
+    // The HashTables are now empty; drop their seqno indexes too.
+    for (auto vbid : vbMap.getBuckets()) {
+        RCPtr<VBucket> vb = getVBucket(vbid);
+        if (vb) {
+            static_cast<EphemeralVBucket&>(*vb).clearSeqList();
+        }
+    }
+}
+
+uint64_t EphemeralBucket::getLastPersistedSeqno(uint16_t vb) {
+    auto vbucket = vbMap.getBucket(vb);
+    if (vbucket) {
+        return vbucket->getHighSeqno();
+    }
+    return 0;
+}
+
 RCPtr<VBucket> EphemeralBucket::makeVBucket(
         VBucket::id_type id,
         vbucket_state_t state,
@@ -35,19 +65,21 @@ RCPtr<VBucket> EphemeralBucket::makeVBucket(
         uint64_t lastSnapEnd,
         uint64_t purgeSeqno,
         uint64_t maxCas) {
-    return RCPtr<VBucket>(new EphemeralVBucket(id,
-                                               state,
-                                               stats,
-                                               engine.getCheckpointConfig(),
-                                               shard,
-                                               lastSeqno,
-                                               lastSnapStart,
-                                               lastSnapEnd,
-                                               std::move(table),
-                                               std::move(newSeqnoCb),
-                                               engine.getConfiguration(),
-                                               eviction_policy,
-                                               initState,
-                                               purgeSeqno,
-                                               maxCas));
+    RCPtr<VBucket> vb(new EphemeralVBucket(id,
+                                           state,
+                                           stats,
+                                           engine.getCheckpointConfig(),
+                                           shard,
+                                           lastSeqno,
+                                           lastSnapStart,
+                                           lastSnapEnd,
+                                           std::move(table),
+                                           std::move(newSeqnoCb),
+                                           engine.getConfiguration(),
+                                           eviction_policy,
+                                           initState,
+                                           purgeSeqno,
+                                           maxCas));
+    vb->ht.setFrequencySketch(frequencySketch);
+    return vb;
 }
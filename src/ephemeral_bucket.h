@@ -29,6 +29,15 @@ class EphemeralBucket : public KVBucket {
 public:
     EphemeralBucket(EventuallyPersistentEngine& theEngine);
 
+    /// Also starts the tombstone purger.
+    bool initialize() override;
+
+    void reset() override;
+
+    /// Everything in memory is as durable as it gets, so DCP may backfill
+    /// up to the high seqno.
+    uint64_t getLastPersistedSeqno(uint16_t vb) override;
+
     /// Eviction not supported for Ephemeral buckets - without some backing
     /// storage, there is nowhere to evict /to/.
     protocol_binary_response_status evictKey(const DocKey& key,
@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "ephemeral_tombstone_purger.h"
+
+#include "ep_engine.h"
+#include "ep_time.h"
+#include "ephemeral_vb.h"
+#include "kv_bucket_iface.h"
+
+#include <phosphor/phosphor.h>
+#include <platform/make_unique.h>
+
+/**
+ * Purges the tombstones of each vbucket which were deleted before a given
+ * time.
+ */
+class EphTombstonePurgerVisitor : public VBucketVisitor {
+public:
+    EphTombstonePurgerVisitor(rel_time_t purgeBefore)
+        : purgeBefore(purgeBefore) {
+    }
+
+    void visitBucket(RCPtr<VBucket>& vb) override {
+        auto& ephVb = static_cast<EphemeralVBucket&>(*vb);
+        ephVb.purgeTombstones(purgeBefore);
+    }
+
+private:
+    const rel_time_t purgeBefore;
+};
+
+EphTombstonePurgerTask::EphTombstonePurgerTask(KVBucketIface& bucket)
+    : GlobalTask(&bucket.getEPEngine(),
+                 TaskId::EphTombstonePurgerTask,
+                 bucket.getEPEngine()
+                         .getConfiguration()
+                         .getEphemeralMetadataPurgeInterval(),
+                 false),
+      bucket(bucket) {
+}
+
+bool EphTombstonePurgerTask::run() {
+    TRACE_EVENT0("ep-engine/task", "EphTombstonePurgerTask");
+    Configuration& config = bucket.getEPEngine().getConfiguration();
+    const rel_time_t now = ep_current_time();
+    const size_t purgeAge = config.getEphemeralMetadataPurgeAge();
+
+    // Nothing can have been deleted for longer than we've been running.
+    if (now > purgeAge) {
+        auto pv = std::make_unique<EphTombstonePurgerVisitor>(now - purgeAge);
+        bucket.visit(std::move(pv),
+                     "Ephemeral tombstone purger",
+                     NONIO_TASK_IDX,
+                     TaskId::EphTombstonePurgerVisitorTask);
+    }
+
+    snooze(config.getEphemeralMetadataPurgeInterval());
+    return true;
+}
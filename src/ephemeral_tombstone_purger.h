@@ -0,0 +1,48 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "tasks.h"
+
+#include <string>
+
+class KVBucketIface;
+
+/**
+ * Periodically removes the tombstones (deleted items) of ephemeral
+ * vbuckets once they are older than ephemeral_metadata_purge_age.
+ *
+ * Ephemeral buckets keep deleted items in memory so DCP backfills can send
+ * the deletion; without this task they would accumulate forever. Runs every
+ * ephemeral_metadata_purge_interval seconds.
+ */
+class EphTombstonePurgerTask : public GlobalTask {
+public:
+    EphTombstonePurgerTask(KVBucketIface& bucket);
+
+    bool run() override;
+
+    std::string getDescription() override {
+        return "Purging ephemeral tombstones.";
+    }
+
+private:
+    KVBucketIface& bucket;
+};
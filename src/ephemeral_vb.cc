@@ -17,6 +17,11 @@
 
 #include "ephemeral_vb.h"
 
+#include "ep_time.h"
+
+// Tombstones looked at per pass of the sequence list when purging.
+static const size_t purgeBatchSize = 1024;
+
 EphemeralVBucket::EphemeralVBucket(
         id_type i,
         vbucket_state_t newState,
@@ -48,4 +53,178 @@ EphemeralVBucket::EphemeralVBucket(
               evictionPolicy,
               initState,
               purgeSeqno,
-              maxCas) {}
+              maxCas),
+      numPurgedTombstones(0) {
+}
+
+void EphemeralVBucket::addStats(bool details,
+                                ADD_STAT add_stat,
+                                const void* c,
+                                item_eviction_policy_t policy) {
+    VBucket::addStats(details, add_stat, c, policy);
+    if (details) {
+        addStat("seqlist_count", seqList.getNumItems(), add_stat, c);
+        addStat("seqlist_deleted_count",
+                seqList.getNumDeletedItems(),
+                add_stat,
+                c);
+        addStat("seqlist_stale_count",
+                seqList.getNumStaleItems(),
+                add_stat,
+                c);
+        addStat("seqlist_purged_count",
+                numPurgedTombstones.load(),
+                add_stat,
+                c);
+        addStat("seqlist_range_read_count",
+                seqList.getNumRangeReads(),
+                add_stat,
+                c);
+    }
+}
+
+SequenceList::RangeReadId EphemeralVBucket::beginRangeRead(int64_t start,
+                                                           int64_t end) {
+    return seqList.beginRangeRead(start, end);
+}
+
+std::vector<std::unique_ptr<Item>> EphemeralVBucket::rangeRead(
+        SequenceList::RangeReadId id, size_t maxItems) {
+    std::vector<std::unique_ptr<Item>> items;
+    while (items.empty()) {
+        auto chunk = seqList.getRangeChunk(id, maxItems);
+        if (chunk.empty()) {
+            break;
+        }
+        for (auto& elem : chunk) {
+            if (elem.item) {
+                items.push_back(std::move(elem.item));
+                continue;
+            }
+            int bucket_num(0);
+            auto lh = ht.getLockedBucket(elem.key, &bucket_num);
+            StoredValue* v = ht.unlocked_find(elem.key,
+                                              bucket_num,
+                                              /*wantsDeleted*/ true,
+                                              /*trackReference*/ false);
+            if (v && v->getBySeqno() == elem.seqno) {
+                items.emplace_back(v->toItem(false, getId()));
+                continue;
+            }
+            lh.unlock();
+            // The item has changed since the chunk was read; if the range
+            // read still needed it its previous state was saved.
+            auto stale = seqList.copyStaleElem(id, elem.seqno);
+            if (stale) {
+                items.push_back(std::move(stale));
+            }
+        }
+        if (items.empty()) {
+            // Nothing left in this chunk; move on to the next one.
+            seqList.advanceRangeRead(id, chunk.back().seqno);
+        }
+    }
+    return items;
+}
+
+void EphemeralVBucket::advanceRangeRead(SequenceList::RangeReadId id,
+                                        int64_t seqno) {
+    seqList.advanceRangeRead(id, seqno);
+}
+
+void EphemeralVBucket::endRangeRead(SequenceList::RangeReadId id) {
+    seqList.endRangeRead(id);
+}
+
+size_t EphemeralVBucket::purgeTombstones(rel_time_t before) {
+    size_t purged = 0;
+    int64_t start = 0;
+    while (true) {
+        auto tombstones = seqList.getTombstones(start, before, purgeBatchSize);
+        if (tombstones.empty()) {
+            break;
+        }
+        for (const auto& tombstone : tombstones) {
+            int bucket_num(0);
+            auto lh = ht.getLockedBucket(tombstone.key, &bucket_num);
+            StoredValue* v = ht.unlocked_find(tombstone.key,
+                                              bucket_num,
+                                              /*wantsDeleted*/ true,
+                                              /*trackReference*/ false);
+            if (!v) {
+                // The HashTable was cleared underneath the list.
+                seqList.removeOrphan(tombstone.seqno, tombstone.key);
+                continue;
+            }
+            if (!v->isDeleted() || v->getBySeqno() != tombstone.seqno) {
+                // Recreated or deleted again since we looked.
+                continue;
+            }
+            if (deleteStoredValue(lh, *v, bucket_num)) {
+                ++purged;
+                if (static_cast<uint64_t>(tombstone.seqno) > getPurgeSeqno()) {
+                    setPurgeSeqno(tombstone.seqno);
+                }
+            }
+        }
+        start = tombstones.back().seqno + 1;
+    }
+    numPurgedTombstones.fetch_add(purged);
+    return purged;
+}
+
+void EphemeralVBucket::clearSeqList() {
+    seqList.clear();
+}
+
+std::pair<MutationStatus, VBNotifyCtx> EphemeralVBucket::updateStoredValue(
+        const HashTable::HashBucketLock& htLock,
+        StoredValue& v,
+        Item& itm,
+        PreserveRevSeqno preserveRevSeqno,
+        const VBQueueItemCtx* queueItmCtx) {
+    seqList.saveStaleCopy(v, getId());
+    // Updating v overwrites its seqno before it is queued, so queueDirty()
+    // can't find its old element; drop that here once v has moved.
+    const int64_t prevSeqno = v.getBySeqno();
+    auto rv = VBucket::updateStoredValue(
+            htLock, v, itm, preserveRevSeqno, queueItmCtx);
+    if (v.getBySeqno() != prevSeqno) {
+        seqList.removeOrphan(prevSeqno, v.getKey());
+    }
+    return rv;
+}
+
+void EphemeralVBucket::softDeleteStoredValue(
+        const HashTable::HashBucketLock& htLock,
+        StoredValue& v,
+        uint64_t revSeqno,
+        bool onlyMarkDeleted) {
+    seqList.saveStaleCopy(v, getId());
+    VBucket::softDeleteStoredValue(htLock, v, revSeqno, onlyMarkDeleted);
+}
+
+bool EphemeralVBucket::deleteStoredValue(
+        const HashTable::HashBucketLock& htLock,
+        StoredValue& v,
+        int bucketNum) {
+    if (!v.isDeleted() && v.isLocked(ep_current_time())) {
+        return false;
+    }
+    seqList.removeListElem(v, getId());
+    return VBucket::deleteStoredValue(htLock, v, bucketNum);
+}
+
+VBNotifyCtx EphemeralVBucket::queueDirty(StoredValue& v,
+                                         GenerateBySeqno generateBySeqno,
+                                         GenerateCas generateCas,
+                                         bool isBackfillItem) {
+    // Hold the list lock while the seqno is generated, so a range read
+    // can't start between the checkpoint and the list seeing the item.
+    const int64_t prevSeqno = v.getBySeqno();
+    std::lock_guard<std::mutex> listWriteLg(seqList.getListWriteLock());
+    VBNotifyCtx notifyCtx = VBucket::queueDirty(
+            v, generateBySeqno, generateCas, isBackfillItem);
+    seqList.updateListElem(listWriteLg, v, prevSeqno, getId());
+    return notifyCtx;
+}
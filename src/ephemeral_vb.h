@@ -19,8 +19,22 @@
 
 #include "config.h"
 
+#include "seqlist.h"
 #include "vbucket.h"
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * A VBucket without any backing storage.
+ *
+ * As well as the HashTable, every item is indexed by seqno in a
+ * SequenceList, so DCP can backfill from memory (see rangeRead()). Deleted
+ * items are kept as tombstones until they are older than
+ * ephemeral_metadata_purge_age, at which point purgeTombstones() removes
+ * them and advances the purge seqno.
+ */
 class EphemeralVBucket : public VBucket {
 public:
     EphemeralVBucket(id_type i,
@@ -38,4 +52,91 @@ public:
                      vbucket_state_t initState = vbucket_state_dead,
                      uint64_t purgeSeqno = 0,
                      uint64_t maxCas = 0);
+
+    void addStats(bool details,
+                  ADD_STAT add_stat,
+                  const void* c,
+                  item_eviction_policy_t policy) override;
+
+    /**
+     * Start reading the seqnos [start, end] in order. Items changed after
+     * this call are still returned as they were when it was made. Any
+     * number of range reads may be in progress at once.
+     *
+     * @return the id to pass to the other range read methods
+     */
+    SequenceList::RangeReadId beginRangeRead(int64_t start, int64_t end);
+
+    /**
+     * Get up to maxItems items from the given range read, continuing from
+     * the last seqno passed to advanceRangeRead(). An empty result means the
+     * range is exhausted.
+     */
+    std::vector<std::unique_ptr<Item>> rangeRead(SequenceList::RangeReadId id,
+                                                 size_t maxItems);
+
+    /// Every item up to and including seqno has been consumed.
+    void advanceRangeRead(SequenceList::RangeReadId id, int64_t seqno);
+
+    /// Finish the given range read.
+    void endRangeRead(SequenceList::RangeReadId id);
+
+    /**
+     * Remove the tombstones of items deleted before `before` from memory.
+     *
+     * @return the number of tombstones purged
+     */
+    size_t purgeTombstones(rel_time_t before);
+
+    /// Remove every item from the sequence list (the HashTable is cleared
+    /// separately).
+    void clearSeqList();
+
+    /// @return the number of items (including tombstones) in the seqno index
+    size_t getSeqListNumItems() const {
+        return seqList.getNumItems();
+    }
+
+    /// @return the number of tombstones in the seqno index
+    size_t getSeqListNumDeletedItems() const {
+        return seqList.getNumDeletedItems();
+    }
+
+    /// @return the number of copies held for in-progress range reads
+    size_t getSeqListNumStaleItems() const {
+        return seqList.getNumStaleItems();
+    }
+
+    /// @return the number of in-progress range reads
+    size_t getSeqListNumRangeReads() const {
+        return seqList.getNumRangeReads();
+    }
+
+protected:
+    std::pair<MutationStatus, VBNotifyCtx> updateStoredValue(
+            const HashTable::HashBucketLock& htLock,
+            StoredValue& v,
+            Item& itm,
+            PreserveRevSeqno preserveRevSeqno,
+            const VBQueueItemCtx* queueItmCtx) override;
+
+    void softDeleteStoredValue(const HashTable::HashBucketLock& htLock,
+                               StoredValue& v,
+                               uint64_t revSeqno,
+                               bool onlyMarkDeleted) override;
+
+    bool deleteStoredValue(const HashTable::HashBucketLock& htLock,
+                           StoredValue& v,
+                           int bucketNum) override;
+
+    VBNotifyCtx queueDirty(StoredValue& v,
+                           GenerateBySeqno generateBySeqno,
+                           GenerateCas generateCas,
+                           bool isBackfillItem) override;
+
+private:
+    SequenceList seqList;
+
+    // Tombstones purged from this vbucket.
+    std::atomic<size_t> numPurgedTombstones;
 };
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "epoch_manager.h"
+
+#include <algorithm>
+
+namespace {
+/**
+ * The reader slot claimed by the current thread, handed back when the
+ * thread exits.
+ */
+struct ThreadSlot {
+    ~ThreadSlot() {
+        if (claimed) {
+            claimed->store(false);
+            releases->fetch_add(1);
+        }
+    }
+
+    void* slot = nullptr;
+    std::atomic<bool>* claimed = nullptr;
+    std::atomic<uint64_t>* releases = nullptr;
+    // Set once claiming has failed, so we don't rescan every slot on each
+    // read; cleared once another thread has released a slot since.
+    bool exhausted = false;
+    uint64_t exhaustedAtRelease = 0;
+};
+
+thread_local ThreadSlot threadSlot;
+}
+
+EpochManager::ReadGuard::ReadGuard(EpochManager& manager)
+    : slot(manager.getThreadSlot()) {
+    if (slot == nullptr || slot->depth++ > 0) {
+        return;
+    }
+    // Publish the epoch we're reading in, then check it didn't move
+    // before the publication became visible; otherwise a writer may have
+    // computed the safe epoch without seeing us.
+    uint64_t e;
+    do {
+        e = manager.epoch.load();
+        slot->epoch.store(e);
+    } while (manager.epoch.load() != e);
+}
+
+EpochManager::ReadGuard::~ReadGuard() {
+    if (slot && --slot->depth == 0) {
+        slot->epoch.store(0, std::memory_order_release);
+    }
+}
+
+EpochManager& EpochManager::get() {
+    static EpochManager manager;
+    return manager;
+}
+
+EpochManager::EpochManager() : epoch(1), releasedSlots(0) {
+}
+
+uint64_t EpochManager::getSafeEpoch() const {
+    uint64_t safe = epoch.load();
+    for (const auto& slot : slots) {
+        const uint64_t e = slot.epoch.load();
+        if (e != 0) {
+            safe = std::min(safe, e);
+        }
+    }
+    return safe;
+}
+
+EpochManager::Slot* EpochManager::getThreadSlot() {
+    if (threadSlot.slot) {
+        return static_cast<Slot*>(threadSlot.slot);
+    }
+    // Read before scanning, so a slot released during the scan makes us
+    // rescan next time.
+    const uint64_t released = releasedSlots.load();
+    if (threadSlot.exhausted && threadSlot.exhaustedAtRelease == released) {
+        return nullptr;
+    }
+    for (auto& slot : slots) {
+        bool expected = false;
+        if (!slot.claimed.load() &&
+            slot.claimed.compare_exchange_strong(expected, true)) {
+            threadSlot.slot = &slot;
+            threadSlot.claimed = &slot.claimed;
+            threadSlot.releases = &releasedSlots;
+            threadSlot.exhausted = false;
+            return &slot;
+        }
+    }
+    threadSlot.exhausted = true;
+    threadSlot.exhaustedAtRelease = released;
+    return nullptr;
+}
@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "utility.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Epoch based reclamation for objects read without locks.
+ *
+ * Readers which may dereference shared objects without holding the lock
+ * that protects them do so inside a ReadGuard, which publishes the global
+ * epoch current at the time the guard was created. A writer which unlinks
+ * such an object (while holding the lock) does not free it immediately;
+ * instead it retires it, stamping it with retire(). The object may be freed
+ * once isReclaimable(stamp) is true - at that point every reader which could
+ * still have been looking at it has left its ReadGuard.
+ *
+ * Reader slots are claimed per thread (on first use) from a fixed size
+ * table and released when the thread exits. If every slot is in use a
+ * ReadGuard is not acquired, and the caller must fall back to its locked
+ * path; the thread tries to claim a slot again once one has been released.
+ */
+class EpochManager {
+    /**
+     * A reader's published epoch; zero while the reader is not inside a
+     * ReadGuard. One cache line each so readers don't contend.
+     */
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> claimed{false};
+        // Nesting depth of ReadGuards; only accessed by the owning thread.
+        size_t depth = 0;
+    };
+
+public:
+    /// Maximum number of threads which can hold a reader slot at once.
+    static const size_t maxReaders = 128;
+
+    /**
+     * RAII guard marking the current thread as reading lock-free.
+     * Guards may be nested.
+     */
+    class ReadGuard {
+    public:
+        explicit ReadGuard(EpochManager& manager = EpochManager::get());
+
+        ~ReadGuard();
+
+        /// @return false if no reader slot was available.
+        explicit operator bool() const {
+            return slot != nullptr;
+        }
+
+    private:
+        Slot* slot;
+
+        DISALLOW_COPY_AND_ASSIGN(ReadGuard);
+    };
+
+    /// The process-wide EpochManager.
+    static EpochManager& get();
+
+    /**
+     * Advance the global epoch, returning the stamp for an object which
+     * has just been made unreachable to new readers.
+     */
+    uint64_t retire() {
+        return epoch.fetch_add(1) + 1;
+    }
+
+    /**
+     * The oldest epoch still observed by any reader; objects retired with
+     * a stamp no greater than this can be freed.
+     */
+    uint64_t getSafeEpoch() const;
+
+    bool isReclaimable(uint64_t stamp) const {
+        return stamp <= getSafeEpoch();
+    }
+
+    /// @return the current global epoch.
+    uint64_t getEpoch() const {
+        return epoch.load();
+    }
+
+private:
+    EpochManager();
+
+    /// Get the calling thread's reader slot, claiming one if necessary.
+    Slot* getThreadSlot();
+
+    std::atomic<uint64_t> epoch;
+    Slot slots[maxReaders];
+    // Number of slots released by exiting threads, so threads which found
+    // every slot claimed know when to look again.
+    std::atomic<uint64_t> releasedSlots;
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "eviction_policy.h"
+
+#include "stored-value.h"
+
+#include <platform/make_unique.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+std::unique_ptr<EvictionPolicy> EvictionPolicy::create(
+        Type type,
+        std::shared_ptr<FrequencySketch> sketch,
+        item_eviction_policy_t evictionMode) {
+    switch (type) {
+    case Type::NRU:
+        return std::make_unique<NRUEvictionPolicy>();
+    case Type::TinyLFU:
+        if (!sketch) {
+            throw std::invalid_argument("EvictionPolicy::create: TinyLFU "
+                                        "needs a FrequencySketch");
+        }
+        return std::make_unique<TinyLFUEvictionPolicy>(std::move(sketch),
+                                                       evictionMode);
+    }
+    throw std::invalid_argument("EvictionPolicy::create: unknown type " +
+                                std::to_string(int(type)));
+}
+
+EvictionPolicy::Type EvictionPolicy::typeFromString(const std::string& type) {
+    if (type == "nru") {
+        return Type::NRU;
+    } else if (type == "tinylfu") {
+        return Type::TinyLFU;
+    }
+    throw std::invalid_argument("EvictionPolicy::typeFromString: unknown "
+                                "type '" + type + "'");
+}
+
+const char* EvictionPolicy::typeToString(Type type) {
+    switch (type) {
+    case Type::NRU:
+        return "nru";
+    case Type::TinyLFU:
+        return "tinylfu";
+    }
+    return "<unknown>";
+}
+
+bool NRUEvictionPolicy::shouldEvict(StoredValue& v, item_pager_phase phase,
+                                    double percent) {
+    // always evict unreferenced items, or randomly evict referenced item
+    double r = phase == PAGING_UNREFERENCED ?
+        1 :
+        static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
+
+    if (phase == PAGING_UNREFERENCED &&
+        v.getNRUValue() == MAX_NRU_VALUE) {
+        return true;
+    } else if (phase == PAGING_RANDOM &&
+               v.incrNRUValue() == MAX_NRU_VALUE &&
+               r <= percent) {
+        return true;
+    }
+    return false;
+}
+
+TinyLFUEvictionPolicy::TinyLFUEvictionPolicy(
+        std::shared_ptr<FrequencySketch> sketch,
+        item_eviction_policy_t evictionMode)
+    : sketch(std::move(sketch)),
+      evictionMode(evictionMode),
+      visited(0),
+      probabilityPercent(-1),
+      nextUpdate(minVisited),
+      randomState(0x2545f4914f6cdd1dULL) {
+    histogram.fill(0);
+    evictProbability.fill(0);
+    // Estimate from all the accesses recorded so far.
+    this->sketch->flush();
+}
+
+bool TinyLFUEvictionPolicy::shouldEvict(StoredValue& v,
+                                        item_pager_phase phase,
+                                        double percent) {
+    // Items which can't be evicted would skew the histogram, so that
+    // fewer than percent of those which can are evicted.
+    if (!v.eligibleForEviction(evictionMode)) {
+        return false;
+    }
+
+    const uint8_t frequency = sketch->estimate(v.getKey().hash());
+    ++histogram[frequency];
+    ++visited;
+
+    if (visited < minVisited) {
+        return frequency == 0 && nextRandom() < percent;
+    }
+    if (percent != probabilityPercent || visited >= nextUpdate) {
+        updateProbabilities(percent);
+        // Often while the histogram is small, then every 1024 items.
+        nextUpdate = visited + std::min(visited, size_t(1024));
+    }
+
+    const double p = evictProbability[frequency];
+    return p >= 1 || (p > 0 && nextRandom() < p);
+}
+
+void TinyLFUEvictionPolicy::updateProbabilities(double percent) {
+    // Walk up the frequencies, evicting all of each until the fraction of
+    // items evicted reaches percent.
+    double below = 0;
+    for (size_t f = 0; f < numFrequencies; f++) {
+        const double share = double(histogram[f]) / visited;
+        if (share == 0 || below >= percent) {
+            evictProbability[f] = 0;
+        } else if (below + share <= percent) {
+            evictProbability[f] = 1;
+        } else {
+            evictProbability[f] = (percent - below) / share;
+        }
+        below += share;
+    }
+    probabilityPercent = percent;
+}
+
+double TinyLFUEvictionPolicy::nextRandom() {
+    // xorshift64*
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return double((randomState * 0x2545f4914f6cdd1dULL) >> 11) /
+           double(uint64_t(1) << 53);
+}
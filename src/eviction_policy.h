@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "frequency_sketch.h"
+#include "item_pager.h"
+
+#include <array>
+#include <memory>
+#include <string>
+
+class StoredValue;
+
+/**
+ * Decides which items the item pager evicts (the pager_eviction_policy
+ * configuration). Each of the pager's visitors creates its own instance,
+ * which sees the items of the vbuckets it visits in turn.
+ */
+class EvictionPolicy {
+public:
+    /**
+     * The policies which may be created:
+     *  - NRU: evict items not referenced since the pager last visited
+     *    them, then (in the pager's random phase) referenced items at
+     *    random.
+     *  - TinyLFU: evict the items accessed least often recently, as
+     *    estimated by a FrequencySketch.
+     */
+    enum class Type {
+        NRU,
+        TinyLFU
+    };
+
+    /**
+     * Create a policy of the given type.
+     *
+     * @param sketch the bucket's FrequencySketch, needed by TinyLFU
+     * @param evictionMode the bucket's item_eviction_policy
+     * @throws std::invalid_argument if the policy needs a sketch and none
+     *         is given
+     */
+    static std::unique_ptr<EvictionPolicy> create(
+            Type type,
+            std::shared_ptr<FrequencySketch> sketch,
+            item_eviction_policy_t evictionMode);
+
+    /**
+     * Convert the pager_eviction_policy configuration string to a Type.
+     */
+    static Type typeFromString(const std::string& type);
+
+    /**
+     * Convert a Type to its configuration string.
+     */
+    static const char* typeToString(Type type);
+
+    virtual ~EvictionPolicy() {}
+
+    virtual Type getType() const = 0;
+
+    /**
+     * Returns true if the pager should evict the given item. Called for
+     * every item the pager visits, with the item's hash bucket lock held.
+     *
+     * @param phase the pager's current phase
+     * @param percent fraction of the vbucket's items the pager is trying
+     *        to evict (0-1)
+     */
+    virtual bool shouldEvict(StoredValue& v, item_pager_phase phase,
+                             double percent) = 0;
+};
+
+/**
+ * The pager's original policy, using the 2 bit NRU value of each item.
+ */
+class NRUEvictionPolicy : public EvictionPolicy {
+public:
+    Type getType() const override {
+        return Type::NRU;
+    }
+
+    bool shouldEvict(StoredValue& v, item_pager_phase phase,
+                     double percent) override;
+};
+
+/**
+ * Evicts the items with the lowest estimated access frequency.
+ *
+ * The policy keeps a histogram of the estimated frequencies of the items
+ * it has visited which could be evicted, and evicts the items in the
+ * lowest frequencies which make up the fraction to be evicted; items of
+ * the frequency straddling that fraction are evicted at random, in
+ * proportion. One-hit wonders, which NRU keeps while they're recently
+ * referenced, are therefore evicted ahead of hot items. The pager phase
+ * is ignored.
+ *
+ * Until enough items have been visited for the histogram to be
+ * meaningful, only items with no recent accesses are evicted.
+ */
+class TinyLFUEvictionPolicy : public EvictionPolicy {
+public:
+    TinyLFUEvictionPolicy(std::shared_ptr<FrequencySketch> sketch,
+                          item_eviction_policy_t evictionMode);
+
+    Type getType() const override {
+        return Type::TinyLFU;
+    }
+
+    bool shouldEvict(StoredValue& v, item_pager_phase phase,
+                     double percent) override;
+
+    // The number of items visited before the histogram is used.
+    static const size_t minVisited = 16;
+
+private:
+    static const size_t numFrequencies = FrequencySketch::maxCount + 1;
+
+    // Recompute evictProbability from the histogram.
+    void updateProbabilities(double percent);
+
+    // A random number in [0, 1); std::rand() takes a lock in some C
+    // libraries, and this is called for every item visited.
+    double nextRandom();
+
+    std::shared_ptr<FrequencySketch> sketch;
+    const item_eviction_policy_t evictionMode;
+    // Number of items visited with each estimated frequency.
+    std::array<size_t, numFrequencies> histogram;
+    size_t visited;
+    // Probability of evicting an item of each estimated frequency, for
+    // probabilityPercent; recomputed as the histogram grows.
+    std::array<double, numFrequencies> evictProbability;
+    double probabilityPercent;
+    size_t nextUpdate;
+    uint64_t randomState;
+};
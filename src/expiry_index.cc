@@ -0,0 +1,68 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "expiry_index.h"
+
+ExpiryIndex::ExpiryIndex() : numEntries(0) {
+}
+
+int ExpiryIndex::update(const DocKey& key,
+                        uint32_t oldExptime,
+                        uint32_t newExptime) {
+    if (oldExptime == 0 && newExptime == 0) {
+        return 0;
+    }
+
+    StoredDocKey storedKey(key);
+    int change = 0;
+    std::lock_guard<std::mutex> lh(mutex);
+    if (oldExptime != 0 && oldExptime != newExptime) {
+        auto it = buckets.find(oldExptime);
+        if (it != buckets.end() && it->second.erase(storedKey)) {
+            --change;
+            if (it->second.empty()) {
+                buckets.erase(it);
+            }
+        }
+    }
+    if (newExptime != 0 &&
+        buckets[newExptime].insert(std::move(storedKey)).second) {
+        ++change;
+    }
+    numEntries.fetch_add(change);
+    return change;
+}
+
+std::vector<StoredDocKey> ExpiryIndex::popExpired(time_t asOf) {
+    std::vector<StoredDocKey> keys;
+    std::lock_guard<std::mutex> lh(mutex);
+    auto end = buckets.begin();
+    for (; end != buckets.end() && time_t(end->first) < asOf; ++end) {
+        keys.insert(keys.end(), end->second.begin(), end->second.end());
+    }
+    buckets.erase(buckets.begin(), end);
+    numEntries.fetch_sub(keys.size());
+    return keys;
+}
+
+size_t ExpiryIndex::clear() {
+    std::lock_guard<std::mutex> lh(mutex);
+    buckets.clear();
+    return numEntries.exchange(0);
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "storeddockey.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * The keys of a hash table's items which have an expiry time, bucketed by
+ * that time, so that the expiry pager can find the items which are due
+ * without visiting every item.
+ *
+ * The index is a hint rather than a definitive record: the hash table adds
+ * and removes keys as items are stored and deleted, but callers must check
+ * each key returned by popExpired() against its item, as a key may be
+ * returned after its item has been given a later expiry time by a path
+ * which doesn't remove the old entry (the later time is indexed too).
+ *
+ * Thread safe; guarded by a mutex which is only taken for items which
+ * have (or had) an expiry time.
+ */
+class ExpiryIndex {
+public:
+    ExpiryIndex();
+
+    /**
+     * Move a key from one expiry time to another; either may be 0 (no
+     * expiry time), to only add or only remove it.
+     *
+     * @return the change in the number of entries (-1, 0 or 1)
+     */
+    int update(const DocKey& key, uint32_t oldExptime, uint32_t newExptime);
+
+    /**
+     * Remove and return the keys whose expiry time is before asOf (as for
+     * StoredValue::isExpired()).
+     */
+    std::vector<StoredDocKey> popExpired(time_t asOf);
+
+    /**
+     * Remove every key.
+     *
+     * @return the number of entries removed
+     */
+    size_t clear();
+
+    /**
+     * Returns the number of keys in the index.
+     */
+    size_t size() const {
+        return numEntries.load();
+    }
+
+private:
+    mutable std::mutex mutex;
+    // Keys by the expiry time (in seconds) they're due at.
+    std::map<uint32_t, std::unordered_set<StoredDocKey>> buckets;
+    std::atomic<size_t> numEntries;
+};
@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "flush_batch_sizer.h"
+
+#include <algorithm>
+#include <limits>
+
+const size_t FlushBatchSizer::minBatchSize;
+const double FlushBatchSizer::alpha = 0.25;
+
+FlushBatchSizer::FlushBatchSizer(size_t targetMs)
+    : target(targetMs * 1000000),
+      timePerItem(0),
+      batchSize(0) {
+}
+
+void FlushBatchSizer::setTarget(size_t targetMs) {
+    std::lock_guard<std::mutex> lh(mutex);
+    target = targetMs * 1000000;
+    updateBatchSize_UNLOCKED();
+}
+
+bool FlushBatchSizer::commitCompleted(size_t items, hrtime_t duration) {
+    std::lock_guard<std::mutex> lh(mutex);
+    if (target == 0 || items == 0) {
+        return false;
+    }
+
+    const double sample = static_cast<double>(duration) / items;
+    if (timePerItem == 0) {
+        timePerItem = sample;
+    } else {
+        timePerItem = alpha * sample + (1 - alpha) * timePerItem;
+    }
+    updateBatchSize_UNLOCKED();
+    return duration > target;
+}
+
+void FlushBatchSizer::updateBatchSize_UNLOCKED() {
+    if (target == 0 || timePerItem == 0) {
+        batchSize.store(0);
+        return;
+    }
+    const double size = static_cast<double>(target) / timePerItem;
+    // Clamp before converting, as a tiny estimate makes size huge.
+    batchSize.store(static_cast<size_t>(
+            std::max(static_cast<double>(minBatchSize),
+                     std::min(size, static_cast<double>(
+                             std::numeric_limits<size_t>::max() / 2)))));
+}
@@ -0,0 +1,85 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <platform/platform.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Chooses how many items the flusher takes from a vbucket's checkpoints for
+ * one flush, so that committing the batch takes about a target time.
+ *
+ * Commit time is modelled as proportional to the number of items committed,
+ * using a moving average of the time per item over recent commits. As that
+ * includes each commit's fixed cost spread over its items, smaller batches
+ * see a higher time per item, and the batch size settles where a commit
+ * takes the target time (or at minBatchSize, if even that is too slow).
+ */
+class FlushBatchSizer {
+public:
+    // The smallest batch chosen; below this the fixed cost of a commit
+    // dominates and shrinking the batch further no longer helps latency.
+    static const size_t minBatchSize = 64;
+
+    /**
+     * @param targetMs the target commit time in milliseconds; zero disables
+     *        sizing.
+     */
+    explicit FlushBatchSizer(size_t targetMs);
+
+    void setTarget(size_t targetMs);
+
+    /**
+     * @return the number of items to flush in the next batch, or zero if
+     *         batches are unlimited - sizing is disabled, or no commit has
+     *         been timed yet.
+     */
+    size_t getBatchSize() const {
+        return batchSize.load();
+    }
+
+    /**
+     * Account for a commit of the given number of items.
+     *
+     * @param duration the time taken by the commit, in nanoseconds
+     * @return true if sizing is enabled and the commit took longer than the
+     *         target.
+     */
+    bool commitCompleted(size_t items, hrtime_t duration);
+
+private:
+    // Weight given to the latest commit in the moving average.
+    static const double alpha;
+
+    // Recompute batchSize from the current target and estimate.
+    void updateBatchSize_UNLOCKED();
+
+    std::mutex mutex;
+    // Target commit time in nanoseconds; zero when disabled.
+    hrtime_t target;
+    // Moving average of commit time per item, in nanoseconds; zero until
+    // the first commit is timed.
+    double timePerItem;
+
+    std::atomic<size_t> batchSize;
+};
@@ -18,11 +18,56 @@
 #include "flusher.h"
 
 #include "common.h"
+#include "ep_engine.h"
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <sstream>
 
+extern "C" {
+    static void launch_commit_thread(void *arg) {
+        static_cast<Flusher*>(arg)->runCommitThread();
+    }
+}
+
+Flusher::Flusher(KVBucket* st, KVShard* k, uint16_t commitInt) :
+    store(st), _state(initializing), taskId(0), minSleepTime(0.1),
+    initCommitInterval(commitInt), currCommitInterval(commitInt),
+    forceShutdownReceived(false), doHighPriority(false), numHighPriority(0),
+    pendingMutation(false), shard(k),
+    pipelined(st->getEPEngine().getConfiguration().isFlusherPipelining()),
+    groupCommitLatency(st->getEPEngine().getConfiguration().
+                       getFlusherGroupCommitLatency() * 1000000),
+    commitRequested(false), stopCommitThread(false), uncommittedSince(0),
+    passStart(0) {
+    if (pipelined) {
+        std::string name("mc:commit_" + std::to_string(shard->getId()));
+        name.resize(std::min(name.size(), size_t(15)));
+        if (cb_create_named_thread(&commitThread, launch_commit_thread, this,
+                                   0, name.c_str()) != 0) {
+            throw std::runtime_error("Flusher::Flusher: failed to create the "
+                                     "commit thread");
+        }
+    }
+}
+
+Flusher::~Flusher() {
+    if (_state != stopped) {
+        LOG(EXTENSION_LOG_WARNING, "Flusher being destroyed in state %s",
+            stateName(_state));
+        stop(true);
+    }
+    if (pipelined) {
+        {
+            std::lock_guard<std::mutex> lh(commitSync);
+            stopCommitThread = true;
+            commitSync.notify_all();
+        }
+        cb_join_thread(commitThread);
+    }
+}
+
 
 bool Flusher::stop(bool isForceShutdown) {
     forceShutdownReceived = isForceShutdown;
@@ -182,12 +227,34 @@ bool Flusher::step(GlobalTask *task) {
 
     case running:
         flushVB();
+        if (defersCommits()) {
+            // Carry on through the vbuckets already queued, so commits can
+            // overlap with collecting the next vbucket's items, or group
+            // several vbuckets. Bounded so the task still yields regularly,
+            // and won't spin on a vbucket which has to be retried.
+            for (size_t n = lpVbs.size() + hpVbs.size();
+                 n > 0 && _state == running; --n) {
+                if (groupCommitLatency > 0 && !uncommittedFlushes.empty() &&
+                    gethrtime() - uncommittedSince >= groupCommitLatency) {
+                    commitDeferred();
+                }
+                flushVB();
+            }
+            // Pending flushes hold vbucket locks, which must be released by
+            // this thread; this task may run on another next time.
+            drainPendingCommits();
+        }
         if (_state == running) {
             double tosleep = computeMinSleepTime();
             if (tosleep > 0) {
                 store->commit(shard->getId());
                 resetCommitInterval();
                 task->snooze(tosleep);
+            } else {
+                tosleep = computeGroupCommitWait();
+                if (tosleep > 0) {
+                    task->snooze(tosleep);
+                }
             }
         }
         return true;
@@ -200,6 +267,7 @@ bool Flusher::step(GlobalTask *task) {
             LOG(EXTENSION_LOG_DEBUG, "%s", ss.str().c_str());
         }
         completeFlush();
+        drainPendingCommits();
         store->commit(shard->getId());
         resetCommitInterval();
         LOG(EXTENSION_LOG_DEBUG, "Flusher stopped");
@@ -231,6 +299,21 @@ double Flusher::computeMinSleepTime() {
     return std::min(minSleepTime, DEFAULT_MAX_SLEEP_TIME);
 }
 
+double Flusher::computeGroupCommitWait() {
+    // With group commit, start a pass over the vbuckets at most once per
+    // groupCommitLatency, so that each vbucket's commit covers more items -
+    // unless someone is waiting on persistence.
+    if (groupCommitLatency == 0 || !lpVbs.empty() || !hpVbs.empty() ||
+        shard->highPriorityCount.load() > 0) {
+        return 0;
+    }
+    const hrtime_t elapsed = gethrtime() - passStart;
+    if (elapsed >= groupCommitLatency) {
+        return 0;
+    }
+    return double(groupCommitLatency - elapsed) / 1e9;
+}
+
 uint16_t Flusher::decrCommitInterval(void) {
     --currCommitInterval;
     //When the current commit interval hits zero, then reset the
@@ -257,6 +340,7 @@ void Flusher::flushVB(void) {
         }
         bool inverse = true;
         if (pendingMutation.compare_exchange_strong(inverse, false)) {
+            passStart = gethrtime();
             for (auto vbid : shard->getVBucketsSortedByState()) {
                 lpVbs.push(vbid);
             }
@@ -296,3 +380,82 @@ void Flusher::flushVB(void) {
         }
     }
 }
+
+void Flusher::deferCommit(uint16_t vbid, std::unique_lock<std::mutex> vbLock,
+                          std::function<void()> onComplete) {
+    if (!defersCommits()) {
+        throw std::logic_error("Flusher::deferCommit: commits are not "
+                               "deferred");
+    }
+    if (uncommittedFlushes.empty()) {
+        uncommittedSince = gethrtime();
+    }
+    uncommittedFlushes.push_back(
+            PendingFlush{vbid, std::move(vbLock), std::move(onComplete)});
+    if (groupCommitLatency == 0) {
+        commitDeferred();
+    }
+}
+
+void Flusher::commitDeferred() {
+    if (uncommittedFlushes.empty()) {
+        return;
+    }
+    // Only one commit at a time.
+    completePendingCommit();
+    committingFlushes.swap(uncommittedFlushes);
+
+    if (pipelined) {
+        std::lock_guard<std::mutex> lh(commitSync);
+        commitRequested = true;
+        commitSync.notify_all();
+    } else {
+        store->commit(shard->getId());
+        completePendingCommit();
+    }
+}
+
+void Flusher::completePendingCommit() {
+    if (committingFlushes.empty()) {
+        return;
+    }
+    if (pipelined) {
+        std::unique_lock<std::mutex> lh(commitSync);
+        while (commitRequested) {
+            commitSync.wait(lh);
+        }
+    }
+
+    std::vector<PendingFlush> committed;
+    committed.swap(committingFlushes);
+    for (auto& flush : committed) {
+        flush.onComplete();
+        flush.vbLock.unlock();
+    }
+}
+
+bool Flusher::hasPendingCommitFor(uint16_t vbid) const {
+    auto isVb = [vbid](const PendingFlush& flush) {
+        return flush.vbid == vbid;
+    };
+    return std::any_of(uncommittedFlushes.begin(), uncommittedFlushes.end(),
+                       isVb) ||
+           std::any_of(committingFlushes.begin(), committingFlushes.end(),
+                       isVb);
+}
+
+void Flusher::runCommitThread() {
+    ObjectRegistry::onSwitchThread(&store->getEPEngine());
+    std::unique_lock<std::mutex> lh(commitSync);
+    while (!stopCommitThread) {
+        if (!commitRequested) {
+            commitSync.wait(lh);
+            continue;
+        }
+        lh.unlock();
+        store->commit(shard->getId());
+        lh.lock();
+        commitRequested = false;
+        commitSync.notify_all();
+    }
+}
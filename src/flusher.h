@@ -20,13 +20,17 @@
 
 #include "config.h"
 
+#include <functional>
 #include <list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <string>
+#include <vector>
 
 #include "kv_bucket.h"
 #include "executorthread.h"
+#include "syncobject.h"
 #include "utility.h"
 
 #define NO_VBUCKETS_INSTANTIATED 0xFFFF
@@ -54,19 +58,9 @@ class KVShard;
 class Flusher {
 public:
 
-    Flusher(KVBucket* st, KVShard* k, uint16_t commitInt) :
-        store(st), _state(initializing), taskId(0), minSleepTime(0.1),
-        initCommitInterval(commitInt), currCommitInterval(commitInt),
-        forceShutdownReceived(false), doHighPriority(false), numHighPriority(0),
-        pendingMutation(false), shard(k) { }
-
-    ~Flusher() {
-        if (_state != stopped) {
-            LOG(EXTENSION_LOG_WARNING, "Flusher being destroyed in state %s",
-                stateName(_state));
-            stop(true);
-        }
-    }
+    Flusher(KVBucket* st, KVShard* k, uint16_t commitInt);
+
+    ~Flusher();
 
     bool stop(bool isForceShutdown = false);
     void wait();
@@ -100,6 +94,51 @@ public:
         currCommitInterval = initCommitInterval;
     }
 
+    /**
+     * True if the flusher commits the items written for a vbucket itself,
+     * rather than flushVBucket committing them:
+     * - when pipelined (flusher_pipelining) the shard's commit runs on a
+     *   separate commit thread while the flusher goes on to collect the next
+     *   vbucket's items;
+     * - with group commit (flusher_group_commit_latency) several vbuckets'
+     *   items are written before they are all committed together.
+     */
+    bool defersCommits() const {
+        return pipelined || groupCommitLatency > 0;
+    }
+
+    /**
+     * Defer the commit of the items just written for a vbucket. The given
+     * vbucket lock is held until they have been committed, after which
+     * onComplete is run (on the flusher's thread).
+     */
+    void deferCommit(uint16_t vbid, std::unique_lock<std::mutex> vbLock,
+                     std::function<void()> onComplete);
+
+    /**
+     * Commit the items of any deferred flushes - on the commit thread if
+     * pipelined, leaving completePendingCommit() to complete them.
+     */
+    void commitDeferred();
+
+    /**
+     * Wait for any commit running on the commit thread, then complete its
+     * flushes and release their vbucket locks.
+     */
+    void completePendingCommit();
+
+    /// Commit and complete all deferred flushes.
+    void drainPendingCommits() {
+        commitDeferred();
+        completePendingCommit();
+    }
+
+    /// @return true if a flush of the vbucket awaits its commit.
+    bool hasPendingCommitFor(uint16_t vbid) const;
+
+    // Body of the commit thread.
+    void runCommitThread();
+
 private:
     bool transition_state(enum flusher_state to);
     void flushVB();
@@ -107,6 +146,7 @@ private:
     void initialize();
     void schedule_UNLOCKED();
     double computeMinSleepTime();
+    double computeGroupCommitWait();
 
     const char * stateName(enum flusher_state st) const;
 
@@ -134,6 +174,30 @@ private:
 
     KVShard *shard;
 
+    // A vbucket flush whose items have been written but not yet committed.
+    struct PendingFlush {
+        uint16_t vbid;
+        std::unique_lock<std::mutex> vbLock;
+        std::function<void()> onComplete;
+    };
+
+    const bool pipelined;
+    // Maximum time (ns) deferred flushes wait to be committed together, and
+    // minimum time between starting passes over the shard's vbuckets.
+    const hrtime_t groupCommitLatency;
+    cb_thread_t commitThread;
+    // Guards commitRequested and stopCommitThread, and signals changes to
+    // them.
+    SyncObject commitSync;
+    bool commitRequested;
+    bool stopCommitThread;
+    // Flushes awaiting commit, and those whose commit is running on the
+    // commit thread. Only accessed on the flusher's thread.
+    std::vector<PendingFlush> uncommittedFlushes;
+    std::vector<PendingFlush> committingFlushes;
+    hrtime_t uncommittedSince;
+    hrtime_t passStart;
+
     DISALLOW_COPY_AND_ASSIGN(Flusher);
 };
 
@@ -1672,6 +1672,9 @@ fdb_compact_decision ForestKVStore::compaction_cb(fdb_file_handle* fhandle,
                     comp_ctx->max_purged_seq[vbid] = doc->seqnum;
                 }
 
+                if (comp_ctx->purgedKeyCallback) {
+                    comp_ctx->purgedKeyCallback->callback(vbid, key);
+                }
                 return FDB_CS_DROP_DOC;
             }
 
@@ -1682,6 +1685,9 @@ fdb_compact_decision ForestKVStore::compaction_cb(fdb_file_handle* fhandle,
                     comp_ctx->max_purged_seq[vbid] = doc->seqnum;
                 }
 
+                if (comp_ctx->purgedKeyCallback) {
+                    comp_ctx->purgedKeyCallback->callback(vbid, key);
+                }
                 return FDB_CS_DROP_DOC;
             }
         }
@@ -0,0 +1,159 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "frequency_sketch.h"
+
+#include <algorithm>
+
+const uint8_t FrequencySketch::maxCount;
+const size_t FrequencySketch::minCounters;
+const size_t FrequencySketch::maxCounters;
+const size_t FrequencySketch::bufferSize;
+
+// Spreads threads over the buffers.
+static std::atomic<size_t> nextThreadIndex{0};
+static thread_local const size_t threadIndex = nextThreadIndex++;
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+FrequencySketch::FrequencySketch(size_t counters)
+    : table(roundUpToPowerOfTwo(std::min(std::max(counters, minCounters),
+                                         maxCounters)) /
+            countersPerWord),
+      additions(0),
+      sampleSize(10 * getNumCounters()),
+      agings(0) {
+    for (auto& word : table) {
+        word.store(0, std::memory_order_relaxed);
+    }
+}
+
+FrequencySketch::Positions FrequencySketch::positionsOf(uint32_t hash) const {
+    // Spread the hash over 64 bits (the splitmix64 finaliser), then pick
+    // each counter by double hashing.
+    uint64_t h = hash + 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    const uint64_t stride = (h >> 32) | 1;
+    const uint64_t counterMask = getNumCounters() - 1;
+    Positions positions;
+    for (int i = 0; i < depth; i++) {
+        const uint64_t counter = (h + i * stride) & counterMask;
+        positions.word[i] = counter / countersPerWord;
+        positions.shift[i] = 4 * (counter % countersPerWord);
+    }
+    return positions;
+}
+
+void FrequencySketch::increment(uint32_t hash) {
+    Buffer& buffer = buffers[threadIndex % numBuffers];
+    std::unique_lock<std::mutex> lh(buffer.mutex, std::try_to_lock);
+    if (!lh) {
+        // Another thread is using the buffer; drop the access.
+        return;
+    }
+    buffer.hashes[buffer.count++] = hash;
+    if (buffer.count == bufferSize) {
+        drain(buffer);
+    }
+}
+
+void FrequencySketch::flush() {
+    for (auto& buffer : buffers) {
+        std::lock_guard<std::mutex> lh(buffer.mutex);
+        drain(buffer);
+    }
+}
+
+void FrequencySketch::drain(Buffer& buffer) {
+    for (size_t i = 0; i < buffer.count; i++) {
+        add(buffer.hashes[i]);
+    }
+    // Saturated accesses still count towards the sample, else a sketch
+    // whose counters all saturate would never be halved.
+    additions.fetch_add(buffer.count, std::memory_order_relaxed);
+    buffer.count = 0;
+}
+
+bool FrequencySketch::ageIfDue() {
+    if (additions.load(std::memory_order_relaxed) < sampleSize) {
+        return false;
+    }
+    age();
+    additions.fetch_sub(sampleSize, std::memory_order_relaxed);
+    return true;
+}
+
+void FrequencySketch::add(uint32_t hash) {
+    const Positions positions = positionsOf(hash);
+
+    // Only increment the counters holding the key's current estimate (a
+    // "conservative update"); the others already over-count it, and
+    // leaving them be reduces the over-counting of keys sharing them.
+    uint8_t counts[depth];
+    uint8_t min = maxCount;
+    for (int i = 0; i < depth; i++) {
+        counts[i] = (table[positions.word[i]].load(std::memory_order_relaxed) >>
+                     positions.shift[i]) & 0xf;
+        min = std::min(min, counts[i]);
+    }
+    for (int i = 0; i < depth && min < maxCount; i++) {
+        if (counts[i] != min) {
+            continue;
+        }
+        auto& word = table[positions.word[i]];
+        uint64_t current = word.load(std::memory_order_relaxed);
+        while (((current >> positions.shift[i]) & 0xf) < maxCount &&
+               !word.compare_exchange_weak(
+                       current, current + (uint64_t(1) << positions.shift[i]),
+                       std::memory_order_relaxed)) {
+        }
+    }
+}
+
+uint8_t FrequencySketch::estimate(uint32_t hash) const {
+    const Positions positions = positionsOf(hash);
+    uint8_t min = maxCount;
+    for (int i = 0; i < depth; i++) {
+        const uint8_t count =
+                (table[positions.word[i]].load(std::memory_order_relaxed) >>
+                 positions.shift[i]) & 0xf;
+        min = std::min(min, count);
+    }
+    return min;
+}
+
+void FrequencySketch::age() {
+    for (auto& word : table) {
+        uint64_t current = word.load(std::memory_order_relaxed);
+        while (!word.compare_exchange_weak(
+                current, (current >> 1) & 0x7777777777777777ULL,
+                std::memory_order_relaxed)) {
+        }
+    }
+    ++agings;
+}
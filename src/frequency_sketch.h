@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * An approximate count of how often each key has been accessed recently,
+ * shared by all of a bucket's hash tables (as in TinyLFU).
+ *
+ * A count-min sketch of 4 bit counters: each access increments the
+ * counters at four positions derived from the key's hash, and a key's
+ * estimate is the smallest of its four counters, so it can only be an
+ * over-estimate (by the accesses of keys sharing all four counters).
+ * Counters saturate at maxCount. Once there have been ten accesses per
+ * counter, ageIfDue() (called periodically by a background task) halves
+ * every counter, so that the estimates favour recent accesses and keys
+ * which were only popular long ago fade out.
+ *
+ * Thread safe. As in Caffeine, accesses are first recorded in one of
+ * several small buffers, picked by thread, and are only applied to the
+ * (shared) counters once the buffer fills; an access finding its buffer
+ * in use by another thread is dropped, so under contention the sketch
+ * samples accesses rather than making threads wait.
+ */
+class FrequencySketch {
+public:
+    static const uint8_t maxCount = 15;
+
+    /**
+     * Create a sketch with about the given number of counters (rounded up
+     * to a power of two, and clamped to [minCounters, maxCounters]); there
+     * should be about one per item the bucket holds.
+     */
+    explicit FrequencySketch(size_t counters);
+
+    /**
+     * Record an access to the key with the given hash. It isn't reflected
+     * in the estimates until its buffer fills or is flushed.
+     */
+    void increment(uint32_t hash);
+
+    /**
+     * Apply the accesses held in all the buffers to the counters.
+     */
+    void flush();
+
+    /**
+     * Halve all the counters if there have been enough accesses since they
+     * were last halved.
+     *
+     * @return true if the counters were halved
+     */
+    bool ageIfDue();
+
+    /**
+     * Returns the estimated number of recent accesses to the key with the
+     * given hash, between 0 and maxCount.
+     */
+    uint8_t estimate(uint32_t hash) const;
+
+    size_t getNumCounters() const {
+        return table.size() * countersPerWord;
+    }
+
+    /**
+     * Returns the number of times the counters have been halved.
+     */
+    size_t getNumAgings() const {
+        return agings.load();
+    }
+
+    static const size_t minCounters = 1024;
+    static const size_t maxCounters = size_t(1) << 28;
+
+    // Accesses a buffer holds before they're applied to the counters.
+    static const size_t bufferSize = 16;
+
+private:
+    static const size_t countersPerWord = 16;
+    static const int depth = 4;
+    static const size_t numBuffers = 64;
+
+    // Accesses recorded by the threads using a buffer, not yet applied.
+    struct Buffer {
+        std::mutex mutex;
+        size_t count = 0;
+        uint32_t hashes[bufferSize];
+    };
+
+    // The positions of a key's counters.
+    struct Positions {
+        size_t word[depth];
+        int shift[depth];
+    };
+
+    Positions positionsOf(uint32_t hash) const;
+
+    // Apply one access to the counters.
+    void add(uint32_t hash);
+
+    // Apply and empty the buffer's accesses; its mutex must be held.
+    void drain(Buffer& buffer);
+
+    // Halve all the counters.
+    void age();
+
+    std::vector<std::atomic<uint64_t>> table;
+    Buffer buffers[numBuffers];
+    // Accesses recorded since the counters were last halved.
+    std::atomic<size_t> additions;
+    size_t sampleSize;
+    std::atomic<size_t> agings;
+};
@@ -17,7 +17,13 @@
 
 #include "hash_table.h"
 
+#include "ep_time.h"
+#include "epoch_manager.h"
+
+#include <platform/make_unique.h>
+
 #include <cstring>
+#include <new>
 
 #ifndef DEFAULT_HT_SIZE
 #define DEFAULT_HT_SIZE 1531
@@ -25,6 +31,7 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+const hrtime_t HashTable::maxResizePinDuration = 60ULL * 1000 * 1000 * 1000;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3079, 6143, 12289, 24571, 49157,
@@ -39,7 +46,10 @@ std::ostream& operator<<(std::ostream& os, const HashTable::Position& pos) {
     return os;
 }
 
-HashTable::HashTable(EPStats &st, size_t s, size_t l)
+HashTable::HashTable(EPStats &st, size_t s, size_t l, Layout layout_,
+                     bool useSlabAllocator, size_t inlineValueSize,
+                     bool optimisticReads_,
+                     bool useExpiryIndex)
     : maxDeletedRevSeqno(0),
       numTotalItems(0),
       numNonResidentItems(0),
@@ -47,17 +57,52 @@ HashTable::HashTable(EPStats &st, size_t s, size_t l)
       memSize(0),
       cacheSize(0),
       metaDataMemory(0),
+      layout(layout_),
+      values(nullptr),
+      fpValues(nullptr),
+      fpValuesAlloc(nullptr),
+      oldSize(0),
+      resizeCursor(0),
+      oldValues(nullptr),
+      oldFpValues(nullptr),
+      oldFpValuesAlloc(nullptr),
+      numOverflowBuckets(0),
       stats(st),
-      valFact(st),
+      slabAllocator(useSlabAllocator ? std::make_unique<SlabAllocator>()
+                                     : nullptr),
+      valFact(st, slabAllocator.get(), inlineValueSize),
+      // Fingerprint buckets are updated in place (slots are moved around
+      // on removal), which optimistic readers can't follow safely.
+      optimisticReads(optimisticReads_ && layout_ == Layout::Chained),
+      expiryIndex(useExpiryIndex ? std::make_unique<ExpiryIndex>() : nullptr),
+      retiresSinceReclaim(0),
+      retiredBytes(0),
       visitors(0),
+      resizePins(0),
+      resizePinTime(0),
+      resizePinEpoch(0),
+      pinnedLowSeqno(std::numeric_limits<uint64_t>::max()),
+      pinnedHighSeqno(0),
       numItems(0),
       numResizes(0),
+      numResizeSteps(0),
+      resizePauseTotal(0),
+      resizePauseMax(0),
       numTempItems(0)
 {
     size = HashTable::getNumBuckets(s);
+    if (s == 0) {
+        // The default number of buckets assumes one StoredValue per bucket.
+        size = scaleForLayout(size);
+    }
     n_locks = HashTable::getNumLocks(l);
-    values = static_cast<StoredValue**>(cb_calloc(size, sizeof(StoredValue*)));
-    mutexes = new std::mutex[n_locks];
+    if (layout == Layout::Chained) {
+        values = static_cast<StoredValue**>(cb_calloc(size,
+                                                      sizeof(StoredValue*)));
+    } else {
+        fpValues = allocateFingerprintBuckets(size, fpValuesAlloc);
+    }
+    mutexes = new BucketMutex[n_locks];
     activeState = true;
 }
 
@@ -71,9 +116,22 @@ HashTable::~HashTable() {
         usleep(100);
 #endif
     }
+    {
+        // No readers remain once the HashTable is being destroyed.
+        std::lock_guard<std::mutex> lh(retiredMutex);
+        reclaimRetired(true);
+    }
     delete []mutexes;
     cb_free(values);
     values = NULL;
+    cb_free(fpValuesAlloc);
+    fpValues = nullptr;
+    fpValuesAlloc = nullptr;
+    cb_free(oldValues);
+    oldValues = nullptr;
+    cb_free(oldFpValuesAlloc);
+    oldFpValues = nullptr;
+    oldFpValuesAlloc = nullptr;
 }
 
 void HashTable::clear(bool deactivate) {
@@ -86,16 +144,28 @@ void HashTable::clear(bool deactivate) {
                     "non-active object");
         }
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    MultiLockHolder<BucketMutex> mlh(mutexes, n_locks);
     if (deactivate) {
         setActiveState(false);
     }
-    for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
+    // Includes the old array buckets of any in-progress resize; the
+    // (now empty) old array is freed once the resize completes.
+    for (int i = 0; i < (int)bucketsEnd(); i++) {
+        forEachInBucket(i, [this, &rv](StoredValue* v) {
             rv.visit(v);
-            values[i] = v->next;
-            delete v;
+            retireStoredValue(v);
+            return true;
+        });
+        if (layout == Layout::Chained) {
+            chainHead(i) = nullptr;
+        }
+    }
+    if (layout == Layout::Fingerprint) {
+        freeOverflowBuckets(fpValues, size);
+        std::memset(fpValues, 0, size * sizeof(FingerprintBucket));
+        if (oldFpValues) {
+            freeOverflowBuckets(oldFpValues, oldSize);
+            std::memset(oldFpValues, 0, oldSize * sizeof(FingerprintBucket));
         }
     }
 
@@ -107,6 +177,39 @@ void HashTable::clear(bool deactivate) {
     numNonResidentItems.store(0);
     memSize.store(0);
     cacheSize.store(0);
+    if (expiryIndex) {
+        stats.expiryIndexSize.fetch_sub(expiryIndex->clear());
+    }
+
+    {
+        std::lock_guard<std::mutex> lh(retiredMutex);
+        reclaimRetired(false);
+    }
+
+    // Every StoredValue has gone; hand the slabs back (e.g. when a deleted
+    // vbucket's memory is reclaimed by VBucketMemoryDeletionTask).
+    if (slabAllocator) {
+        slabAllocator->releaseUnusedSlabs();
+    }
+}
+
+/**
+ * Read a field which a bucket lock holder may be writing concurrently (for
+ * seqlock readers, which validate what they read afterwards).
+ */
+template <typename T>
+static T loadRelaxed(const T& field) {
+    static_assert(sizeof(std::atomic<T>) == sizeof(T),
+                  "loadRelaxed: std::atomic<T> must have the layout of T");
+    return reinterpret_cast<const std::atomic<T>&>(field).load(
+            std::memory_order_relaxed);
+}
+
+/// Copy bytes with relaxed loads; see loadRelaxed().
+static void copyRelaxed(char* dest, const char* src, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dest[i] = loadRelaxed(src[i]);
+    }
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -123,7 +226,16 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
 }
 
 void HashTable::resize() {
-    size_t ni = getNumInMemoryItems();
+    resize(getAutoResizeSize());
+}
+
+bool HashTable::startIncrementalResize() {
+    return startIncrementalResize(getAutoResizeSize());
+}
+
+size_t HashTable::getAutoResizeSize() {
+    size_t ni = scaleForLayout(getNumInMemoryItems());
+    const size_t minSize = scaleForLayout(defaultNumBuckets);
     int i(0);
     size_t new_size(0);
 
@@ -136,9 +248,9 @@ void HashTable::resize() {
     if (prime_size_table[i] == -1) {
         // We're at the end, take the biggest
         new_size = prime_size_table[i-1];
-    } else if (prime_size_table[i] < static_cast<ssize_t>(defaultNumBuckets)) {
+    } else if (prime_size_table[i] < static_cast<ssize_t>(minSize)) {
         // Was going to be smaller than the configured ht_size.
-        new_size = defaultNumBuckets;
+        new_size = minSize;
     } else if (0 == i) {
         new_size = prime_size_table[i];
     }else if (isCurrently(size, prime_size_table[i-1], prime_size_table[i])) {
@@ -150,67 +262,173 @@ void HashTable::resize() {
         new_size = nearest(ni, prime_size_table[i-1], prime_size_table[i]);
     }
 
-    resize(new_size);
+    return new_size;
 }
 
 void HashTable::resize(size_t newSize) {
+    if (startIncrementalResize(newSize)) {
+        continueResize(std::numeric_limits<size_t>::max());
+    }
+}
+
+bool HashTable::startIncrementalResize(size_t newSize) {
     if (!isActive()) {
-        throw std::logic_error("HashTable::resize: Cannot call on a "
-                "non-active object");
+        throw std::logic_error("HashTable::startIncrementalResize: Cannot "
+                "call on a non-active object");
     }
 
     // Due to the way hashing works, we can't fit anything larger than
     // an int.
     if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
-        return;
+        return false;
     }
 
     // Don't resize to the same size, either.
     if (newSize == size) {
-        return;
+        return false;
+    }
+
+    // Get a place for the new items before taking the locks.
+    StoredValue** newValues = nullptr;
+    FingerprintBucket* newFpValues = nullptr;
+    void* newFpValuesAlloc = nullptr;
+    if (layout == Layout::Chained) {
+        newValues = static_cast<StoredValue**>(cb_calloc(newSize,
+                                                     sizeof(StoredValue*)));
+    } else {
+        newFpValues = allocateFingerprintBuckets(newSize, newFpValuesAlloc);
+    }
+    // If we can't allocate memory, don't move stuff around.
+    if (!newValues && !newFpValues) {
+        return false;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
-    if (visitors.load() > 0) {
+    MultiLockHolder<BucketMutex> mlh(mutexes, n_locks);
+    if (visitors.load() > 0 || isResizePinned() || newSize == size) {
         // Do not allow a resize while any visitors are actually
-        // processing.  The next attempt will have to pick it up.  New
-        // visitors cannot start doing meaningful work (we own all
-        // locks at this point).
-        return;
+        // processing (or part way through a pass).  The next attempt will
+        // have to pick it up.  New visitors cannot start doing meaningful
+        // work (we own all locks at this point).
+        cb_free(newValues);
+        cb_free(newFpValuesAlloc);
+        return false;
     }
+    const hrtime_t start = gethrtime();
 
-    // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(cb_calloc(newSize,
-                                                        sizeof(StoredValue*)));
-    // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
-        return;
+    // Only one old array is tracked, so finish off any resize which is
+    // already in progress.
+    if (isResizing()) {
+        migrateBuckets(oldSize);
     }
 
     stats.memOverhead->fetch_sub(memorySize());
     ++numResizes;
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
+    // The current array becomes the old array; everything in it is
+    // found there until its bucket is migrated.
+    resizeCursor.store(0);
+    oldValues = values.load();
+    oldFpValues = fpValues;
+    oldFpValuesAlloc = fpValuesAlloc;
+    oldSize.store(size);
+
+    values = newValues;
+    fpValues = newFpValues;
+    fpValuesAlloc = newFpValuesAlloc;
     size.store(newSize);
 
-    // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
+    stats.memOverhead->fetch_add(memorySize());
+
+    if (bucketsEnd() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        // Old array bucket numbers wouldn't fit in an int; migrate
+        // everything now.
+        migrateBuckets(oldSize);
+    }
+
+    recordResizePause(start);
+    return true;
+}
 
-            int newBucket = getBucketForHash(v->getKey().hash());
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+size_t HashTable::continueResize(size_t maxBuckets) {
+    if (!isActive() || !isResizing()) {
+        return 0;
+    }
+
+    MultiLockHolder<BucketMutex> mlh(mutexes, n_locks);
+    if (visitors.load() > 0 || isResizePinned()) {
+        // Visitors rely on the set of buckets not changing under them.
+        return 0;
+    }
+    const hrtime_t start = gethrtime();
+    const size_t migrated = migrateBuckets(maxBuckets);
+    recordResizePause(start);
+    return migrated;
+}
+
+size_t HashTable::migrateBuckets(size_t maxBuckets) {
+    const size_t begin = resizeCursor;
+    const size_t end = (oldSize - begin > maxBuckets) ? begin + maxBuckets
+                                                      : oldSize.load();
+
+    for (size_t i = begin; i < end; ++i) {
+        if (layout == Layout::Chained) {
+            StoredValue*& head = oldValues.load(std::memory_order_relaxed)[i];
+            while (head) {
+                StoredValue *v = head;
+                head = v->next;
+                linkIntoBucket(v, getCurrentArrayBucketForHash(
+                                          v->getKey().hash()));
+            }
+        } else {
+            for (FingerprintBucket* fb = &oldFpValues[i]; fb;
+                 fb = fb->overflow) {
+                for (size_t slot = 0; slot < fb->used; ++slot) {
+                    StoredValue* v = fb->slots[slot];
+                    linkIntoBucket(v, getCurrentArrayBucketForHash(
+                                              v->getKey().hash()));
+                }
+            }
+            freeOverflowBuckets(&oldFpValues[i], 1);
+            std::memset(&oldFpValues[i], 0, sizeof(FingerprintBucket));
         }
     }
+    resizeCursor.store(end);
+
+    if (end == oldSize) {
+        // All migrated; the old array is now empty.
+        stats.memOverhead->fetch_sub(memorySize());
+        retireArray(oldValues, oldSize * sizeof(StoredValue*));
+        oldValues = nullptr;
+        cb_free(oldFpValuesAlloc);
+        oldFpValues = nullptr;
+        oldFpValuesAlloc = nullptr;
+        resizeCursor.store(0);
+        oldSize.store(0);
+        stats.memOverhead->fetch_add(memorySize());
+    }
 
-    // values still points to the old (now empty) table.
-    cb_free(values);
-    values = newValues;
+    return end - begin;
+}
 
-    stats.memOverhead->fetch_add(memorySize());
+bool HashTable::isResizePinned() {
+    if (resizePins == 0) {
+        return false;
+    }
+    if (gethrtime() - resizePinTime < maxResizePinDuration) {
+        return true;
+    }
+    // The paused passes haven't been resumed; don't let them hold up
+    // resizing forever. They restart when resumed if buckets were moved.
+    resizePins = 0;
+    ++resizePinEpoch;
+    return false;
+}
+
+void HashTable::recordResizePause(hrtime_t start) {
+    const uint64_t pause = (gethrtime() - start) / 1000;
+    ++numResizeSteps;
+    resizePauseTotal.fetch_add(pause);
+    atomic_setIfBigger(resizePauseMax, pause);
 }
 
 StoredValue* HashTable::find(const DocKey& key, bool trackReference,
@@ -220,19 +438,146 @@ StoredValue* HashTable::find(const DocKey& key, bool trackReference,
                 "non-active object");
     }
     int bucket_num(0);
-    std::unique_lock<std::mutex> lh = getLockedBucket(key, &bucket_num);
+    HashBucketLock lh = getLockedBucket(key, &bucket_num);
     return unlocked_find(key, bucket_num, wantsDeleted, trackReference);
 }
 
+Item* HashTable::optimisticGet(const DocKey& key,
+                               uint16_t vbucket,
+                               bool trackReference,
+                               bool hideLockedCas) {
+    if (!optimisticReads || !isActive()) {
+        return nullptr;
+    }
+    // Anything we reach without the lock stays allocated until the guard
+    // is released.
+    EpochManager::ReadGuard guard;
+    if (!guard) {
+        return nullptr;
+    }
+
+    const int h = key.hash();
+    const int bucket_num = getBucketForHash(h);
+    const BucketMutex& mutex = mutexes[mutexForBucket(bucket_num)];
+    const uint64_t seq = mutex.readBegin();
+    if (seq & 1) {
+        // A writer holds the lock.
+        return nullptr;
+    }
+    // A resize may have completed a step between choosing the lock and
+    // reading its sequence number; if so the key may now live elsewhere.
+    if (getBucketForHash(h) != bucket_num ||
+        &mutexes[mutexForBucket(bucket_num)] != &mutex) {
+        return nullptr;
+    }
+
+    // resize() swaps the bucket arrays, so one read here may not match the
+    // size read; only index it once the sequence number shows no resize
+    // ran since readBegin(). Retired arrays stay allocated under the guard.
+    const size_t b = static_cast<size_t>(bucket_num);
+    const size_t curSize = size.load();
+    StoredValue** array = (b < curSize ? values : oldValues)
+                                  .load(std::memory_order_acquire);
+    if (array == nullptr || !mutex.readValidate(seq)) {
+        return nullptr;
+    }
+
+    // Keys are immutable, so only the links need reading atomically.
+    StoredValue* v = loadRelaxed(array[b < curSize ? b : b - curSize]);
+    for (size_t steps = 0; v && !v->hasKey(key); v = loadRelaxed(v->next)) {
+        // A chain can't be this long in a consistent table state.
+        if (++steps == maxOptimisticChainLength) {
+            return nullptr;
+        }
+    }
+    if (!v) {
+        return nullptr;
+    }
+
+    // Copy the fields needed one at a time; none of them can be trusted
+    // until validated against the lock's sequence number.
+    struct {
+        uint32_t flags;
+        uint32_t exptime;
+        uint64_t cas;
+        uint64_t revSeqno;
+        int64_t bySeqno;
+        rel_time_t lockExpiry;
+        StoredValue::Bits bits;
+        Blob* blob;
+        StoredValue::InlineValueHeader inlineHeader;
+        char inlineData[std::numeric_limits<uint8_t>::max()];
+    } snapshot;
+    snapshot.flags = loadRelaxed(v->flags);
+    snapshot.exptime = loadRelaxed(v->exptime);
+    snapshot.cas = loadRelaxed(v->cas);
+    snapshot.revSeqno = loadRelaxed(v->revSeqno);
+    snapshot.bySeqno = loadRelaxed(v->bySeqno);
+    snapshot.lockExpiry = loadRelaxed(v->lock_expiry);
+    snapshot.bits = loadRelaxed(v->bits);
+    snapshot.blob = v->value.getRelaxed();
+    if (snapshot.bits.hasInlineStorage && snapshot.bits.valueInline) {
+        const char* storage = v->inlineStorage();
+        copyRelaxed(reinterpret_cast<char*>(&snapshot.inlineHeader), storage,
+                    sizeof(snapshot.inlineHeader));
+        copyRelaxed(snapshot.inlineData,
+                    storage + sizeof(snapshot.inlineHeader),
+                    std::min<size_t>(snapshot.inlineHeader.length,
+                                     sizeof(snapshot.inlineData)));
+    }
+
+    if (!mutex.readValidate(seq)) {
+        return nullptr;
+    }
+
+    // Leave anything which needs the StoredValue updating (expiry,
+    // reference tracking), a background fetch or special handling of
+    // deleted and temp items to the locked path.
+    if (snapshot.bits.deleted ||
+        snapshot.bySeqno == StoredValue::state_deleted_key ||
+        snapshot.bySeqno == StoredValue::state_non_existent_key ||
+        snapshot.bySeqno == StoredValue::state_temp_init) {
+        return nullptr;
+    }
+    if (!snapshot.bits.valueInline && snapshot.blob == nullptr) {
+        return nullptr;
+    }
+    if (snapshot.exptime != 0 && snapshot.exptime < ep_real_time()) {
+        return nullptr;
+    }
+    if (trackReference && snapshot.bits.nru > MIN_NRU_VALUE) {
+        return nullptr;
+    }
+
+    if (trackReference && frequencySketch) {
+        frequencySketch->increment(h);
+    }
+
+    const bool locked = snapshot.lockExpiry != 0 &&
+                        ep_current_time() <= snapshot.lockExpiry;
+    value_t value = snapshot.bits.valueInline
+                            ? StoredValue::makeInlineValue(
+                                      snapshot.inlineHeader,
+                                      snapshot.inlineData)
+                            : value_t(snapshot.blob);
+    Item* itm = new Item(key, snapshot.flags, snapshot.exptime, value,
+                         (hideLockedCas && locked) ? static_cast<uint64_t>(-1)
+                                                   : snapshot.cas,
+                         snapshot.bySeqno, vbucket, snapshot.revSeqno);
+    itm->setNRUValue(snapshot.bits.nru);
+    return itm;
+}
+
 Item* HashTable::getRandomKey(long rnd) {
-    /* Try to locate a partition */
-    size_t start = rnd % size;
+    /* Try to locate a partition (in either array during a resize) */
+    const size_t end = bucketsEnd();
+    size_t start = rnd % end;
     size_t curr = start;
     Item *ret;
 
     do {
         ret = getRandomKeyFromSlot(curr++);
-        if (curr == size) {
+        if (curr == end) {
             curr = 0;
         }
     } while (ret == NULL && curr != start);
@@ -247,7 +592,7 @@ MutationStatus HashTable::set(Item& val,
     }
 
     int bucket_num(0);
-    std::unique_lock<std::mutex> lh = getLockedBucket(val.getKey(), &bucket_num);
+    HashBucketLock lh = getLockedBucket(val.getKey(), &bucket_num);
     StoredValue* v = unlocked_find(val.getKey(), bucket_num, true, false);
     if (v) {
         return unlocked_updateStoredValue(lh, *v, val, preserveRevSeqno);
@@ -258,7 +603,7 @@ MutationStatus HashTable::set(Item& val,
 }
 
 MutationStatus HashTable::unlocked_updateStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashBucketLock& htLock,
         StoredValue& v,
         Item& itm,
         const PreserveRevSeqno preserveRevSeqno) {
@@ -286,12 +631,14 @@ MutationStatus HashTable::unlocked_updateStoredValue(
         ++numTotalItems;
     }
 
+    const uint32_t oldExptime = v.getExptime();
     v.setValue(itm, *this, preserveRevSeqno);
+    updateExpiryIndex(v, oldExptime);
     return status;
 }
 
 StoredValue* HashTable::unlocked_addNewStoredValue(
-        const std::unique_lock<std::mutex>& htLock, Item& itm) {
+        const HashBucketLock& htLock, Item& itm) {
     if (!htLock) {
         throw std::invalid_argument(
                 "HashTable::unlocked_addNewStoredValue: htLock "
@@ -305,8 +652,8 @@ StoredValue* HashTable::unlocked_addNewStoredValue(
     }
 
     int bucket_num = getBucketForHash(itm.getKey().hash());
-    StoredValue* v = valFact(itm, values[bucket_num], *this);
-    values[bucket_num] = v;
+    StoredValue* v = valFact(itm, nullptr, *this);
+    linkIntoBucket(v, bucket_num);
 
     if (v->isTempItem()) {
         ++numTempItems;
@@ -314,17 +661,19 @@ StoredValue* HashTable::unlocked_addNewStoredValue(
         ++numItems;
         ++numTotalItems;
     }
+    updateExpiryIndex(*v, 0);
 
     return v;
 }
 
-void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
+void HashTable::unlocked_softDelete(const HashBucketLock& htLock,
                                     StoredValue& v,
                                     bool onlyMarkDeleted) {
     if (!v.isResident() && !v.isDeleted() && !v.isTempItem()) {
         decrNumNonResidentItems();
     }
 
+    const uint32_t oldExptime = v.getExptime();
     if (onlyMarkDeleted) {
         v.markDeleted();
     } else {
@@ -335,28 +684,207 @@ void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
         }
         v.del(*this);
     }
+    updateExpiryIndex(v, oldExptime);
+}
+
+void HashTable::unlocked_setExptime(const HashBucketLock& htLock,
+                                    StoredValue& v,
+                                    time_t exptime) {
+    if (!htLock) {
+        throw std::invalid_argument(
+                "HashTable::unlocked_setExptime: htLock "
+                "not held");
+    }
+
+    const uint32_t oldExptime = v.getExptime();
+    v.setExptime(exptime);
+    updateExpiryIndex(v, oldExptime);
+}
+
+void HashTable::updateExpiryIndex(const StoredValue& v,
+                                  uint32_t oldExptime,
+                                  bool removed) {
+    if (!expiryIndex) {
+        return;
+    }
+    const uint32_t exptime = (removed || v.isDeleted() || v.isTempItem())
+                                     ? 0
+                                     : v.getExptime();
+    const int change = expiryIndex->update(v.getKey(), oldExptime, exptime);
+    if (change > 0) {
+        stats.expiryIndexSize.fetch_add(change);
+    } else if (change < 0) {
+        stats.expiryIndexSize.fetch_sub(-change);
+    }
+}
+
+std::vector<StoredDocKey> HashTable::popExpiredKeys(time_t asOf) {
+    if (!expiryIndex) {
+        return {};
+    }
+    auto keys = expiryIndex->popExpired(asOf);
+    stats.expiryIndexSize.fetch_sub(keys.size());
+    return keys;
 }
 
 StoredValue* HashTable::unlocked_find(const DocKey& key, int bucket_num,
                                       bool wantsDeleted, bool trackReference) {
-    StoredValue *v = values[bucket_num];
-    while (v) {
-        if (v->hasKey(key)) {
-            if (trackReference && !v->isDeleted()) {
-                v->referenced();
-            }
-            if (wantsDeleted || !v->isDeleted()) {
+    StoredValue* v = findInBucket(key, bucket_num);
+    if (!v) {
+        return NULL;
+    }
+    if (trackReference && !v->isDeleted()) {
+        v->referenced();
+        if (frequencySketch) {
+            frequencySketch->increment(key.hash());
+        }
+    }
+    if (wantsDeleted || !v->isDeleted()) {
+        return v;
+    }
+    return NULL;
+}
+
+StoredValue* HashTable::findInBucket(const DocKey& key, int bucket_num) {
+    if (layout == Layout::Chained) {
+        for (StoredValue* v = chainHead(bucket_num); v; v = v->next) {
+            if (v->hasKey(key)) {
                 return v;
-            } else {
-                return NULL;
             }
         }
-        v = v->next;
+        return nullptr;
     }
-    return NULL;
+
+    // Only dereference StoredValues whose fingerprint matches; in the
+    // common case the key is only compared once.
+    const uint8_t fp = fingerprintOf(key.hash());
+    for (FingerprintBucket* fb = &fingerprintBucket(bucket_num); fb;
+         fb = fb->overflow) {
+        for (size_t i = 0; i < fb->used; ++i) {
+            if (fb->fingerprints[i] == fp && fb->slots[i]->hasKey(key)) {
+                return fb->slots[i];
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool HashTable::isBucketEmpty(int bucket_num) {
+    if (layout == Layout::Chained) {
+        return chainHead(bucket_num) == nullptr;
+    }
+    return fingerprintBucket(bucket_num).used == 0 &&
+           fingerprintBucket(bucket_num).overflow == nullptr;
+}
+
+void HashTable::linkIntoBucket(StoredValue* v, int bucket_num) {
+    if (layout == Layout::Chained) {
+        StoredValue*& head = chainHead(bucket_num);
+        v->next = head;
+        head = v;
+        return;
+    }
+
+    FingerprintBucket* fb = &fingerprintBucket(bucket_num);
+    while (fb->used == FingerprintBucket::slotsPerBucket) {
+        if (!fb->overflow) {
+            fb->overflow = static_cast<FingerprintBucket*>(
+                    cb_calloc(1, sizeof(FingerprintBucket)));
+            if (!fb->overflow) {
+                throw std::bad_alloc();
+            }
+            ++numOverflowBuckets;
+            stats.memOverhead->fetch_add(sizeof(FingerprintBucket));
+        }
+        fb = fb->overflow;
+    }
+    fb->fingerprints[fb->used] = fingerprintOf(v->getKey().hash());
+    fb->slots[fb->used] = v;
+    ++fb->used;
+}
+
+bool HashTable::unlinkFromBucket(StoredValue* v, int bucket_num) {
+    if (layout == Layout::Chained) {
+        StoredValue*& head = chainHead(bucket_num);
+        StoredValue* curr = head;
+        if (curr == v) {
+            head = v->next;
+            return true;
+        }
+        while (curr && curr->next) {
+            if (curr->next == v) {
+                curr->next = v->next;
+                return true;
+            }
+            curr = curr->next;
+        }
+        return false;
+    }
+
+    FingerprintBucket* prev = nullptr;
+    for (FingerprintBucket* fb = &fingerprintBucket(bucket_num); fb;
+         prev = fb, fb = fb->overflow) {
+        for (size_t i = 0; i < fb->used; ++i) {
+            if (fb->slots[i] != v) {
+                continue;
+            }
+            // Fill the hole with the last entry of this cache line.
+            const size_t last = fb->used - 1;
+            fb->fingerprints[i] = fb->fingerprints[last];
+            fb->slots[i] = fb->slots[last];
+            fb->slots[last] = nullptr;
+            --fb->used;
+
+            // Release overflow buckets as soon as they become empty; the
+            // first bucket is part of the table itself.
+            if (fb->used == 0 && prev) {
+                prev->overflow = fb->overflow;
+                cb_free(fb);
+                --numOverflowBuckets;
+                stats.memOverhead->fetch_sub(sizeof(FingerprintBucket));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+HashTable::FingerprintBucket* HashTable::allocateFingerprintBuckets(
+        size_t n, void*& alloc) {
+    // Over-allocate by one bucket so the array can start on a cache line
+    // boundary.
+    const uintptr_t lineSize = sizeof(FingerprintBucket);
+    alloc = cb_calloc(n + 1, sizeof(FingerprintBucket));
+    if (!alloc) {
+        return nullptr;
+    }
+    uintptr_t addr = reinterpret_cast<uintptr_t>(alloc);
+    addr = (addr + lineSize - 1) & ~(lineSize - 1);
+    return reinterpret_cast<FingerprintBucket*>(addr);
 }
 
-void HashTable::unlocked_del(const std::unique_lock<std::mutex>& htLock,
+void HashTable::freeOverflowBuckets(FingerprintBucket* buckets, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        FingerprintBucket* fb = buckets[i].overflow;
+        buckets[i].overflow = nullptr;
+        while (fb) {
+            FingerprintBucket* next = fb->overflow;
+            cb_free(fb);
+            --numOverflowBuckets;
+            stats.memOverhead->fetch_sub(sizeof(FingerprintBucket));
+            fb = next;
+        }
+    }
+}
+
+size_t HashTable::scaleForLayout(size_t n) const {
+    if (layout == Layout::Fingerprint) {
+        return std::max(n / fingerprintTargetDepth, size_t(1));
+    }
+    return n;
+}
+
+void HashTable::unlocked_del(const HashBucketLock& htLock,
                              const DocKey& key,
                              int bucket_num) {
     if (!htLock) {
@@ -369,50 +897,86 @@ void HashTable::unlocked_del(const std::unique_lock<std::mutex>& htLock,
         throw std::logic_error("HashTable::unlocked_del: Cannot call on a "
                 "non-active object");
     }
-    StoredValue *v = values[bucket_num];
 
     // Special case empty bucket.
-    if (!v) {
+    if (isBucketEmpty(bucket_num)) {
         return;
     }
 
-    // Special case the first one
-    if (v->hasKey(key)) {
-        values[bucket_num] = v->next;
-        StoredValue::reduceCacheSize(*this, v->size());
-        StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
-        if (v->isTempItem()) {
-            --numTempItems;
-        } else {
-            decrNumItems();
-            decrNumTotalItems();
-        }
-        delete v;
-        return;
+    StoredValue* v = findInBucket(key, bucket_num);
+    if (!v) {
+        /* We must delete the StoredValue in the HashTable */
+        throw std::logic_error(
+                "HashTable::unlocked_del: StoredValue to be deleted "
+                "not found in HashTable; possibly HashTable leak");
     }
 
-    while (v->next) {
-        if (v->next->hasKey(key)) {
-            StoredValue *tmp = v->next;
-            v->next = v->next->next;
-            StoredValue::reduceCacheSize(*this, tmp->size());
-            StoredValue::reduceMetaDataSize(*this, stats, tmp->metaDataSize());
-            if (tmp->isTempItem()) {
-                --numTempItems;
-            } else {
-                decrNumItems();
-                decrNumTotalItems();
-            }
-            delete tmp;
-            return;
-        } else {
-            v = v->next;
+    unlinkFromBucket(v, bucket_num);
+    updateExpiryIndex(*v, v->getExptime(), /*removed*/ true);
+    StoredValue::reduceCacheSize(*this, v->size());
+    StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
+    if (v->isTempItem()) {
+        --numTempItems;
+    } else {
+        decrNumItems();
+        decrNumTotalItems();
+    }
+    retireStoredValue(v);
+}
+
+void HashTable::retireValue(const value_t& value) {
+    if (optimisticReads && value) {
+        retire({0, value->getSize(), nullptr, value, nullptr});
+    }
+}
+
+void HashTable::retireStoredValue(StoredValue* v) {
+    if (optimisticReads) {
+        retire({0, v->size(), v, value_t(), nullptr});
+    } else {
+        valFact.destroy(v);
+    }
+}
+
+void HashTable::retireArray(void* array, size_t bytes) {
+    if (optimisticReads && array) {
+        retire({0, bytes, nullptr, value_t(), array});
+    } else {
+        cb_free(array);
+    }
+}
+
+void HashTable::retire(RetiredObject&& object) {
+    std::lock_guard<std::mutex> lh(retiredMutex);
+    // Stamp under retiredMutex so the list stays in stamp order.
+    object.stamp = EpochManager::get().retire();
+    retiredBytes.fetch_add(object.bytes);
+    stats.memOverhead->fetch_add(object.bytes);
+    retired.push_back(std::move(object));
+    if (++retiresSinceReclaim >= retireReclaimInterval) {
+        reclaimRetired(false);
+    }
+}
+
+void HashTable::reclaimRetired() {
+    std::lock_guard<std::mutex> lh(retiredMutex);
+    reclaimRetired(false);
+}
+
+void HashTable::reclaimRetired(bool force) {
+    retiresSinceReclaim = 0;
+    const uint64_t safeEpoch = EpochManager::get().getSafeEpoch();
+    while (!retired.empty() && (force || retired.front().stamp <= safeEpoch)) {
+        RetiredObject& object = retired.front();
+        if (object.storedValue) {
+            valFact.destroy(object.storedValue);
         }
+        cb_free(object.array);
+        retiredBytes.fetch_sub(object.bytes);
+        stats.memOverhead->fetch_sub(object.bytes);
+        // Releases our reference to any value.
+        retired.pop_front();
     }
-    /* We cannot reach here, we must delete the StoredValue in the HashTable */
-    throw std::logic_error(
-            "HashTable::unlocked_del: StoredValue to be deleted "
-            "not found in HashTable; possibly HashTable leak");
 }
 
 void HashTable::visit(HashTableVisitor &visitor) {
@@ -423,41 +987,56 @@ void HashTable::visit(HashTableVisitor &visitor) {
     // Acquire one (any) of the mutexes before incrementing {visitors}, this
     // prevents any race between this visitor and the HashTable resizer.
     // See comments in pauseResumeVisit() for further details.
-    std::unique_lock<std::mutex> lh(mutexes[0]);
+    HashBucketLock lh(mutexes[0]);
     VisitorTracker vt(&visitors);
     lh.unlock();
 
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
-    for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks);
-         l++) {
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+    for (size_t l = 0; isActive() && !aborted && l < n_locks; l++) {
+        for (size_t i = firstBucketForLock(l); i < bucketsEnd();
+             i = nextBucketForLock(i)) {
             // (re)acquire mutex on each HashBucket, to minimise any impact
             // on front-end threads.
-            LockHolder lh(mutexes[l]);
-
-            StoredValue *v = values[i];
-            if (v) {
-                // TODO: Perf: This check seems costly - do we think it's still
-                // worth keeping?
-                auto hashbucket = getBucketForHash(v->getKey().hash());
-                if (i != hashbucket) {
-                    throw std::logic_error("HashTable::visit: inconsistency "
-                            "between StoredValue's calculated hashbucket "
-                            "(which is " + std::to_string(hashbucket) +
-                            ") and bucket is is located in (which is " +
-                            std::to_string(i) + ")");
+            std::lock_guard<BucketMutex> lh(mutexes[l]);
+
+            bool checked = false;
+            forEachInBucket(i, [this, i, &checked, &visitor](StoredValue* v) {
+                if (!checked) {
+                    // TODO: Perf: This check seems costly - do we think it's
+                    // still worth keeping?
+                    checkBucketForValue(*v, i);
+                    checked = true;
                 }
-            }
-            while (v) {
-                StoredValue *tmp = v->next;
                 visitor.visit(v);
-                v = tmp;
-            }
+                return true;
+            });
             ++visited;
         }
         aborted = !visitor.shouldContinue();
     }
+    reclaimRetired();
+}
+
+void HashTable::visitAtomically(HashTableVisitor& visitor) {
+    if (!isActive()) {
+        return;
+    }
+
+    MultiLockHolder<BucketMutex> mlh(mutexes, n_locks);
+    if (!visitor.shouldContinue()) {
+        return;
+    }
+    // Includes the old array buckets of any in-progress resize.
+    for (size_t i = 0; i < bucketsEnd(); i++) {
+        const bool completed = forEachInBucket(i, [&visitor](StoredValue* v) {
+            visitor.visit(v);
+            return visitor.shouldContinue();
+        });
+        if (!completed) {
+            return;
+        }
+    }
 }
 
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
@@ -467,29 +1046,22 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     size_t visited = 0;
     VisitorTracker vt(&visitors);
 
-    for (int l = 0; l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+    for (size_t l = 0; l < n_locks; l++) {
+        std::lock_guard<BucketMutex> lh(mutexes[l]);
+        for (size_t i = firstBucketForLock(l); i < bucketsEnd();
+             i = nextBucketForLock(i)) {
             size_t depth = 0;
-            StoredValue *p = values[i];
-            if (p) {
-                // TODO: Perf: This check seems costly - do we think it's still
-                // worth keeping?
-                auto hashbucket = getBucketForHash(p->getKey().hash());
-                if (i != hashbucket) {
-                    throw std::logic_error("HashTable::visit: inconsistency "
-                            "between StoredValue's calculated hashbucket "
-                            "(which is " + std::to_string(hashbucket) +
-                            ") and bucket it is located in (which is " +
-                            std::to_string(i) + ")");
-                }
-            }
             size_t mem(0);
-            while (p) {
+            forEachInBucket(i, [this, i, &depth, &mem](StoredValue* p) {
+                if (depth == 0) {
+                    // TODO: Perf: This check seems costly - do we think it's
+                    // still worth keeping?
+                    checkBucketForValue(*p, i);
+                }
                 depth++;
                 mem += p->size();
-                p = p->next;
-            }
+                return true;
+            });
             visitor.visit(i, depth, mem);
             ++visited;
         }
@@ -501,6 +1073,12 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
                             Position& start_pos) {
     if ((numItems.load() + numTempItems.load()) == 0 || !isActive()) {
         // Nothing to visit
+        if (start_pos.pinned) {
+            HashBucketLock lh(mutexes[0]);
+            if (start_pos.pin_epoch == resizePinEpoch) {
+                --resizePins;
+            }
+        }
         return endPosition();
     }
 
@@ -517,43 +1095,49 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     // inside the inner for() loop. To prevent this race, we explicitly acquire
     // (any) mutex, increment {visitors} and then release the mutex. This
     //avoids the race as if visitors >0 then Resizer will not attempt to resize.
-    std::unique_lock<std::mutex> lh(mutexes[0]);
+    HashBucketLock lh(mutexes[0]);
     VisitorTracker vt(&visitors);
+    Position start = start_pos;
+    if (start.pinned && start.resize_steps != numResizeSteps) {
+        // Our pin lapsed and buckets have moved since we paused, so items
+        // may have moved into buckets already visited; start again.
+        start = Position();
+    }
     lh.unlock();
 
     // Start from the requested lock number if in range.
-    size_t lock = (start_pos.lock < n_locks) ? start_pos.lock : 0;
+    size_t lock = (start.lock < n_locks) ? start.lock : 0;
     size_t hash_bucket = 0;
 
     for (; isActive() && !paused && lock < n_locks; lock++) {
 
         // If the bucket position is *this* lock, then start from the
-        // recorded bucket (as long as we haven't resized).
-        hash_bucket = lock;
-        if (start_pos.lock == lock &&
-            start_pos.ht_size == size &&
-            start_pos.hash_bucket < size) {
-            hash_bucket = start_pos.hash_bucket;
+        // recorded bucket (as long as we haven't resized, and the bucket
+        // is still guarded by this lock).
+        hash_bucket = firstBucketForLock(lock);
+        if (start.lock == lock &&
+            start.ht_size == size &&
+            start.hash_bucket < bucketsEnd() &&
+            mutexForBucket(start.hash_bucket) == lock) {
+            hash_bucket = start.hash_bucket;
         }
 
         // Iterate across all values in the hash buckets owned by this lock.
         // Note: we don't record how far into the bucket linked-list we
         // pause at; so any restart will begin from the next bucket.
-        for (; !paused && hash_bucket < size; hash_bucket += n_locks) {
-            LockHolder lh(mutexes[lock]);
-
-            StoredValue *v = values[hash_bucket];
-            while (!paused && v) {
-                StoredValue *tmp = v->next;
-                paused = !visitor.visit(*v);
-                v = tmp;
-            }
+        for (; !paused && hash_bucket < bucketsEnd();
+             hash_bucket = nextBucketForLock(hash_bucket)) {
+            std::lock_guard<BucketMutex> lh(mutexes[lock]);
+
+            paused = !forEachInBucket(hash_bucket, [&visitor](StoredValue* v) {
+                return visitor.visit(*v);
+            });
         }
 
         // If the visitor paused us before we visited all hash buckets owned
         // by this lock, we don't want to skip the remaining hash buckets, so
         // stop the outer for loop from advancing to the next lock.
-        if (paused && hash_bucket < size) {
+        if (paused && hash_bucket < bucketsEnd()) {
             break;
         }
 
@@ -563,13 +1147,57 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     }
 
     // Return the *next* location that should be visited.
-    return HashTable::Position(size, lock, hash_bucket);
+    HashTable::Position next(size, lock, hash_bucket);
+
+    // Pin any resize while the pass is part way through (taking the pin
+    // if the pass has only just started, or its pin lapsed), and release
+    // the pin once the pass is complete.
+    lh.lock();
+    const bool holdsPin = start.pinned && start.pin_epoch == resizePinEpoch;
+    if (lock < n_locks) {
+        if (!holdsPin) {
+            ++resizePins;
+        }
+        resizePinTime = gethrtime();
+        next.resize_steps = numResizeSteps;
+        next.pin_epoch = resizePinEpoch;
+        next.pinned = true;
+    } else if (holdsPin) {
+        --resizePins;
+    }
+    lh.unlock();
+
+    // Visits are the item pager's and defragmenter's regular passes over
+    // the table; have them free retired objects too.
+    reclaimRetired();
+    return next;
 }
 
 HashTable::Position HashTable::endPosition() const  {
     return HashTable::Position(size, n_locks, size);
 }
 
+size_t HashTable::firstBucketForLock(size_t lock) const {
+    if (lock < size) {
+        return lock;
+    }
+    if (lock < oldSize) {
+        return size + lock;
+    }
+    return bucketsEnd();
+}
+
+size_t HashTable::nextBucketForLock(size_t bucket_num) const {
+    // Buckets guarded by the same lock are n_locks apart within each array.
+    const size_t next = bucket_num + n_locks;
+    if (bucket_num < size && next >= size) {
+        // Done with the current array; continue with the old one (if any).
+        const size_t lock = bucket_num % n_locks;
+        return lock < oldSize ? size + lock : bucketsEnd();
+    }
+    return std::min(next, bucketsEnd());
+}
+
 static inline size_t getDefault(size_t x, size_t d) {
     return x == 0 ? d : x;
 }
@@ -594,6 +1222,37 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+HashTable::Layout HashTable::layoutFromString(const std::string& layout) {
+    if (layout == "chained") {
+        return Layout::Chained;
+    } else if (layout == "fingerprint") {
+        return Layout::Fingerprint;
+    }
+    throw std::invalid_argument("HashTable::layoutFromString: unknown "
+                                "layout '" + layout + "'");
+}
+
+const char* HashTable::layoutToString(Layout layout) {
+    switch (layout) {
+    case Layout::Chained:
+        return "chained";
+    case Layout::Fingerprint:
+        return "fingerprint";
+    }
+    return "<unknown>";
+}
+
+void HashTable::checkBucketForValue(const StoredValue& v, int bucket_num) {
+    auto hashbucket = getBucketForHash(v.getKey().hash());
+    if (bucket_num != hashbucket) {
+        throw std::logic_error("HashTable::visit: inconsistency "
+                "between StoredValue's calculated hashbucket "
+                "(which is " + std::to_string(hashbucket) +
+                ") and bucket it is located in (which is " +
+                std::to_string(bucket_num) + ")");
+    }
+}
+
 bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                    item_eviction_policy_t policy) {
     if (vptr == nullptr) {
@@ -601,6 +1260,13 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                 "Unable to delete NULL StoredValue");
     }
 
+    const int64_t seqno = vptr->getBySeqno();
+    if (seqno > 0 && uint64_t(seqno) >= pinnedLowSeqno.load() &&
+        uint64_t(seqno) <= pinnedHighSeqno.load()) {
+        ++stats.numFailedEjects;
+        return false;
+    }
+
     if (policy == VALUE_ONLY) {
         bool rv = vptr->ejectValue(*this, policy);
         if (rv) {
@@ -618,25 +1284,15 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                             vptr->metaDataSize());
             StoredValue::reduceCacheSize(*this, vptr->size());
             int bucket_num = getBucketForHash(vptr->getKey().hash());
-            StoredValue *v = values[bucket_num];
             // Remove the item from the hash table.
-            if (v == vptr) {
-                values[bucket_num] = v->next;
-            } else {
-                while (v->next) {
-                    if (v->next == vptr) {
-                        v->next = v->next->next;
-                        break;
-                    } else {
-                        v = v->next;
-                    }
-                }
-            }
+            unlinkFromBucket(vptr, bucket_num);
+            // Expired on disk by compaction, as the pager won't see it.
+            updateExpiryIndex(*vptr, vptr->getExptime(), /*removed*/ true);
 
             if (vptr->isResident()) {
                 ++stats.numValueEjects;
             }
-            if (!vptr->isResident() && !v->isTempItem()) {
+            if (!vptr->isResident() && !vptr->isTempItem()) {
                 decrNumNonResidentItems(); // Decrement because the item is
                                            // fully evicted.
             }
@@ -644,7 +1300,7 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
             ++numEjects;
             updateMaxDeletedRevSeqno(vptr->getRevSeqno());
 
-            delete vptr; // Free the item.
+            retireStoredValue(vptr); // Free the item.
             vptr = NULL;
             return true;
         } else {
@@ -655,21 +1311,29 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
 }
 
 Item *HashTable::getRandomKeyFromSlot(int slot) {
-    std::unique_lock<std::mutex> lh = getLockedBucket(slot);
-    StoredValue *v = values[slot];
+    HashBucketLock lh = getLockedBucket(slot);
+    Item* ret = NULL;
+
+    // The table may have been resized before we acquired the lock; skip
+    // the slot if it no longer exists or is guarded by a different lock.
+    if (static_cast<size_t>(slot) >= bucketsEnd() ||
+        lh.mutex() != &mutexes[mutexForBucket(slot)]) {
+        return ret;
+    }
 
-    while (v) {
+    forEachInBucket(slot, [&ret](StoredValue* v) {
         if (!v->isTempItem() && !v->isDeleted() && v->isResident()) {
-            return v->toItem(false, 0);
+            ret = v->toItem(false, 0);
+            return false;
         }
-        v = v->next;
-    }
+        return true;
+    });
 
-    return NULL;
+    return ret;
 }
 
 bool HashTable::unlocked_restoreValue(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashBucketLock& htLock,
         const Item& itm,
         StoredValue& v) {
     if (!htLock || !isActive() || v.isResident()) {
@@ -686,13 +1350,15 @@ bool HashTable::unlocked_restoreValue(
         decrNumNonResidentItems();
     }
 
-    v.restoreValue(itm);
+    const uint32_t oldExptime = v.getExptime();
+    v.restoreValue(itm, *this);
+    updateExpiryIndex(v, oldExptime);
 
-    StoredValue::increaseCacheSize(*this, v.getValue()->length());
+    StoredValue::increaseCacheSize(*this, v.residentValueLength());
     return true;
 }
 
-void HashTable::unlocked_restoreMeta(const std::unique_lock<std::mutex>& htLock,
+void HashTable::unlocked_restoreMeta(const HashBucketLock& htLock,
                                      const Item& itm,
                                      StoredValue& v) {
     if (!htLock) {
@@ -707,7 +1373,9 @@ void HashTable::unlocked_restoreMeta(const std::unique_lock<std::mutex>& htLock,
                 "call on a non-active HT object");
     }
 
+    const uint32_t oldExptime = v.getExptime();
     v.restoreMeta(itm);
+    updateExpiryIndex(v, oldExptime);
     if (!itm.isDeleted()) {
         --numTempItems;
         ++numItems;
@@ -18,9 +18,17 @@
 #pragma once
 
 #include "config.h"
+#include "expiry_index.h"
+#include "frequency_sketch.h"
 #include "storeddockey.h"
 #include "stored-value.h"
 
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+
 class HashTableStatVisitor;
 class HashTableVisitor;
 class HashTableDepthVisitor;
@@ -62,6 +70,14 @@ enum class AddStatus : uint16_t {
  * order of the number of CPUs. Essentially ht bucket B is guarded by
  * mutex B mod N.
  *
+ * The HashTable can be resized incrementally: startIncrementalResize()
+ * allocates a new bucket array, after which continueResize() migrates the
+ * old buckets across in bounded chunks. Each chunk holds all the locks, but
+ * only briefly; in between, operations on keys whose old bucket has not yet
+ * been migrated find them in the old array. Old array buckets are numbered
+ * [size, size + oldSize) so they can be passed around like any other bucket
+ * number while the bucket lock is held.
+ *
  * StoredValue objects can have their value (Blob object) ejected, making the
  * value non-resident. Such StoredValues are still in the HashTable, and their
  * metadata (CAS, revSeqno, bySeqno, etc) is still accessible, but the value
@@ -80,6 +96,13 @@ enum class AddStatus : uint16_t {
  * period of time - until the deletion is recorded on disk by the Flusher, at
  * which point they are removed from the HashTable by PersistenceCallback (we
  * don't want to unnecessarily spend memory on items which have been deleted).
+ *
+ * With optimistic reads enabled (Chained layout only), optimisticGet() reads
+ * an item without taking its bucket lock: each lock carries a sequence
+ * counter which writers bump on lock and unlock, and a read is only used if
+ * the counter was even and unchanged across it. StoredValues, Blobs and
+ * bucket arrays which are unlinked while such readers may still be looking
+ * at them are retired via the EpochManager rather than freed immediately.
  */
 class HashTable {
 public:
@@ -89,12 +112,23 @@ public:
      *
      * Currently opaque (and constant), clients can pass them around but
      * cannot reposition the iterator.
+     *
+     * A position part way through a pass pins any incremental resize (see
+     * pauseResumeVisit()), so it should be resumed from (or the pass left
+     * to time out) rather than held indefinitely.
      */
     class Position {
     public:
         // Allow default construction positioned at the start,
         // but nothing else.
-        Position() : ht_size(0), lock(0), hash_bucket(0) {}
+        Position()
+            : ht_size(0),
+              lock(0),
+              hash_bucket(0),
+              resize_steps(0),
+              pin_epoch(0),
+              pinned(false) {
+        }
 
         bool operator==(const Position& other) const {
             return (ht_size == other.ht_size) &&
@@ -110,7 +144,10 @@ public:
         Position(size_t ht_size_, int lock_, int hash_bucket_)
           : ht_size(ht_size_),
             lock(lock_),
-            hash_bucket(hash_bucket_) {}
+            hash_bucket(hash_bucket_),
+            resize_steps(0),
+            pin_epoch(0),
+            pinned(false) {}
 
         // Size of the hashtable when the position was created.
         size_t ht_size;
@@ -118,26 +155,192 @@ public:
         size_t lock;
         // hash bucket ID (under the given lock) we are up to.
         size_t hash_bucket;
+        // Number of resize steps taken when the position was created.
+        size_t resize_steps;
+        // Pin epoch the pass's resize pin (if any) was taken in.
+        size_t pin_epoch;
+        // True if the pass is part way through, holding a resize pin.
+        bool pinned;
 
         friend class HashTable;
         friend std::ostream& operator<<(std::ostream& os, const Position& pos);
     };
 
+    /**
+     * Mutex guarding a stripe of hash buckets (see getLockedBucket()).
+     *
+     * Alongside the mutex is a sequence counter which is odd while the mutex
+     * is held, so optimistic readers can detect when the buckets they read
+     * without the lock were modified under them.
+     */
+    class BucketMutex {
+    public:
+        BucketMutex() : seq(0) {}
+
+        void lock() {
+            mutex.lock();
+            seq.store(seq.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+            // Order the (odd) sequence number before the writer's stores.
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        bool try_lock() {
+            if (!mutex.try_lock()) {
+                return false;
+            }
+            seq.store(seq.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return true;
+        }
+
+        void unlock() {
+            seq.store(seq.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_release);
+            mutex.unlock();
+        }
+
+        /**
+         * Begin an optimistic read of the buckets guarded by this mutex.
+         *
+         * @return the sequence number to pass to readValidate(); odd if a
+         *         writer currently holds the mutex.
+         */
+        uint64_t readBegin() const {
+            return seq.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @return true if no writer held the mutex since readBegin()
+         *         returned the (even) sequence number s.
+         */
+        bool readValidate(uint64_t s) const {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return seq.load(std::memory_order_relaxed) == s;
+        }
+
+    private:
+        std::mutex mutex;
+        std::atomic<uint64_t> seq;
+    };
+
+    using HashBucketLock = std::unique_lock<BucketMutex>;
+
+    /**
+     * How StoredValues are organised within each hash bucket.
+     */
+    enum class Layout : uint8_t {
+        /**
+         * Each bucket is a singly-linked list of StoredValues, chained
+         * through StoredValue::next.
+         */
+        Chained,
+        /**
+         * Each bucket is a cache-line sized array of one-byte key
+         * fingerprints plus StoredValue pointers (see FingerprintBucket).
+         * A lookup only dereferences StoredValues whose fingerprint matches,
+         * so most finds touch a single cache line.
+         */
+        Fingerprint
+    };
+
     /**
      * Create a HashTable.
      *
      * @param st the global stats reference
      * @param s the number of hash table buckets
      * @param l the number of locks in the hash table
+     * @param layout how StoredValues are organised within each bucket
+     * @param useSlabAllocator if true, allocate StoredValues from a
+     *        per-HashTable SlabAllocator rather than individually
+     * @param inlineValueSize values of up to this many bytes are held
+     *        inline in their StoredValue rather than in a Blob (0 disables)
+     * @param optimisticReads if true, allow optimisticGet() to read items
+     *        without taking bucket locks (ignored for the Fingerprint layout)
+     * @param useExpiryIndex if true, index the items which have an expiry
+     *        time (see popExpiredKeys())
      */
-    HashTable(EPStats &st, size_t s = 0, size_t l = 0);
+    HashTable(EPStats &st, size_t s = 0, size_t l = 0,
+              Layout layout = Layout::Chained,
+              bool useSlabAllocator = false,
+              size_t inlineValueSize = 0,
+              bool optimisticReads = false,
+              bool useExpiryIndex = false);
 
     ~HashTable();
 
+    /**
+     * Get the memory used by the bucket array and locks. Overflow buckets
+     * (Fingerprint layout) are accounted in EPStats::memOverhead as they are
+     * allocated and freed, so aren't included here.
+     */
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(std::mutex));
+            + ((size + oldSize) * bucketSize())
+            + (n_locks * sizeof(BucketMutex));
+    }
+
+    /**
+     * Get the bucket layout of this hash table.
+     */
+    Layout getLayout() const {
+        return layout;
+    }
+
+    /**
+     * Get the number of overflow cache lines allocated by buckets which
+     * hold more StoredValues than fit in a single FingerprintBucket.
+     * Always zero for the Chained layout.
+     */
+    size_t getNumOverflowBuckets() const {
+        return numOverflowBuckets;
+    }
+
+    /**
+     * True if optimisticGet() may read items without taking locks.
+     */
+    bool isOptimisticReadsEnabled() const {
+        return optimisticReads;
+    }
+
+    /**
+     * Record the accesses to items which track references in the given
+     * sketch (shared by the bucket's hash tables, for the item pager's
+     * eviction policy). Must be set before the hash table is used.
+     */
+    void setFrequencySketch(std::shared_ptr<FrequencySketch> sketch) {
+        frequencySketch = std::move(sketch);
+    }
+
+    /**
+     * True if the items which have an expiry time are indexed.
+     */
+    bool hasExpiryIndex() const {
+        return expiryIndex != nullptr;
+    }
+
+    /**
+     * Get the number of keys in the expiry index (0 if there is none).
+     */
+    size_t getExpiryIndexSize() const {
+        return expiryIndex ? expiryIndex->size() : 0;
+    }
+
+    /**
+     * Remove and return the keys of the items whose expiry time is before
+     * asOf from the expiry index. The items must be checked (with their
+     * bucket locked) before they are expired: a key may have been deleted,
+     * or given a later expiry time, since it was indexed.
+     */
+    std::vector<StoredDocKey> popExpiredKeys(time_t asOf);
+
+    /**
+     * Get the SlabAllocator StoredValues are allocated from, or nullptr if
+     * they are allocated individually.
+     */
+    const SlabAllocator* getSlabAllocator() const {
+        return slabAllocator.get();
     }
 
     /**
@@ -250,6 +453,87 @@ public:
      */
     void resize(size_t to);
 
+    /**
+     * Begin an incremental resize to fit the current data. Buckets are
+     * migrated to the new array by subsequent calls to continueResize().
+     *
+     * @return true if a resize was started.
+     */
+    bool startIncrementalResize();
+
+    /**
+     * Begin an incremental resize to the specified size. If a resize is
+     * already in progress it is completed first.
+     *
+     * @return true if a resize was started.
+     */
+    bool startIncrementalResize(size_t to);
+
+    /**
+     * Migrate up to maxBuckets buckets of an in-progress incremental resize
+     * to the new bucket array. All locks are held for the duration of
+     * the call, so maxBuckets bounds the pause seen by front-end operations.
+     * No progress is made while any visitors are running.
+     *
+     * @return the number of old buckets migrated.
+     */
+    size_t continueResize(size_t maxBuckets);
+
+    /**
+     * True if an incremental resize is in progress.
+     */
+    bool isResizing() const {
+        return oldSize != 0;
+    }
+
+    /**
+     * Get the number of old buckets still to be migrated by the
+     * in-progress resize (zero if not resizing).
+     */
+    size_t getResizeBucketsRemaining() const {
+        return oldSize - resizeCursor;
+    }
+
+    /**
+     * Get the number of resize steps (chunks of buckets migrated while
+     * holding all locks) performed by this hash table.
+     */
+    size_t getNumResizeSteps() const {
+        return numResizeSteps;
+    }
+
+    /**
+     * Get the total time in microseconds all locks were held by resize
+     * steps.
+     */
+    uint64_t getResizePauseTotal() const {
+        return resizePauseTotal;
+    }
+
+    /**
+     * Get the longest time in microseconds all locks were held by a single
+     * resize step.
+     */
+    uint64_t getResizePauseMax() const {
+        return resizePauseMax;
+    }
+
+    /**
+     * Get the bytes held by objects unlinked from the table but not yet
+     * freed, as optimistic readers may still be looking at them.
+     */
+    size_t getRetiredBytes() const {
+        return retiredBytes;
+    }
+
+    /**
+     * Free any retired objects which no optimistic reader can still be
+     * using. Retired objects are otherwise only reclaimed every
+     * retireReclaimInterval retirements; visits call this so a table with
+     * few writes doesn't hold on to them.
+     */
+    void reclaimRetired();
+
     /**
      * Find the item with the given key.
      *
@@ -262,6 +546,27 @@ public:
     StoredValue *find(const DocKey& key, bool trackReference=true,
                       bool wantsDeleted=false);
 
+    /**
+     * Get a copy of the live, resident item with the given key without
+     * taking its bucket lock.
+     *
+     * Only succeeds when the read needs no modification of the StoredValue
+     * and is not interleaved with a writer; in all other cases (including
+     * when the key isn't found, or is deleted, expired, a temp item or not
+     * resident) nullptr is returned and the caller must use the locked path.
+     *
+     * @param key the key to find
+     * @param vbucket the vbucket of the returned Item
+     * @param trackReference whether the read should count as a reference;
+     *        falls back if that would modify the item's NRU value
+     * @param hideLockedCas return a CAS of -1 if the item is locked
+     * @return a new Item, or nullptr if the locked path must be used
+     */
+    Item* optimisticGet(const DocKey& key,
+                        uint16_t vbucket,
+                        bool trackReference,
+                        bool hideLockedCas);
+
     /**
      * Find a resident item
      *
@@ -296,7 +601,7 @@ public:
      * @return Result indicating the status of the operation
      */
     MutationStatus unlocked_updateStoredValue(
-            const std::unique_lock<std::mutex>& htLock,
+            const HashBucketLock& htLock,
             StoredValue& v,
             Item& itm,
             PreserveRevSeqno preserveRevSeqno);
@@ -312,7 +617,7 @@ public:
      *         returns non-null ptr
      */
     StoredValue* unlocked_addNewStoredValue(
-            const std::unique_lock<std::mutex>& htLock, Item& itm);
+            const HashBucketLock& htLock, Item& itm);
 
     /**
      * Logically (soft) delete the item in ht
@@ -324,10 +629,22 @@ public:
      * @param onlyMarkDeleted indicates if we must reset the StoredValue or
      *                        just mark deleted
      */
-    void unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
+    void unlocked_softDelete(const HashBucketLock& htLock,
                              StoredValue& v,
                              bool onlyMarkDeleted);
 
+    /**
+     * Set the expiry time of an item, updating the expiry index.
+     * Assumes that HT bucket lock is grabbed.
+     *
+     * @param htLock Hash table lock that must be held
+     * @param v Reference to the StoredValue to update
+     * @param exptime the new expiry time (0 for none)
+     */
+    void unlocked_setExptime(const HashBucketLock& htLock,
+                             StoredValue& v,
+                             time_t exptime);
+
     /**
      * Find an item within a specific bucket assuming you already
      * locked the bucket.
@@ -348,8 +665,8 @@ public:
      * @param bucket the bucket to lock
      * @return a locked LockHolder
      */
-    inline std::unique_lock<std::mutex> getLockedBucket(int bucket) {
-        std::unique_lock<std::mutex> rv(mutexes[mutexForBucket(bucket)]);
+    inline HashBucketLock getLockedBucket(int bucket) {
+        HashBucketLock rv(mutexes[mutexForBucket(bucket)]);
         return rv;
     }
 
@@ -361,15 +678,18 @@ public:
      * @param bucket output parameter to receive a bucket
      * @return a locked LockHolder
      */
-    inline std::unique_lock<std::mutex> getLockedBucket(int h, int *bucket) {
+    inline HashBucketLock getLockedBucket(int h, int *bucket) {
         while (true) {
             if (!isActive()) {
                 throw std::logic_error("HashTable::getLockedBucket: "
                         "Cannot call on a non-active object");
             }
+            const size_t lock = mutexForBucket(getBucketForHash(h));
+            HashBucketLock rv(mutexes[lock]);
+            // The bucket a hash maps to (and the lock guarding it) is only
+            // stable while a lock is held, as resizing needs all locks.
             *bucket = getBucketForHash(h);
-            std::unique_lock<std::mutex> rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
+            if (mutexForBucket(*bucket) == lock) {
                 return rv;
             }
         }
@@ -383,7 +703,7 @@ public:
      * @param bucket output parameter to receive a bucket
      * @return a locked LockHolder
      */
-    inline std::unique_lock<std::mutex> getLockedBucket(const DocKey& key, int *bucket) {
+    inline HashBucketLock getLockedBucket(const DocKey& key, int *bucket) {
         if (!isActive()) {
             throw std::logic_error("HashTable::getLockedBucket: Cannot call on a "
                     "non-active object");
@@ -400,7 +720,7 @@ public:
      * @param key the key to delete
      * @param bucket_num the bucket to look in (must already be locked)
      */
-    void unlocked_del(const std::unique_lock<std::mutex>& htLock,
+    void unlocked_del(const HashBucketLock& htLock,
                       const DocKey& key,
                       int bucket_num);
 
@@ -409,6 +729,19 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Visit all items within this hashtable as of a single point in time:
+     * every lock is held for the whole visit, so no item can change while
+     * it is in progress. This blocks all front-end operations on the
+     * hashtable, so only use it where a consistent view is required and
+     * the visitor is cheap.
+     *
+     * The visitor's shouldContinue() is called once all locks have been
+     * acquired (before the first item), and after each item; the visit
+     * stops as soon as it returns false.
+     */
+    void visitAtomically(HashTableVisitor& visitor);
+
     /**
      * Visit all items within this call with a depth visitor.
      */
@@ -429,6 +762,12 @@ public:
      * As a consequence, *DO NOT USE THIS METHOD* if you need to guarantee
      * that all items are visited!
      *
+     * An incremental resize doesn't migrate any buckets while a pass is
+     * paused part way through, as items could move from buckets not yet
+     * visited into ones already visited. The pin lapses if the pass isn't
+     * resumed within maxResizePinDuration, in which case the pass restarts
+     * from the beginning on resume if any buckets were migrated.
+     *
      * @param visitor The visitor object to use.
      * @param start_pos At what position to start in the hashtable.
      * @return The final HashTable position visited; equal to
@@ -468,6 +807,16 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Convert the ht_layout configuration string to a Layout.
+     */
+    static Layout layoutFromString(const std::string& layout);
+
+    /**
+     * Convert a Layout to its configuration string.
+     */
+    static const char* layoutToString(Layout layout);
+
     /**
      * Get the max deleted revision seqno seen so far.
      */
@@ -495,7 +844,8 @@ public:
      *             This is passed as a reference as it may be modified by this
      *             function (see note below).
      * @param policy item eviction policy
-     * @return true if an item is ejected.
+     * @return true if an item is ejected; always false for an item whose
+     *         seqno is pinned (see setPinnedSeqnos()).
      *
      * NOTE: Upon a successful ejection (and if full eviction is enabled)
      *       the StoredValue will be deleted, therefore it is *not* safe to
@@ -503,6 +853,21 @@ public:
      */
     bool unlocked_ejectItem(StoredValue*& vptr, item_eviction_policy_t policy);
 
+    /**
+     * Stop items with seqnos in [low, high] being ejected, so a reader
+     * visiting the table a lock at a time can rely on those which were
+     * resident staying so. Replaces any range pinned before.
+     */
+    void setPinnedSeqnos(uint64_t low, uint64_t high) {
+        pinnedLowSeqno = low;
+        pinnedHighSeqno = high;
+    }
+
+    /// Allow every item to be ejected again.
+    void clearPinnedSeqnos() {
+        setPinnedSeqnos(std::numeric_limits<uint64_t>::max(), 0);
+    }
+
     /**
      * Restore the value for the item.
      * Assumes that HT bucket lock is grabbed.
@@ -513,7 +878,7 @@ public:
      *
      * @return true if restored; else false
      */
-    bool unlocked_restoreValue(const std::unique_lock<std::mutex>& htLock,
+    bool unlocked_restoreValue(const HashBucketLock& htLock,
                                const Item& itm,
                                StoredValue& v);
 
@@ -526,10 +891,17 @@ public:
      * @param itm the Item whose metadata is being restored
      * @param v corresponding StoredValue
      */
-    void unlocked_restoreMeta(const std::unique_lock<std::mutex>& htLock,
+    void unlocked_restoreMeta(const HashBucketLock& htLock,
                               const Item& itm,
                               StoredValue& v);
 
+    /**
+     * Hand over the StoredValue's reference to a value it no longer holds;
+     * the value is released once no optimistic reader can be using it.
+     * Must be called with the bucket lock held.
+     */
+    void retireValue(const value_t& value);
+
     std::atomic<uint64_t>     maxDeletedRevSeqno;
     std::atomic<size_t>       numTotalItems;
     std::atomic<size_t>       numNonResidentItems;
@@ -544,25 +916,327 @@ public:
 private:
     friend class StoredValue;
 
+    /**
+     * A hash bucket in the Fingerprint layout - exactly one cache line.
+     *
+     * Holds up to slotsPerBucket StoredValue pointers, each alongside a
+     * one-byte fingerprint of its key's hash. Entries occupy slots
+     * [0, used); removing an entry moves the last entry into its place.
+     * When all slots are in use further entries go into a chain of
+     * overflow buckets.
+     */
+    struct FingerprintBucket {
+        static const size_t slotsPerBucket = 6;
+
+        uint8_t fingerprints[slotsPerBucket];
+        uint8_t used;
+        uint8_t padding;
+        StoredValue* slots[slotsPerBucket];
+        FingerprintBucket* overflow;
+    };
+    static_assert(sizeof(FingerprintBucket) == 64,
+                  "FingerprintBucket should occupy exactly one cache line");
+
+    /**
+     * Number of StoredValues per bucket resize() aims for with the
+     * Fingerprint layout; leaves headroom in each cache line so most
+     * buckets never need an overflow bucket.
+     */
+    static const size_t fingerprintTargetDepth = 4;
+
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
+    /**
+     * Get the storage for a chained bucket, which may be in the old array
+     * of an in-progress resize.
+     */
+    StoredValue*& chainHead(int bucket_num) {
+        const size_t b = static_cast<size_t>(bucket_num);
+        return b < size ? values.load(std::memory_order_relaxed)[b]
+                        : oldValues.load(std::memory_order_relaxed)[b - size];
+    }
+
+    /**
+     * Get the storage for a Fingerprint bucket, which may be in the old
+     * array of an in-progress resize.
+     */
+    FingerprintBucket& fingerprintBucket(int bucket_num) {
+        const size_t b = static_cast<size_t>(bucket_num);
+        return b < size ? fpValues[b] : oldFpValues[b - size];
+    }
+
+    static uint8_t fingerprintOf(int h) {
+        // Use the top bits of a multiplicative hash, so the fingerprint
+        // is largely independent of the bucket index (h % size).
+        return static_cast<uint8_t>((static_cast<uint32_t>(h) *
+                                     2654435761u) >> 24);
+    }
+
+    size_t bucketSize() const {
+        return layout == Layout::Chained ? sizeof(StoredValue*)
+                                         : sizeof(FingerprintBucket);
+    }
+
+    /**
+     * Scale a number of StoredValues (or the default table size, which is
+     * expressed as one StoredValue per bucket) to a number of buckets
+     * for this table's layout.
+     */
+    size_t scaleForLayout(size_t n) const;
+
+    /**
+     * Get the size to automatically resize to for the current data.
+     */
+    size_t getAutoResizeSize();
+
+    /**
+     * Migrate up to maxBuckets old buckets of an in-progress resize into
+     * the current array, freeing the old array once all are migrated.
+     * Caller must hold all locks.
+     *
+     * @return the number of old buckets migrated.
+     */
+    size_t migrateBuckets(size_t maxBuckets);
+
+    /**
+     * Get the first bucket (in the current array, then the old array of any
+     * in-progress resize) guarded by the given lock.
+     */
+    size_t firstBucketForLock(size_t lock) const;
+
+    /**
+     * Get the bucket after the given one which is guarded by the same lock,
+     * or bucketsEnd() if there are none.
+     */
+    size_t nextBucketForLock(size_t bucket_num) const;
+
+    /**
+     * One past the last bucket number, including old array buckets.
+     */
+    size_t bucketsEnd() const {
+        return size + oldSize;
+    }
+
+    /**
+     * Throw if the given StoredValue doesn't hash to the given bucket.
+     */
+    void checkBucketForValue(const StoredValue& v, int bucket_num);
+
+    /**
+     * @return true if the given bucket holds no StoredValues.
+     */
+    bool isBucketEmpty(int bucket_num);
+
+    /**
+     * Account a resize step which started (having acquired all locks) at
+     * the given time.
+     */
+    void recordResizePause(hrtime_t start);
+
+    /**
+     * True if a paused pauseResumeVisit() pass pins resizing. Drops any
+     * pins which have lapsed. All locks must be held.
+     */
+    bool isResizePinned();
+
+    /**
+     * Move the given item's key in the expiry index from oldExptime to its
+     * current expiry time (none if it's deleted or a temp item, or is being
+     * removed from the hash table).
+     */
+    void updateExpiryIndex(const StoredValue& v,
+                           uint32_t oldExptime,
+                           bool removed = false);
+
+    /**
+     * Find the StoredValue with the given key in the given bucket, ignoring
+     * deleted state and reference tracking.
+     */
+    StoredValue* findInBucket(const DocKey& key, int bucket_num);
+
+    /**
+     * Add a newly created StoredValue to the given bucket.
+     */
+    void linkIntoBucket(StoredValue* v, int bucket_num);
+
+    /**
+     * Remove the given StoredValue from the given bucket (without deleting
+     * it).
+     *
+     * @return true if v was found in (and removed from) the bucket.
+     */
+    bool unlinkFromBucket(StoredValue* v, int bucket_num);
+
+    /**
+     * Invoke func on each StoredValue in the given bucket until it returns
+     * false. func may remove (and delete) the StoredValue it is passed, but
+     * no other StoredValue in the bucket.
+     *
+     * @return false if func stopped the iteration, otherwise true.
+     */
+    template <typename Func>
+    bool forEachInBucket(int bucket_num, Func func) {
+        if (layout == Layout::Chained) {
+            StoredValue* v = chainHead(bucket_num);
+            while (v) {
+                StoredValue* tmp = v->next;
+                if (!func(v)) {
+                    return false;
+                }
+                v = tmp;
+            }
+            return true;
+        }
+        FingerprintBucket* fb = &fingerprintBucket(bucket_num);
+        while (fb) {
+            FingerprintBucket* next = fb->overflow;
+            // Iterate backwards; removing slot i only moves an
+            // already-visited entry into i.
+            for (size_t i = fb->used; i-- > 0;) {
+                if (!func(fb->slots[i])) {
+                    return false;
+                }
+            }
+            fb = next;
+        }
+        return true;
+    }
+
+    /**
+     * Allocate a zeroed, cache-line aligned array of Fingerprint buckets.
+     *
+     * @param n the number of buckets
+     * @param alloc output parameter receiving the underlying allocation,
+     *        which must be passed to cb_free.
+     * @return the aligned array, or nullptr if allocation failed.
+     */
+    static FingerprintBucket* allocateFingerprintBuckets(size_t n,
+                                                         void*& alloc);
+
+    /**
+     * Free the overflow buckets chained from each of the n given buckets.
+     */
+    void freeOverflowBuckets(FingerprintBucket* buckets, size_t n);
+
+    /**
+     * An object unlinked from the table while optimistic readers may still
+     * be looking at it, with its EpochManager retire stamp and size.
+     * Exactly one of storedValue, value and array is set.
+     */
+    struct RetiredObject {
+        uint64_t stamp;
+        size_t bytes;
+        StoredValue* storedValue;
+        value_t value;
+        void* array;
+    };
+
+    /**
+     * Destroy the given (unlinked) StoredValue, deferring it until no
+     * optimistic reader can be using it.
+     */
+    void retireStoredValue(StoredValue* v);
+
+    /**
+     * cb_free the given (unlinked) bucket array of the given size,
+     * deferring it until no optimistic reader can be using it.
+     */
+    void retireArray(void* array, size_t bytes);
+
+    /**
+     * Queue the given object for reclamation; its bytes are accounted in
+     * EPStats::memOverhead until it is freed.
+     */
+    void retire(RetiredObject&& object);
+
+    /**
+     * Free retired objects which no optimistic reader can be using, or all
+     * of them if force is set. Caller must hold retiredMutex.
+     */
+    void reclaimRetired(bool force);
+
+    /// Number of retirements between attempts to reclaim retired objects.
+    static const size_t retireReclaimInterval = 128;
+
+    /// Longest chain an optimistic read follows before falling back.
+    static const size_t maxOptimisticChainLength = 64;
+
+    /// Longest a paused pauseResumeVisit() pass can pin resizing for.
+    static const hrtime_t maxResizePinDuration;
+
+    const Layout         layout;
     std::atomic<size_t> size;
     size_t               n_locks;
-    StoredValue        **values;
-    std::mutex               *mutexes;
+    // Swapped by resize() while holding all locks; atomic as optimistic
+    // readers load them without a lock. Arrays are freed via retireArray().
+    std::atomic<StoredValue**> values;
+    FingerprintBucket   *fpValues;
+    void                *fpValuesAlloc;
+    // Bucket array being migrated from by an in-progress resize, and the
+    // index of the next old bucket to migrate. Only modified while holding
+    // all locks.
+    std::atomic<size_t>  oldSize;
+    std::atomic<size_t>  resizeCursor;
+    std::atomic<StoredValue**> oldValues;
+    FingerprintBucket   *oldFpValues;
+    void                *oldFpValuesAlloc;
+    std::atomic<size_t>  numOverflowBuckets;
+    BucketMutex          *mutexes;
     EPStats&             stats;
+    std::unique_ptr<SlabAllocator> slabAllocator;
     StoredValueFactory   valFact;
+    const bool           optimisticReads;
+    std::shared_ptr<FrequencySketch> frequencySketch;
+    // Keys of the items with an expiry time; null if not indexed.
+    std::unique_ptr<ExpiryIndex> expiryIndex;
+    // Objects awaiting reclamation, in retire stamp order.
+    std::mutex                retiredMutex;
+    std::deque<RetiredObject> retired;
+    size_t                    retiresSinceReclaim;
+    std::atomic<size_t>       retiredBytes;
     std::atomic<size_t>       visitors;
+    // Number of pauseResumeVisit() passes paused part way through, which
+    // pin any resize; when last pinned; and the epoch of the current pins
+    // (advanced when lapsed pins are dropped). Only modified while holding
+    // the first lock.
+    size_t                    resizePins;
+    hrtime_t                  resizePinTime;
+    size_t                    resizePinEpoch;
+    // Seqnos which may not be ejected (see setPinnedSeqnos()); none if
+    // low is above high.
+    std::atomic<uint64_t>     pinnedLowSeqno;
+    std::atomic<uint64_t>     pinnedHighSeqno;
     std::atomic<size_t>       numItems;
     std::atomic<size_t>       numResizes;
+    std::atomic<size_t>       numResizeSteps;
+    std::atomic<uint64_t>     resizePauseTotal;
+    std::atomic<uint64_t>     resizePauseMax;
     std::atomic<size_t>       numTempItems;
     bool                 activeState;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
 
+    /**
+     * Get the bucket which holds (or would hold) items with the given hash;
+     * during a resize this is in the old array if that bucket has not yet
+     * been migrated. Only stable while a lock is held.
+     */
     int getBucketForHash(int h) {
+        if (oldSize != 0) {
+            const int oldBucket = abs(h % static_cast<int>(oldSize));
+            if (static_cast<size_t>(oldBucket) >= resizeCursor) {
+                return static_cast<int>(size) + oldBucket;
+            }
+        }
+        return getCurrentArrayBucketForHash(h);
+    }
+
+    /**
+     * Get the bucket in the current array for the given hash.
+     */
+    int getCurrentArrayBucketForHash(int h) {
         return abs(h % static_cast<int>(size));
     }
 
@@ -571,6 +1245,11 @@ private:
             throw std::logic_error("HashTable::mutexForBucket: Cannot call on a "
                     "non-active object");
         }
+        // Old array buckets are guarded by the lock for their index in the
+        // old array.
+        if (bucket_num >= size) {
+            bucket_num -= size;
+        }
         return bucket_num % n_locks;
     }
 
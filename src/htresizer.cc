@@ -20,6 +20,7 @@
 #include "htresizer.h"
 
 #include <memory>
+#include <thread>
 
 #include <phosphor/phosphor.h>
 #include <platform/make_unique.h>
@@ -28,19 +29,37 @@ static const double FREQUENCY(60.0);
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
+ *
+ * Resizing is performed incrementally: buckets are migrated to the new
+ * table in chunks of at most chunkSize, with all locks released between
+ * chunks so front-end operations are only ever paused briefly. If a chunk
+ * cannot be migrated (e.g. a visitor is running) the remainder is picked up
+ * on the next run of the task.
  */
 class ResizingVisitor : public VBucketVisitor {
 public:
-    ResizingVisitor() { }
+    ResizingVisitor(size_t chunkSize)
+        : chunkSize(chunkSize) {
+    }
 
     void visitBucket(RCPtr<VBucket> &vb) override {
-        vb->ht.resize();
+        HashTable& ht = vb->ht;
+        if (!ht.isResizing() && !ht.startIncrementalResize()) {
+            return;
+        }
+        while (ht.isResizing() && ht.continueResize(chunkSize) > 0) {
+            std::this_thread::yield();
+        }
     }
+
+private:
+    const size_t chunkSize;
 };
 
 bool HashtableResizerTask::run(void) {
     TRACE_EVENT0("ep-engine/task", "HashtableResizerTask");
-    auto pv = std::make_unique<ResizingVisitor>();
+    auto pv = std::make_unique<ResizingVisitor>(
+            store->getEPEngine().getConfiguration().getHtResizeChunkSize());
     store->visit(std::move(pv),
                  "Hashtable resizer",
                  NONIO_TASK_IDX,
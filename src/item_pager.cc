@@ -21,14 +21,17 @@
 #include "dcp/dcpconnmap.h"
 #include "kv_bucket_iface.h"
 #include "ep_engine.h"
+#include "eviction_policy.h"
+#include "frequency_sketch.h"
 #include "tapconnmap.h"
 
-#include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <list>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <phosphor/phosphor.h>
 #include <platform/make_unique.h>
@@ -41,6 +44,42 @@ enum pager_type_t {
     EXPIRY_PAGER
 };
 
+/**
+ * State shared by the PagingVisitors of a single ItemPager run, which
+ * visit disjoint sets of vbuckets concurrently. Each evicts towards the
+ * same target (the low watermark, checked against the bucket's memory
+ * usage before every vbucket), and the run is only complete once all
+ * have finished.
+ */
+struct PagingRunState {
+    PagingRunState(size_t visitors, std::atomic<hrtime_t>* highWatSince)
+        : remaining(visitors),
+          completePhase(true),
+          highWatSince(highWatSince) {
+    }
+
+    // Visitors yet to complete.
+    std::atomic<size_t> remaining;
+    // False if any visitor stopped early, having reached the low watermark.
+    std::atomic<bool> completePhase;
+    // When memory usage went above the high watermark (0 if it isn't).
+    std::atomic<hrtime_t>* highWatSince;
+};
+
+/**
+ * Record how long memory usage took to get from above the high watermark
+ * back to the low watermark, if it was above the high watermark.
+ */
+static void recordLowWatReached(EPStats& stats,
+                                std::atomic<hrtime_t>& highWatSince) {
+    const hrtime_t since = highWatSince.exchange(0);
+    if (since != 0) {
+        const hrtime_t elapsed = (gethrtime() - since) / 1000;
+        stats.pagerHighToLowWatHisto.add(elapsed);
+        stats.pagerHighToLowWatTime.store(elapsed);
+    }
+}
+
 /**
  * As part of the ItemPager, visit all of the objects in memory and
  * eject some within a constrained probability
@@ -61,19 +100,30 @@ public:
      *              visits
      * @param bias active vbuckets eviction probability bias multiplier (0-1)
      * @param phase pointer to an item_pager_phase to be set
+     * @param policy decides which items to evict (ItemPager only)
+     * @param filter the vbuckets to visit
+     * @param run state shared with the other visitors of the same run, if
+     *            the vbuckets are split between several
      */
     PagingVisitor(KVBucketIface& s, EPStats &st, double pcnt,
                   std::shared_ptr<std::atomic<bool>> &sfin, pager_type_t caller,
                   bool pause, double bias,
-                  std::atomic<item_pager_phase>* phase) :
+                  std::atomic<item_pager_phase>* phase,
+                  std::unique_ptr<EvictionPolicy> policy = nullptr,
+                  const VBucketFilter& filter = VBucketFilter(),
+                  std::shared_ptr<PagingRunState> run = nullptr) :
+        VBucketVisitor(filter),
         store(s), stats(st), percent(pcnt),
-        activeBias(bias), ejected(0),
+        activeBias(bias), ejected(0), visited(0), totalExpired(0),
         startTime(ep_real_time()), stateFinalizer(sfin), owner(caller),
         canPause(pause), completePhase(true),
         wasHighMemoryUsage(s.isMemoryUsageTooHigh()),
-        taskStart(gethrtime()), pager_phase(phase) {}
+        taskStart(gethrtime()), pager_phase(phase),
+        evictionPolicy(std::move(policy)), runState(std::move(run)) {}
 
     void visit(StoredValue *v) override {
+        ++visited;
+
         // Delete expired items for an active vbucket.
         bool isExpired = (currentBucket->getState() == vbucket_state_active) &&
             v->isExpired(startTime) && !v->isDeleted();
@@ -84,21 +134,11 @@ public:
         }
 
         // return if not ItemPager, which uses valid eviction percentage
-        if (percent <= 0 || !pager_phase) {
+        if (percent <= 0 || !pager_phase || !evictionPolicy) {
             return;
         }
 
-        // always evict unreferenced items, or randomly evict referenced item
-        double r = *pager_phase == PAGING_UNREFERENCED ?
-            1 :
-            static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
-
-        if (*pager_phase == PAGING_UNREFERENCED &&
-            v->getNRUValue() == MAX_NRU_VALUE) {
-            doEviction(v);
-        } else if (*pager_phase == PAGING_RANDOM &&
-                   v->incrNRUValue() == MAX_NRU_VALUE &&
-                   r <= percent) {
+        if (evictionPolicy->shouldEvict(*v, *pager_phase, percent)) {
             doEviction(v);
         }
     }
@@ -124,7 +164,14 @@ public:
         if (percent <= 0 || !pager_phase) {
             if (vBucketFilter(vb->getId())) {
                 currentBucket = vb;
-                vb->ht.visit(*this);
+                // Temp items (left by background fetches) are only found by
+                // visiting every item.
+                if (vb->ht.hasExpiryIndex() &&
+                    vb->ht.getNumTempItems() == 0) {
+                    visitExpiryIndex(*vb);
+                } else {
+                    vb->ht.visit(*this);
+                }
             }
             return;
         }
@@ -150,6 +197,9 @@ public:
 
         } else { // stop eviction whenever memory usage is below low watermark
             completePhase = false;
+            if (runState && runState->highWatSince) {
+                recordLowWatReached(stats, *runState->highWatSince);
+            }
         }
     }
 
@@ -164,6 +214,7 @@ public:
         if (num_expired > 0) {
             LOG(EXTENSION_LOG_INFO, "Purged %ld expired items", num_expired);
         }
+        totalExpired += num_expired;
 
         ejected = 0;
         expired.clear();
@@ -177,11 +228,24 @@ public:
     void complete() override {
         update();
 
+        if (runState) {
+            if (!completePhase) {
+                runState->completePhase = false;
+            }
+            // The last of the run's visitors to finish completes the run.
+            if (runState->remaining.fetch_sub(1) != 1) {
+                return;
+            }
+            completePhase = runState->completePhase;
+        }
+
         hrtime_t elapsed_time = (gethrtime() - taskStart) / 1000;
         if (owner == ITEM_PAGER) {
             stats.itemPagerHisto.add(elapsed_time);
         } else if (owner == EXPIRY_PAGER) {
             stats.expiryPagerHisto.add(elapsed_time);
+            stats.expiryPagerLastVisited.store(visited);
+            stats.expiryPagerLastExpired.store(totalExpired);
         }
 
         bool inverse = false;
@@ -221,6 +285,27 @@ private:
         }
     }
 
+    /**
+     * Visit the items of the vbucket's expiry index which are due, rather
+     * than every item. Only active vbuckets expire items, so the others
+     * keep their index until they become active.
+     */
+    void visitExpiryIndex(VBucket& vb) {
+        if (vb.getState() != vbucket_state_active) {
+            return;
+        }
+        for (const auto& key : vb.ht.popExpiredKeys(startTime)) {
+            int bucket_num(0);
+            auto lh = vb.ht.getLockedBucket(key, &bucket_num);
+            StoredValue* v = vb.ht.unlocked_find(key, bucket_num,
+                                                 /*wantsDeleted*/ false,
+                                                 /*trackReference*/ false);
+            if (v) {
+                visit(v);
+            }
+        }
+    }
+
     void doEviction(StoredValue *v) {
         item_eviction_policy_t policy = store.getItemEvictionPolicy();
         StoredDocKey key(v->getKey());
@@ -245,6 +330,9 @@ private:
     double percent;
     double activeBias;
     size_t ejected;
+    // Items visited and expired over the whole run.
+    size_t visited;
+    size_t totalExpired;
     time_t startTime;
     std::shared_ptr<std::atomic<bool>> stateFinalizer;
     pager_type_t owner;
@@ -253,6 +341,8 @@ private:
     bool wasHighMemoryUsage;
     hrtime_t taskStart;
     std::atomic<item_pager_phase>* pager_phase;
+    std::unique_ptr<EvictionPolicy> evictionPolicy;
+    std::shared_ptr<PagingRunState> runState;
     RCPtr<VBucket> currentBucket;
 };
 
@@ -262,7 +352,8 @@ ItemPager::ItemPager(EventuallyPersistentEngine *e, EPStats &st) :
     stats(st),
     available(new std::atomic<bool>(true)),
     phase(PAGING_UNREFERENCED),
-    doEvict(false) { }
+    doEvict(false),
+    highWatSince(0) { }
 
 bool ItemPager::run(void) {
     TRACE_EVENT0("ep-engine/task", "ItemPager");
@@ -274,6 +365,10 @@ bool ItemPager::run(void) {
 
     if (current <= lower) {
         doEvict = false;
+        recordLowWatReached(stats, highWatSince);
+    } else if (current > upper) {
+        hrtime_t notAbove = 0;
+        highWatSince.compare_exchange_strong(notAbove, gethrtime());
     }
 
     bool inverse = true;
@@ -297,18 +392,55 @@ bool ItemPager::run(void) {
         size_t activeEvictPerc = cfg.getPagerActiveVbPcnt();
         double bias = static_cast<double>(activeEvictPerc) / 50;
 
-        auto pv = std::make_unique<PagingVisitor>(*kvBucket,
-                                                  stats,
-                                                  toKill,
-                                                  available,
-                                                  ITEM_PAGER,
-                                                  false,
-                                                  bias,
-                                                  &phase);
-        kvBucket->visit(std::move(pv),
-                        "Item pager",
-                        NONIO_TASK_IDX,
-                        TaskId::ItemPagerVisitor);
+        // Split the vbuckets between up to pager_concurrency visitors by
+        // shard, so that eviction keeps up with a burst of writes.
+        const VBucketMap& vbMap = kvBucket->getVBuckets();
+        const size_t numVisitors = std::max(
+                size_t(1),
+                std::min(cfg.getPagerConcurrency(), vbMap.getNumShards()));
+        std::vector<std::vector<uint16_t>> vbsByVisitor(numVisitors);
+        for (auto vbid : vbMap.getBuckets()) {
+            vbsByVisitor[vbMap.getShardByVbId(vbid)->getId() % numVisitors]
+                    .push_back(vbid);
+        }
+        vbsByVisitor.erase(
+                std::remove_if(vbsByVisitor.begin(),
+                               vbsByVisitor.end(),
+                               [](const std::vector<uint16_t>& vbs) {
+                                   return vbs.empty();
+                               }),
+                vbsByVisitor.end());
+        if (vbsByVisitor.empty()) {
+            // No vbuckets; a single visitor (of all) completes the run.
+            vbsByVisitor.emplace_back();
+        }
+
+        auto runState = std::make_shared<PagingRunState>(vbsByVisitor.size(),
+                                                         &highWatSince);
+        const auto policyType =
+                EvictionPolicy::typeFromString(cfg.getPagerEvictionPolicy());
+        for (const auto& vbs : vbsByVisitor) {
+            auto policy = EvictionPolicy::create(
+                    policyType,
+                    kvBucket->getFrequencySketch(),
+                    kvBucket->getItemEvictionPolicy());
+
+            auto pv = std::make_unique<PagingVisitor>(*kvBucket,
+                                                      stats,
+                                                      toKill,
+                                                      available,
+                                                      ITEM_PAGER,
+                                                      false,
+                                                      bias,
+                                                      &phase,
+                                                      std::move(policy),
+                                                      VBucketFilter(vbs),
+                                                      runState);
+            kvBucket->visit(std::move(pv),
+                            "Item pager",
+                            NONIO_TASK_IDX,
+                            TaskId::ItemPagerVisitor);
+        }
     }
 
     snooze(sleepTime);
@@ -393,3 +525,17 @@ void ExpiredItemPager::updateExpPagerTime(double sleepSecs) {
     _waketime.tv_sec += sleepSecs;
     stats.expPagerTime.store(_waketime.tv_sec);
 }
+
+FrequencySketchAger::FrequencySketchAger(
+        EventuallyPersistentEngine* e,
+        std::shared_ptr<FrequencySketch> sketch)
+    : GlobalTask(e, TaskId::FrequencySketchAger, 1, false),
+      sketch(std::move(sketch)) {
+}
+
+bool FrequencySketchAger::run(void) {
+    TRACE_EVENT0("ep-engine/task", "FrequencySketchAger");
+    sketch->ageIfDue();
+    snooze(1);
+    return true;
+}
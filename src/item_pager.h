@@ -22,10 +22,13 @@
 
 #include "tasks.h"
 
+#include <memory>
+
 typedef std::pair<int64_t, int64_t> row_range_t;
 
 // Forward declaration.
 class EventuallyPersistentEngine;
+class FrequencySketch;
 
 /**
  * The item pager phase
@@ -80,6 +83,10 @@ private:
     // objects running on different threads.
     std::atomic<item_pager_phase> phase;
     bool                            doEvict;
+    // When memory usage went above the high watermark, or 0 if it hasn't
+    // since it was last below the low watermark. Atomic as the
+    // PagingVisitors record when they reach the low watermark.
+    std::atomic<hrtime_t>           highWatSince;
 };
 
 /**
@@ -118,4 +125,24 @@ private:
     std::shared_ptr<std::atomic<bool>>   available;
 };
 
+/**
+ * Dispatcher job responsible for periodically halving the counters of the
+ * bucket's FrequencySketch (used by the TinyLFU eviction policy) once
+ * enough accesses have been recorded, so front-end threads never walk it.
+ */
+class FrequencySketchAger : public GlobalTask {
+public:
+    FrequencySketchAger(EventuallyPersistentEngine* e,
+                        std::shared_ptr<FrequencySketch> sketch);
+
+    bool run(void);
+
+    std::string getDescription() {
+        return std::string("Aging the item access frequency sketch.");
+    }
+
+private:
+    std::shared_ptr<FrequencySketch> sketch;
+};
+
 #endif  // SRC_ITEM_PAGER_H_
@@ -26,6 +26,7 @@
 #include <map>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -33,12 +34,15 @@
 #include <platform/make_unique.h>
 
 #include "access_scanner.h"
+#include "bgfetcher.h"
+#include "bloomfilter_file.h"
 #include "checkpoint_remover.h"
 #include "conflict_resolution.h"
 #include "dcp/dcpconnmap.h"
 #include "defragmenter.h"
 #include "kv_bucket.h"
 #include "ep_engine.h"
+#include "eviction_policy.h"
 #include "ext_meta_parser.h"
 #include "failover-table.h"
 #include "flusher.h"
@@ -114,6 +118,8 @@ public:
             store.setBGFetchDelay(static_cast<uint32_t>(value));
         } else if (key.compare("compaction_write_queue_cap") == 0) {
             store.setCompactionWriteQueueCap(value);
+        } else if (key.compare("flusher_batch_latency_target") == 0) {
+            store.setFlushBatchLatencyTarget(value);
         } else if (key.compare("exp_pager_stime") == 0) {
             store.setExpiryPagerSleeptime(value);
         } else if (key.compare("exp_pager_initial_run_time") == 0) {
@@ -184,6 +190,11 @@ public:
     void callback(uint16_t& vbucketId, const DocKey& key, bool& isDeleted) {
         RCPtr<VBucket> vb = store.getVBucket(vbucketId);
         if (vb) {
+            if (removesPurgedKeys(*vb)) {
+                // The filter is kept as is, rather than rebuilt.
+                return;
+            }
+
             /* Check if a temporary filter has been initialized. If not,
              * initialize it. If initialization fails, throw an exception
              * to the caller and let the caller deal with it.
@@ -228,9 +239,49 @@ public:
         }
     }
 
+    /**
+     * Returns true if the vbucket's bloom filter is to be kept accurate by
+     * removing the keys of the tombstones this compaction purges, rather
+     * than rebuilt. Decided when first asked for each vbucket, so that the
+     * whole compaction either rebuilds the filter or removes keys from it.
+     */
+    bool removesPurgedKeys(VBucket& vb) {
+        auto it = removingKeys.find(vb.getId());
+        if (it == removingKeys.end()) {
+            it = removingKeys.emplace(vb.getId(),
+                                      vb.canRemoveFromFilter()).first;
+        }
+        return it->second;
+    }
+
 private:
     bool initTempFilter(uint16_t vbucketId);
     KVBucket& store;
+    // Whether the filter of each vbucket compacted so far is having keys
+    // removed.
+    std::unordered_map<uint16_t, bool> removingKeys;
+};
+
+/**
+ * Callback class used by EpStore, for removing the keys of the tombstones
+ * compaction purges from bloomfilters which support it.
+ */
+class PurgedKeyCallback : public Callback<uint16_t&, const DocKey&> {
+public:
+    PurgedKeyCallback(KVBucket& eps, std::shared_ptr<BloomFilterCallback> cb)
+        : store(eps), filterCallback(cb) {
+    }
+
+    void callback(uint16_t& vbucketId, const DocKey& key) {
+        RCPtr<VBucket> vb = store.getVBucket(vbucketId);
+        if (vb && filterCallback->removesPurgedKeys(*vb)) {
+            vb->removeFromFilter(key);
+        }
+    }
+
+private:
+    KVBucket& store;
+    std::shared_ptr<BloomFilterCallback> filterCallback;
 };
 
 bool BloomFilterCallback::initTempFilter(uint16_t vbucketId) {
@@ -289,7 +340,8 @@ bool BloomFilterCallback::initTempFilter(uint16_t vbucketId) {
         estimated_count = initial_estimation;
     }
 
-    vb->initTempFilter(estimated_count, config.getBfilterFpProb());
+    vb->initTempFilter(estimated_count, config.getBfilterFpProb(),
+                       BloomFilter::typeFromString(config.getBfilterType()));
 
     return true;
 }
@@ -345,7 +397,9 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
       bgFetchDelay(0),
       backfillMemoryThreshold(0.95),
       statsSnapshotTaskId(0),
-      lastTransTimePerItem(0) {
+      lastTransTimePerItem(0),
+      flushBatchSizer(
+              theEngine.getConfiguration().getFlusherBatchLatencyTarget()) {
     cachedResidentRatio.activeRatio.store(0);
     cachedResidentRatio.replicaRatio.store(0);
 
@@ -449,6 +503,9 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
     config.addValueChangedListener("dcp_min_compression_ratio",
                                    new EPStoreValueChangeListener(*this));
 
+    config.addValueChangedListener("flusher_batch_latency_target",
+                                   new EPStoreValueChangeListener(*this));
+
     const std::string &policy = config.getItemEvictionPolicy();
     if (policy.compare("value_only") == 0) {
         eviction_policy = VALUE_ONLY;
@@ -456,6 +513,14 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
         eviction_policy = FULL_EVICTION;
     }
 
+    if (EvictionPolicy::typeFromString(config.getPagerEvictionPolicy()) ==
+        EvictionPolicy::Type::TinyLFU) {
+        // About one counter for each item the bucket could hold, assuming
+        // items of 512 bytes or more; a counter is half a byte.
+        frequencySketch = std::make_shared<FrequencySketch>(
+                config.getMaxSize() / 512);
+    }
+
     if (config.isWarmup()) {
         warmupTask = std::make_unique<Warmup>(*this, config);
     }
@@ -478,6 +543,12 @@ bool KVBucket::initialize() {
     itmpTask = new ItemPager(&engine, stats);
     ExecutorPool::get()->schedule(itmpTask, NONIO_TASK_IDX);
 
+    if (frequencySketch) {
+        ExTask agerTask =
+                make_STRCPtr<FrequencySketchAger>(&engine, frequencySketch);
+        ExecutorPool::get()->schedule(agerTask, NONIO_TASK_IDX);
+    }
+
     {
         LockHolder elh(expiryPager.mutex);
         expiryPager.enabled = config.isExpPagerEnabled();
@@ -800,7 +871,9 @@ ENGINE_ERROR_CODE KVBucket::setVBucketState_UNLOCKED(uint16_t vbid,
             // Initialize bloom filters upon vbucket creation during
             // bucket creation and rebalance
             newvb->createFilter(config.getBfilterKeyCount(),
-                                config.getBfilterFpProb());
+                                config.getBfilterFpProb(),
+                                BloomFilter::typeFromString(
+                                        config.getBfilterType()));
         }
 
         // The first checkpoint for active vbucket should start with id 2.
@@ -850,6 +923,7 @@ bool KVBucket::completeVBucketDeletion(uint16_t vbid, const void* cookie) {
 
         if (bucketDeleting) {
             LockHolder vlh(vb_mutexes[vbid]);
+            removeSavedFilter(vbid);
             if (!getRWUnderlying(vbid)->delVBucket(vbid)) {
                 return false;
             }
@@ -976,8 +1050,9 @@ uint16_t KVBucket::getDBFileId(const protocol_binary_request_compact_db& req) {
 }
 
 void KVBucket::compactInternal(compaction_ctx *ctx) {
-    BloomFilterCBPtr filter(new BloomFilterCallback(*this));
+    auto filter = std::make_shared<BloomFilterCallback>(*this);
     ctx->bloomFilterCallback = filter;
+    ctx->purgedKeyCallback = std::make_shared<PurgedKeyCallback>(*this, filter);
 
     ExpiredItemsCBPtr expiry(new ExpiredItemsCallback(*this));
     ctx->expiryCallback = expiry;
@@ -986,6 +1061,13 @@ void KVBucket::compactInternal(compaction_ctx *ctx) {
     KVStore* store = shard->getRWUnderlying();
     bool result = store->compactDB(ctx);
 
+    // Gets go through the read-only store, which must let go of the
+    // pre-compaction file.
+    KVStore* roStore = shard->getROUnderlying();
+    if (result && roStore != store) {
+        roStore->invalidateCachedDBs(ctx->db_file_id);
+    }
+
     Configuration& config = getEPEngine().getConfiguration();
     /* Iterate over all the vbucket ids set in max_purged_seq map. If there is an entry
      * in the map for a vbucket id, then it was involved in compaction and thus can
@@ -1000,6 +1082,7 @@ void KVBucket::compactInternal(compaction_ctx *ctx) {
 
         if (config.isBfilterEnabled() && result) {
             vb->swapFilter();
+            saveFilter(*vb);
         } else {
             vb->clearFilter();
         }
@@ -1645,7 +1728,7 @@ std::string KVBucket::validateKey(const DocKey& key, uint16_t vbucket,
         if (diskItem.getFlags() != v->getFlags()) {
             return "flags_mismatch";
         } else if (v->isResident() && memcmp(diskItem.getData(),
-                                             v->getValue()->getData(),
+                                             v->materializeValue()->getData(),
                                              diskItem.getNBytes())) {
             return "data_mismatch";
         } else {
@@ -1941,8 +2024,10 @@ void KVBucket::flushOneDeleteAll() {
 
 int KVBucket::flushVBucket(uint16_t vbid) {
     KVShard *shard = vbMap.getShardByVbId(vbid);
+    Flusher *flusher = shard->getFlusher();
     if (diskDeleteAll && !deleteAllTaskCtx.delay) {
         if (shard->getId() == EP_PRIMARY_SHARD) {
+            flusher->drainPendingCommits();
             flushOneDeleteAll();
         } else {
             // disk flush is pending just return
@@ -1955,6 +2040,10 @@ int KVBucket::flushVBucket(uint16_t vbid) {
 
     RCPtr<VBucket> vb = vbMap.getBucket(vbid);
     if (vb) {
+        if (flusher->hasPendingCommitFor(vbid)) {
+            // This thread still holds the vbucket's lock for its commit.
+            flusher->drainPendingCommits();
+        }
         std::unique_lock<std::mutex> lh(vb_mutexes[vbid], std::try_to_lock);
         if (!lh.owns_lock()) { // Try another bucket if this one is locked
             return RETRY_FLUSH_VBUCKET; // to avoid blocking flusher
@@ -1971,13 +2060,32 @@ int KVBucket::flushVBucket(uint16_t vbid) {
         // Append any 'backfill' items (mutations added by a TAP stream).
         vb->getBackfillItems(items);
 
-        // Append all items outstanding for the persistence cursor.
+        // Append the items outstanding for the persistence cursor, up to the
+        // batch size expected to commit within the latency target.
         snapshot_range_t range;
         hrtime_t _begin_ = gethrtime();
-        range = vb->checkpointManager.getAllItemsForCursor(
-                CheckpointManager::pCursorName, items);
+        const size_t batchSize = flushBatchSizer.getBatchSize();
+        if (batchSize == 0) {
+            range = vb->checkpointManager.getAllItemsForCursor(
+                    CheckpointManager::pCursorId, items);
+        } else {
+            const size_t prevSize = items.size();
+            range = vb->checkpointManager.getItemsForCursor(
+                    CheckpointManager::pCursorId, items, batchSize);
+            if (items.size() - prevSize == batchSize &&
+                vb->checkpointManager.getNumItemsForCursor(
+                        CheckpointManager::pCursorId) > 0) {
+                // Flush the rest in a later batch.
+                flusher->notifyFlushEvent();
+            }
+        }
         stats.persistenceCursorGetItemsHisto.add((gethrtime() - _begin_) / 1000);
 
+        // Sorting doesn't touch the KVStore's state, so (when pipelined) can
+        // overlap with a commit still in flight; nothing further can.
+        rwUnderlying->optimizeWrites(items);
+        flusher->completePendingCommit();
+
         if (!items.empty()) {
             while (!rwUnderlying->begin()) {
                 ++stats.beginFailed;
@@ -1985,7 +2093,6 @@ int KVBucket::flushVBucket(uint16_t vbid) {
                     "Retry in 1 sec ...");
                 sleep(1);
             }
-            rwUnderlying->optimizeWrites(items);
 
             Item *prev = NULL;
             auto vbstate = vb->getVBucketState();
@@ -2091,6 +2198,29 @@ int KVBucket::flushVBucket(uint16_t vbid) {
             if ((items_flushed > 0) &&
                 (decrCommitInterval(shard->getId()) == 0)) {
 
+                if (flusher->defersCommits()) {
+                    // The flusher commits these items in the background
+                    // and/or along with other vbuckets'; the rest of this
+                    // flush (under the vbucket's lock) follows the commit.
+                    flusher->deferCommit(
+                            vbid, std::move(lh),
+                            [this, vb, rwUnderlying, range, items_flushed,
+                             flush_start, flusher]() mutable {
+                                if (vb->setBucketCreation(false)) {
+                                    LOG(EXTENSION_LOG_INFO,
+                                        "VBucket %" PRIu16 " created",
+                                        vb->getId());
+                                }
+                                if (!completeVBucketFlush(vb, *rwUnderlying,
+                                                          &range,
+                                                          items_flushed,
+                                                          flush_start)) {
+                                    flusher->notifyFlushEvent();
+                                }
+                            });
+                    return items_flushed;
+                }
+
                 commit(shard->getId());
 
                 // Now the commit is complete, vBucket file must exist.
@@ -2098,54 +2228,69 @@ int KVBucket::flushVBucket(uint16_t vbid) {
                     LOG(EXTENSION_LOG_INFO, "VBucket %" PRIu16 " created", vbid);
                 }
             }
+        }
 
-            hrtime_t flush_end = gethrtime();
-            uint64_t trans_time = (flush_end - flush_start) / 1000000;
-
-            lastTransTimePerItem.store((items_flushed == 0) ? 0 :
-                                       static_cast<double>(trans_time) /
-                                       static_cast<double>(items_flushed));
-            stats.cumulativeFlushTime.fetch_add(trans_time);
-            stats.flusher_todo.store(0);
-            stats.totalPersistVBState++;
-
-            if (vb->rejectQueue.empty()) {
-                vb->setPersistedSnapshot(range.start, range.end);
-                uint64_t highSeqno = rwUnderlying->getLastPersistedSeqno(vbid);
-                if (highSeqno > 0 &&
-                    highSeqno != vb->getPersistenceSeqno()) {
-                    vb->setPersistenceSeqno(highSeqno);
-                }
-            }
+        if (!completeVBucketFlush(vb, *rwUnderlying,
+                                  items.empty() ? nullptr : &range,
+                                  items_flushed, flush_start)) {
+            return RETRY_FLUSH_VBUCKET;
         }
+    }
 
-        rwUnderlying->pendingTasks();
+    return items_flushed;
+}
 
-        if (vb->checkpointManager.getNumCheckpoints() > 1) {
-            wakeUpCheckpointRemover();
-        }
+bool KVBucket::completeVBucketFlush(RCPtr<VBucket> &vb, KVStore& rwUnderlying,
+                                    const snapshot_range_t* range,
+                                    int items_flushed, hrtime_t flush_start) {
+    if (range) {
+        hrtime_t flush_end = gethrtime();
+        uint64_t trans_time = (flush_end - flush_start) / 1000000;
+        stats.persistenceLatencyHisto.add((flush_end - flush_start) / 1000);
+
+        lastTransTimePerItem.store((items_flushed == 0) ? 0 :
+                                   static_cast<double>(trans_time) /
+                                   static_cast<double>(items_flushed));
+        stats.cumulativeFlushTime.fetch_add(trans_time);
+        stats.flusher_todo.store(0);
+        stats.totalPersistVBState++;
 
         if (vb->rejectQueue.empty()) {
-            vb->checkpointManager.itemsPersisted();
-            uint64_t seqno = vb->getPersistenceSeqno();
-            uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
-            vb->notifyOnPersistence(engine, seqno, true);
-            vb->notifyOnPersistence(engine, chkid, false);
-            if (chkid > 0 && chkid != vb->getPersistenceCheckpointId()) {
-                vb->setPersistenceCheckpointId(chkid);
+            vb->setPersistedSnapshot(range->start, range->end);
+            uint64_t highSeqno = rwUnderlying.getLastPersistedSeqno(vb->getId());
+            if (highSeqno > 0 &&
+                highSeqno != vb->getPersistenceSeqno()) {
+                vb->setPersistenceSeqno(highSeqno);
             }
-        } else {
-            return RETRY_FLUSH_VBUCKET;
         }
     }
 
-    return items_flushed;
+    rwUnderlying.pendingTasks();
+
+    if (vb->checkpointManager.getNumCheckpoints() > 1) {
+        wakeUpCheckpointRemover();
+    }
+
+    if (!vb->rejectQueue.empty()) {
+        return false;
+    }
+
+    vb->checkpointManager.itemsPersisted();
+    uint64_t seqno = vb->getPersistenceSeqno();
+    uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
+    vb->notifyOnPersistence(engine, seqno, true);
+    vb->notifyOnPersistence(engine, chkid, false);
+    if (chkid > 0 && chkid != vb->getPersistenceCheckpointId()) {
+        vb->setPersistenceCheckpointId(chkid);
+    }
+    return true;
 }
 
 void KVBucket::commit(uint16_t shardId) {
     KVStore *rwUnderlying = getRWUnderlyingByShard(shardId);
     std::list<PersistenceCallback *>& pcbs = rwUnderlying->getPersistenceCbList();
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
+    const size_t numItems = pcbs.size();
     hrtime_t commit_start = gethrtime();
 
     while (!rwUnderlying->commit()) {
@@ -2179,6 +2324,10 @@ void KVBucket::commit(uint16_t shardId) {
 
     ++stats.flusherCommits;
     hrtime_t commit_end = gethrtime();
+    if (flushBatchSizer.commitCompleted(numItems, commit_end - commit_start)) {
+        ++stats.flushBatchTargetMisses;
+    }
+    stats.flushBatchSize.store(flushBatchSizer.getBatchSize());
     uint64_t commit_time = (commit_end - commit_start) / 1000000;
     stats.commit_time.store(commit_time);
     stats.cumulativeCommitTime.fetch_add(commit_time);
@@ -2470,6 +2619,44 @@ void KVBucket::resetAccessScannerStartTime() {
     }
 }
 
+void KVBucket::saveFilter(VBucket& vb) {
+    Configuration& config = engine.getConfiguration();
+    if (!config.isBfilterEnabled() || !config.isBfilterPersist()) {
+        return;
+    }
+
+    // Everything persisted up to this seqno is in the snapshot.
+    const int64_t highSeqno = vb.getPersistenceSeqno();
+    const uint64_t uuid = vb.failovers->getLatestUUID();
+    auto filter = vb.snapshotFilter();
+    if (filter) {
+        BloomFilterFile::save(
+                BloomFilterFile::getPath(config.getDbname(), vb.getId()),
+                *filter, uuid, highSeqno);
+    }
+}
+
+bool KVBucket::restoreFilter(VBucket& vb, uint64_t uuid, int64_t highSeqno) {
+    Configuration& config = engine.getConfiguration();
+    const std::string path =
+            BloomFilterFile::getPath(config.getDbname(), vb.getId());
+    std::unique_ptr<BloomFilter> filter;
+    if (config.isBfilterEnabled()) {
+        filter = BloomFilterFile::load(path, uuid, highSeqno);
+    }
+    BloomFilterFile::remove(path);
+    if (!filter) {
+        return false;
+    }
+    vb.restoreFilter(std::move(filter));
+    return true;
+}
+
+void KVBucket::removeSavedFilter(uint16_t vbid) {
+    BloomFilterFile::remove(BloomFilterFile::getPath(
+            engine.getConfiguration().getDbname(), vbid));
+}
+
 void KVBucket::setAllBloomFilters(bool to) {
     for (VBucketMap::id_type vbid = 0; vbid < vbMap.getSize(); vbid++) {
         RCPtr<VBucket> vb = vbMap.getBucket(vbid);
@@ -2605,6 +2792,11 @@ void KVBucket::addKVStoreTimingStats(ADD_STAT add_stat, const void* cookie) {
         for (auto* store : underlyingSet) {
             store->addTimingStats(add_stat, cookie);
         }
+
+        BgFetcher* bgFetcher = vbMap.shards[i]->getBgFetcher();
+        if (bgFetcher) {
+            bgFetcher->addTimingStats(add_stat, cookie);
+        }
     }
 }
 
@@ -2701,7 +2893,7 @@ private:
 void KVBucket::rollbackCheckpoint(RCPtr<VBucket> &vb,
                                   int64_t rollbackSeqno) {
     std::vector<queued_item> items;
-    vb->checkpointManager.getAllItemsForCursor(CheckpointManager::pCursorName,
+    vb->checkpointManager.getAllItemsForCursor(CheckpointManager::pCursorId,
                                                items);
     for (const auto& item : items) {
         if (item->getBySeqno() > rollbackSeqno &&
@@ -2743,6 +2935,7 @@ ENGINE_ERROR_CODE KVBucket::rollback(uint16_t vbid, uint64_t rollbackSeqno) {
             RollbackResult result = rwUnderlying->rollback(vbid, rollbackSeqno, cb);
 
             if (result.success) {
+                removeSavedFilter(vbid);
                 rollbackCheckpoint(vb, rollbackSeqno);
                 vb->failovers->pruneEntries(result.highSeqno);
                 vb->checkpointManager.clear(vb, result.highSeqno);
@@ -2782,6 +2975,14 @@ void KVBucket::setCursorDroppingLowerUpperThresholds(size_t maxSize) {
                     ((double)(config.getCursorDroppingLowerMark()) / 100)));
     stats.cursorDroppingUThreshold.store(static_cast<size_t>(maxSize *
                     ((double)(config.getCursorDroppingUpperMark()) / 100)));
+    stats.cursorDroppingCheckpointMemLThreshold.store(
+            static_cast<size_t>(maxSize *
+                    ((double)(config.getCursorDroppingCheckpointMemLowerMark()) /
+                     100)));
+    stats.cursorDroppingCheckpointMemUThreshold.store(
+            static_cast<size_t>(maxSize *
+                    ((double)(config.getCursorDroppingCheckpointMemUpperMark()) /
+                     100)));
 }
 
 size_t KVBucket::getActiveResidentRatio() const {
@@ -18,6 +18,7 @@
 
 #include "ep_types.h"
 #include "executorpool.h"
+#include "flush_batch_sizer.h"
 #include "mutation_log.h"
 #include "storeddockey.h"
 #include "stored-value.h"
@@ -574,6 +575,27 @@ public:
 
     void setAllBloomFilters(bool to);
 
+    /**
+     * Save the vbucket's bloom filter to disk, if bfilter_persist is set, so
+     * that warmup can restore it.
+     */
+    void saveFilter(VBucket& vb);
+
+    /**
+     * Restore the vbucket's bloom filter saved by saveFilter(), if it is
+     * valid for the given (on disk) state of the vbucket. The saved filter
+     * is removed either way.
+     *
+     * @return true if the filter was restored
+     */
+    bool restoreFilter(VBucket& vb, uint64_t uuid, int64_t highSeqno);
+
+    /**
+     * Remove the vbucket's saved bloom filter, when its data on disk is
+     * changed other than by persisting items.
+     */
+    void removeSavedFilter(uint16_t vbid);
+
     float getBfiltersResidencyThreshold() {
         return bfilterResidencyThreshold;
     }
@@ -688,6 +710,11 @@ public:
         compactionWriteQueueCap = to;
     }
 
+    void setFlushBatchLatencyTarget(size_t targetMs) {
+        flushBatchSizer.setTarget(targetMs);
+        stats.flushBatchSize.store(flushBatchSizer.getBatchSize());
+    }
+
     void setCompactionExpMemThreshold(size_t to) {
         compactionExpMemThreshold = static_cast<double>(to) / 100.0;
     }
@@ -725,6 +752,10 @@ public:
     size_t getActiveResidentRatio() const;
 
     size_t getReplicaResidentRatio() const;
+
+    std::shared_ptr<FrequencySketch> getFrequencySketch() const {
+        return frequencySketch;
+    }
     /*
      * Change the max_cas of the specified vbucket to cas without any
      * care for the data or ongoing operations...
@@ -810,6 +841,20 @@ protected:
     PersistenceCallback* flushOneDelOrSet(const queued_item &qi,
                                           RCPtr<VBucket> &vb);
 
+    /**
+     * The part of flushVBucket following the commit of a vbucket's items:
+     * record the persisted snapshot and notify anyone waiting on
+     * persistence.
+     *
+     * @param range the snapshot range flushed, or nullptr if there were no
+     *        items to flush
+     * @return false if items were rejected and the vbucket must be flushed
+     *         again
+     */
+    bool completeVBucketFlush(RCPtr<VBucket> &vb, KVStore& rwUnderlying,
+                              const snapshot_range_t* range,
+                              int items_flushed, hrtime_t flush_start);
+
     GetValue getInternal(const DocKey& key, uint16_t vbucket, const void *cookie,
                          vbucket_state_t allowedState,
                          get_options_t options = TRACK_REFERENCE);
@@ -890,7 +935,12 @@ protected:
     } cachedResidentRatio;
     size_t statsSnapshotTaskId;
     std::atomic<size_t> lastTransTimePerItem;
+    // Limits each flush's batch to what commits in the latency target.
+    FlushBatchSizer flushBatchSizer;
     item_eviction_policy_t eviction_policy;
+    // Recent accesses to every vbucket's items, when the item pager uses
+    // the TinyLFU policy.
+    std::shared_ptr<FrequencySketch> frequencySketch;
 
     std::mutex compactionLock;
     std::list<CompTaskEntry> compactionTasks;
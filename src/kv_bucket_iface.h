@@ -780,6 +780,12 @@ public:
 
     virtual size_t getReplicaResidentRatio() const = 0;
 
+    /**
+     * Get the sketch of recent item accesses used by the item pager's
+     * TinyLFU eviction policy, or nullptr if the policy isn't in use.
+     */
+    virtual std::shared_ptr<FrequencySketch> getFrequencySketch() const = 0;
+
     /*
      * Change the max_cas of the specified vbucket to cas without any
      * care for the data or ongoing operations...
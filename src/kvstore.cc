@@ -40,6 +40,8 @@ KVStoreConfig::KVStoreConfig(Configuration& config, uint16_t shardid)
                     config.getBackend(),
                     shardid,
                     config.isCollectionsPrototypeEnabled()) {
+    ioUring = config.isCouchstoreIoUring();
+    dbHandleCacheSize = config.getCouchstoreDbHandleCacheSize();
 }
 
 KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
@@ -55,6 +57,8 @@ KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
       shardId(_shardId),
       logger(&global_logger),
       buffered(true),
+      ioUring(false),
+      dbHandleCacheSize(0),
       persistDocNamespace(_persistDocNamespace) {
 }
 
@@ -68,6 +72,16 @@ KVStoreConfig& KVStoreConfig::setBuffered(bool _buffered) {
     return *this;
 }
 
+KVStoreConfig& KVStoreConfig::setIoUring(bool _ioUring) {
+    ioUring = _ioUring;
+    return *this;
+}
+
+KVStoreConfig& KVStoreConfig::setDbHandleCacheSize(size_t _dbHandleCacheSize) {
+    dbHandleCacheSize = _dbHandleCacheSize;
+    return *this;
+}
+
 KVStore *KVStoreFactory::create(KVStoreConfig &config, bool read_only) {
     KVStore *ret = NULL;
     std::string backend = config.getBackend();
@@ -228,6 +242,10 @@ void KVStore::addStats(ADD_STAT add_stat, const void *c) {
     addStat(prefix, "readTime",       st.readTimeHisto,   add_stat, c);
     addStat(prefix, "readSize",       st.readSizeHisto,   add_stat, c);
     addStat(prefix, "numLoadedVb",    st.numLoadedVb,     add_stat, c);
+    addStat(prefix, "db_handle_cache_hits", st.numDbHandleCacheHits,
+            add_stat, c);
+    addStat(prefix, "db_handle_cache_misses", st.numDbHandleCacheMisses,
+            add_stat, c);
 
     // failure stats
     addStat(prefix, "failure_open",   st.numOpenFailure, add_stat, c);
@@ -106,6 +106,7 @@ typedef uint16_t DBFileId;
 
 typedef std::shared_ptr<Callback<uint16_t&, const DocKey&, bool&> > BloomFilterCBPtr;
 typedef std::shared_ptr<Callback<uint16_t&, const DocKey&, uint64_t&, time_t&> > ExpiredItemsCBPtr;
+typedef std::shared_ptr<Callback<uint16_t&, const DocKey&> > PurgedKeyCBPtr;
 
 class KVStoreConfig;
 typedef struct {
@@ -119,6 +120,8 @@ typedef struct {
     uint32_t curr_time;
     BloomFilterCBPtr bloomFilterCallback;
     ExpiredItemsCBPtr expiryCallback;
+    // Called with the key of each deleted item compaction purges.
+    PurgedKeyCBPtr purgedKeyCallback;
 } compaction_ctx;
 
 /**
@@ -379,6 +382,8 @@ public:
       numDelFailure(0),
       numOpenFailure(0),
       numVbSetFailure(0),
+      numDbHandleCacheHits(0),
+      numDbHandleCacheMisses(0),
       io_num_read(0),
       io_num_write(0),
       io_read_bytes(0),
@@ -399,6 +404,8 @@ public:
         numDelFailure = 0;
         numOpenFailure = 0;
         numVbSetFailure = 0;
+        numDbHandleCacheHits = 0;
+        numDbHandleCacheMisses = 0;
 
         readTimeHisto.reset();
         readSizeHisto.reset();
@@ -429,6 +436,10 @@ public:
     Couchbase::RelaxedAtomic<size_t> numOpenFailure;
     Couchbase::RelaxedAtomic<size_t> numVbSetFailure;
 
+    //! Number of gets which reused / had to open a file handle
+    Couchbase::RelaxedAtomic<size_t> numDbHandleCacheHits;
+    Couchbase::RelaxedAtomic<size_t> numDbHandleCacheMisses;
+
     //! Number of read related io operations
     Couchbase::RelaxedAtomic<size_t> io_num_read;
     //! Number of write related io operations
@@ -611,6 +622,25 @@ public:
         return buffered;
     }
 
+    /**
+     * Indicates whether or not file IO is batched through io_uring.
+     *
+     * Only recognised by CouchKVStore
+     */
+    bool getIoUring() const {
+        return ioUring;
+    }
+
+    /**
+     * Maximum number of read-only file handles kept open for reuse by
+     * gets (0 if handles aren't reused).
+     *
+     * Only recognised by CouchKVStore
+     */
+    size_t getDbHandleCacheSize() const {
+        return dbHandleCacheSize;
+    }
+
     /**
      * Used to override the default logger object
      */
@@ -623,6 +653,20 @@ public:
      */
     KVStoreConfig& setBuffered(bool _buffered);
 
+    /**
+     * Used to enable or disable batching file IO through io_uring.
+     *
+     * Only recognised by CouchKVStore
+     */
+    KVStoreConfig& setIoUring(bool _ioUring);
+
+    /**
+     * Used to set the number of read-only file handles kept for reuse.
+     *
+     * Only recognised by CouchKVStore
+     */
+    KVStoreConfig& setDbHandleCacheSize(size_t _dbHandleCacheSize);
+
     bool shouldPersistDocNamespace() const {
         return persistDocNamespace;
     }
@@ -639,6 +683,8 @@ private:
     uint16_t shardId;
     Logger* logger;
     bool buffered;
+    bool ioUring;
+    size_t dbHandleCacheSize;
     bool persistDocNamespace;
 };
 
@@ -838,6 +884,14 @@ public:
      */
     virtual bool compactDB(compaction_ctx *c) = 0;
 
+    /**
+     * Drop any handles kept open on the given vbucket's database file, as
+     * it has been replaced (e.g. compacted through another KVStore).
+     */
+    virtual void invalidateCachedDBs(uint16_t vbid) {
+        (void) vbid;
+    }
+
     /**
      * Return the database file id from the compaction request
      * @param compact_req request structure for compaction
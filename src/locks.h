@@ -32,8 +32,9 @@
 using LockHolder = std::lock_guard<std::mutex>;
 
 /**
- * RAII lock holder over multiple locks.
+ * RAII lock holder over multiple locks (std::mutex by default).
  */
+template <typename Mutex = std::mutex>
 class MultiLockHolder {
 public:
 
@@ -43,7 +44,7 @@ public:
      * @param m beginning of an array of locks
      * @param n the number of locks to lock
      */
-    MultiLockHolder(std::mutex* m, size_t n)
+    MultiLockHolder(Mutex* m, size_t n)
         : mutexes(m),
           n_locks(n) {
         lock();
@@ -72,7 +73,7 @@ private:
         }
     }
 
-    std::mutex* mutexes;
+    Mutex* mutexes;
     size_t n_locks;
 
     DISALLOW_COPY_AND_ASSIGN(MultiLockHolder);
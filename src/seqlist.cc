@@ -0,0 +1,289 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "seqlist.h"
+
+#include "ep_time.h"
+#include "stored-value.h"
+
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+SequenceList::SequenceList() : numDeleted(0), lastRangeReadId(0) {
+}
+
+void SequenceList::updateListElem(std::lock_guard<std::mutex>& listWriteLg,
+                                  const StoredValue& v,
+                                  int64_t prevSeqno,
+                                  uint16_t vbid) {
+    const int64_t newSeqno = v.getBySeqno();
+    auto it = findElem(prevSeqno, v.getKey());
+    if (it != elems.end()) {
+        if (prevSeqno == newSeqno) {
+            // Still in the same place; just refresh the element's state.
+            if (v.isDeleted() && !it->second.deleted) {
+                ++numDeleted;
+            } else if (!v.isDeleted() && it->second.deleted) {
+                --numDeleted;
+            }
+            it->second.deleted = v.isDeleted();
+            it->second.time = ep_current_time();
+            return;
+        }
+        // If nobody saved the old version before v was changed, the best
+        // we can do is the new state at the old position.
+        saveStaleCopy(it->first, v, vbid);
+        eraseElem(it);
+    }
+
+    if (newSeqno <= 0) {
+        // Temporary items have no place in the list.
+        return;
+    }
+
+    auto existing = elems.find(newSeqno);
+    if (existing != elems.end()) {
+        // A seqno can only be reused if the vbucket was reset underneath us
+        // (e.g. flushed); the existing element is an orphan.
+        eraseElem(existing);
+    }
+
+    elems.emplace(newSeqno,
+                  Elem{StoredDocKey(v.getKey()),
+                       v.isDeleted(),
+                       ep_current_time()});
+    if (v.isDeleted()) {
+        ++numDeleted;
+    }
+}
+
+void SequenceList::saveStaleCopy(const StoredValue& v, uint16_t vbid) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    if (rangeReads.empty()) {
+        return;
+    }
+    auto it = findElem(v.getBySeqno(), v.getKey());
+    if (it != elems.end()) {
+        saveStaleCopy(it->first, v, vbid);
+    }
+}
+
+void SequenceList::removeListElem(const StoredValue& v, uint16_t vbid) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    auto it = findElem(v.getBySeqno(), v.getKey());
+    if (it != elems.end()) {
+        saveStaleCopy(it->first, v, vbid);
+        eraseElem(it);
+    }
+}
+
+SequenceList::RangeReadId SequenceList::beginRangeRead(int64_t start,
+                                                       int64_t end) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    const RangeReadId id = ++lastRangeReadId;
+    rangeReads.emplace(id, RangeRead{start, end});
+    return id;
+}
+
+std::vector<SequenceList::RangeElem> SequenceList::getRangeChunk(
+        RangeReadId id, size_t maxElems) {
+    std::vector<RangeElem> chunk;
+    std::lock_guard<std::mutex> lh(writeLock);
+    const RangeRead& read = getRangeRead(id, "getRangeChunk");
+
+    // Merge the live and stale elements; a stale element takes precedence
+    // as it holds the state the item had when the range read began.
+    auto live = elems.lower_bound(read.pos);
+    auto stale = staleElems.lower_bound(read.pos);
+    while (chunk.size() < maxElems) {
+        if (stale != staleElems.end() && !isVisibleTo(id, stale->second)) {
+            ++stale;
+            continue;
+        }
+        const bool liveInRange =
+                live != elems.end() && live->first <= read.end;
+        const bool staleInRange =
+                stale != staleElems.end() && stale->first <= read.end;
+        if (staleInRange && (!liveInRange || stale->first <= live->first)) {
+            if (liveInRange && live->first == stale->first) {
+                ++live;
+            }
+            std::unique_ptr<Item> copy(new Item(*stale->second.item));
+            StoredDocKey key(copy->getKey());
+            chunk.push_back({stale->first, std::move(key), std::move(copy)});
+            ++stale;
+        } else if (liveInRange) {
+            chunk.push_back({live->first, live->second.key, nullptr});
+            ++live;
+        } else {
+            break;
+        }
+    }
+    return chunk;
+}
+
+std::unique_ptr<Item> SequenceList::copyStaleElem(RangeReadId id,
+                                                  int64_t seqno) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    auto it = staleElems.find(seqno);
+    if (it == staleElems.end() || !isVisibleTo(id, it->second)) {
+        return nullptr;
+    }
+    return std::unique_ptr<Item>(new Item(*it->second.item));
+}
+
+void SequenceList::advanceRangeRead(RangeReadId id, int64_t seqno) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    RangeRead& read = getRangeRead(id, "advanceRangeRead");
+    if (seqno < read.pos) {
+        return;
+    }
+    const int64_t from = read.pos;
+    read.pos = seqno + 1;
+    releaseStaleElems(from, seqno);
+}
+
+void SequenceList::endRangeRead(RangeReadId id) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    auto it = rangeReads.find(id);
+    if (it == rangeReads.end()) {
+        return;
+    }
+    const RangeRead read = it->second;
+    rangeReads.erase(it);
+    releaseStaleElems(read.pos, read.end);
+}
+
+std::vector<SequenceList::Tombstone> SequenceList::getTombstones(
+        int64_t start, rel_time_t before, size_t maxElems) {
+    std::vector<Tombstone> tombstones;
+    std::lock_guard<std::mutex> lh(writeLock);
+    if (numDeleted == 0) {
+        return tombstones;
+    }
+    for (auto it = elems.lower_bound(start);
+         it != elems.end() && tombstones.size() < maxElems;
+         ++it) {
+        if (it->second.deleted && it->second.time < before) {
+            tombstones.push_back({it->first, it->second.key});
+        }
+    }
+    return tombstones;
+}
+
+void SequenceList::removeOrphan(int64_t seqno, const DocKey& key) {
+    std::lock_guard<std::mutex> lh(writeLock);
+    auto it = findElem(seqno, key);
+    if (it != elems.end()) {
+        eraseElem(it);
+    }
+}
+
+void SequenceList::clear() {
+    std::lock_guard<std::mutex> lh(writeLock);
+    elems.clear();
+    staleElems.clear();
+    numDeleted = 0;
+}
+
+size_t SequenceList::getNumItems() const {
+    std::lock_guard<std::mutex> lh(writeLock);
+    return elems.size();
+}
+
+size_t SequenceList::getNumDeletedItems() const {
+    std::lock_guard<std::mutex> lh(writeLock);
+    return numDeleted;
+}
+
+size_t SequenceList::getNumStaleItems() const {
+    std::lock_guard<std::mutex> lh(writeLock);
+    return staleElems.size();
+}
+
+size_t SequenceList::getNumRangeReads() const {
+    std::lock_guard<std::mutex> lh(writeLock);
+    return rangeReads.size();
+}
+
+int64_t SequenceList::getHighSeqno() const {
+    std::lock_guard<std::mutex> lh(writeLock);
+    return elems.empty() ? 0 : elems.rbegin()->first;
+}
+
+std::map<int64_t, SequenceList::Elem>::iterator SequenceList::findElem(
+        int64_t seqno, const DocKey& key) {
+    auto it = elems.find(seqno);
+    if (it == elems.end() || it->second.key != StoredDocKey(key)) {
+        return elems.end();
+    }
+    return it;
+}
+
+void SequenceList::eraseElem(std::map<int64_t, Elem>::iterator it) {
+    if (it->second.deleted) {
+        --numDeleted;
+    }
+    elems.erase(it);
+}
+
+void SequenceList::saveStaleCopy(int64_t seqno,
+                                 const StoredValue& v,
+                                 uint16_t vbid) {
+    if (!mustKeepForRangeRead(seqno) || staleElems.count(seqno) != 0) {
+        return;
+    }
+    std::unique_ptr<Item> stale(v.toItem(false, vbid));
+    stale->setBySeqno(seqno);
+    staleElems.emplace(seqno, StaleElem{lastRangeReadId, std::move(stale)});
+}
+
+bool SequenceList::mustKeepForRangeRead(int64_t seqno) const {
+    for (const auto& read : rangeReads) {
+        if (seqno >= read.second.pos && seqno <= read.second.end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SequenceList::releaseStaleElems(int64_t from, int64_t to) {
+    auto it = staleElems.lower_bound(from);
+    while (it != staleElems.end() && it->first <= to) {
+        bool needed = false;
+        for (const auto& read : rangeReads) {
+            if (it->first >= read.second.pos && it->first <= read.second.end &&
+                isVisibleTo(read.first, it->second)) {
+                needed = true;
+                break;
+            }
+        }
+        it = needed ? std::next(it) : staleElems.erase(it);
+    }
+}
+
+SequenceList::RangeRead& SequenceList::getRangeRead(RangeReadId id,
+                                                    const char* caller) {
+    auto it = rangeReads.find(id);
+    if (it == rangeReads.end()) {
+        throw std::logic_error(std::string("SequenceList::") + caller +
+                               ": no range read " + std::to_string(id) +
+                               " is active");
+    }
+    return it->second;
+}
@@ -0,0 +1,248 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+#include "storeddockey.h"
+#include "utility.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class StoredValue;
+
+/**
+ * A seqno-ordered index over the StoredValues of an ephemeral vbucket.
+ *
+ * Ephemeral buckets have no disk to backfill DCP streams from, so every
+ * item (including deleted items, which stay in the HashTable as tombstones
+ * until purged) is kept in seqno order here. Each element records the key
+ * of the StoredValue which currently has that seqno. There is no separate
+ * index by key: an item's element is found at the seqno the StoredValue
+ * had before it changed, and when an item is given a new seqno its element
+ * moves to the end of the list.
+ *
+ * Range reads give a point-in-time view of a seqno range, and any number
+ * may be active at once. While range reads are active, an item which one
+ * of them has yet to return and which is about to be changed has a copy of
+ * its current state kept as a "stale" element, so those reads still return
+ * it at its original seqno; reads started after the copy was taken skip
+ * it, as they see the item at its new seqno. Stale elements are dropped
+ * once no active range read needs them.
+ *
+ * Locking: the list is protected by its write lock. Changes to an item are
+ * made with the item's HashTable bucket lock held, and the list write lock
+ * is taken (if at all) after it; range readers and the tombstone purger
+ * never hold the list lock while acquiring a HashTable lock.
+ */
+class SequenceList {
+public:
+    /// Identifies an active range read.
+    using RangeReadId = uint64_t;
+
+    /**
+     * An element returned by getRangeChunk(); either a copy of the item
+     * (for stale elements) or the key to look up in the HashTable.
+     */
+    struct RangeElem {
+        int64_t seqno;
+        StoredDocKey key;
+        std::unique_ptr<Item> item;
+    };
+
+    /// A deleted item eligible to be purged.
+    struct Tombstone {
+        int64_t seqno;
+        StoredDocKey key;
+    };
+
+    SequenceList();
+
+    /**
+     * The lock which must be held by updateListElem(). Writers hold it
+     * while their new seqno is generated so that no range read can begin
+     * between a seqno being handed out and it being added to the list.
+     */
+    std::mutex& getListWriteLock() {
+        return writeLock;
+    }
+
+    /**
+     * Move the element for v from prevSeqno to v's (new) seqno, adding one
+     * if v wasn't in the list at prevSeqno.
+     *
+     * Must be called with v's HashTable bucket lock and the list write lock
+     * held.
+     *
+     * @param listWriteLg proof that the list write lock is held
+     * @param v the item, with its new seqno already assigned
+     * @param prevSeqno the seqno v had before it changed
+     * @param vbid vbucket the list belongs to
+     */
+    void updateListElem(std::lock_guard<std::mutex>& listWriteLg,
+                        const StoredValue& v,
+                        int64_t prevSeqno,
+                        uint16_t vbid);
+
+    /**
+     * If an active range read has yet to return v, keep a copy of v as it
+     * is now. Called with v's HashTable bucket lock held, just before v is
+     * changed in place.
+     */
+    void saveStaleCopy(const StoredValue& v, uint16_t vbid);
+
+    /**
+     * Remove the element for v, which is about to be removed from the
+     * HashTable. Called with v's HashTable bucket lock held.
+     */
+    void removeListElem(const StoredValue& v, uint16_t vbid);
+
+    /// Start a range read of the seqnos [start, end].
+    RangeReadId beginRangeRead(int64_t start, int64_t end);
+
+    /**
+     * Get up to maxElems elements of the given range read, in seqno order,
+     * starting at its current read position. The read position is not
+     * moved; see advanceRangeRead().
+     */
+    std::vector<RangeElem> getRangeChunk(RangeReadId id, size_t maxElems);
+
+    /**
+     * Get a copy of the stale element at seqno which the given range read
+     * should see, if there is one. Used when the item at a seqno returned
+     * by getRangeChunk() has since changed.
+     */
+    std::unique_ptr<Item> copyStaleElem(RangeReadId id, int64_t seqno);
+
+    /**
+     * Mark every seqno up to and including `seqno` as returned by the
+     * given range read. Stale elements which no active range read still
+     * needs are released.
+     */
+    void advanceRangeRead(RangeReadId id, int64_t seqno);
+
+    /// End the given range read, releasing stale elements only it needed.
+    void endRangeRead(RangeReadId id);
+
+    /**
+     * Find deleted items which have had their current seqno since before
+     * `before`.
+     *
+     * @param start seqno to start looking from
+     * @param before only return items deleted before this time
+     * @param maxElems return at most this many tombstones
+     */
+    std::vector<Tombstone> getTombstones(int64_t start,
+                                         rel_time_t before,
+                                         size_t maxElems);
+
+    /**
+     * Remove the element at seqno for `key`, if there is one. Used to drop
+     * elements whose item has moved to another seqno or is no longer in
+     * the HashTable.
+     */
+    void removeOrphan(int64_t seqno, const DocKey& key);
+
+    /// Remove every element (e.g. when the vbucket is flushed).
+    void clear();
+
+    /// @return the number of (non-stale) elements.
+    size_t getNumItems() const;
+
+    /// @return the number of (non-stale) elements for deleted items.
+    size_t getNumDeletedItems() const;
+
+    /// @return the number of stale elements held for active range reads.
+    size_t getNumStaleItems() const;
+
+    /// @return the number of active range reads.
+    size_t getNumRangeReads() const;
+
+    /// @return the highest seqno in the list, or 0 if it is empty.
+    int64_t getHighSeqno() const;
+
+private:
+    struct Elem {
+        StoredDocKey key;
+        bool deleted;
+        // When the item was given this seqno.
+        rel_time_t time;
+    };
+
+    struct StaleElem {
+        // The last range read started when the copy was taken; only it and
+        // earlier reads should see the copy.
+        RangeReadId savedAt;
+        std::unique_ptr<Item> item;
+    };
+
+    struct RangeRead {
+        // Next seqno the read will return, and where it stops.
+        int64_t pos;
+        int64_t end;
+    };
+
+    /**
+     * @return the element for the item with the given key at seqno, or
+     *         elems.end() if that seqno is held by no item or another one.
+     */
+    std::map<int64_t, Elem>::iterator findElem(int64_t seqno,
+                                               const DocKey& key);
+
+    /// Remove the element at `it`.
+    void eraseElem(std::map<int64_t, Elem>::iterator it);
+
+    /**
+     * Keep a copy of v at seqno if an active range read still has to
+     * return seqno and no copy has been taken yet.
+     */
+    void saveStaleCopy(int64_t seqno, const StoredValue& v, uint16_t vbid);
+
+    /// @return true if any active range read still has to return seqno.
+    bool mustKeepForRangeRead(int64_t seqno) const;
+
+    /// @return true if the given range read should see `stale`.
+    static bool isVisibleTo(RangeReadId id, const StaleElem& stale) {
+        return stale.savedAt >= id;
+    }
+
+    /**
+     * Release the stale elements in [from, to] which no active range read
+     * needs.
+     */
+    void releaseStaleElems(int64_t from, int64_t to);
+
+    RangeRead& getRangeRead(RangeReadId id, const char* caller);
+
+    mutable std::mutex writeLock;
+    // Items in seqno order.
+    std::map<int64_t, Elem> elems;
+    // Copies of items which changed while a range read needed them.
+    std::map<int64_t, StaleElem> staleElems;
+    size_t numDeleted;
+
+    // Active range reads, and the id of the last one started.
+    std::map<RangeReadId, RangeRead> rangeReads;
+    RangeReadId lastRangeReadId;
+
+    DISALLOW_COPY_AND_ASSIGN(SequenceList);
+};
@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "slab_allocator.h"
+
+#include <platform/cb_malloc.h>
+
+#include <iterator>
+#include <new>
+
+const size_t SlabAllocator::granularity;
+const size_t SlabAllocator::maxObjectSize;
+const size_t SlabAllocator::slabSize;
+
+SlabAllocator::SlabAllocator()
+    : numSlabs(0),
+      usedBytes(0),
+      numLargeObjects(0) {
+}
+
+SlabAllocator::~SlabAllocator() {
+    for (auto& sc : sizeClasses) {
+        std::lock_guard<std::mutex> lh(sc.mutex);
+        while (!sc.slabs.empty()) {
+            releaseSlab(sc, sc.slabs.begin());
+        }
+    }
+}
+
+void* SlabAllocator::allocate(size_t size) {
+    if (size == 0 || size > maxObjectSize) {
+        ++numLargeObjects;
+        return ::operator new(size);
+    }
+
+    const size_t index = sizeClassIndex(size);
+    const size_t objectSize = (index + 1) * granularity;
+    SizeClass& sc = sizeClasses[index];
+
+    std::lock_guard<std::mutex> lh(sc.mutex);
+    if (sc.available.empty()) {
+        char* base = static_cast<char*>(cb_malloc(slabSize));
+        if (!base) {
+            throw std::bad_alloc();
+        }
+        sc.slabs.emplace(base, Slab());
+        sc.available.insert(base);
+        ++numSlabs;
+    }
+
+    char* base = *sc.available.begin();
+    Slab& slab = sc.slabs[base];
+    void* rv;
+    if (slab.freeList) {
+        rv = slab.freeList;
+        slab.freeList = slab.freeList->next;
+    } else {
+        rv = base + slab.carved;
+        slab.carved += objectSize;
+    }
+    if (!slab.freeList && slabSize - slab.carved < objectSize) {
+        sc.available.erase(sc.available.begin());
+    }
+    ++slab.liveObjects;
+    usedBytes.fetch_add(objectSize);
+    return rv;
+}
+
+void SlabAllocator::deallocate(void* p, size_t size) {
+    if (size == 0 || size > maxObjectSize) {
+        --numLargeObjects;
+        ::operator delete(p);
+        return;
+    }
+
+    const size_t index = sizeClassIndex(size);
+    SizeClass& sc = sizeClasses[index];
+
+    std::lock_guard<std::mutex> lh(sc.mutex);
+    // The slab holding p is the last one which starts at or before it.
+    auto it = sc.slabs.upper_bound(static_cast<char*>(p));
+    --it;
+    Slab& slab = it->second;
+    FreeObject* obj = static_cast<FreeObject*>(p);
+    obj->next = slab.freeList;
+    slab.freeList = obj;
+    --slab.liveObjects;
+    usedBytes.fetch_sub((index + 1) * granularity);
+
+    sc.available.insert(it->first);
+    if (slab.liveObjects == 0 && sc.available.size() > 1) {
+        // Another slab can take this class's next allocation.
+        releaseSlab(sc, it);
+    }
+}
+
+size_t SlabAllocator::releaseUnusedSlabs() {
+    size_t released = 0;
+    for (auto& sc : sizeClasses) {
+        std::lock_guard<std::mutex> lh(sc.mutex);
+        for (auto it = sc.slabs.begin(); it != sc.slabs.end();) {
+            auto next = std::next(it);
+            if (it->second.liveObjects == 0) {
+                releaseSlab(sc, it);
+                released += slabSize;
+            }
+            it = next;
+        }
+    }
+    return released;
+}
+
+void SlabAllocator::releaseSlab(SizeClass& sc,
+                                std::map<char*, Slab>::iterator slab) {
+    sc.available.erase(slab->first);
+    cb_free(slab->first);
+    sc.slabs.erase(slab);
+    --numSlabs;
+}
@@ -0,0 +1,139 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "utility.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <set>
+
+/**
+ * A slab allocator for small, fixed-lifetime objects (StoredValues).
+ *
+ * Requests are rounded up to a multiple of `granularity` bytes and served
+ * from the size class for that size. Each size class carves objects out of
+ * large slabs (of `slabSize` bytes) and recycles freed objects through an
+ * intrusive free list, so the general purpose allocator only sees
+ * occasional slab-sized requests instead of one request per object.
+ *
+ * Each slab tracks its own live objects and free list. New objects are
+ * taken from the lowest addressed slab with space, so live objects gather
+ * in as few slabs as possible, and a slab is returned to the system as
+ * soon as its last object is freed, unless it is the only slab in its size
+ * class with space (kept to avoid freeing and reallocating a slab when one
+ * object is repeatedly freed and allocated) - see also
+ * releaseUnusedSlabs(). Requests larger than `maxObjectSize` are passed
+ * straight through to ::operator new.
+ *
+ * Allocation and deallocation are thread-safe; each size class has its own
+ * mutex.
+ */
+class SlabAllocator {
+public:
+    static const size_t granularity = 8;
+    static const size_t maxObjectSize = 512;
+    static const size_t slabSize = 64 * 1024;
+
+    SlabAllocator();
+
+    ~SlabAllocator();
+
+    /**
+     * Allocate storage for an object of the given size.
+     *
+     * @throws std::bad_alloc if a new slab could not be allocated.
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Return storage previously obtained from allocate(size) with the same
+     * size.
+     */
+    void deallocate(void* p, size_t size);
+
+    /**
+     * Free every slab which has no live objects, including those kept
+     * spare by deallocate().
+     *
+     * @return the number of bytes released.
+     */
+    size_t releaseUnusedSlabs();
+
+    /// @return the number of bytes held in slabs.
+    size_t getSlabBytes() const {
+        return numSlabs * slabSize;
+    }
+
+    /// @return the number of slab bytes occupied by live objects.
+    size_t getUsedBytes() const {
+        return usedBytes;
+    }
+
+    /// @return the number of slabs currently allocated.
+    size_t getNumSlabs() const {
+        return numSlabs;
+    }
+
+    /// @return the number of live objects too large for any size class.
+    size_t getNumLargeObjects() const {
+        return numLargeObjects;
+    }
+
+private:
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    struct Slab {
+        // Freed objects, to be reused before carving out new ones.
+        FreeObject* freeList = nullptr;
+        // Bytes from the start of the slab carved out as objects so far.
+        size_t carved = 0;
+        size_t liveObjects = 0;
+    };
+
+    struct SizeClass {
+        std::mutex mutex;
+        // Every slab, by address.
+        std::map<char*, Slab> slabs;
+        // The slabs with space for another object, by address.
+        std::set<char*> available;
+    };
+
+    static const size_t numSizeClasses = maxObjectSize / granularity;
+
+    static size_t sizeClassIndex(size_t size) {
+        return (size + granularity - 1) / granularity - 1;
+    }
+
+    /// Free the given slab and remove it from its size class.
+    void releaseSlab(SizeClass& sc, std::map<char*, Slab>::iterator slab);
+
+    std::array<SizeClass, numSizeClasses> sizeClasses;
+    std::atomic<size_t> numSlabs;
+    std::atomic<size_t> usedBytes;
+    std::atomic<size_t> numLargeObjects;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
@@ -84,6 +84,8 @@ public:
         dirtyAge(0),
         dirtyAgeHighWat(0),
         commit_time(0),
+        flushBatchSize(0),
+        flushBatchTargetMisses(0),
         vbucketDeletions(0),
         vbucketDeletionFail(0),
         mem_low_wat(0),
@@ -92,10 +94,18 @@ public:
         mem_high_wat_percent(0),
         cursorDroppingLThreshold(0),
         cursorDroppingUThreshold(0),
+        cursorDroppingCheckpointMemLThreshold(0),
+        cursorDroppingCheckpointMemUThreshold(0),
         cursorsDropped(0),
         pagerRuns(0),
+        pagerHighToLowWatTime(0),
         expiryPagerRuns(0),
+        expiryIndexSize(0),
+        expiryPagerLastVisited(0),
+        expiryPagerLastExpired(0),
         itemsRemovedFromCheckpoints(0),
+        itemsExpelledFromCheckpoints(0),
+        memFreedByCheckpointItemExpel(0),
         numValueEjects(0),
         numFailedEjects(0),
         numNotMyVBuckets(0),
@@ -107,6 +117,7 @@ public:
         totalStoredValSize(0),
         storedValOverhead(0),
         memOverhead(0),
+        checkpointMemUsage(0),
         numItem(0),
         totalMemory(0),
         memoryTrackerEnabled(false),
@@ -170,6 +181,8 @@ public:
         defragNumMoved(0),
         dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
         diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
+        persistenceLatencyHisto(
+                GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
         mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
         timingLog(NULL),
         maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
@@ -261,6 +274,12 @@ public:
     std::atomic<rel_time_t> dirtyAgeHighWat;
     //! Amount of time spent in the commit phase.
     std::atomic<rel_time_t> commit_time;
+    //! Most items the flusher takes from a vbucket for one flush (zero if
+    //! unlimited).
+    std::atomic<size_t> flushBatchSize;
+    //! Number of commits which took longer than the flush batch latency
+    //! target.
+    Counter flushBatchTargetMisses;
     //! Number of times we deleted a vbucket.
     Counter vbucketDeletions;
     //! Number of times we failed to delete a vbucket.
@@ -277,16 +296,35 @@ public:
     //! Cursor dropping thresholds used by checkpoint remover
     std::atomic<size_t> cursorDroppingLThreshold;
     std::atomic<size_t> cursorDroppingUThreshold;
+    //! Thresholds on the memory held by the items queued in all
+    //! checkpoints, above which new checkpoints are created and cursor
+    //! dropping commences
+    std::atomic<size_t> cursorDroppingCheckpointMemLThreshold;
+    std::atomic<size_t> cursorDroppingCheckpointMemUThreshold;
 
     //! Number of cursors dropped by checkpoint remover
     Counter cursorsDropped;
 
     //! Number of times we needed to kick in the pager
     Counter pagerRuns;
+    //! Time (us) memory usage last took to get from above the high
+    //! watermark back to the low watermark
+    std::atomic<hrtime_t> pagerHighToLowWatTime;
     //! Number of times the expiry pager runs for purging expired items
     Counter expiryPagerRuns;
+    //! Number of keys in the vbuckets' expiry indexes
+    Counter expiryIndexSize;
+    //! Number of items the last expiry pager run visited
+    std::atomic<size_t> expiryPagerLastVisited;
+    //! Number of items the last expiry pager run expired
+    std::atomic<size_t> expiryPagerLastExpired;
     //! Number of items removed from closed unreferenced checkpoints.
     Counter itemsRemovedFromCheckpoints;
+    //! Number of items expelled from open checkpoints after every cursor
+    //! had processed them.
+    Counter itemsExpelledFromCheckpoints;
+    //! Checkpoint memory released by expelling items.
+    Counter memFreedByCheckpointItemExpel;
     //! Number of times a value is ejected
     Counter numValueEjects;
     //! Number of times a value could not be ejected
@@ -309,6 +347,8 @@ public:
     Counter storedValOverhead;
     //! Amount of memory used to track items and what-not.
     cb::CachelinePadded<Counter> memOverhead;
+    //! Memory held by the items queued in all checkpoints.
+    cb::CachelinePadded<Counter> checkpointMemUsage;
     //! Total number of Item objects
     cb::CachelinePadded<Counter> numItem;
     //! The total amount of memory used by this bucket (From memory tracking)
@@ -391,6 +431,9 @@ public:
     Histogram<hrtime_t> itemPagerHisto;
     //! Histogram of expiry pager run times
     Histogram<hrtime_t> expiryPagerHisto;
+    //! Histogram of the times memory usage took to get from above the high
+    //! watermark back to the low watermark
+    Histogram<hrtime_t> pagerHighToLowWatHisto;
 
     /* TAP related stats */
     //! The total number of tap events sent (not including noops)
@@ -553,6 +596,10 @@ public:
     //! Histogram of disk commits
     Histogram<hrtime_t> diskCommitHisto;
 
+    //! Histogram of the time from the flusher collecting a vbucket's items
+    //! to their commit completing
+    Histogram<hrtime_t> persistenceLatencyHisto;
+
     //! Histogram of mutation log compactor
     Histogram<hrtime_t> mlogCompactorHisto;
 
@@ -577,9 +624,12 @@ public:
         dirtyAge.store(0);
         dirtyAgeHighWat.store(0);
         commit_time.store(0);
+        flushBatchTargetMisses.store(0);
         cursorsDropped.store(0);
         pagerRuns.store(0);
         itemsRemovedFromCheckpoints.store(0);
+        itemsExpelledFromCheckpoints.store(0);
+        memFreedByCheckpointItemExpel.store(0);
         numValueEjects.store(0);
         numFailedEjects.store(0);
         numNotMyVBuckets.store(0);
@@ -623,6 +673,7 @@ public:
         checkpointRemoverHisto.reset();
         itemPagerHisto.reset();
         expiryPagerHisto.reset();
+        pagerHighToLowWatHisto.reset();
         tapBgWaitHisto.reset();
         tapBgLoadHisto.reset();
         getVbucketCmdHisto.reset();
@@ -642,6 +693,7 @@ public:
         diskDelHisto.reset();
         diskVBDelHisto.reset();
         diskCommitHisto.reset();
+        persistenceLatencyHisto.reset();
         itemAllocSizeHisto.reset();
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
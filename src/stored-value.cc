@@ -27,52 +27,52 @@ const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
 const int64_t StoredValue::state_temp_init = -5;
 const int64_t StoredValue::state_collection_open = -6;
+const size_t StoredValue::maxInlineValueSize;
 
 bool StoredValue::ejectValue(HashTable &ht, item_eviction_policy_t policy) {
     if (eligibleForEviction(policy)) {
-        reduceCacheSize(ht, value->length());
-        markNotResident();
-        value = NULL;
+        reduceCacheSize(ht, residentValueLength());
+        markNotResident(ht);
         return true;
     }
     return false;
 }
 
 void StoredValue::referenced() {
-    if (nru > MIN_NRU_VALUE) {
-        --nru;
+    if (bits.nru > MIN_NRU_VALUE) {
+        --bits.nru;
     }
 }
 
 void StoredValue::setNRUValue(uint8_t nru_val) {
     if (nru_val <= MAX_NRU_VALUE) {
-        nru = nru_val;
+        bits.nru = nru_val;
     }
 }
 
 uint8_t StoredValue::incrNRUValue() {
     uint8_t ret = MAX_NRU_VALUE;
-    if (nru < MAX_NRU_VALUE) {
-        ret = ++nru;
+    if (bits.nru < MAX_NRU_VALUE) {
+        ret = ++bits.nru;
     }
     return ret;
 }
 
 uint8_t StoredValue::getNRUValue() {
-    return nru;
+    return bits.nru;
 }
 
-void StoredValue::restoreValue(const Item& itm) {
+void StoredValue::restoreValue(const Item& itm, HashTable& ht) {
     if (isTempInitialItem()) {
         cas = itm.getCas();
         flags = itm.getFlags();
         exptime = itm.getExptime();
         revSeqno = itm.getRevSeqno();
         bySeqno = itm.getBySeqno();
-        nru = INITIAL_NRU_VALUE;
+        bits.nru = INITIAL_NRU_VALUE;
     }
-    deleted = itm.isDeleted();
-    value = itm.getValue();
+    bits.deleted = itm.isDeleted();
+    storeValue(itm.getValue(), ht);
 }
 
 void StoredValue::restoreMeta(const Item& itm) {
@@ -86,10 +86,10 @@ void StoredValue::restoreMeta(const Item& itm) {
         bySeqno = itm.getBySeqno();
         /* set it back to false as we created a temp item by setting it to true
            when bg fetch is scheduled (full eviction mode). */
-        newCacheItem = false;
+        bits.newCacheItem = false;
     }
-    if (nru == MAX_NRU_VALUE) {
-        nru = INITIAL_NRU_VALUE;
+    if (bits.nru == MAX_NRU_VALUE) {
+        bits.nru = INITIAL_NRU_VALUE;
     }
 }
 
@@ -135,22 +135,70 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm,
 }
 
 Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    Item* itm = new Item(key, getFlags(), getExptime(), value,
+    Item* itm = new Item(key, getFlags(), getExptime(), materializeValue(),
                          lck ? static_cast<uint64_t>(-1) : getCas(),
                          bySeqno, vbucket, getRevSeqno());
 
-    itm->setNRUValue(nru);
+    itm->setNRUValue(bits.nru);
 
-    if (deleted) {
+    if (bits.deleted) {
         itm->setDeleted();
     }
 
     return itm;
 }
 
-void StoredValue::reallocate() {
+void StoredValue::reallocate(HashTable& ht) {
+    if (bits.valueInline) {
+        return;
+    }
     // Allocate a new Blob for this stored value; copy the existing Blob to
     // the new one and free the old.
     value_t new_val(Blob::Copy(*value));
+    releaseValue(ht);
     value.reset(new_val);
 }
+
+void StoredValue::storeValue(const value_t& val, HashTable& ht) {
+    InlineValueHeader header = getInlineHeader();
+    if (bits.hasInlineStorage && val &&
+        sizeof(header) + val->length() <= header.capacity) {
+        header.length = static_cast<uint8_t>(val->length());
+        header.extMetaLen = val->getExtLen();
+        setInlineHeader(header);
+        std::memcpy(inlineStorage() + sizeof(header), val->getBlob(),
+                    val->length());
+        releaseValue(ht);
+        bits.valueInline = true;
+    } else {
+        if (value.get() != val.get()) {
+            releaseValue(ht);
+        }
+        value = val;
+        bits.valueInline = false;
+    }
+}
+
+void StoredValue::releaseValue(HashTable& ht) {
+    ht.retireValue(value);
+    value.reset();
+}
+
+value_t StoredValue::materializeValue() const {
+    if (!bits.valueInline) {
+        return value;
+    }
+    const InlineValueHeader header = getInlineHeader();
+    return makeInlineValue(header, inlineStorage() + sizeof(header));
+}
+
+value_t StoredValue::makeInlineValue(const InlineValueHeader& header,
+                                     const char* data) {
+    const size_t metaLen = FLEX_DATA_OFFSET + header.extMetaLen;
+    uint8_t* extMeta = reinterpret_cast<uint8_t*>(
+            const_cast<char*>(data + FLEX_DATA_OFFSET));
+    return value_t(Blob::New(data + metaLen,
+                             header.length - metaLen,
+                             extMeta,
+                             header.extMetaLen));
+}
@@ -21,10 +21,15 @@
 #include "config.h"
 
 #include "item_pager.h"
+#include "slab_allocator.h"
 #include "utility.h"
 
 #include <platform/cb_malloc.h>
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 // Forward declaration for StoredValue
 class HashTable;
 class StoredValueFactory;
@@ -57,7 +62,7 @@ public:
      * Mark this item as needing to be persisted.
      */
     void markDirty() {
-        _isDirty = 1;
+        bits._isDirty = 1;
     }
 
     /**
@@ -69,7 +74,7 @@ public:
      * @param dataAge the previous dataAge of this record
      */
     void reDirty() {
-        _isDirty = 1;
+        bits._isDirty = 1;
     }
 
     // returns time this object was dirtied.
@@ -77,14 +82,14 @@ public:
      * Mark this item as clean.
      */
     void markClean() {
-        _isDirty = 0;
+        bits._isDirty = 0;
     }
 
     /**
      * True if this object is dirty.
      */
     bool isDirty() const {
-        return _isDirty;
+        return bits._isDirty;
     }
 
     /**
@@ -133,12 +138,28 @@ public:
     }
 
     /**
-     * Get this item's value.
+     * Get this item's value Blob; null if the value is held inline (see
+     * isValueInline()).
      */
     const value_t &getValue() const {
         return value;
     }
 
+    /**
+     * Get this item's value as a Blob: the one referenced, or for an inline
+     * value a new copy - so keep it off hot paths other than handing the
+     * value on in toItem().
+     */
+    value_t materializeValue() const;
+
+    /**
+     * True if this item's value is held inline in the StoredValue itself,
+     * rather than in a separately allocated Blob.
+     */
+    bool isValueInline() const {
+        return bits.valueInline;
+    }
+
     /**
      * Get the expiration time of this item.
      *
@@ -181,8 +202,8 @@ public:
                   const PreserveRevSeqno preserveRevSeqno) {
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
-        value = itm.getValue();
-        deleted = itm.isDeleted();
+        storeValue(itm.getValue(), ht);
+        bits.deleted = itm.isDeleted();
         flags = itm.getFlags();
         bySeqno = itm.getBySeqno();
 
@@ -195,7 +216,7 @@ public:
             itm.setRevSeqno(revSeqno);
         }
 
-        nru = itm.getNRUValue();
+        bits.nru = itm.getNRUValue();
 
         if (isTempInitialItem()) {
             markClean();
@@ -204,7 +225,7 @@ public:
         }
 
         if (isTempItem()) {
-            markNotResident();
+            markNotResident(ht);
         }
 
         size_t newSize = size();
@@ -212,21 +233,23 @@ public:
     }
 
     void markDeleted() {
-        deleted = true;
+        bits.deleted = true;
         markDirty();
     }
 
     /**
      * Reset the value of this item.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
      */
-    void resetValue() {
+    void resetValue(HashTable& ht) {
         if (isDeleted()) {
             throw std::logic_error("StoredValue::resetValue: Not possible to "
                     "reset the value of a deleted item");
         }
-        markNotResident();
+        markNotResident(ht);
         // item no longer resident once reset the value
-        deleted = true;
+        bits.deleted = true;
     }
 
     /**
@@ -239,8 +262,9 @@ public:
      * Restore the value for this item.
      *
      * @param itm the item to be restored
+     * @param ht the hashtable that contains this StoredValue instance
      */
-    void restoreValue(const Item& itm);
+    void restoreValue(const Item& itm, HashTable& ht);
 
     /**
      * Restore the metadata of of a temporary item upon completion of a
@@ -332,7 +356,7 @@ public:
     /**
      * Is this a temporary item created for processing a get-meta request?
      */
-     bool isTempItem() {
+     bool isTempItem() const {
          return(isTempNonExistentItem() || isTempDeletedItem() || isTempInitialItem());
 
      }
@@ -340,7 +364,7 @@ public:
     /**
      * Is this an initial temporary item?
      */
-    bool isTempInitialItem() {
+    bool isTempInitialItem() const {
         return bySeqno == state_temp_init;
     }
 
@@ -354,7 +378,7 @@ public:
     /**
      * Is this a temporary item created for a deleted key?
      */
-    bool isTempDeletedItem() {
+    bool isTempDeletedItem() const {
          return bySeqno == state_deleted_key;
 
      }
@@ -363,12 +387,15 @@ public:
         if (isDeleted() || !isResident()) {
             return 0;
         }
-        return value->length();
+        return residentValueLength();
     }
 
     /**
      * Get the total size of this item.
      *
+     * Inline values are accounted by their length, the same as Blob values;
+     * unused inline capacity is not included.
+     *
      * @return the amount of memory used by this item.
      */
     size_t size() {
@@ -397,18 +424,24 @@ public:
      * True if this value is resident in memory currently.
      */
     bool isResident() const {
-        return value.get() != NULL;
+        return bits.valueInline || value.get() != NULL;
     }
 
-    void markNotResident() {
-        value.reset();
+    /**
+     * Drop this item's value.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
+     */
+    void markNotResident(HashTable& ht) {
+        releaseValue(ht);
+        bits.valueInline = false;
     }
 
     /**
      * True if this object is logically deleted.
      */
     bool isDeleted() const {
-        return deleted;
+        return bits.deleted;
     }
 
     /**
@@ -420,7 +453,7 @@ public:
         }
 
         reduceCacheSize(ht, valuelen());
-        resetValue();
+        resetValue(ht);
         markDirty();
     }
 
@@ -440,14 +473,14 @@ public:
      * Return true if this is a new cache item.
      */
     bool isNewCacheItem(void) {
-        return newCacheItem;
+        return bits.newCacheItem;
     }
 
     /**
      * Set / reset a new cache item flag.
      */
     void setNewCacheItem(bool newitem) {
-        newCacheItem = newitem;
+        bits.newCacheItem = newitem;
     }
 
     /**
@@ -495,14 +528,16 @@ public:
     }
 
     size_t getObjectSize() const {
-        return sizeof(*this) + key.getObjectSize();
+        return sizeof(*this) + key.getObjectSize() + getInlineHeader().capacity;
     }
 
     /**
      * Reallocates the dynamic members of StoredValue. Used as part of
-     * defragmentation.
+     * defragmentation; an inline value has no Blob to reallocate.
+     *
+     * @param ht the hashtable that contains this StoredValue instance
      */
-    void reallocate();
+    void reallocate(HashTable& ht);
 
     /* [TBD] : Move this function out of StoredValue class */
     static bool hasAvailableSpace(EPStats&,
@@ -510,19 +545,45 @@ public:
                                   bool isReplication = false);
 
 private:
-    StoredValue(const Item& itm, StoredValue* n, EPStats& stats, HashTable& ht)
-        : value(itm.getValue()),
-          next(n),
+    /**
+     * Header of the inline value storage in the StoredValue tail (after the
+     * key). The bytes which follow are a copy of the Blob contents (as
+     * returned by Blob::getBlob()) if valueInline is set.
+     */
+    struct InlineValueHeader {
+        uint8_t capacity; //!< Size of the inline storage, including header
+        uint8_t length;
+        uint8_t extMetaLen;
+    };
+
+    /// The largest value size which can be held inline.
+    static const size_t maxInlineValueSize =
+            std::numeric_limits<uint8_t>::max() - sizeof(InlineValueHeader);
+
+    StoredValue(const Item& itm,
+                StoredValue* n,
+                EPStats& stats,
+                HashTable& ht,
+                uint8_t inlineCapacity = 0)
+        : next(n),
           cas(itm.getCas()),
           revSeqno(itm.getRevSeqno()),
           bySeqno(itm.getBySeqno()),
           lock_expiry(0),
           exptime(itm.getExptime()),
           flags(itm.getFlags()),
-          deleted(false),
-          newCacheItem(true),
-          nru(itm.getNRUValue()),
+          bits{/*_isDirty*/ false,
+               /*deleted*/ false,
+               /*newCacheItem*/ true,
+               itm.getNRUValue(),
+               /*hasInlineStorage*/ inlineCapacity != 0,
+               /*valueInline*/ false},
           key(itm.getKey()) {
+        if (bits.hasInlineStorage) {
+            setInlineHeader({inlineCapacity, 0, 0});
+        }
+        storeValue(itm.getValue(), ht);
+
         if (isTempInitialItem()) {
             markClean();
         } else {
@@ -530,7 +591,7 @@ private:
         }
 
         if (isTempItem()) {
-            markNotResident();
+            markNotResident(ht);
         }
 
         increaseMetaDataSize(ht, stats, metaDataSize());
@@ -549,10 +610,71 @@ private:
         return sizeof(StoredValue) + SerialisedDocKey::getObjectSize(item.getKey().size());
     }
 
+    /*
+     * Return how many bytes of inline value storage to reserve for the given
+     * Item, for a HashTable which inlines values of up to inlineValueSize
+     * bytes.
+     */
+    static uint8_t getInlineCapacity(const Item& item, size_t inlineValueSize) {
+        const value_t& val = item.getValue();
+        inlineValueSize = std::min(inlineValueSize, maxInlineValueSize);
+        if (inlineValueSize == 0 || !val ||
+            val->length() > inlineValueSize) {
+            return 0;
+        }
+        return static_cast<uint8_t>(sizeof(InlineValueHeader) +
+                                    inlineValueSize);
+    }
+
+    /// Address of the inline value storage, immediately after the key.
+    char* inlineStorage() {
+        return reinterpret_cast<char*>(&key) + key.getObjectSize();
+    }
+
+    const char* inlineStorage() const {
+        return reinterpret_cast<const char*>(&key) + key.getObjectSize();
+    }
+
+    /**
+     * Set the value: copied into the inline storage if it fits (releasing
+     * any Blob), otherwise by referencing the Blob.
+     */
+    void storeValue(const value_t& val, HashTable& ht);
+
+    /**
+     * Release the reference to the current Blob value (if any); it's freed
+     * once no optimistic readers of the HashTable can be using it.
+     */
+    void releaseValue(HashTable& ht);
+
+    /// Create a Blob from an inline value's header and bytes.
+    static value_t makeInlineValue(const InlineValueHeader& header,
+                                   const char* data);
+
+    InlineValueHeader getInlineHeader() const {
+        InlineValueHeader header = {0, 0, 0};
+        if (bits.hasInlineStorage) {
+            std::memcpy(&header, inlineStorage(), sizeof(header));
+        }
+        return header;
+    }
+
+    void setInlineHeader(const InlineValueHeader& header) {
+        std::memcpy(inlineStorage(), &header, sizeof(header));
+    }
+
+    /// Length of the value (inline or Blob), ignoring whether deleted.
+    size_t residentValueLength() const {
+        if (bits.valueInline) {
+            return getInlineHeader().length;
+        }
+        return value ? value->length() : 0;
+    }
+
     friend class HashTable;
     friend class StoredValueFactory;
 
-    value_t            value;          // 8 bytes
+    value_t            value;          // 8 bytes; null if valueInline
     StoredValue        *next;          // 8 bytes
     uint64_t           cas;            //!< CAS identifier.
     uint64_t           revSeqno;       //!< Revision id sequence number
@@ -560,10 +682,15 @@ private:
     rel_time_t         lock_expiry;    //!< getl lock expiration
     uint32_t           exptime;        //!< Expiration time of this item.
     uint32_t           flags;          // 4 bytes
-    bool               _isDirty  :  1; // 1 bit
-    bool               deleted   :  1;
-    bool               newCacheItem : 1;
-    uint8_t            nru       :  2; //!< True if referenced since last sweep
+    // Grouped so HashTable::optimisticGet() can load them as one byte.
+    struct Bits {
+        bool           _isDirty  :  1; // 1 bit
+        bool           deleted   :  1;
+        bool           newCacheItem : 1;
+        uint8_t        nru       :  2; //!< True if referenced since last sweep
+        bool           hasInlineStorage : 1; //!< Inline storage follows key
+        bool           valueInline : 1; //!< Value is held in inline storage
+    } bits;
     SerialisedDocKey key; //!< The key itself.
 
     static void increaseMetaDataSize(HashTable &ht, EPStats &st, size_t by);
@@ -577,6 +704,10 @@ private:
 
 /**
  * Creator of StoredValue instances.
+ *
+ * If given a SlabAllocator, StoredValues are carved out of its slabs rather
+ * than individually allocated; they must then be freed with destroy() rather
+ * than delete.
  */
 class StoredValueFactory {
 public:
@@ -584,7 +715,10 @@ public:
     /**
      * Create a new StoredValueFactory of the given type.
      */
-    StoredValueFactory(EPStats &s) : stats(&s) { }
+    StoredValueFactory(EPStats &s,
+                       SlabAllocator* slabs = nullptr,
+                       size_t inlineValueSize = 0)
+        : stats(&s), slabs(slabs), inlineValueSize(inlineValueSize) { }
 
     /**
      * Create a new StoredValue with the given item.
@@ -598,19 +732,39 @@ public:
         return newStoredValue(itm, n, ht);
     }
 
+    /**
+     * Destroy a StoredValue created by this factory, releasing its storage.
+     */
+    void destroy(StoredValue* v) {
+        if (!slabs) {
+            delete v;
+            return;
+        }
+        const size_t size = v->getObjectSize();
+        v->~StoredValue();
+        slabs->deallocate(v, size);
+    }
+
 private:
     StoredValue* newStoredValue(const Item& itm,
                                 StoredValue* n,
                                 HashTable& ht) {
         // Allocate a buffer to store the StoredValue and any trailing bytes
         // that maybe required.
-        StoredValue* t =
-                new (::operator new(StoredValue::getRequiredStorage(itm)))
-                        StoredValue(itm, n, *stats, ht);
+        const uint8_t inlineCapacity =
+                StoredValue::getInlineCapacity(itm, inlineValueSize);
+        const size_t size =
+                StoredValue::getRequiredStorage(itm) + inlineCapacity;
+        void* storage = slabs ? slabs->allocate(size) : ::operator new(size);
+        StoredValue* t = new (storage)
+                StoredValue(itm, n, *stats, ht, inlineCapacity);
         return t;
     }
 
     EPStats                *stats;
+    SlabAllocator          *slabs;
+    // Values of up to this many bytes are stored inline; 0 disables.
+    size_t                 inlineValueSize;
 };
 
 #endif  // SRC_STORED_VALUE_H_
@@ -58,7 +58,7 @@ bool StatSnap::run() {
 
 bool MultiBGFetcherTask::run() {
     TRACE_EVENT0("ep-engine/task", "MultiBGFetcherTask");
-    return bgfetcher->run(this);
+    return bgfetcher->run(this, lane);
 }
 
 bool DeleteAllTask::run() {
@@ -71,8 +71,11 @@ TASK(StatCheckpointTask, 7)
 TASK(ItemPager, 7)
 TASK(ExpiredItemPager, 7)
 TASK(ItemPagerVisitor, 7)
+TASK(FrequencySketchAger, 7)
 TASK(ExpiredItemPagerVisitor, 7)
 TASK(DefragmenterTask, 7)
+TASK(EphTombstonePurgerTask, 7)
+TASK(EphTombstonePurgerVisitorTask, 7)
 TASK(ConnManager, 8)
 TASK(WorkLoadMonitor, 10)
 TASK(ResumeCallback, 316)
@@ -135,10 +135,10 @@ private:
 class BgFetcher;
 class MultiBGFetcherTask : public GlobalTask {
 public:
-    MultiBGFetcherTask(EventuallyPersistentEngine *e, BgFetcher *b, bool sleeptime = 0,
-                        bool completeBeforeShutdown = false)
-        : GlobalTask(e, TaskId::MultiBGFetcherTask, sleeptime, completeBeforeShutdown),
-          bgfetcher(b) {}
+    MultiBGFetcherTask(EventuallyPersistentEngine *e, BgFetcher *b,
+                       size_t l = 0, bool completeBeforeShutdown = false)
+        : GlobalTask(e, TaskId::MultiBGFetcherTask, 0, completeBeforeShutdown),
+          bgfetcher(b), lane(l) {}
 
     bool run();
 
@@ -148,6 +148,7 @@ public:
 
 private:
     BgFetcher *bgfetcher;
+    size_t lane;
 };
 
 /**
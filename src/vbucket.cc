@@ -17,7 +17,9 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <functional>
+#include <limits>
 #include <list>
 #include <set>
 #include <string>
@@ -135,7 +137,14 @@ VBucket::VBucket(id_type i,
                  vbucket_state_t initState,
                  uint64_t purgeSeqno,
                  uint64_t maxCas)
-    : ht(st),
+    : ht(st,
+         0,
+         0,
+         HashTable::layoutFromString(config.getHtLayout()),
+         config.isHtSlabAllocator(),
+         config.getHtInlineValueSize(),
+         config.isHtOptimisticReads(),
+         config.isExpPagerIndex()),
       checkpointManager(st,
                         i,
                         chkConfig,
@@ -166,6 +175,7 @@ VBucket::VBucket(id_type i,
       persisted_snapshot_end(lastSnapEnd),
       numHpChks(0),
       shard(kvshard),
+      nextResidentBackfillPin(0),
       rollbackItemCount(0),
       hlc(maxCas,
           std::chrono::microseconds(config.getHlcDriftAheadThresholdUs()),
@@ -353,6 +363,12 @@ void VBucket::addStat(const char *nm, const T &val, ADD_STAT add_stat,
     }
 }
 
+// Subclasses add their own details stats (see EphemeralVBucket::addStats).
+template void VBucket::addStat(const char* nm,
+                               const size_t& val,
+                               ADD_STAT add_stat,
+                               const void* c);
+
 size_t VBucket::queueBGFetchItem(const DocKey& key,
                                  std::unique_ptr<VBucketBGFetchItem> fetch,
                                  BgFetcher* bgFetcher) {
@@ -392,9 +408,9 @@ void VBucket::addHighPriorityVBEntry(uint64_t id, const void *cookie,
 }
 
 void VBucket::handlePreExpiry(StoredValue& v) {
-    value_t value = v.getValue();
-    if (value) {
+    if (v.isResident()) {
         std::unique_ptr<Item> itm(v.toItem(false, id));
+        value_t value = itm->getValue();
         item_info itm_info;
         EventuallyPersistentEngine* engine = ObjectRegistry::getCurrentEngine();
         itm_info = itm->toItemInfo(failovers->getLatestUUID());
@@ -407,11 +423,11 @@ void VBucket::handlePreExpiry(StoredValue& v) {
          * value after pre-expiry is performed.
          */
         if (sapi->document->pre_expiry(itm_info)) {
-            char* extMeta = const_cast<char *>(v.getValue()->getExtMeta());
+            char* extMeta = const_cast<char *>(value->getExtMeta());
             Item new_item(v.getKey(), v.getFlags(), v.getExptime(),
                           itm_info.value[0].iov_base, itm_info.value[0].iov_len,
                           reinterpret_cast<uint8_t*>(extMeta),
-                          v.getValue()->getExtLen(), v.getCas(),
+                          value->getExtLen(), v.getCas(),
                           v.getBySeqno(), id, v.getRevSeqno(),
                           v.getNRUValue());
 
@@ -586,27 +602,29 @@ bool VBucket::isResidentRatioUnderThreshold(float threshold,
     }
 }
 
-void VBucket::createFilter(size_t key_count, double probability) {
+void VBucket::createFilter(size_t key_count, double probability,
+                           BloomFilter::Type type) {
     // Create the actual bloom filter upon vbucket creation during
     // scenarios:
     //      - Bucket creation
     //      - Rebalance
     LockHolder lh(bfMutex);
     if (bFilter == nullptr && tempFilter == nullptr) {
-        bFilter = std::make_unique<BloomFilter>(key_count, probability,
-                                        BFILTER_ENABLED);
+        bFilter = BloomFilter::create(type, key_count, probability,
+                                      BFILTER_ENABLED);
     } else {
         LOG(EXTENSION_LOG_WARNING, "(vb %" PRIu16 ") Bloom filter / Temp filter"
             " already exist!", id);
     }
 }
 
-void VBucket::initTempFilter(size_t key_count, double probability) {
+void VBucket::initTempFilter(size_t key_count, double probability,
+                             BloomFilter::Type type) {
     // Create a temp bloom filter with status as COMPACTING,
     // if the main filter is found to exist, set its state to
     // COMPACTING as well.
     LockHolder lh(bfMutex);
-    tempFilter = std::make_unique<BloomFilter>(key_count, probability,
+    tempFilter = BloomFilter::create(type, key_count, probability,
                                      BFILTER_COMPACTING);
     if (bFilter) {
         bFilter->setStatus(BFILTER_COMPACTING);
@@ -659,6 +677,22 @@ void VBucket::addToTempFilter(const DocKey& key) {
     }
 }
 
+bool VBucket::canRemoveFromFilter() {
+    LockHolder lh(bfMutex);
+    return bFilter && !tempFilter && bFilter->supportsRemoval() &&
+           bFilter->getStatus() == BFILTER_ENABLED &&
+           bFilter->getNumOfKeysInFilter() <= bFilter->getKeyCapacity();
+}
+
+void VBucket::removeFromFilter(const DocKey& key) {
+    // Only the main filter: a temp filter is only created by compactions
+    // which rebuild the filter, and they don't remove keys.
+    LockHolder lh(bfMutex);
+    if (bFilter) {
+        bFilter->removeKey(key);
+    }
+}
+
 void VBucket::swapFilter() {
     // Delete the main bloom filter and replace it with
     // the temp filter that was populated during compaction,
@@ -690,6 +724,74 @@ void VBucket::clearFilter() {
     tempFilter.reset();
 }
 
+/**
+ * Adds the keys of the items in a hash table to a bloom filter.
+ */
+class FilterKeyVisitor : public HashTableVisitor {
+public:
+    FilterKeyVisitor(BloomFilter& filter) : filter(filter) {
+    }
+
+    void visit(StoredValue* v) override {
+        if (!v->isTempItem()) {
+            filter.addKey(v->getKey());
+        }
+    }
+
+private:
+    BloomFilter& filter;
+};
+
+std::unique_ptr<BloomFilter> VBucket::snapshotFilter() {
+    std::unique_ptr<BloomFilter> residentKeys;
+    if (eviction == FULL_EVICTION) {
+        {
+            LockHolder lh(bfMutex);
+            if (!bFilter) {
+                return nullptr;
+            }
+            residentKeys = bFilter->cloneEmpty();
+        }
+        residentKeys->setStatus(BFILTER_ENABLED);
+        FilterKeyVisitor visitor(*residentKeys);
+        ht.visit(visitor);
+    }
+
+    // An item evicted while the hash table was visited may have been
+    // missed by the visitor; it was added to the filter (under the hash
+    // bucket lock) before leaving the hash table, so is picked up by
+    // snapshotting the filter afterwards. The resident keys are collected
+    // in a filter of their own, rather than in a copy of the filter, so
+    // that a counting filter's counts aren't all doubled by the merge.
+    std::unique_ptr<BloomFilter> snapshot;
+    {
+        LockHolder lh(bfMutex);
+        if (!bFilter || (bFilter->getStatus() != BFILTER_COMPACTING &&
+                         bFilter->getStatus() != BFILTER_ENABLED)) {
+            return nullptr;
+        }
+        snapshot = bFilter->clone();
+    }
+    snapshot->setStatus(BFILTER_ENABLED);
+
+    if (residentKeys) {
+        try {
+            snapshot->merge(*residentKeys);
+        } catch (const std::invalid_argument&) {
+            // The filter was replaced by compaction.
+            return nullptr;
+        }
+    }
+    return snapshot;
+}
+
+void VBucket::restoreFilter(std::unique_ptr<BloomFilter> filter) {
+    LockHolder lh(bfMutex);
+    if (bFilter == nullptr && tempFilter == nullptr) {
+        bFilter = std::move(filter);
+    }
+}
+
 void VBucket::setFilterStatus(bfilter_status_t to) {
     LockHolder lh(bfMutex);
     if (bFilter) {
@@ -770,7 +872,7 @@ VBNotifyCtx VBucket::trackCasDriftAndQueueDirty(
     return queueDirty(v, generateBySeqno, generateCas, isBackfillItem);
 }
 
-StoredValue* VBucket::fetchValidValue(std::unique_lock<std::mutex>& lh,
+StoredValue* VBucket::fetchValidValue(HashTable::HashBucketLock& lh,
                                       const DocKey& key,
                                       const int bucket_num,
                                       const bool wantsDeleted,
@@ -834,7 +936,7 @@ void VBucket::bgFetch(const DocKey& key,
                 std::make_unique<VBucketBGFetchItem>(cookie, isMeta),
                 shard->getBgFetcher());
         if (shard) {
-            shard->getBgFetcher()->notifyBGEvent();
+            shard->getBgFetcher()->notifyBGEvent(id);
         }
         LOG(EXTENSION_LOG_DEBUG,
             "Queued a background fetch, now at %" PRIu64,
@@ -955,9 +1057,9 @@ ENGINE_ERROR_CODE VBucket::completeBGFetchForSingleItem(
     return status;
 }
 
-/* [TBD]: Get rid of std::unique_lock<std::mutex> lock */
+/* [TBD]: Get rid of HashTable::HashBucketLock lock */
 ENGINE_ERROR_CODE VBucket::addTempItemAndBGFetch(
-        std::unique_lock<std::mutex>& lock,
+        HashTable::HashBucketLock& lock,
         const int bucket_num,
         const DocKey& key,
         const void* cookie,
@@ -1856,7 +1958,7 @@ GetValue VBucket::getAndUpdateTtl(const DocKey& key,
         const bool exptime_mutated = exptime != v->getExptime();
         if (exptime_mutated) {
             v->markDirty();
-            v->setExptime(exptime);
+            ht.unlocked_setExptime(lh, *v, exptime);
             v->setRevSeqno(v->getRevSeqno() + 1);
         }
 
@@ -1911,7 +2013,7 @@ MutationStatus VBucket::insertFromWarmup(Item& itm,
                     lh, itm, PreserveRevSeqno::Yes, /*queueItmCtx*/ nullptr)
                     .first;
         if (keyMetaDataOnly) {
-            v->markNotResident();
+            v->markNotResident(ht);
             /* For now ht stats are updated from outside ht. This seems to be
                a better option for now than passing a flag to
                addNewStoredValue() just for this func */
@@ -1935,7 +2037,7 @@ MutationStatus VBucket::insertFromWarmup(Item& itm,
             if (v->getCas() == 0) {
                 v->setCas(itm.getCas());
                 v->setFlags(itm.getFlags());
-                v->setExptime(itm.getExptime());
+                ht.unlocked_setExptime(lh, *v, itm.getExptime());
                 v->setRevSeqno(itm.getRevSeqno());
             } else {
                 return MutationStatus::InvalidCas;
@@ -1962,6 +2064,19 @@ GetValue VBucket::getInternal(const DocKey& key,
                               bool diskFlushAll) {
     const bool trackReference = (options & TRACK_REFERENCE);
     const bool getDeletedValue = (options & GET_DELETED_VALUE);
+
+    // Most gets are of live, resident items; try to serve them without
+    // taking the hash bucket lock.
+    if (ht.isOptimisticReadsEnabled()) {
+        Item* itm = ht.optimisticGet(
+                key, getId(), trackReference, options & HIDE_LOCKED_CAS);
+        if (itm) {
+            const int64_t bySeqno = itm->getBySeqno();
+            const uint8_t nru = itm->getNRUValue();
+            return GetValue(itm, ENGINE_SUCCESS, bySeqno, false, nru);
+        }
+    }
+
     int bucket_num(0);
     auto lh = ht.getLockedBucket(key, &bucket_num);
     StoredValue* v = fetchValidValue(
@@ -2026,6 +2141,75 @@ GetValue VBucket::getInternal(const DocKey& key,
     }
 }
 
+uint64_t VBucket::pinForResidentBackfill(uint64_t startSeqno) {
+    std::lock_guard<std::mutex> rbh(residentBackfillMutex);
+    const uint64_t pin = nextResidentBackfillPin++;
+    residentBackfillPins[pin] = {startSeqno,
+                                 std::numeric_limits<uint64_t>::max()};
+    updatePinnedSeqnos(rbh);
+    return pin;
+}
+
+void VBucket::updateResidentBackfillPin(uint64_t pin,
+                                        uint64_t low,
+                                        uint64_t high) {
+    std::lock_guard<std::mutex> rbh(residentBackfillMutex);
+    auto it = residentBackfillPins.find(pin);
+    if (it == residentBackfillPins.end()) {
+        throw std::logic_error(
+                "VBucket::updateResidentBackfillPin: vb:" +
+                std::to_string(getId()) + " has no pin " +
+                std::to_string(pin));
+    }
+    it->second = {low, high};
+    updatePinnedSeqnos(rbh);
+}
+
+void VBucket::unpinForResidentBackfill(uint64_t pin) {
+    std::vector<std::pair<StoredDocKey, uint64_t>> deletes;
+    {
+        std::lock_guard<std::mutex> rbh(residentBackfillMutex);
+        if (residentBackfillPins.erase(pin) == 0) {
+            throw std::logic_error(
+                    "VBucket::unpinForResidentBackfill: vb:" +
+                    std::to_string(getId()) + " has no pin " +
+                    std::to_string(pin));
+        }
+        updatePinnedSeqnos(rbh);
+        if (!residentBackfillPins.empty()) {
+            return;
+        }
+        deletes.swap(deferredDeletes);
+    }
+
+    for (const auto& del : deletes) {
+        int bucket_num(0);
+        auto lh = ht.getLockedBucket(del.first, &bucket_num);
+        StoredValue* v = ht.unlocked_find(del.first,
+                                          bucket_num,
+                                          /*wantsDeleted*/ true,
+                                          /*trackReference*/ false);
+        // Only remove the delete if it hasn't since been replaced, and
+        // is still the persisted revision.
+        if (v && v->isDeleted() && v->getRevSeqno() == del.second &&
+            !v->isDirty()) {
+            deleteStoredValue(lh, *v, bucket_num);
+        }
+    }
+}
+
+void VBucket::updatePinnedSeqnos(const std::lock_guard<std::mutex>& rbh) {
+    // Pin the span of every backfill's range; any gap between them is
+    // only pinned for as long as both backfills run.
+    uint64_t low = std::numeric_limits<uint64_t>::max();
+    uint64_t high = 0;
+    for (const auto& pin : residentBackfillPins) {
+        low = std::min(low, pin.second.first);
+        high = std::max(high, pin.second.second);
+    }
+    ht.setPinnedSeqnos(low, high);
+}
+
 void VBucket::deletedOnDiskCbk(const Item& queuedItem, bool deleted) {
     int bucket_num(0);
     auto lh = ht.getLockedBucket(queuedItem.getKey(), &bucket_num);
@@ -2038,8 +2222,19 @@ void VBucket::deletedOnDiskCbk(const Item& queuedItem, bool deleted) {
     //  1. Item is existent in hashtable, and deleted flag is true
     //  2. rev seqno of queued item matches rev seqno of hash table item
     if (v && v->isDeleted() && (queuedItem.getRevSeqno() == v->getRevSeqno())) {
-        bool isDeleted = deleteStoredValue(lh, *v, bucket_num);
-        if (!isDeleted) {
+        bool deferred = false;
+        {
+            // A resident backfill may still need to send the delete; it is
+            // removed once the last one finishes.
+            std::lock_guard<std::mutex> rbh(residentBackfillMutex);
+            if (!residentBackfillPins.empty()) {
+                deferredDeletes.emplace_back(StoredDocKey(queuedItem.getKey()),
+                                             queuedItem.getRevSeqno());
+                deferred = true;
+            }
+        }
+
+        if (!deferred && !deleteStoredValue(lh, *v, bucket_num)) {
             throw std::logic_error(
                     "deletedOnDiskCbk:callback: "
                     "Failed to delete key with seqno:" +
@@ -2185,7 +2380,7 @@ void VBucket::updateBGStats(const hrtime_t init,
 }
 
 std::pair<MutationStatus, VBNotifyCtx> VBucket::processSet(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         StoredValue*& v,
         Item& itm,
         const uint64_t cas,
@@ -2264,7 +2459,7 @@ std::pair<MutationStatus, VBNotifyCtx> VBucket::processSet(
 }
 
 std::pair<AddStatus, VBNotifyCtx> VBucket::processAdd(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         StoredValue*& v,
         Item& itm,
         bool maybeKeyExists,
@@ -2331,7 +2526,7 @@ std::pair<AddStatus, VBNotifyCtx> VBucket::processAdd(
 }
 
 MutationStatus VBucket::processSoftDelete(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         StoredValue& v,
         uint64_t cas) {
     if (!htLock) {
@@ -2346,7 +2541,7 @@ MutationStatus VBucket::processSoftDelete(
 }
 
 MutationStatus VBucket::processSoftDelete(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         StoredValue& v,
         uint64_t cas,
         const ItemMetaData& metadata,
@@ -2364,7 +2559,7 @@ MutationStatus VBucket::processSoftDelete(
          * but functionally correct and for performance reasons
          * only the system xattrs need to be stored.
          */
-        value_t value = v.getValue();
+        value_t value = v.materializeValue();
         if (value && mcbp::datatype::is_xattr(value->getDataType())) {
             softDeleteStoredValue(
                     htLock, v, metadata.revSeqno, /*onlyMarkDeleted*/ true);
@@ -2405,7 +2600,7 @@ MutationStatus VBucket::processSoftDelete(
 }
 
 std::pair<MutationStatus, VBNotifyCtx> VBucket::updateStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         StoredValue& v,
         Item& itm,
         const PreserveRevSeqno preserveRevSeqno,
@@ -2432,7 +2627,7 @@ std::pair<MutationStatus, VBNotifyCtx> VBucket::updateStoredValue(
 }
 
 std::pair<StoredValue*, VBNotifyCtx> VBucket::addNewStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         Item& itm,
         const PreserveRevSeqno preserveRevSeqno,
         const VBQueueItemCtx* queueItmCtx) {
@@ -2471,7 +2666,7 @@ std::pair<StoredValue*, VBNotifyCtx> VBucket::addNewStoredValue(
     return {v, VBNotifyCtx()};
 }
 
-bool VBucket::deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
+bool VBucket::deleteStoredValue(const HashTable::HashBucketLock& htLock,
                                 StoredValue& v,
                                 int bucketNum) {
     if (!v.isDeleted() && v.isLocked(ep_current_time())) {
@@ -2485,7 +2680,7 @@ bool VBucket::deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
     return true;
 }
 
-void VBucket::softDeleteStoredValue(const std::unique_lock<std::mutex>& htLock,
+void VBucket::softDeleteStoredValue(const HashTable::HashBucketLock& htLock,
                                     StoredValue& v,
                                     uint64_t revSeqno,
                                     bool onlyMarkDeleted) {
@@ -2495,7 +2690,7 @@ void VBucket::softDeleteStoredValue(const std::unique_lock<std::mutex>& htLock,
 }
 
 AddStatus VBucket::addTempStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
+        const HashTable::HashBucketLock& htLock,
         int bucket_num,
         const DocKey& key,
         bool isReplication) {
@@ -34,6 +34,7 @@
 
 #include <platform/non_negative_counter.h>
 #include <atomic>
+#include <map>
 #include <queue>
 
 class BgFetcher;
@@ -203,7 +204,7 @@ public:
             uint64_t purgeSeqno = 0,
             uint64_t maxCas = 0);
 
-    ~VBucket();
+    virtual ~VBucket();
 
     int64_t getHighSeqno() const {
         return checkpointManager.getHighSeqno();
@@ -457,12 +458,29 @@ public:
     /**
      * BloomFilter operations for vbucket
      */
-    void createFilter(size_t key_count, double probability);
-    void initTempFilter(size_t key_count, double probability);
+    void createFilter(size_t key_count, double probability,
+                      BloomFilter::Type type = BloomFilter::Type::Standard);
+    void initTempFilter(size_t key_count, double probability,
+                        BloomFilter::Type type = BloomFilter::Type::Standard);
     void addToFilter(const DocKey& key);
     bool maybeKeyExistsInFilter(const DocKey& key);
     bool isTempFilterAvailable();
     void addToTempFilter(const DocKey& key);
+
+    /**
+     * Returns true if keys can be removed from the bloom filter as their
+     * tombstones are purged, keeping it accurate without being rebuilt by
+     * compaction: the filter supports removal, is enabled and complete (not
+     * being rebuilt) and holds no more keys than it was sized for.
+     */
+    bool canRemoveFromFilter();
+
+    /**
+     * Remove the key of a purged tombstone from the bloom filter, if it
+     * supports removal.
+     */
+    void removeFromFilter(const DocKey& key);
+
     void swapFilter();
     void clearFilter();
     void setFilterStatus(bfilter_status_t to);
@@ -470,6 +488,19 @@ public:
     size_t getFilterSize();
     size_t getNumOfKeysInFilter();
 
+    /**
+     * Returns a copy of the bloom filter to save to disk, or nullptr if
+     * there's no enabled filter. Under full eviction, keys are only added to
+     * the filter as they are evicted, so the copy also holds the keys in the
+     * hash table; it then holds every key persisted before the call.
+     */
+    std::unique_ptr<BloomFilter> snapshotFilter();
+
+    /**
+     * Use a bloom filter loaded from disk, unless a filter already exists.
+     */
+    void restoreFilter(std::unique_ptr<BloomFilter> filter);
+
     uint64_t nextHLCCas() {
         return hlc.nextHLC();
     }
@@ -478,8 +509,8 @@ public:
     bool isResidentRatioUnderThreshold(float threshold,
                                        item_eviction_policy_t policy);
 
-    void addStats(bool details, ADD_STAT add_stat, const void *c,
-                  item_eviction_policy_t policy);
+    virtual void addStats(bool details, ADD_STAT add_stat, const void *c,
+                          item_eviction_policy_t policy);
 
     size_t getNumItems(item_eviction_policy_t policy) const;
 
@@ -534,7 +565,7 @@ public:
      * @param trackReference
      * @param queueExpired Delete an expired item
      */
-    StoredValue* fetchValidValue(std::unique_lock<std::mutex>& lh,
+    StoredValue* fetchValidValue(HashTable::HashBucketLock& lh,
                                  const DocKey& key,
                                  int bucket_num,
                                  bool wantsDeleted = false,
@@ -589,7 +620,7 @@ public:
      *
      * @return ENGINE_ERROR_CODE status notified to be to the front end
      */
-    ENGINE_ERROR_CODE addTempItemAndBGFetch(std::unique_lock<std::mutex>& lock,
+    ENGINE_ERROR_CODE addTempItemAndBGFetch(HashTable::HashBucketLock& lock,
                                             int bucket_num,
                                             const DocKey& key,
                                             const void* cookie,
@@ -883,6 +914,30 @@ public:
                          get_options_t options,
                          bool diskFlushAll);
 
+    /**
+     * Keep the items of this vbucket from startSeqno onwards in memory for
+     * a resident DCP backfill (see DCPBackfill::createFromMemory()), which
+     * reads the HashTable a lock at a time: until the matching
+     * unpinForResidentBackfill(), those items aren't ejected, and deleted
+     * items stay in the HashTable once persisted. A backfill holds its pin
+     * until it completes or is cancelled along with its stream.
+     *
+     * @return the id of the pin
+     */
+    uint64_t pinForResidentBackfill(uint64_t startSeqno);
+
+    /**
+     * Narrow a pin to the seqnos [low, high] its backfill has yet to read,
+     * letting the rest be ejected.
+     */
+    void updateResidentBackfillPin(uint64_t pin, uint64_t low, uint64_t high);
+
+    /**
+     * Release a pinForResidentBackfill(), removing any persisted deletes
+     * which were kept once the last pin is released.
+     */
+    void unpinForResidentBackfill(uint64_t pin);
+
     /**
      * Update in memory data structures after an item is deleted on disk
      *
@@ -943,7 +998,7 @@ protected:
      *                info
      */
     std::pair<MutationStatus, VBNotifyCtx> processSet(
-            const std::unique_lock<std::mutex>& htLock,
+            const HashTable::HashBucketLock& htLock,
             StoredValue*& v,
             Item& itm,
             uint64_t cas,
@@ -969,7 +1024,7 @@ protected:
      *                info
      */
     std::pair<AddStatus, VBNotifyCtx> processAdd(
-            const std::unique_lock<std::mutex>& htLock,
+            const HashTable::HashBucketLock& htLock,
             StoredValue*& v,
             Item& itm,
             bool maybeKeyExists,
@@ -988,7 +1043,7 @@ protected:
      *
      * @return Result indicating the status of the operation
      */
-    MutationStatus processSoftDelete(const std::unique_lock<std::mutex>& htLock,
+    MutationStatus processSoftDelete(const HashTable::HashBucketLock& htLock,
                                      StoredValue& v,
                                      uint64_t cas);
 
@@ -1001,7 +1056,9 @@ protected:
      * does not store a reference or a copy of the StoredValue. If any other
      * in-memory data strucutures are formed intrusively using StoredValues,
      * then it must be decided in this function which data structure deletes
-     * the StoredValue. Currently it is HashTable that deleted the StoredValue
+     * the StoredValue. Currently it is HashTable that deleted the StoredValue;
+     * subclasses which also index StoredValues (see EphemeralVBucket) override
+     * this to unlink them first.
      *
      * @param htLock Hash table lock that must be held
      * @param v Reference to the StoredValue to be deleted
@@ -1009,14 +1066,78 @@ protected:
      *
      * @return true if an object was deleted, false otherwise
      */
-    bool deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
-                           StoredValue& v,
-                           int bucketNum);
+    virtual bool deleteStoredValue(const HashTable::HashBucketLock& htLock,
+                                   StoredValue& v,
+                                   int bucketNum);
+
+    /**
+     * Updates an existing StoredValue in in-memory data structures like HT.
+     * Assumes that HT bucket lock is grabbed.
+     *
+     * @param htLock Hash table lock that must be held
+     * @param v Reference to the StoredValue to be updated.
+     * @param itm Item to be updated. On success, its revSeqno is updated
+     * @param preserveRevSeqno should we keep the same revision seqno or
+     *        increment it
+     * @param queueItmCtx holds info needed to queue an item in chkpt or vb
+     *                    backfill queue; NULL if item need not be queued
+     *
+     * @return Result indicating the status of the operation and notification
+     *                info
+     */
+    virtual std::pair<MutationStatus, VBNotifyCtx> updateStoredValue(
+            const HashTable::HashBucketLock& htLock,
+            StoredValue& v,
+            Item& itm,
+            PreserveRevSeqno preserveRevSeqno,
+            const VBQueueItemCtx* queueItmCtx);
+
+    /**
+     * Logically (soft) delete item in all in-memory data structures. Also
+     * updates revSeqno. Depending on the in-memory data structure the item may
+     * be marked delete and/or reset and/or a new value (marked as deleted)
+     * added.
+     * Assumes that HT bucket lock is grabbed.
+     * Also assumes that v is in the hash table.
+     *
+     * @param htLock Hash table lock that must be held
+     * @param v Reference to the StoredValue to be soft deleted
+     * @param revSeqno revision id sequence number
+     * @param onlyMarkDeleted indicates if we must reset the StoredValue or
+     *                        just mark deleted
+     */
+    virtual void softDeleteStoredValue(
+            const HashTable::HashBucketLock& htLock,
+            StoredValue& v,
+            uint64_t revSeqno,
+            bool onlyMarkDeleted);
+
+    /**
+     * Queue an item for persistence and replication
+     *
+     * The caller of this function must hold the lock of the hash table
+     * partition that contains the StoredValue being Queued.
+     *
+     * @param v the dirty item. The cas and seqno maybe updated based on the
+     *          flags passed
+     * @param generateBySeqno request that the seqno is generated by this call
+     * @param generateCas request that the CAS is generated by this call
+     * @param isBackfillItem indicates if the item must be put onto vb queue or
+     *        onto checkpoint
+     *
+     * @return Notification context containing info needed to notify the
+     *         clients (like connections, flusher)
+     */
+    virtual VBNotifyCtx queueDirty(
+            StoredValue& v,
+            GenerateBySeqno generateBySeqno = GenerateBySeqno::Yes,
+            GenerateCas generateCas = GenerateCas::Yes,
+            bool isBackfillItem = false);
 
-private:
     template <typename T>
     void addStat(const char *nm, const T &val, ADD_STAT add_stat, const void *c);
 
+private:
     void fireAllOps(EventuallyPersistentEngine &engine, ENGINE_ERROR_CODE code);
 
     void adjustCheckpointFlushTimeout(size_t wall_time);
@@ -1027,6 +1148,14 @@ private:
 
     void decrDirtyQueuePendingWrites(size_t decrementBy);
 
+    /**
+     * Pin the seqnos in the HashTable which the resident backfills still
+     * need (see pinForResidentBackfill()).
+     *
+     * @param rbh residentBackfillMutex, which must be held
+     */
+    void updatePinnedSeqnos(const std::lock_guard<std::mutex>& rbh);
+
     /**
      * Helper function to update stats after completion of a background fetch
      * for either the value of metadata of a key.
@@ -1039,28 +1168,6 @@ private:
                        const hrtime_t start,
                        const hrtime_t stop);
 
-    /**
-     * Updates an existing StoredValue in in-memory data structures like HT.
-     * Assumes that HT bucket lock is grabbed.
-     *
-     * @param htLock Hash table lock that must be held
-     * @param v Reference to the StoredValue to be updated.
-     * @param itm Item to be updated. On success, its revSeqno is updated
-     * @param preserveRevSeqno should we keep the same revision seqno or
-     *        increment it
-     * @param queueItmCtx holds info needed to queue an item in chkpt or vb
-     *                    backfill queue; NULL if item need not be queued
-     *
-     * @return Result indicating the status of the operation and notification
-     *                info
-     */
-    std::pair<MutationStatus, VBNotifyCtx> updateStoredValue(
-            const std::unique_lock<std::mutex>& htLock,
-            StoredValue& v,
-            Item& itm,
-            PreserveRevSeqno preserveRevSeqno,
-            const VBQueueItemCtx* queueItmCtx);
-
     /**
      * Adds a new StoredValue in in-memory data structures like HT.
      * Assumes that HT bucket lock is grabbed.
@@ -1075,29 +1182,11 @@ private:
      * @return Ptr of the StoredValue added and notification info
      */
     std::pair<StoredValue*, VBNotifyCtx> addNewStoredValue(
-            const std::unique_lock<std::mutex>& htLock,
+            const HashTable::HashBucketLock& htLock,
             Item& itm,
             PreserveRevSeqno preserveRevSeqno,
             const VBQueueItemCtx* queueItmCtx);
 
-    /**
-     * Logically (soft) delete item in all in-memory data structures. Also
-     * updates revSeqno. Depending on the in-memory data structure the item may
-     * be marked delete and/or reset and/or a new value (marked as deleted)
-     * added.
-     * Assumes that HT bucket lock is grabbed.
-     * Also assumes that v is in the hash table.
-     *
-     * @param htLock Hash table lock that must be held
-     * @param v Reference to the StoredValue to be soft deleted
-     * @param revSeqno revision id sequence number
-     * @param onlyMarkDeleted indicates if we must reset the StoredValue or
-     *                        just mark deleted
-     */
-    void softDeleteStoredValue(const std::unique_lock<std::mutex>& htLock,
-                               StoredValue& v,
-                               uint64_t revSeqno,
-                               bool onlyMarkDeleted);
 
     /**
      * This function checks cas, expiry, eviction policy and other partition
@@ -1113,7 +1202,7 @@ private:
      *
      * @return Result indicating the status of the operation
      */
-    MutationStatus processSoftDelete(const std::unique_lock<std::mutex>& htLock,
+    MutationStatus processSoftDelete(const HashTable::HashBucketLock& htLock,
                                      StoredValue& v,
                                      uint64_t cas,
                                      const ItemMetaData& metadata,
@@ -1130,32 +1219,11 @@ private:
      *
      * @return Result indicating the status of the operation
      */
-    AddStatus addTempStoredValue(const std::unique_lock<std::mutex>& htLock,
+    AddStatus addTempStoredValue(const HashTable::HashBucketLock& htLock,
                                  int bucket_num,
                                  const DocKey& key,
                                  bool isReplication = false);
 
-    /**
-     * Queue an item for persistence and replication
-     *
-     * The caller of this function must hold the lock of the hash table
-     * partition that contains the StoredValue being Queued.
-     *
-     * @param v the dirty item. The cas and seqno maybe updated based on the
-     *          flags passed
-     * @param generateBySeqno request that the seqno is generated by this call
-     * @param generateCas request that the CAS is generated by this call
-     * @param isBackfillItem indicates if the item must be put onto vb queue or
-     *        onto checkpoint
-     *
-     * @return Notification context containing info needed to notify the
-     *         clients (like connections, flusher)
-     */
-    VBNotifyCtx queueDirty(
-            StoredValue& v,
-            GenerateBySeqno generateBySeqno = GenerateBySeqno::Yes,
-            GenerateCas generateCas = GenerateCas::Yes,
-            bool isBackfillItem = false);
 
     /**
      * Track CAS Drift and then queue an item for persistence and replication
@@ -1217,6 +1285,13 @@ private:
     std::atomic<size_t> numHpChks; // size of list hpChks (to avoid MB-9434)
     KVShard *shard;
 
+    // The seqnos each resident backfill pins, by pin id, and the persisted
+    // deletes (key and revSeqno) kept in the HashTable for them.
+    std::mutex residentBackfillMutex;
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> residentBackfillPins;
+    uint64_t nextResidentBackfillPin;
+    std::vector<std::pair<StoredDocKey, uint64_t>> deferredDeletes;
+
     std::mutex bfMutex;
     std::unique_ptr<BloomFilter> bFilter;
     std::unique_ptr<BloomFilter> tempFilter;    // Used during compaction.
@@ -409,7 +409,8 @@ Warmup::Warmup(KVBucket& st, Configuration& config_)
       corruptAccessLog(false),
       warmupComplete(false),
       warmupOOMFailure(false),
-      estimatedWarmupCount(std::numeric_limits<size_t>::max())
+      estimatedWarmupCount(std::numeric_limits<size_t>::max()),
+      restoredFilters(0)
 {
 }
 
@@ -507,6 +508,8 @@ void Warmup::createVBuckets(uint16_t shardId) {
                 table = std::make_unique<FailoverTable>(vbs.failovers,
                                                         maxEntries);
             }
+            // The failover UUID on disk, before any entry is added below.
+            const uint64_t uuid = table->getLatestUUID();
             KVShard* shard = store.getVBuckets().getShardByVbId(vbid);
 
             vb = store.makeVBucket(vbid,
@@ -529,6 +532,10 @@ void Warmup::createVBuckets(uint16_t shardId) {
                 }
             }
 
+            if (store.restoreFilter(*vb, uuid, vbs.highSeqno)) {
+                ++restoredFilters;
+            }
+
             store.vbMap.addBucket(vb);
         }
 
@@ -973,6 +980,7 @@ void Warmup::addStats(ADD_STAT add_stat, const void *c) const
     addStat("value_count", stats.warmedUpValues, add_stat, c);
     addStat("dups", stats.warmDups, add_stat, c);
     addStat("oom", stats.warmOOM, add_stat, c);
+    addStat("bfilters_restored", restoredFilters.load(), add_stat, c);
     addStat("min_memory_threshold",
             stats.warmupMemUsedCap * 100.0,
             add_stat,
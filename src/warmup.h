@@ -219,6 +219,9 @@ private:
     std::atomic<bool> warmupOOMFailure;
     std::atomic<size_t> estimatedWarmupCount;
 
+    // Number of vbuckets whose bloom filter was restored from disk.
+    std::atomic<size_t> restoredFilters;
+
     DISALLOW_COPY_AND_ASSIGN(Warmup);
 };
 
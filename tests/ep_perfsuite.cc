@@ -39,12 +39,16 @@
 #include <condition_variable>
 #include <fstream>
 #include <iterator>
+#include <list>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <thread>
 #include <type_traits>
 #include <unordered_map>
 
+#include "bloomfilter.h"
+#include "chunked_queue.h"
 #include "ep_testsuite_common.h"
 #include "ep_test_apis.h"
 
@@ -455,6 +459,33 @@ static enum test_result perf_latency_baseline(ENGINE_HANDLE *h,
     return perf_latency(h, h1, "1_bucket_1_thread_baseline", ITERATIONS);
 }
 
+/* Benchmark the baseline latency using the fingerprint hash table layout;
+ * compare with perf_latency_baseline (chained layout).
+ */
+static enum test_result perf_latency_fingerprint_ht(ENGINE_HANDLE *h,
+                                                    ENGINE_HANDLE_V1 *h1) {
+    return perf_latency(h, h1, "1_bucket_1_thread_fingerprint_ht",
+                        ITERATIONS);
+}
+
+/* Benchmark the baseline latency with StoredValues allocated from slabs;
+ * compare with perf_latency_baseline (individually allocated).
+ */
+static enum test_result perf_latency_slab_allocator(ENGINE_HANDLE *h,
+                                                   ENGINE_HANDLE_V1 *h1) {
+    return perf_latency(h, h1, "1_bucket_1_thread_slab_allocator",
+                        ITERATIONS);
+}
+
+/* Benchmark the baseline latency with small values stored inline in their
+ * StoredValue; compare with perf_latency_baseline (values in Blobs).
+ */
+static enum test_result perf_latency_inline_values(ENGINE_HANDLE *h,
+                                                  ENGINE_HANDLE_V1 *h1) {
+    return perf_latency(h, h1, "1_bucket_1_thread_inline_values",
+                        ITERATIONS);
+}
+
 /* Benchmark the baseline latency with the defragmenter enabled.
  */
 static enum test_result perf_latency_defragmenter(ENGINE_HANDLE *h,
@@ -469,6 +500,313 @@ static enum test_result perf_latency_expiry_pager(ENGINE_HANDLE *h,
     return perf_latency(h, h1, "With constant Expiry pager", ITERATIONS);
 }
 
+/*
+ * Measure how get latency scales with the number of concurrent reader
+ * threads, all reading the same small set of hot (resident) keys - and
+ * hence contending on the same hash table locks.
+ */
+static enum test_result perf_read_scaling(ENGINE_HANDLE *h,
+                                          ENGINE_HANDLE_V1 *h1,
+                                          const char* title) {
+    // Only timing front-end performance, not considering persistence.
+    stop_persistence(h, h1);
+
+    const size_t num_keys = 64;
+    const size_t gets_per_thread = ITERATIONS / 10;
+    const std::string data(100, 'x');
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < num_keys; i++) {
+        keys.push_back("hot_" + std::to_string(i));
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, nullptr, OPERATION_SET, keys.back().c_str(),
+                      data.c_str(), nullptr),
+                "Failed to store a value");
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::vector<hrtime_t>> timings;
+    std::vector<double> throughputs;
+    for (const int n_threads : {1, 2, 4, 8, 16, 32}) {
+        std::vector<std::vector<hrtime_t>> thread_timings(n_threads);
+        std::vector<const void*> cookies;
+        for (int t = 0; t < n_threads; t++) {
+            cookies.push_back(testHarness.create_cookie());
+            thread_timings[t].reserve(gets_per_thread);
+        }
+
+        const hrtime_t start = gethrtime();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++) {
+            threads.emplace_back([&, t]() {
+                for (size_t i = 0; i < gets_per_thread; i++) {
+                    item* it = nullptr;
+                    const auto& key = keys[(i + t) % num_keys];
+                    const hrtime_t get_start = gethrtime();
+                    checkeq(ENGINE_SUCCESS,
+                            get(h, h1, cookies[t], &it, key, 0),
+                            "Failed to get a value");
+                    thread_timings[t].push_back(gethrtime() - get_start);
+                    h1->release(h, cookies[t], it);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const hrtime_t elapsed = gethrtime() - start;
+
+        for (const auto* cookie : cookies) {
+            testHarness.destroy_cookie(cookie);
+        }
+
+        std::vector<hrtime_t> all;
+        for (const auto& t : thread_timings) {
+            all.insert(all.end(), t.begin(), t.end());
+        }
+        names.push_back(std::to_string(n_threads) + " threads");
+        timings.push_back(std::move(all));
+        throughputs.push_back((n_threads * gets_per_thread) /
+                              (elapsed / 1e9));
+    }
+
+    add_sentinel_doc(h, h1, /*vbid*/0);
+
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    for (size_t i = 0; i < names.size(); i++) {
+        all_timings.push_back(std::make_pair(names[i], &timings[i]));
+    }
+    std::string description(std::string("Get latency [") + title + "] - " +
+                            std::to_string(num_keys) + " hot keys (µs)");
+    output_result(title, description, all_timings, "µs");
+
+    for (size_t i = 0; i < names.size(); i++) {
+        printf("  %-22s %12.0f gets/s\n", names[i].c_str(), throughputs[i]);
+    }
+    return SUCCESS;
+}
+
+/* Benchmark read scaling with gets taking the hash bucket lock.
+ */
+static enum test_result perf_read_scaling_locked(ENGINE_HANDLE *h,
+                                                 ENGINE_HANDLE_V1 *h1) {
+    return perf_read_scaling(h, h1, "read_scaling_locked");
+}
+
+/* Benchmark read scaling with optimistic (lock-free) hash table reads;
+ * compare with perf_read_scaling_locked.
+ */
+static enum test_result perf_read_scaling_optimistic(ENGINE_HANDLE *h,
+                                                     ENGINE_HANDLE_V1 *h1) {
+    return perf_read_scaling(h, h1, "read_scaling_optimistic");
+}
+
+/*
+ * Queue items into a checkpoint-style queue the way a checkpoint does -
+ * appending each mutation and, when its key is already queued, erasing the
+ * previous entry from the middle - then walk it as a cursor would. Records
+ * the time per item for each batch queued, and for each batch walked.
+ */
+template <typename Queue>
+static void bench_checkpoint_queue(Queue& queue,
+                                   const std::vector<int>& values,
+                                   std::vector<hrtime_t>& queue_timings,
+                                   std::vector<hrtime_t>& walk_timings) {
+    const size_t batch = 1000;
+    const size_t num_keys = values.size() * 3 / 4;
+    std::vector<typename Queue::iterator> index(num_keys, queue.end());
+
+    for (size_t i = 0; i < values.size(); i += batch) {
+        const hrtime_t start = gethrtime();
+        for (size_t j = i; j < i + batch && j < values.size(); j++) {
+            // Re-queue one key in every four.
+            const size_t key = (j % 4 == 3) ? (j * 7919) % num_keys
+                                            : j % num_keys;
+            queue.push_back(&values[j]);
+            if (index[key] != queue.end()) {
+                queue.erase(index[key]);
+            }
+            index[key] = std::prev(queue.end());
+        }
+        queue_timings.push_back((gethrtime() - start) / batch);
+    }
+
+    size_t sum = 0;
+    auto it = queue.begin();
+    while (it != queue.end()) {
+        const hrtime_t start = gethrtime();
+        for (size_t j = 0; j < batch && it != queue.end(); j++, ++it) {
+            sum += **it;
+        }
+        walk_timings.push_back((gethrtime() - start) / batch);
+    }
+    cb_assert(sum > 0);
+}
+
+/*
+ * Compare the chunked CheckpointQueue with the std::list previously used:
+ * queueing and cursor iteration time per item, and memory overhead per
+ * queued item.
+ */
+static enum test_result perf_checkpoint_queue(ENGINE_HANDLE *h,
+                                              ENGINE_HANDLE_V1 *h1) {
+    const size_t num_items = ITERATIONS * 10;
+    std::vector<int> values(num_items);
+    std::iota(values.begin(), values.end(), 1);
+
+    std::vector<hrtime_t> list_queue, list_walk;
+    std::vector<hrtime_t> chunked_queue, chunked_walk;
+    std::list<const int*> list;
+    ChunkedQueue<const int*> chunked;
+    bench_checkpoint_queue(list, values, list_queue, list_walk);
+    bench_checkpoint_queue(chunked, values, chunked_queue, chunked_walk);
+
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    all_timings.push_back(std::make_pair("std::list queue", &list_queue));
+    all_timings.push_back(std::make_pair("Chunked queue", &chunked_queue));
+    all_timings.push_back(std::make_pair("std::list walk", &list_walk));
+    all_timings.push_back(std::make_pair("Chunked walk", &chunked_walk));
+    output_result("Checkpoint queue",
+                  "Checkpoint queue time per item (ns)",
+                  all_timings, "ns");
+
+    // A list node holds the element plus two links, before any allocator
+    // overhead (typically a further 8-16 bytes per allocation).
+    const double list_bytes = sizeof(const int*) + 2 * sizeof(void*);
+    const double chunked_bytes =
+            double(chunked.getMemoryUsage()) / chunked.size();
+    printf("  %-22s %8.1f bytes/item (+ allocator overhead)\n",
+           "std::list", list_bytes);
+    printf("  %-22s %8.1f bytes/item\n", "Chunked queue", chunked_bytes);
+    return SUCCESS;
+}
+
+/*
+ * Time lookups in a filter too large to stay in cache, half of them of
+ * keys which were added, for each type of bloom filter.
+ */
+static enum test_result perf_bloomfilter_lookup(ENGINE_HANDLE *h,
+                                                ENGINE_HANDLE_V1 *h1) {
+    const size_t num_keys = 1000000;
+    const size_t batch = 10000;
+    std::vector<std::string> keys;
+    keys.reserve(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+        keys.push_back("key_" + std::to_string(i));
+    }
+
+    std::vector<BloomFilter::Type> types = {BloomFilter::Type::Standard,
+                                            BloomFilter::Type::Blocked,
+                                            BloomFilter::Type::Counting};
+    std::vector<std::string> names;
+    std::vector<std::vector<hrtime_t> > timings(types.size());
+    for (size_t t = 0; t < types.size(); t++) {
+        auto filter = BloomFilter::create(types[t], num_keys, 0.01,
+                                          BFILTER_ENABLED);
+        for (size_t i = 0; i < num_keys; i += 2) {
+            filter->addKey(DocKey(keys[i], DocNamespace::DefaultCollection));
+        }
+
+        size_t found = 0;
+        for (size_t i = 0; i < num_keys; i += batch) {
+            const hrtime_t start = gethrtime();
+            for (size_t j = i; j < i + batch && j < num_keys; j++) {
+                found += filter->maybeKeyExists(
+                        DocKey(keys[j], DocNamespace::DefaultCollection));
+            }
+            timings[t].push_back((gethrtime() - start) / batch);
+        }
+        checkge(found, num_keys / 2, "Bloom filter lost keys");
+        names.push_back(BloomFilter::typeToString(types[t]));
+    }
+
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    for (size_t t = 0; t < types.size(); t++) {
+        all_timings.push_back(std::make_pair(names[t], &timings[t]));
+    }
+    output_result("Bloom filter lookup",
+                  "Bloom filter lookup time (ns)",
+                  all_timings, "ns");
+    return SUCCESS;
+}
+
+/*
+ * Load items across several vbuckets with persistence stopped, then time
+ * how long the flushers take to drain them. Reports the drain rate (from
+ * ep_diskqueue_drain) and persistence latency percentiles so runs with and
+ * without flusher_pipelining / group commit can be compared.
+ */
+static enum test_result perf_flusher_drain(ENGINE_HANDLE *h,
+                                           ENGINE_HANDLE_V1 *h1,
+                                           const char* title) {
+    const int num_vbuckets = 16;
+    const size_t num_docs = ITERATIONS;
+    for (int vb = 0; vb < num_vbuckets; vb++) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed set_vbucket_state for vbucket");
+    }
+    wait_for_stat_to_be(h, h1, "ep_persist_vbstate_total", num_vbuckets);
+
+    // Small commits (a few items per vbucket at a time) are where the flusher
+    // spends most of its time waiting on commits, so load in rounds, letting
+    // each drain before the next.
+    const size_t rounds = 10;
+    std::vector<hrtime_t> round_timings;
+    const std::string value(256, 'x');
+    const int drained_before = get_int_stat(h, h1, "ep_diskqueue_drain");
+    const hrtime_t start = gethrtime();
+    hrtime_t load_time = 0;
+    for (size_t round = 0; round < rounds; round++) {
+        stop_persistence(h, h1);
+        const hrtime_t load_start = gethrtime();
+        for (size_t ii = round; ii < num_docs; ii += rounds) {
+            const std::string key("key_" + std::to_string(ii));
+            checkeq(ENGINE_SUCCESS,
+                    store(h, h1, nullptr, OPERATION_SET, key.c_str(),
+                          value.c_str(), nullptr, 0, ii % num_vbuckets),
+                    "Failed to store a value");
+        }
+        const hrtime_t drain_start = gethrtime();
+        load_time += drain_start - load_start;
+        start_persistence(h, h1);
+        wait_for_flusher_to_settle(h, h1);
+        round_timings.push_back((gethrtime() - drain_start) / 1000);
+    }
+    const double drain_secs = double(gethrtime() - start - load_time) / 1e9;
+    const int drained = get_int_stat(h, h1, "ep_diskqueue_drain") -
+                        drained_before;
+
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    all_timings.push_back(std::make_pair("Drain", &round_timings));
+    output_result(title,
+                  "Flusher drain time per round of " +
+                  std::to_string(num_docs / rounds) + " items (µs)",
+                  all_timings, "µs");
+    printf("  %-22s %8.0f items/s (ep_diskqueue_drain %d)\n",
+           "Drain rate", drained / drain_secs, drained);
+    printf("  %-22s p50 %d µs, p90 %d µs, p99 %d µs\n",
+           "Persistence latency",
+           get_int_stat(h, h1, "ep_persistence_latency_p50"),
+           get_int_stat(h, h1, "ep_persistence_latency_p90"),
+           get_int_stat(h, h1, "ep_persistence_latency_p99"));
+    return SUCCESS;
+}
+
+static enum test_result perf_flusher_drain_baseline(ENGINE_HANDLE *h,
+                                                    ENGINE_HANDLE_V1 *h1) {
+    return perf_flusher_drain(h, h1, "Flusher drain");
+}
+
+static enum test_result perf_flusher_drain_pipelined(ENGINE_HANDLE *h,
+                                                     ENGINE_HANDLE_V1 *h1) {
+    return perf_flusher_drain(h, h1, "Pipelined flusher drain");
+}
+
+static enum test_result perf_flusher_drain_group_commit(ENGINE_HANDLE *h,
+                                                        ENGINE_HANDLE_V1 *h1) {
+    return perf_flusher_drain(h, h1, "Group commit flusher drain");
+}
+
 class ThreadArguments {
 public:
     void reserve(int n) {
@@ -1414,6 +1752,51 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209",
                  prepare, cleanup),
+        TestCase("Fingerprint hash table latency",
+                 perf_latency_fingerprint_ht,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;ht_layout=fingerprint",
+                 prepare, cleanup),
+        TestCase("Slab allocated StoredValue latency",
+                 perf_latency_slab_allocator,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;ht_slab_allocator=true",
+                 prepare, cleanup),
+        TestCase("Inline value latency",
+                 perf_latency_inline_values,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;ht_inline_value_size=64",
+                 prepare, cleanup),
+        TestCase("Read scaling latency", perf_read_scaling_locked,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+        TestCase("Optimistic read scaling latency",
+                 perf_read_scaling_optimistic,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;ht_optimistic_reads=true",
+                 prepare, cleanup),
+        TestCase("Checkpoint queue", perf_checkpoint_queue,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+        TestCase("Bloom filter lookup", perf_bloomfilter_lookup,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+        TestCase("Flusher drain", perf_flusher_drain_baseline,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+        TestCase("Pipelined flusher drain", perf_flusher_drain_pipelined,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;flusher_pipelining=true",
+                 prepare, cleanup),
+        TestCase("Group commit flusher drain", perf_flusher_drain_group_commit,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;"
+                 "flusher_group_commit_latency=10",
+                 prepare, cleanup),
         TestCase("Defragmenter latency", perf_latency_defragmenter,
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209"
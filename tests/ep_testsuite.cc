@@ -792,6 +792,58 @@ static enum test_result test_expiry_pager_settings(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_expiry_pager_index(ENGINE_HANDLE *h,
+                                                ENGINE_HANDLE_V1 *h1) {
+    // Items without an expiry time aren't indexed.
+    for (int i = 0; i < 10; i++) {
+        item *it = nullptr;
+        std::string key("no_ttl_" + std::to_string(i));
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, nullptr, OPERATION_SET, key.c_str(), "value",
+                      &it, 0, 0, 0),
+                "Failed to store an item without a TTL");
+        h1->release(h, nullptr, it);
+    }
+    checkeq(0, get_int_stat(h, h1, "ep_expiry_index_size"),
+            "Items without a TTL shouldn't be indexed");
+
+    for (int i = 0; i < 5; i++) {
+        item *it = nullptr;
+        std::string key("ttl_" + std::to_string(i));
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, nullptr, OPERATION_SET, key.c_str(), "value",
+                      &it, 0, 0, 10),
+                "Failed to store an item with a TTL");
+        h1->release(h, nullptr, it);
+    }
+    checkeq(5, get_int_stat(h, h1, "ep_expiry_index_size"),
+            "Items with a TTL should be indexed");
+
+    checkeq(ENGINE_SUCCESS, del(h, h1, "ttl_0", 0, 0),
+            "Failed to delete an item with a TTL");
+    checkeq(4, get_int_stat(h, h1, "ep_expiry_index_size"),
+            "Deleted item should be removed from the index");
+    wait_for_flusher_to_settle(h, h1);
+
+    testHarness.time_travel(15);
+    set_param(h, h1, protocol_binary_engine_param_flush,
+              "exp_pager_stime", "1");
+    set_param(h, h1, protocol_binary_engine_param_flush,
+              "exp_pager_enabled", "true");
+    wait_for_stat_to_be(h, h1, "ep_expired_pager", 4);
+    checkeq(0, get_int_stat(h, h1, "ep_expiry_index_size"),
+            "Expired items should be removed from the index");
+    wait_for_stat_to_be(h, h1, "curr_items", 10);
+
+    // Later runs have nothing to visit.
+    int runs = get_int_stat(h, h1, "ep_num_expiry_pager_runs");
+    wait_for_stat_to_be_gte(h, h1, "ep_num_expiry_pager_runs", runs + 2);
+    checkeq(0, get_int_stat(h, h1, "ep_expiry_pager_last_visited"),
+            "Expiry pager shouldn't visit items which aren't due");
+
+    return SUCCESS;
+}
+
 static enum test_result test_expiry_with_xattr(ENGINE_HANDLE* h,
                                                ENGINE_HANDLE_V1* h1) {
     const char* key = "test_expiry";
@@ -2669,6 +2721,129 @@ static enum test_result test_bloomfilter_delete_plus_set_scenario(
     return SUCCESS;
 }
 
+static enum test_result test_counting_bloomfilter_removes_purged_keys(
+                                       ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    checkeq(std::string("counting"), get_str_stat(h, h1, "ep_bfilter_type"),
+            "Expected a counting bloom filter");
+
+    // Store 10 items and delete 5 of them; the deleted keys are added to
+    // the filter in either eviction mode.
+    item *it = NULL;
+    for (int i = 0; i < 10; ++i) {
+        std::string key("key-" + std::to_string(i));
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, NULL, OPERATION_SET, key.c_str(), "somevalue",
+                      &it),
+                "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+    for (int i = 0; i < 5; ++i) {
+        checkeq(ENGINE_SUCCESS,
+                del(h, h1, ("key-" + std::to_string(i)).c_str(), 0, 0),
+                "Failed remove with value.");
+    }
+    wait_for_flusher_to_settle(h, h1);
+    checkeq(5, get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                            "vbucket-details 0"),
+            "Unexpected number of keys in bloomfilter");
+
+    // Compaction purges all but the last delete, and removes their keys
+    // from the filter rather than rebuilding it.
+    useconds_t sleepTime = 128;
+    compact_db(h, h1, 0, 0, 15, 15, 1);
+    while (get_int_stat(h, h1, "ep_pending_compactions") != 0) {
+        decayingSleep(&sleepTime);
+    }
+    checkeq(std::string("ENABLED"),
+            get_str_stat(h, h1, "vb_0:bloom_filter", "vbucket-details 0"),
+            "Vbucket 0's bloom filter wasn't enabled after compaction");
+    checkeq(1, get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                            "vbucket-details 0"),
+            "Expected the purged keys to be removed from the bloomfilter");
+
+    // Only the key whose delete wasn't purged goes to disk.
+    int num_read_attempts = get_int_stat_or_default(h, h1, 0,
+                                                    "ep_bg_num_samples");
+    for (int i = 0; i < 5; ++i) {
+        checkeq(ENGINE_KEY_ENOENT,
+                get(h, h1, NULL, &it, "key-" + std::to_string(i), 0),
+                "Expected deleted key");
+    }
+    checkeq(num_read_attempts + 1,
+            get_int_stat_or_default(h, h1, 0, "ep_bg_num_samples"),
+            "Expected one bgFetch attempt");
+
+    return SUCCESS;
+}
+
+static enum test_result test_bloomfilter_restored_on_warmup(
+                                       ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    if (!isWarmupEnabled(h, h1)) {
+        return SKIPPED;
+    }
+
+    // Store 10 items, evicting half of them; under full eviction only the
+    // evicted keys are in the filter.
+    item *it = NULL;
+    for (int i = 0; i < 10; ++i) {
+        std::string key("key-" + std::to_string(i));
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, NULL, OPERATION_SET, key.c_str(), "somevalue",
+                      &it),
+                "Error setting.");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+    for (int i = 0; i < 5; ++i) {
+        evict_key(h, h1, ("key-" + std::to_string(i)).c_str(), 0,
+                  "Ejected.");
+    }
+    checkeq(5, get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                            "vbucket-details 0"),
+            "Unexpected number of keys in bloomfilter");
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    // The saved filter also holds the keys which were resident.
+    checkeq(1, get_int_stat(h, h1, "ep_warmup_bfilters_restored", "warmup"),
+            "Expected vb 0's bloom filter to be restored");
+    checkeq(std::string("ENABLED"),
+            get_str_stat(h, h1, "vb_0:bloom_filter", "vbucket-details 0"),
+            "Vbucket 0's bloom filter wasn't enabled after warmup");
+    checkeq(10, get_int_stat(h, h1, "vb_0:bloom_filter_key_count",
+                             "vbucket-details 0"),
+            "Unexpected number of keys in restored bloomfilter");
+
+    // Missing keys are ruled out without going to disk.
+    int num_read_attempts = get_int_stat_or_default(h, h1, 0,
+                                                    "ep_bg_num_samples");
+    for (int i = 0; i < 10; ++i) {
+        checkeq(ENGINE_KEY_ENOENT,
+                get(h, h1, NULL, &it, "missing-" + std::to_string(i), 0),
+                "Expected missing key");
+    }
+    checkeq(num_read_attempts,
+            get_int_stat_or_default(h, h1, 0, "ep_bg_num_samples"),
+            "Expected no bgFetch attempts");
+
+    // A second restart doesn't reuse the (consumed) file, and the filter
+    // isn't saved after an unclean shutdown.
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, true);
+    wait_for_warmup_complete(h, h1);
+    checkeq(0, get_int_stat(h, h1, "ep_warmup_bfilters_restored", "warmup"),
+            "Expected no bloom filter to be restored");
+
+    return SUCCESS;
+}
+
 static enum test_result test_datatype(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     const void *cookie = testHarness.create_cookie();
     testHarness.set_datatype_support(cookie, true);
@@ -6140,6 +6315,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         },
         {"dcp",
             {
+                "ep_dcp_backfills_disk",
+                "ep_dcp_backfills_memory",
                 "ep_dcp_count",
                 "ep_dcp_dead_conn_count",
                 "ep_dcp_items_remaining",
@@ -6156,13 +6333,21 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         {"hash",
             {
                 "vb_0:counted",
+                "vb_0:layout",
                 "vb_0:locks",
                 "vb_0:max_depth",
                 "vb_0:mem_size",
                 "vb_0:mem_size_counted",
                 "vb_0:min_depth",
+                "vb_0:overflow_buckets",
                 "vb_0:reported",
+                "vb_0:resize_buckets_remaining",
+                "vb_0:resize_in_progress",
+                "vb_0:resize_pause_max_us",
+                "vb_0:resize_pause_total_us",
+                "vb_0:resize_steps",
                 "vb_0:resized",
+                "vb_0:retired_bytes",
                 "vb_0:size",
                 "vb_0:state"
             }},
@@ -6298,10 +6483,15 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bfilter_enabled",
                 "ep_bfilter_fp_prob",
                 "ep_bfilter_key_count",
+                "ep_bfilter_persist",
                 "ep_bfilter_residency_threshold",
+                "ep_bfilter_type",
                 "ep_bg_fetch_delay",
+                "ep_bgfetcher_tasks_per_shard",
                 "ep_bucket_type",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
+                "ep_chk_max_size",
                 "ep_chk_period",
                 "ep_chk_remover_stime",
                 "ep_collections_prototype_enabled",
@@ -6311,11 +6501,16 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_conflict_resolution_type",
                 "ep_connection_manager_interval",
                 "ep_couch_bucket",
+                "ep_couchstore_db_handle_cache_size",
+                "ep_couchstore_io_uring",
+                "ep_cursor_dropping_checkpoint_mem_lower_mark",
+                "ep_cursor_dropping_checkpoint_mem_upper_mark",
                 "ep_cursor_dropping_lower_mark",
                 "ep_cursor_dropping_upper_mark",
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_in_memory",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6339,17 +6534,28 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_defragmenter_enabled",
                 "ep_defragmenter_interval",
                 "ep_enable_chk_merge",
+                "ep_ephemeral_metadata_purge_age",
+                "ep_ephemeral_metadata_purge_interval",
                 "ep_exp_pager_enabled",
+                "ep_exp_pager_index",
                 "ep_exp_pager_initial_run_time",
                 "ep_exp_pager_stime",
                 "ep_failpartialwarmup",
                 "ep_flushall_enabled",
+                "ep_flusher_batch_latency_target",
+                "ep_flusher_group_commit_latency",
+                "ep_flusher_pipelining",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_inline_value_size",
+                "ep_ht_layout",
                 "ep_ht_locks",
+                "ep_ht_optimistic_reads",
+                "ep_ht_resize_chunk_size",
                 "ep_ht_size",
+                "ep_ht_slab_allocator",
                 "ep_initfile",
                 "ep_item_eviction_policy",
                 "ep_item_num_based_new_chk",
@@ -6371,6 +6577,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_mem_low_wat",
                 "ep_mutation_mem_threshold",
                 "ep_pager_active_vb_pcnt",
+                "ep_pager_concurrency",
+                "ep_pager_eviction_policy",
                 "ep_postInitfile",
                 "ep_replication_throttle_cap_pcnt",
                 "ep_replication_throttle_queue_cap",
@@ -6460,17 +6668,23 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bfilter_enabled",
                 "ep_bfilter_fp_prob",
                 "ep_bfilter_key_count",
+                "ep_bfilter_persist",
                 "ep_bfilter_residency_threshold",
+                "ep_bfilter_type",
                 "ep_bg_fetch_delay",
                 "ep_bg_fetched",
                 "ep_bg_meta_fetched",
                 "ep_bg_remaining_items",
                 "ep_bg_remaining_jobs",
+                "ep_bgfetcher_tasks_per_shard",
                 "ep_blob_num",
                 "ep_blob_overhead",
                 "ep_bucket_priority",
                 "ep_bucket_type",
+                "ep_checkpoint_memory",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
+                "ep_chk_max_size",
                 "ep_chk_period",
                 "ep_chk_persistence_remains",
                 "ep_chk_persistence_timeout",
@@ -6483,6 +6697,12 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_conflict_resolution_type",
                 "ep_connection_manager_interval",
                 "ep_couch_bucket",
+                "ep_couchstore_db_handle_cache_size",
+                "ep_couchstore_io_uring",
+                "ep_cursor_dropping_checkpoint_mem_lower_mark",
+                "ep_cursor_dropping_checkpoint_mem_lower_threshold",
+                "ep_cursor_dropping_checkpoint_mem_upper_mark",
+                "ep_cursor_dropping_checkpoint_mem_upper_threshold",
                 "ep_cursor_dropping_lower_mark",
                 "ep_cursor_dropping_lower_threshold",
                 "ep_cursor_dropping_upper_mark",
@@ -6491,6 +6711,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_in_memory",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6522,23 +6743,37 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_diskqueue_memory",
                 "ep_diskqueue_pending",
                 "ep_enable_chk_merge",
+                "ep_ephemeral_metadata_purge_age",
+                "ep_ephemeral_metadata_purge_interval",
                 "ep_exp_pager_enabled",
+                "ep_exp_pager_index",
                 "ep_exp_pager_initial_run_time",
                 "ep_exp_pager_stime",
                 "ep_expired_access",
                 "ep_expired_compactor",
                 "ep_expired_pager",
+                "ep_expiry_index_size",
+                "ep_expiry_pager_last_expired",
+                "ep_expiry_pager_last_visited",
                 "ep_expiry_pager_task_time",
                 "ep_failpartialwarmup",
                 "ep_flush_all",
                 "ep_flush_duration_total",
                 "ep_flushall_enabled",
+                "ep_flusher_batch_latency_target",
+                "ep_flusher_group_commit_latency",
+                "ep_flusher_pipelining",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_inline_value_size",
+                "ep_ht_layout",
                 "ep_ht_locks",
+                "ep_ht_optimistic_reads",
+                "ep_ht_resize_chunk_size",
                 "ep_ht_size",
+                "ep_ht_slab_allocator",
                 "ep_initfile",
                 "ep_io_compaction_read_bytes",
                 "ep_io_compaction_write_bytes",
@@ -6547,6 +6782,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_item_eviction_policy",
                 "ep_item_num",
                 "ep_item_num_based_new_chk",
+                "ep_items_expelled_from_checkpoints",
                 "ep_items_rm_from_checkpoints",
                 "ep_keep_closed_chks",
                 "ep_kv_size",
@@ -6564,6 +6800,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_max_size",
                 "ep_max_threads",
                 "ep_max_vbuckets",
+                "ep_mem_freed_by_checkpoint_item_expel",
                 "ep_mem_high_wat",
                 "ep_mem_high_wat_percent",
                 "ep_mem_low_wat",
@@ -6593,6 +6830,9 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_oom_errors",
                 "ep_overhead",
                 "ep_pager_active_vb_pcnt",
+                "ep_pager_concurrency",
+                "ep_pager_eviction_policy",
+                "ep_pager_high_to_low_wat_time",
                 "ep_pending_compactions",
                 "ep_pending_ops",
                 "ep_pending_ops_max",
@@ -6738,10 +6978,15 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                          {"ep_commit_num",
                           "ep_commit_time",
                           "ep_commit_time_total",
+                          "ep_flush_batch_size",
+                          "ep_flush_batch_target_misses",
                           "ep_item_begin_failed",
                           "ep_item_commit_failed",
                           "ep_item_flush_expired",
                           "ep_item_flush_failed",
+                          "ep_persistence_latency_p50",
+                          "ep_persistence_latency_p90",
+                          "ep_persistence_latency_p99",
                           "ep_total_persisted",
                           "ep_uncommitted_items"});
 
@@ -6763,6 +7008,14 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         auto& vb_details = statsKeys.at("vbucket-details 0");
         vb_details.push_back("vb_0:db_data_size");
         vb_details.push_back("vb_0:db_file_size");
+    } else {
+        // Ephemeral buckets report on their seqno index instead.
+        auto& vb_details = statsKeys.at("vbucket-details 0");
+        vb_details.push_back("vb_0:seqlist_count");
+        vb_details.push_back("vb_0:seqlist_deleted_count");
+        vb_details.push_back("vb_0:seqlist_purged_count");
+        vb_details.push_back("vb_0:seqlist_range_read_count");
+        vb_details.push_back("vb_0:seqlist_stale_count");
     }
 
     if (isTapEnabled(h, h1)) {
@@ -7149,6 +7402,9 @@ BaseTestCase testsuite_testcases[] = {
         TestCase("expiry pager settings", test_expiry_pager_settings,
                  test_setup, teardown, "exp_pager_enabled=false",
                  prepare, cleanup),
+        TestCase("expiry pager index", test_expiry_pager_index,
+                 test_setup, teardown, "exp_pager_enabled=false",
+                 prepare, cleanup),
         TestCase("expiry", test_expiry, test_setup, teardown,
                  NULL, prepare, cleanup),
         TestCase("expiry with xattr", test_expiry_with_xattr,
@@ -7202,6 +7458,12 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("test item pager", test_item_pager, test_setup,
                  teardown, "max_size=6291456", prepare_ep_bucket, cleanup),
+        TestCase("test item pager (tinylfu)", test_item_pager, test_setup,
+                 teardown, "max_size=6291456;pager_eviction_policy=tinylfu",
+                 prepare_ep_bucket, cleanup),
+        TestCase("test item pager (single visitor)", test_item_pager,
+                 test_setup, teardown, "max_size=6291456;pager_concurrency=1",
+                 prepare_ep_bucket, cleanup),
         TestCase("warmup conf", test_warmup_conf, test_setup,
                  teardown, NULL, prepare, cleanup),
         TestCase("bloomfilter conf", test_bloomfilter_conf, test_setup,
@@ -7215,6 +7477,14 @@ BaseTestCase testsuite_testcases[] = {
         TestCase("test bloomfilters's in a delete+set scenario",
                  test_bloomfilter_delete_plus_set_scenario, test_setup,
                  teardown, NULL, prepare_ep_bucket, cleanup),
+        TestCase("test counting bloomfilter removes purged keys",
+                 test_counting_bloomfilter_removes_purged_keys, test_setup,
+                 teardown, "bfilter_type=counting", prepare_ep_bucket,
+                 cleanup),
+        TestCase("test bloomfilter restored on warmup",
+                 test_bloomfilter_restored_on_warmup, test_setup, teardown,
+                 "item_eviction_policy=full_eviction", prepare_full_eviction,
+                 cleanup),
         TestCase("test datatype", test_datatype, test_setup,
                  teardown, NULL, prepare, cleanup),
         TestCase("test datatype with unknown command", test_datatype_with_unknown_command,
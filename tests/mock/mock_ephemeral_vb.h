@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Mock of the EphemeralVBucket class. Provides access to the protected
+ * functions which set and delete items with them queued (and so added to
+ * the sequence list), as a front-end operation would.
+ */
+#pragma once
+
+#include "config.h"
+#include "ephemeral_vb.h"
+
+class MockEphemeralVBucket : public EphemeralVBucket {
+public:
+    MockEphemeralVBucket(id_type i,
+                         vbucket_state_t newState,
+                         EPStats& st,
+                         CheckpointConfig& chkConfig,
+                         Configuration& config)
+        : EphemeralVBucket(i,
+                           newState,
+                           st,
+                           chkConfig,
+                           /*kvshard*/ nullptr,
+                           /*lastSeqno*/ 0,
+                           /*lastSnapStart*/ 0,
+                           /*lastSnapEnd*/ 0,
+                           /*table*/ nullptr,
+                           /*newSeqnoCb*/ nullptr,
+                           config,
+                           VALUE_ONLY) {
+    }
+
+    MutationStatus public_processSet(Item& itm, const uint64_t cas) {
+        int bucket_num(0);
+        auto lh = ht.getLockedBucket(itm.getKey(), &bucket_num);
+        StoredValue* v =
+                ht.unlocked_find(itm.getKey(), bucket_num, true, false);
+        VBQueueItemCtx queueItmCtx(GenerateBySeqno::Yes,
+                                   GenerateCas::Yes,
+                                   TrackCasDrift::No,
+                                   /*isBackfillItem*/ false);
+        return processSet(lh, v, itm, cas, true, false, &queueItmCtx).first;
+    }
+
+    MutationStatus public_softDelete(const DocKey& key) {
+        int bucket_num(0);
+        auto lh = ht.getLockedBucket(key, &bucket_num);
+        StoredValue* v = ht.unlocked_find(key, bucket_num, false, false);
+        if (!v) {
+            return MutationStatus::NotFound;
+        }
+        MutationStatus status = processSoftDelete(lh, *v, 0);
+        queueDirty(*v,
+                   GenerateBySeqno::Yes,
+                   GenerateCas::Yes,
+                   /*isBackfillItem*/ false);
+        return status;
+    }
+
+    bool public_deleteStoredValue(const DocKey& key) {
+        int bucket_num(0);
+        HashTable::HashBucketLock lh = ht.getLockedBucket(key, &bucket_num);
+        StoredValue* v = ht.unlocked_find(key,
+                                          bucket_num,
+                                          /*wantsDeleted*/ true,
+                                          /*trackReference*/ false);
+        if (!v) {
+            return false;
+        }
+        return deleteStoredValue(lh, *v, bucket_num);
+    }
+};
@@ -97,7 +97,7 @@ public:
 
     bool public_deleteStoredValue(const DocKey& key) {
         int bucket_num(0);
-        std::unique_lock<std::mutex> lh = ht.getLockedBucket(key, &bucket_num);
+        HashTable::HashBucketLock lh = ht.getLockedBucket(key, &bucket_num);
         StoredValue* v = ht.unlocked_find(key,
                                           bucket_num,
                                           /*wantsDeleted*/ true,
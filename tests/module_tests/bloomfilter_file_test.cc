@@ -0,0 +1,96 @@
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "bloomfilter_file.h"
+#include "makestoreddockey.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+
+class BloomFilterFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        filter = BloomFilter::create(BloomFilter::Type::Standard, 1000, 0.01,
+                                     BFILTER_ENABLED);
+        filter->addKey(makeStoredDocKey("key"));
+    }
+
+    void TearDown() override {
+        std::remove(path.c_str());
+    }
+
+    const std::string path = "bloomfilter_file_test.bloomfilter";
+    std::unique_ptr<BloomFilter> filter;
+};
+
+TEST_F(BloomFilterFileTest, GetPath) {
+    EXPECT_EQ("/data/12.bloomfilter", BloomFilterFile::getPath("/data", 12));
+}
+
+TEST_F(BloomFilterFileTest, SaveAndLoad) {
+    ASSERT_TRUE(BloomFilterFile::save(path, *filter, 1234, 56));
+
+    auto loaded = BloomFilterFile::load(path, 1234, 56);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(BFILTER_ENABLED, loaded->getStatus());
+    EXPECT_EQ(1, loaded->getNumOfKeysInFilter());
+    EXPECT_TRUE(loaded->maybeKeyExists(makeStoredDocKey("key")));
+    EXPECT_FALSE(loaded->maybeKeyExists(makeStoredDocKey("other")));
+}
+
+// A file saved at a different UUID or seqno to the vbucket's may be missing
+// keys, so isn't loaded.
+TEST_F(BloomFilterFileTest, OutOfDate) {
+    ASSERT_TRUE(BloomFilterFile::save(path, *filter, 1234, 56));
+    EXPECT_FALSE(BloomFilterFile::load(path, 1234, 57));
+    EXPECT_FALSE(BloomFilterFile::load(path, 1235, 56));
+}
+
+TEST_F(BloomFilterFileTest, Missing) {
+    EXPECT_FALSE(BloomFilterFile::load(path, 1234, 56));
+
+    ASSERT_TRUE(BloomFilterFile::save(path, *filter, 1234, 56));
+    BloomFilterFile::remove(path);
+    EXPECT_FALSE(BloomFilterFile::load(path, 1234, 56));
+}
+
+TEST_F(BloomFilterFileTest, Corrupt) {
+    ASSERT_TRUE(BloomFilterFile::save(path, *filter, 1234, 56));
+    std::string data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+    }
+
+    // Flip a bit of the filter.
+    {
+        std::string corrupt = data;
+        corrupt.back() ^= 1;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << corrupt;
+    }
+    EXPECT_FALSE(BloomFilterFile::load(path, 1234, 56));
+
+    // Truncate it.
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << data.substr(0, data.size() - 1);
+    }
+    EXPECT_FALSE(BloomFilterFile::load(path, 1234, 56));
+}
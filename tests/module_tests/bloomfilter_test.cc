@@ -91,3 +91,260 @@ INSTANTIATE_TEST_CASE_P(
         BloomFilterDocKeyTest,
         ::testing::Combine(::testing::ValuesIn(allDocNamespaces),
                            ::testing::ValuesIn(allDocNamespaces)), );
+
+/*
+ * Tests run against each type of filter.
+ */
+class BloomFilterTypeTest
+        : public ::testing::TestWithParam<BloomFilter::Type> {
+protected:
+    std::unique_ptr<BloomFilter> createFilter(bfilter_status_t status =
+                                                      BFILTER_ENABLED) {
+        return BloomFilter::create(GetParam(), 10000, 0.01, status);
+    }
+};
+
+TEST_P(BloomFilterTypeTest, check_namespaces) {
+    auto filter = createFilter();
+    filter->addKey(StoredDocKey("key", DocNamespace::DefaultCollection));
+    EXPECT_EQ(1, filter->getNumOfKeysInFilter());
+    EXPECT_TRUE(filter->maybeKeyExists(
+            StoredDocKey("key", DocNamespace::DefaultCollection)));
+    EXPECT_FALSE(filter->maybeKeyExists(
+            StoredDocKey("key", DocNamespace::Collections)));
+    EXPECT_FALSE(filter->maybeKeyExists(
+            StoredDocKey("key", DocNamespace::System)));
+
+    // Adding the same key again doesn't count it twice.
+    filter->addKey(StoredDocKey("key", DocNamespace::DefaultCollection));
+    EXPECT_EQ(1, filter->getNumOfKeysInFilter());
+}
+
+TEST_P(BloomFilterTypeTest, check_status) {
+    auto filter = createFilter(BFILTER_DISABLED);
+    auto key = StoredDocKey("key", DocNamespace::DefaultCollection);
+
+    // A disabled filter neither records keys nor rules them out.
+    filter->addKey(key);
+    EXPECT_EQ(0, filter->getNumOfKeysInFilter());
+    EXPECT_EQ(0, filter->getFilterSize());
+    EXPECT_TRUE(filter->maybeKeyExists(
+            StoredDocKey("other", DocNamespace::DefaultCollection)));
+
+    filter->setStatus(BFILTER_ENABLED);
+    filter->setStatus(BFILTER_COMPACTING);
+    filter->addKey(key);
+    EXPECT_EQ(1, filter->getNumOfKeysInFilter());
+    EXPECT_NE(0, filter->getFilterSize());
+
+    // Disabling clears the filter.
+    filter->setStatus(BFILTER_DISABLED);
+    filter->setStatus(BFILTER_ENABLED);
+    filter->setStatus(BFILTER_COMPACTING);
+    EXPECT_FALSE(filter->maybeKeyExists(key));
+}
+
+TEST_P(BloomFilterTypeTest, no_false_negatives) {
+    auto filter = createFilter();
+    for (int i = 0; i < 10000; i++) {
+        filter->addKey(makeStoredDocKey("key_" + std::to_string(i)));
+    }
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_TRUE(filter->maybeKeyExists(
+                makeStoredDocKey("key_" + std::to_string(i))));
+    }
+}
+
+/*
+ * Fill a filter to its estimated key count and check the false positive
+ * rate is close to the requested probability.
+ */
+TEST_P(BloomFilterTypeTest, false_positive_rate) {
+    auto filter = createFilter();
+    for (int i = 0; i < 10000; i++) {
+        filter->addKey(makeStoredDocKey("key_" + std::to_string(i)));
+    }
+
+    const int lookups = 100000;
+    int falsePositives = 0;
+    for (int i = 0; i < lookups; i++) {
+        if (filter->maybeKeyExists(
+                    makeStoredDocKey("missing_" + std::to_string(i)))) {
+            falsePositives++;
+        }
+    }
+    EXPECT_LT(double(falsePositives) / lookups, 0.02);
+}
+
+TEST_P(BloomFilterTypeTest, serialise) {
+    auto filter = createFilter();
+    for (int i = 0; i < 100; i++) {
+        filter->addKey(makeStoredDocKey("key_" + std::to_string(i)));
+    }
+
+    auto copy = BloomFilter::deserialise(filter->serialise());
+    EXPECT_EQ(GetParam(), copy->getType());
+    EXPECT_EQ(BFILTER_ENABLED, copy->getStatus());
+    EXPECT_EQ(filter->getFilterSize(), copy->getFilterSize());
+    EXPECT_EQ(filter->getNumOfKeysInFilter(), copy->getNumOfKeysInFilter());
+    EXPECT_EQ(filter->serialise(), copy->serialise());
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(copy->maybeKeyExists(
+                makeStoredDocKey("key_" + std::to_string(i))));
+    }
+
+    // Truncated or corrupt data is rejected.
+    std::string data = filter->serialise();
+    EXPECT_THROW(BloomFilter::deserialise(data.substr(0, data.size() - 1)),
+                 std::invalid_argument);
+    data[0] = ~data[0];
+    EXPECT_THROW(BloomFilter::deserialise(data), std::invalid_argument);
+}
+
+TEST_P(BloomFilterTypeTest, clone_and_merge) {
+    auto filter = createFilter();
+    auto key1 = makeStoredDocKey("key1");
+    auto key2 = makeStoredDocKey("key2");
+    filter->addKey(key1);
+
+    // The clone is independent of the original.
+    auto clone = filter->clone();
+    clone->addKey(key2);
+    EXPECT_TRUE(clone->maybeKeyExists(key1));
+    EXPECT_TRUE(clone->maybeKeyExists(key2));
+    EXPECT_FALSE(filter->maybeKeyExists(key2));
+
+    auto other = createFilter();
+    other->addKey(key2);
+    filter->merge(*other);
+    EXPECT_TRUE(filter->maybeKeyExists(key1));
+    EXPECT_TRUE(filter->maybeKeyExists(key2));
+
+    // Filters of a different type or size can't be merged.
+    auto smaller = BloomFilter::create(GetParam(), 1000, 0.01,
+                                       BFILTER_ENABLED);
+    EXPECT_THROW(filter->merge(*smaller), std::invalid_argument);
+    auto otherType = BloomFilter::create(
+            GetParam() == BloomFilter::Type::Standard
+                    ? BloomFilter::Type::Blocked
+                    : BloomFilter::Type::Standard,
+            10000, 0.01, BFILTER_ENABLED);
+    EXPECT_THROW(filter->merge(*otherType), std::invalid_argument);
+
+    // An empty clone keeps the type and size, but not the keys.
+    auto empty = filter->cloneEmpty();
+    EXPECT_EQ(GetParam(), empty->getType());
+    EXPECT_EQ(filter->getFilterSize(), empty->getFilterSize());
+    EXPECT_EQ(0, empty->getNumOfKeysInFilter());
+    EXPECT_FALSE(empty->maybeKeyExists(key1));
+    empty->merge(*filter);
+    EXPECT_TRUE(empty->maybeKeyExists(key1));
+}
+
+TEST_P(BloomFilterTypeTest, removeKey) {
+    auto filter = createFilter();
+    auto key = makeStoredDocKey("key");
+    filter->addKey(key);
+    EXPECT_EQ(filter->supportsRemoval(), filter->removeKey(key));
+    EXPECT_NE(filter->supportsRemoval(), filter->maybeKeyExists(key));
+}
+
+TEST_P(BloomFilterTypeTest, getKeyCapacity) {
+    // The capacity is about the key count the filter was created for.
+    auto filter = createFilter();
+    EXPECT_GT(filter->getKeyCapacity(), 9000);
+    EXPECT_LT(filter->getKeyCapacity(), 11000);
+}
+
+INSTANTIATE_TEST_CASE_P(
+        Types,
+        BloomFilterTypeTest,
+        ::testing::Values(BloomFilter::Type::Standard,
+                          BloomFilter::Type::Blocked,
+                          BloomFilter::Type::Counting),
+        [](const ::testing::TestParamInfo<BloomFilter::Type>& info) {
+            return std::string(BloomFilter::typeToString(info.param));
+        });
+
+TEST(BloomFilterTest, typeFromString) {
+    EXPECT_EQ(BloomFilter::Type::Standard,
+              BloomFilter::typeFromString("standard"));
+    EXPECT_EQ(BloomFilter::Type::Blocked,
+              BloomFilter::typeFromString("blocked"));
+    EXPECT_EQ(BloomFilter::Type::Counting,
+              BloomFilter::typeFromString("counting"));
+    EXPECT_THROW(BloomFilter::typeFromString("unknown"),
+                 std::invalid_argument);
+}
+
+/*
+ * Removing keys leaves the remaining keys in the filter, and the filter
+ * about as accurate as if the removed keys had never been added.
+ */
+TEST(CountingBloomFilterTest, removeKeys) {
+    CountingBloomFilter filter(10000, 0.01, BFILTER_ENABLED);
+    for (int i = 0; i < 20000; i++) {
+        filter.addKey(makeStoredDocKey("key_" + std::to_string(i)));
+    }
+    for (int i = 0; i < 20000; i += 2) {
+        EXPECT_TRUE(filter.removeKey(
+                makeStoredDocKey("key_" + std::to_string(i))));
+    }
+
+    int removedFound = 0;
+    for (int i = 0; i < 20000; i++) {
+        auto key = makeStoredDocKey("key_" + std::to_string(i));
+        if (i % 2) {
+            EXPECT_TRUE(filter.maybeKeyExists(key));
+        } else if (filter.maybeKeyExists(key)) {
+            removedFound++;
+        }
+    }
+    EXPECT_LT(double(removedFound) / 10000, 0.02);
+    EXPECT_LE(filter.getNumOfKeysInFilter(), 10000);
+    EXPECT_GT(filter.getNumOfKeysInFilter(), 9000);
+}
+
+TEST(CountingBloomFilterTest, removeAbsentKey) {
+    CountingBloomFilter filter(10000, 0.01, BFILTER_ENABLED);
+    auto key = makeStoredDocKey("key");
+    EXPECT_FALSE(filter.removeKey(key));
+    filter.addKey(key);
+    EXPECT_FALSE(filter.removeKey(makeStoredDocKey("other")));
+    EXPECT_TRUE(filter.maybeKeyExists(key));
+
+    // Nothing is removed while the filter is disabled.
+    filter.setStatus(BFILTER_DISABLED);
+    EXPECT_FALSE(filter.removeKey(key));
+}
+
+TEST(CountingBloomFilterTest, saturation) {
+    CountingBloomFilter filter(10000, 0.01, BFILTER_ENABLED);
+    auto key = makeStoredDocKey("key");
+    const int adds = CountingBloomFilter::maxCount + 5;
+    for (int i = 0; i < adds; i++) {
+        filter.addKey(key);
+    }
+
+    // The key's counters stuck at their maximum, so it can't be removed by
+    // as many removals as additions.
+    for (int i = 0; i < adds; i++) {
+        EXPECT_TRUE(filter.removeKey(key));
+    }
+    EXPECT_TRUE(filter.maybeKeyExists(key));
+}
+
+TEST(CountingBloomFilterTest, merge) {
+    CountingBloomFilter filter(10000, 0.01, BFILTER_ENABLED);
+    CountingBloomFilter other(10000, 0.01, BFILTER_ENABLED);
+    auto key = makeStoredDocKey("key");
+    filter.addKey(key);
+    other.addKey(key);
+
+    // The counts are added, so the key takes two removals.
+    filter.merge(other);
+    EXPECT_TRUE(filter.removeKey(key));
+    EXPECT_TRUE(filter.maybeKeyExists(key));
+    EXPECT_TRUE(filter.removeKey(key));
+    EXPECT_FALSE(filter.maybeKeyExists(key));
+}
@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "checkpoint_index.h"
+#include "makestoreddockey.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+class CheckpointIndexTest : public ::testing::Test {
+protected:
+    /// Queue an item for the given key and add it to the index.
+    void queueAndIndex(const std::string& key, int64_t seqno) {
+        const auto docKey = makeStoredDocKey(key);
+        queue.push_back(queued_item(new Item(docKey, 0, 0, "x", 1)));
+        index.insert(docKey, {std::prev(queue.end()), seqno});
+    }
+
+    CheckpointQueue queue;
+    CheckpointIndex index;
+};
+
+TEST_F(CheckpointIndexTest, InsertAndFind) {
+    EXPECT_EQ(nullptr, index.find(makeStoredDocKey("key")));
+    EXPECT_EQ(0, index.getMemoryUsage());
+
+    const int n = 1000;
+    for (int ii = 0; ii < n; ++ii) {
+        queueAndIndex("key_" + std::to_string(ii), ii);
+    }
+    EXPECT_EQ(n, index.size());
+
+    for (int ii = 0; ii < n; ++ii) {
+        const auto key = makeStoredDocKey("key_" + std::to_string(ii));
+        const index_entry* entry = index.find(key);
+        ASSERT_NE(nullptr, entry);
+        EXPECT_EQ(ii, entry->mutation_id);
+        EXPECT_EQ(key, (*entry->position)->getKey());
+    }
+    EXPECT_EQ(nullptr, index.find(makeStoredDocKey("key_" +
+                                                   std::to_string(n))));
+
+    // The same key in another namespace is a different key.
+    EXPECT_EQ(nullptr,
+              index.find(StoredDocKey("key_0", DocNamespace::Collections)));
+
+    EXPECT_THROW(index.insert(makeStoredDocKey("key_0"),
+                              {queue.begin(), 0}),
+                 std::logic_error);
+}
+
+// Entries stay findable when others sharing their probe sequence are
+// erased.
+TEST_F(CheckpointIndexTest, Erase) {
+    const int n = 1000;
+    for (int ii = 0; ii < n; ++ii) {
+        queueAndIndex("key_" + std::to_string(ii), ii);
+    }
+    const size_t memory = index.getMemoryUsage();
+
+    for (int ii = 0; ii < n; ii += 2) {
+        EXPECT_TRUE(index.erase(makeStoredDocKey("key_" +
+                                                 std::to_string(ii))));
+    }
+    EXPECT_FALSE(index.erase(makeStoredDocKey("key_0")));
+    EXPECT_EQ(n / 2, index.size());
+    EXPECT_EQ(memory, index.getMemoryUsage());
+
+    for (int ii = 0; ii < n; ++ii) {
+        const index_entry* entry =
+                index.find(makeStoredDocKey("key_" + std::to_string(ii)));
+        if (ii % 2 == 0) {
+            EXPECT_EQ(nullptr, entry);
+        } else {
+            ASSERT_NE(nullptr, entry);
+            EXPECT_EQ(ii, entry->mutation_id);
+        }
+    }
+}
+
+TEST_F(CheckpointIndexTest, Set) {
+    queueAndIndex("key", 1);
+    const auto key = makeStoredDocKey("key");
+
+    // Re-queue the key, updating the entry before removing the old item.
+    auto old = index.find(key)->position;
+    queue.push_back(queued_item(new Item(key, 0, 0, "y", 1)));
+    index.set(key, {std::prev(queue.end()), 2});
+    queue.erase(old);
+
+    EXPECT_EQ(1, index.size());
+    EXPECT_EQ(2, index.find(key)->mutation_id);
+}
@@ -379,7 +379,8 @@ TYPED_TEST(CheckpointTest, CheckFixture) {
     EXPECT_EQ(1, this->manager->getNumOfCursors());
     EXPECT_EQ(1, this->manager->getNumOpenChkItems());
     for (auto& cursor : this->manager->getAllCursors()) {
-        EXPECT_EQ(CheckpointManager::pCursorName, cursor.first);
+        EXPECT_EQ(CheckpointManager::pCursorId, cursor.id);
+        EXPECT_EQ(CheckpointManager::pCursorName, cursor.name);
     }
     // Should initially be zero items to persist.
     EXPECT_EQ(0,
@@ -556,7 +557,8 @@ TYPED_TEST(CheckpointTest, ItemBasedCheckpointCreation) {
                                                /*itemBased*/ true,
                                                /*keepClosed*/ false,
                                                /*enableMerge*/ false,
-                                               /*persistenceEnabled*/ true);
+                                               /*persistenceEnabled*/ true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
     // TODO: ^^ Consider a variant for Ephemeral testing -
     // persistenceEnabled:false
 
@@ -628,6 +630,106 @@ TYPED_TEST(CheckpointTest, ItemBasedCheckpointCreation) {
             this->manager->getNumOpenChkItems()); // 1x op_ckpt_start, 1x op_set
 }
 
+// Test the automatic creation of checkpoints based on the memory used by
+// their items.
+TYPED_TEST(CheckpointTest, SizeBasedCheckpointCreation) {
+    const size_t maxSize = 1024;
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MAX_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 2,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true,
+                                               maxSize);
+    this->createManager();
+
+    // Re-queueing the same key replaces the existing item, so the memory
+    // used doesn't grow.
+    EXPECT_TRUE(this->queueNewItem("key"));
+    const size_t memUsage = this->manager->getMemoryUsage();
+    EXPECT_LT(memUsage, maxSize);
+    for (int ii = 0; ii < 100; ++ii) {
+        EXPECT_FALSE(this->queueNewItem("key"));
+    }
+    EXPECT_EQ(memUsage, this->manager->getMemoryUsage());
+    EXPECT_EQ(memUsage, this->global_stats.checkpointMemUsage->load());
+    EXPECT_EQ(1, this->manager->getNumCheckpoints());
+
+    // Queue new keys until the checkpoint's items reach the max size; the
+    // next item queued is then added to a new checkpoint.
+    int ii = 0;
+    while (this->manager->getMemoryUsage() < maxSize) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii++)));
+        EXPECT_EQ(1, this->manager->getNumCheckpoints());
+    }
+    EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    EXPECT_EQ(2, this->manager->getNumCheckpoints());
+    EXPECT_EQ(2, this->manager->getNumOpenChkItems());
+
+    // Checkpoint memory is released along with the checkpoints.
+    this->manager.reset();
+    EXPECT_EQ(0, this->global_stats.checkpointMemUsage->load());
+}
+
+// Test that the items merged into a checkpoint when a replica collapses its
+// closed checkpoints count towards checkpoint memory, and that only the
+// older revisions de-duplicated by the merge are released.
+TYPED_TEST(CheckpointTest, CheckpointMemUsageAfterMerge) {
+    this->vbucket->setState(vbucket_state_replica);
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MIN_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 2,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ true,
+                                               /*persistenceEnabled*/ true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
+    this->createManager();
+
+    // A DCP cursor left in the first checkpoint keeps it from being removed.
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+    ASSERT_TRUE(this->queueNewItem("key0"));
+    ASSERT_TRUE(this->queueNewItem("key1"));
+    bool isLastMutationItem;
+    this->manager->nextItem(dcp_cursor, isLastMutationItem);
+    this->manager->nextItem(dcp_cursor, isLastMutationItem);
+
+    // key1 is queued again in the second checkpoint.
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(3, items.size());
+    const size_t oldKey1Size = items[2]->size();
+    EXPECT_EQ(2, this->manager->createNewCheckpoint());
+    ASSERT_TRUE(this->queueNewItem("key1"));
+    ASSERT_TRUE(this->queueNewItem("key2"));
+
+    // Move the persistence cursor into a third checkpoint.
+    EXPECT_EQ(3, this->manager->createNewCheckpoint());
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    const size_t memUsage = this->manager->getMemoryUsage();
+    EXPECT_EQ(memUsage, this->global_stats.checkpointMemUsage->load());
+
+    // The first checkpoint is merged into the second; key0 is carried
+    // over, the old key1 is dropped.
+    bool newCheckpointCreated;
+    this->manager->removeClosedUnrefCheckpoints(*this->vbucket,
+                                                newCheckpointCreated);
+    EXPECT_EQ(2, this->manager->getNumCheckpoints());
+    EXPECT_EQ(memUsage - oldKey1Size, this->manager->getMemoryUsage());
+    EXPECT_EQ(memUsage - oldKey1Size,
+              this->global_stats.checkpointMemUsage->load());
+
+    items.clear();
+    this->manager->getAllItemsForCursor(dcp_cursor, items);
+    ASSERT_LE(2, items.size());
+    EXPECT_EQ(makeStoredDocKey("key1"), items[0]->getKey());
+    EXPECT_EQ(makeStoredDocKey("key2"), items[1]->getKey());
+}
+
 // Test checkpoint and cursor accounting - when checkpoints are closed the
 // offset of cursors is updated as appropriate.
 TYPED_TEST(CheckpointTest, CursorOffsetOnCheckpointClose) {
@@ -760,7 +862,8 @@ TYPED_TEST(CheckpointTest, ItemsForCheckpointCursor) {
                                                /*itemBased*/ true,
                                                /*keepClosed*/ false,
                                                /*enableMerge*/ false,
-                                               /*persistenceEnabled*/ true);
+                                               /*persistenceEnabled*/ true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
     // TODO: ^^ Consider a variant for Ephemeral testing -
     // persistenceEnabled:false
 
@@ -812,7 +915,8 @@ TYPED_TEST(CheckpointTest, CursorMovement) {
                                                /*itemBased*/ true,
                                                /*keepClosed*/ false,
                                                /*enableMerge*/ false,
-                                               /*persistenceEnabled*/true);
+                                               /*persistenceEnabled*/true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
     // TODO: ^^ Consider a variant for Ephemeral testing -
     // persistenceEnabled:false
 
@@ -924,7 +1028,8 @@ TYPED_TEST(CheckpointTest, CursorMovementReplicaMerge) {
                                                /*itemBased*/ true,
                                                /*keepClosed*/ false,
                                                /*enableMerge*/ true,
-                                               /*persistenceEnabled*/true);
+                                               /*persistenceEnabled*/true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
     // TODO: ^^ Consider a variant for Ephemeral testing -
     // persistenceEnabled:false
 
@@ -1051,7 +1156,8 @@ TYPED_TEST(CheckpointTest, SeqnoAndHLCOrdering) {
                                                /*itemBased*/ true,
                                                /*keepClosed*/ false,
                                                /*enableMerge*/ false,
-                                               /*persistenceEnabled*/true);
+                                               /*persistenceEnabled*/true,
+                                               DEFAULT_CHECKPOINT_MAX_SIZE);
     // TODO: ^^ Consider a variant for Ephemeral testing -
     // persistenceEnabled:false
 
@@ -1239,3 +1345,195 @@ TYPED_TEST(CheckpointTest,
     // Test - second item (duplicate key) should return false.
     EXPECT_FALSE(this->queueNewItem("key"));
 }
+
+// Test that the items every cursor has processed are expelled from the open
+// checkpoint, and that keys queued again afterwards are treated as new.
+TYPED_TEST(CheckpointTest, ExpelUnreferencedItems) {
+    for (int ii = 0; ii < 10; ++ii) {
+        ASSERT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    ASSERT_EQ(11, this->manager->getNumOpenChkItems());
+
+    // Nothing can be expelled until the persistence cursor has moved on.
+    auto result = this->manager->expelUnreferencedCheckpointItems();
+    EXPECT_EQ(0, result.numItems);
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(11, items.size());
+
+    // The item the cursor is on (key9) is kept.
+    const size_t memOverhead = this->global_stats.memOverhead->load();
+    result = this->manager->expelUnreferencedCheckpointItems();
+    EXPECT_EQ(9, result.numItems);
+    EXPECT_EQ(0, result.numMetaItems);
+    EXPECT_LT(0, result.memory);
+    EXPECT_EQ(memOverhead - 9 * sizeof(queued_item),
+              this->global_stats.memOverhead->load());
+    EXPECT_EQ(2, this->manager->getNumOpenChkItems());
+    EXPECT_EQ(0,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+
+    // Nothing more to expel.
+    result = this->manager->expelUnreferencedCheckpointItems();
+    EXPECT_EQ(0, result.numItems);
+
+    // An expelled key is a new item; the key the cursor is on is
+    // de-duplicated as before.
+    EXPECT_TRUE(this->queueNewItem("key0"));
+    EXPECT_TRUE(this->queueNewItem("key9"));
+    EXPECT_EQ(3, this->manager->getNumOpenChkItems());
+    EXPECT_EQ(2,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(2, items.size());
+    EXPECT_EQ(makeStoredDocKey("key0"), items[0]->getKey());
+    EXPECT_EQ(1011, items[0]->getBySeqno());
+    EXPECT_EQ(makeStoredDocKey("key9"), items[1]->getKey());
+    EXPECT_EQ(1012, items[1]->getBySeqno());
+}
+
+// Test that only the items before the slowest cursor are expelled, and that
+// a cursor registered within the expelled range is told to backfill.
+TYPED_TEST(CheckpointTest, ExpelUpToSlowestCursor) {
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+
+    for (int ii = 0; ii < 10; ++ii) {
+        ASSERT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+
+    // The DCP cursor hasn't read anything yet.
+    EXPECT_EQ(0, this->manager->expelUnreferencedCheckpointItems().numItems);
+
+    // Read checkpoint_start and key0..key3.
+    bool isLastMutationItem;
+    for (int ii = 0; ii < 5; ++ii) {
+        this->manager->nextItem(dcp_cursor, isLastMutationItem);
+    }
+    auto result = this->manager->expelUnreferencedCheckpointItems();
+    EXPECT_EQ(3, result.numItems);
+    EXPECT_EQ(8, this->manager->getNumOpenChkItems());
+    EXPECT_EQ(6, this->manager->getNumItemsForCursor(dcp_cursor));
+
+    // The DCP cursor carries on from key4.
+    queued_item qi = this->manager->nextItem(dcp_cursor, isLastMutationItem);
+    EXPECT_EQ(makeStoredDocKey("key4"), qi->getKey());
+
+    // key0..key2 (seqnos 1001..1003) are gone from the checkpoint, so a
+    // cursor starting before them needs a backfill...
+    const std::string dcp_cursor2(DCP_CURSOR_PREFIX + std::to_string(2));
+    auto reg = this->manager->registerCursorBySeqno(
+            dcp_cursor2, 1001, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(1004, reg.seqno);
+    EXPECT_TRUE(reg.tryBackfill);
+    EXPECT_EQ(1003, reg.highestExpelledSeqno);
+
+    // ...but one starting after them doesn't.
+    reg = this->manager->registerCursorBySeqno(
+            dcp_cursor2, 1003, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(1004, reg.seqno);
+    EXPECT_FALSE(reg.tryBackfill);
+}
+
+// Test that expelling a set_vbucket_state item doesn't remove the index
+// entry of a later one (they share a key), which a cursor positioned on
+// the later one needs when a duplicate key is queued.
+TYPED_TEST(CheckpointTest, ExpelMetaItemKeepsLaterIndexEntry) {
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+
+    this->manager->queueSetVBState(*this->vbucket);
+    this->manager->queueSetVBState(*this->vbucket);
+    ASSERT_TRUE(this->queueNewItem("key"));
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+
+    // Read checkpoint_start and both set_vbucket_states.
+    bool isLastMutationItem;
+    for (int ii = 0; ii < 3; ++ii) {
+        this->manager->nextItem(dcp_cursor, isLastMutationItem);
+    }
+    auto result = this->manager->expelUnreferencedCheckpointItems();
+    EXPECT_EQ(0, result.numItems);
+    EXPECT_EQ(1, result.numMetaItems);
+
+    // De-duplicating looks up the key of the item each cursor is on.
+    EXPECT_FALSE(this->queueNewItem("key"));
+    EXPECT_EQ(1, this->manager->getNumItemsForCursor(dcp_cursor));
+    queued_item qi = this->manager->nextItem(dcp_cursor, isLastMutationItem);
+    EXPECT_EQ(makeStoredDocKey("key"), qi->getKey());
+}
+
+// Cursors can be addressed by the id returned on registration, which is
+// kept when a cursor is re-registered.
+TYPED_TEST(CheckpointTest, CursorIds) {
+    for (unsigned int ii = 0; ii < 3; ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    auto reg = this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+    const CursorId id = reg.cursorId;
+    EXPECT_NE(CheckpointManager::invalidCursorId, id);
+    EXPECT_NE(CheckpointManager::pCursorId, id);
+
+    EXPECT_EQ(3, this->manager->getNumItemsForCursor(id));
+    EXPECT_EQ(this->manager->getNumItemsForCursor(dcp_cursor),
+              this->manager->getNumItemsForCursor(id));
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(id, items);
+    // op_ckpt_start + 3 items.
+    EXPECT_EQ(4, items.size());
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(id));
+
+    // Re-registering the same name keeps the id.
+    reg = this->manager->registerCursorBySeqno(
+            dcp_cursor, 1001, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(id, reg.cursorId);
+    EXPECT_EQ(2, this->manager->getNumOfCursors());
+
+    // A removed cursor's id is no longer valid.
+    EXPECT_TRUE(this->manager->removeCursor(id));
+    EXPECT_FALSE(this->manager->removeCursor(id));
+    EXPECT_FALSE(this->manager->removeCursor(dcp_cursor));
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(id));
+    EXPECT_EQ(1, this->manager->getNumOfCursors());
+}
+
+// Items can be fetched for a cursor in limited batches.
+TYPED_TEST(CheckpointTest, ItemsForCursorWithLimit) {
+    for (unsigned int ii = 0; ii < 10; ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+
+    std::vector<queued_item> items;
+    auto range = this->manager->getItemsForCursor(CheckpointManager::pCursorId,
+                                                  items, 4);
+    // op_ckpt_start + 3 items.
+    EXPECT_EQ(4, items.size());
+    EXPECT_EQ(7, this->manager->getNumItemsForCursor(
+            CheckpointManager::pCursorId));
+
+    // The remainder is fetched by the next call, with the same snapshot.
+    items.clear();
+    auto rest = this->manager->getAllItemsForCursor(
+            CheckpointManager::pCursorId, items);
+    EXPECT_EQ(7, items.size());
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(
+            CheckpointManager::pCursorId));
+    EXPECT_EQ(rest.start, range.start);
+    EXPECT_EQ(rest.end, range.end);
+    EXPECT_EQ(1010, items.back()->getBySeqno());
+}
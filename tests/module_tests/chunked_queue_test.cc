@@ -0,0 +1,157 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "chunked_queue.h"
+
+#include <memory>
+#include <vector>
+
+// Small chunks, so the tests cross chunk boundaries.
+using Queue = ChunkedQueue<std::shared_ptr<int>, 4>;
+
+static std::vector<int> contents(const Queue& q) {
+    std::vector<int> rv;
+    for (const auto& e : q) {
+        rv.push_back(*e);
+    }
+    return rv;
+}
+
+static std::vector<int> reverseContents(const Queue& q) {
+    std::vector<int> rv;
+    for (auto it = q.rbegin(); it != q.rend(); ++it) {
+        rv.push_back(**it);
+    }
+    return rv;
+}
+
+TEST(ChunkedQueueTest, PushAndIterate) {
+    Queue q;
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(q.begin(), q.end());
+
+    for (int ii = 0; ii < 10; ++ii) {
+        q.push_back(std::make_shared<int>(ii));
+    }
+    q.push_front(std::make_shared<int>(-1));
+    q.push_front(std::make_shared<int>(-2));
+
+    EXPECT_EQ(12, q.size());
+    EXPECT_EQ(4, q.getNumChunks());
+    EXPECT_EQ(-2, *q.front());
+    EXPECT_EQ(9, *q.back());
+    EXPECT_EQ(std::vector<int>({-2, -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9}),
+              contents(q));
+    EXPECT_EQ(std::vector<int>({9, 8, 7, 6, 5, 4, 3, 2, 1, 0, -1, -2}),
+              reverseContents(q));
+}
+
+// Erasing from the middle leaves every other iterator valid, and emptied
+// chunks are released.
+TEST(ChunkedQueueTest, EraseKeepsIteratorsStable) {
+    Queue q;
+    std::vector<Queue::iterator> its;
+    for (int ii = 0; ii < 12; ++ii) {
+        q.push_back(std::make_shared<int>(ii));
+        its.push_back(std::prev(q.end()));
+    }
+
+    // Erase the whole of the middle chunk and part of the others.
+    for (int ii : {4, 5, 6, 7, 2, 9}) {
+        q.erase(its[ii]);
+    }
+    EXPECT_EQ(6, q.size());
+    EXPECT_EQ(2, q.getNumChunks());
+    EXPECT_EQ(std::vector<int>({0, 1, 3, 8, 10, 11}), contents(q));
+    EXPECT_EQ(std::vector<int>({11, 10, 8, 3, 1, 0}), reverseContents(q));
+    for (int ii : {0, 1, 3, 8, 10, 11}) {
+        EXPECT_EQ(ii, **its[ii]);
+    }
+
+    // Step across the holes in both directions.
+    EXPECT_EQ(its[8], std::next(its[3]));
+    EXPECT_EQ(its[3], std::prev(its[8]));
+
+    // erase returns the following element.
+    EXPECT_EQ(its[10], q.erase(its[8]));
+    EXPECT_EQ(q.end(), q.erase(its[11]));
+    EXPECT_EQ(10, *q.back());
+}
+
+// end() is a fixed sentinel: an iterator at end() stays there as elements
+// are pushed, and stepping back from it reaches the new last element.
+TEST(ChunkedQueueTest, EndIsStable) {
+    Queue q;
+    q.push_back(std::make_shared<int>(0));
+    auto end = q.end();
+    for (int ii = 1; ii < 6; ++ii) {
+        q.push_back(std::make_shared<int>(ii));
+    }
+    EXPECT_EQ(q.end(), end);
+    EXPECT_EQ(5, **std::prev(end));
+}
+
+// A queue drained at the front as it is filled at the back reuses its
+// chunks rather than growing.
+TEST(ChunkedQueueTest, FifoReusesChunks) {
+    Queue q;
+    for (int ii = 0; ii < 8; ++ii) {
+        q.push_back(std::make_shared<int>(ii));
+    }
+    // One extra chunk is needed to move along into, after which the chunk
+    // emptied at the front is recycled at the back.
+    size_t memory = 0;
+    for (int ii = 8; ii < 1000; ++ii) {
+        q.pop_front();
+        q.push_back(std::make_shared<int>(ii));
+        EXPECT_LE(q.getNumChunks(), 3);
+        if (ii == 8) {
+            memory = q.getMemoryUsage();
+        }
+        EXPECT_EQ(memory, q.getMemoryUsage());
+    }
+    EXPECT_EQ(992, *q.front());
+    EXPECT_EQ(999, *q.back());
+}
+
+TEST(ChunkedQueueTest, PopToEmpty) {
+    Queue q;
+    for (int ii = 0; ii < 9; ++ii) {
+        q.push_back(std::make_shared<int>(ii));
+    }
+    while (!q.empty()) {
+        q.pop_back();
+    }
+    EXPECT_EQ(0, q.getNumChunks());
+    EXPECT_EQ(q.begin(), q.end());
+
+    // Usable again once emptied.
+    q.push_front(std::make_shared<int>(1));
+    q.push_back(std::make_shared<int>(2));
+    EXPECT_EQ(std::vector<int>({1, 2}), contents(q));
+
+    q.clear();
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(ChunkedQueueTest, RejectsEmptyValue) {
+    Queue q;
+    EXPECT_THROW(q.push_back(nullptr), std::invalid_argument);
+    EXPECT_TRUE(q.empty());
+}
@@ -0,0 +1,103 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fetch-planner.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using Range = FetchPlanner::Range;
+
+static const size_t block = FetchPlanner::blockSize;
+
+static DocInfo makeDocInfo(uint64_t bp, size_t size) {
+    DocInfo docinfo = {};
+    docinfo.bp = bp;
+    docinfo.size = size;
+    return docinfo;
+}
+
+TEST(FetchPlannerTest, SortByOffset) {
+    DocInfo a = makeDocInfo(300, 1);
+    DocInfo b = makeDocInfo(100, 1);
+    DocInfo c = makeDocInfo(200, 1);
+    std::vector<DocInfo*> docinfos = {&a, &b, &c};
+
+    FetchPlanner::sortByOffset(docinfos);
+    EXPECT_EQ((std::vector<DocInfo*>{&b, &c, &a}), docinfos);
+}
+
+TEST(FetchPlannerTest, BodyBlocks) {
+    // Within a block.
+    EXPECT_EQ((Range{0, block}),
+              FetchPlanner::bodyBlocks(makeDocInfo(100, 100)));
+    EXPECT_EQ((Range{2 * block, block}),
+              FetchPlanner::bodyBlocks(makeDocInfo(2 * block + 1, 100)));
+
+    // Crossing into the next block.
+    EXPECT_EQ((Range{0, 2 * block}),
+              FetchPlanner::bodyBlocks(makeDocInfo(block - 10, 100)));
+
+    // The marker bytes at block boundaries push a body which would exactly
+    // fill its blocks into the next.
+    EXPECT_EQ((Range{0, 2 * block}),
+              FetchPlanner::bodyBlocks(makeDocInfo(1, block - 9)));
+}
+
+TEST(FetchPlannerTest, CoalesceAdjacent) {
+    FetchPlanner planner(0, 100 * block);
+    EXPECT_EQ((std::vector<Range>{{0, 3 * block}}),
+              planner.coalesce({{block, block},
+                                {0, block},
+                                {2 * block, block}}));
+}
+
+TEST(FetchPlannerTest, CoalesceOverlapping) {
+    FetchPlanner planner(0, 100 * block);
+    EXPECT_EQ((std::vector<Range>{{0, 3 * block}}),
+              planner.coalesce({{0, 2 * block},
+                                {block, 2 * block},
+                                {block, block}}));
+}
+
+TEST(FetchPlannerTest, CoalesceGap) {
+    FetchPlanner planner(2 * block, 100 * block);
+    EXPECT_EQ((std::vector<Range>{{0, 5 * block}, {8 * block, block}}),
+              planner.coalesce({{0, block},
+                                {3 * block, block},
+                                {4 * block, block},
+                                {8 * block, block},
+                                {9 * block, 0}}));
+}
+
+TEST(FetchPlannerTest, CoalesceMaxReadSize) {
+    FetchPlanner planner(0, 2 * block);
+    EXPECT_EQ((std::vector<Range>{{0, 2 * block}, {2 * block, block}}),
+              planner.coalesce({{0, block},
+                                {block, block},
+                                {2 * block, block}}));
+
+    // A range larger than the maximum is read whole, and a range it overlaps
+    // only reads what it doesn't cover.
+    EXPECT_EQ((std::vector<Range>{{0, 4 * block}, {4 * block, block}}),
+              planner.coalesce({{0, 4 * block},
+                                {block, block},
+                                {3 * block, 2 * block}}));
+}
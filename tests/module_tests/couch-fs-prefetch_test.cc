@@ -0,0 +1,165 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "src/couch-kvstore/couch-fs-prefetch.h"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+/**
+ * couchstore's default file ops, counting the preads made through them.
+ */
+class CountingFileOps : public FileOpsInterface {
+public:
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override {
+        return base.constructor(errinfo);
+    }
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle, const char* path,
+                            int oflag) override {
+        return base.open(errinfo, handle, path, oflag);
+    }
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override {
+        return base.close(errinfo, handle);
+    }
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle, void* buf, size_t nbytes,
+                  cs_off_t offset) override {
+        ++preads;
+        return base.pread(errinfo, handle, buf, nbytes, offset);
+    }
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle, const void* buf,
+                   size_t nbytes, cs_off_t offset) override {
+        return base.pwrite(errinfo, handle, buf, nbytes, offset);
+    }
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override {
+        return base.goto_eof(errinfo, handle);
+    }
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override {
+        return base.sync(errinfo, handle);
+    }
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle, cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override {
+        return base.advise(errinfo, handle, offset, len, advice);
+    }
+    void destructor(couch_file_handle handle) override {
+        base.destructor(handle);
+    }
+
+    FileOpsInterface& base = *couchstore_get_default_file_ops();
+    size_t preads = 0;
+};
+
+class PrefetchFileOpsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::remove(path.c_str());
+        handle = ops.constructor(&errinfo);
+        ASSERT_EQ(COUCHSTORE_SUCCESS,
+                  ops.open(&errinfo, &handle, path.c_str(), O_RDWR | O_CREAT));
+    }
+
+    void TearDown() override {
+        EXPECT_EQ(COUCHSTORE_SUCCESS, ops.close(&errinfo, handle));
+        ops.destructor(handle);
+        std::remove(path.c_str());
+    }
+
+    void write(const std::string& data, cs_off_t offset) {
+        ASSERT_EQ(ssize_t(data.size()),
+                  ops.pwrite(&errinfo, handle, data.data(), data.size(),
+                             offset));
+    }
+
+    std::string read(size_t size, cs_off_t offset) {
+        std::string data(size, '\0');
+        ssize_t rv = ops.pread(&errinfo, handle, &data[0], size, offset);
+        EXPECT_GE(rv, 0);
+        data.resize(rv < 0 ? 0 : rv);
+        return data;
+    }
+
+    const std::string path = "couch-fs-prefetch_test.couch";
+    CountingFileOps base;
+    PrefetchFileOps ops{base};
+    couchstore_error_info_t errinfo;
+    couch_file_handle handle = nullptr;
+};
+
+// Each range is read with one pread, and reads within the ranges are then
+// served from memory.
+TEST_F(PrefetchFileOpsTest, Prefetch) {
+    write(std::string(4096, 'a') + std::string(4096, 'b') +
+                  std::string(4096, 'c'),
+          0);
+
+    ASSERT_TRUE(ops.prefetch(path, {{4096, 4096}, {0, 100}}));
+    EXPECT_EQ(2, base.preads);
+
+    EXPECT_EQ(std::string(4096, 'b'), read(4096, 4096));
+    EXPECT_EQ(std::string(10, 'b'), read(10, 8000));
+    EXPECT_EQ(std::string(10, 'a'), read(10, 50));
+    EXPECT_EQ(2, base.preads);
+
+    // Reads not wholly within a range go to the file.
+    EXPECT_EQ(std::string(200, 'a'), read(200, 0));
+    EXPECT_EQ(std::string(10, 'c'), read(10, 8192));
+    EXPECT_EQ(4, base.preads);
+
+    // A write drops the prefetched data.
+    write("z", 4096);
+    EXPECT_EQ("zb", read(2, 4096));
+    EXPECT_EQ(5, base.preads);
+}
+
+// A range beyond the end of the file reads short, like pread.
+TEST_F(PrefetchFileOpsTest, PrefetchAtEof) {
+    write(std::string(5000, 'x'), 0);
+    ASSERT_TRUE(ops.prefetch(path, {{4096, 4096}}));
+    base.preads = 0;
+
+    EXPECT_EQ(std::string(904, 'x'), read(4096, 4096));
+    EXPECT_EQ("", read(10, 5000));
+    EXPECT_EQ(0, base.preads);
+}
+
+// Only files the calling thread has used are prefetched.
+TEST_F(PrefetchFileOpsTest, PrefetchOtherThread) {
+    write("data", 0);
+    EXPECT_FALSE(ops.prefetch("other-file.couch", {{0, 4}}));
+
+    bool prefetched = true;
+    std::thread other([this, &prefetched]() {
+        prefetched = ops.prefetch(path, {{0, 4}});
+    });
+    other.join();
+    EXPECT_FALSE(prefetched);
+    EXPECT_TRUE(ops.prefetch(path, {{0, 4}}));
+}
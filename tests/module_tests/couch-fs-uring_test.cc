@@ -0,0 +1,181 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "src/couch-kvstore/couch-fs-uring.h"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+// The tests run through io_uring where the build and kernel allow, and
+// otherwise exercise the fallback path.
+class UringFileOpsTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::remove(path.c_str());
+        handle = ops.constructor(&errinfo);
+        ASSERT_EQ(COUCHSTORE_SUCCESS,
+                  ops.open(&errinfo, &handle, path.c_str(), O_RDWR | O_CREAT));
+    }
+
+    void TearDown() override {
+        if (handle) {
+            EXPECT_EQ(COUCHSTORE_SUCCESS, ops.close(&errinfo, handle));
+            ops.destructor(handle);
+        }
+        std::remove(path.c_str());
+    }
+
+    void write(const std::string& data, cs_off_t offset) {
+        ASSERT_EQ(ssize_t(data.size()),
+                  ops.pwrite(&errinfo, handle, data.data(), data.size(),
+                             offset));
+    }
+
+    std::string read(size_t size, cs_off_t offset) {
+        std::string data(size, '\0');
+        ssize_t rv = ops.pread(&errinfo, handle, &data[0], size, offset);
+        EXPECT_GE(rv, 0);
+        data.resize(rv < 0 ? 0 : rv);
+        return data;
+    }
+
+    // Read the file's contents on disk, bypassing the ops.
+    std::string readFromDisk(size_t size, cs_off_t offset) {
+        std::string data(size, '\0');
+        int fd = ::open(path.c_str(), O_RDONLY);
+        EXPECT_NE(-1, fd);
+        ssize_t rv = ::pread(fd, &data[0], size, offset);
+        ::close(fd);
+        data.resize(rv < 0 ? 0 : rv);
+        return data;
+    }
+
+    void writeToDisk(const std::string& data, cs_off_t offset) {
+        int fd = ::open(path.c_str(), O_WRONLY);
+        ASSERT_NE(-1, fd);
+        EXPECT_EQ(ssize_t(data.size()),
+                  ::pwrite(fd, data.data(), data.size(), offset));
+        ::close(fd);
+    }
+
+    const std::string path = "couch-fs-uring_test.couch";
+    UringFileOps ops;
+    couchstore_error_info_t errinfo;
+    couch_file_handle handle = nullptr;
+};
+
+// CMake found liburing, so the ring path must have been compiled in (it's
+// keyed on HAVE_LIBURING from config.h).
+#ifdef EXPECT_LIBURING
+TEST(UringFileOpsBuildTest, RingBuilt) {
+    EXPECT_TRUE(UringFileOps::isUringBuilt());
+}
+#endif
+
+TEST_F(UringFileOpsTest, OpenMissingFile) {
+    couch_file_handle h = ops.constructor(&errinfo);
+    EXPECT_EQ(COUCHSTORE_ERROR_NO_SUCH_FILE,
+              ops.open(&errinfo, &h, "no-such-file.couch", O_RDONLY));
+    ops.destructor(h);
+}
+
+// Writes are queued until the file is synced, but are visible to reads and
+// the end of the file in the meantime.
+TEST_F(UringFileOpsTest, QueuedWrites) {
+    write("hello ", 0);
+    write("world", 6);
+    write("!", 100);
+    EXPECT_EQ(101, ops.goto_eof(&errinfo, handle));
+    EXPECT_EQ("", readFromDisk(11, 0));
+
+    EXPECT_EQ("hello world", read(11, 0));
+    EXPECT_EQ("hello world", readFromDisk(11, 0));
+
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops.sync(&errinfo, handle));
+    EXPECT_EQ("!", readFromDisk(1, 100));
+    EXPECT_EQ(101, ops.goto_eof(&errinfo, handle));
+}
+
+// A write overlapping a queued one takes effect after it.
+TEST_F(UringFileOpsTest, OverlappingWrites) {
+    write("aaaa", 0);
+    write("bb", 2);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops.sync(&errinfo, handle));
+    EXPECT_EQ("aabb", readFromDisk(4, 0));
+}
+
+// Writes left queued are written by close.
+TEST_F(UringFileOpsTest, CloseWritesQueued) {
+    write("data", 0);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops.close(&errinfo, handle));
+    ops.destructor(handle);
+    handle = nullptr;
+    EXPECT_EQ("data", readFromDisk(4, 0));
+}
+
+TEST_F(UringFileOpsTest, Prefetch) {
+    const std::string data(3 * 4096, 'x');
+    write(data, 0);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops.sync(&errinfo, handle));
+
+    ASSERT_TRUE(ops.prefetch(path, {{4096, 4096}, {0, 100}}));
+
+    // Change the file behind the ops' back: reads within the prefetched
+    // ranges return the data prefetched.
+    writeToDisk(std::string(data.size(), 'y'), 0);
+    EXPECT_EQ(std::string(4096, 'x'), read(4096, 4096));
+    EXPECT_EQ(std::string(10, 'x'), read(10, 50));
+    EXPECT_EQ(std::string(200, 'y'), read(200, 0));
+    EXPECT_EQ(std::string(10, 'y'), read(10, 8192));
+
+    // A write drops the prefetched data.
+    write("z", 0);
+    EXPECT_EQ(std::string(4096, 'y'), read(4096, 4096));
+}
+
+// A range beyond the end of the file reads short, like pread.
+TEST_F(UringFileOpsTest, PrefetchAtEof) {
+    write(std::string(5000, 'x'), 0);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops.sync(&errinfo, handle));
+
+    ASSERT_TRUE(ops.prefetch(path, {{4096, 4096}}));
+    writeToDisk(std::string(5000, 'y'), 0);
+    EXPECT_EQ(std::string(904, 'x'), read(4096, 4096));
+    EXPECT_EQ("", read(10, 5000));
+}
+
+// Only files opened by the calling thread are prefetched.
+TEST_F(UringFileOpsTest, PrefetchOtherThread) {
+    write("data", 0);
+    EXPECT_FALSE(ops.prefetch("other-file.couch", {{0, 4}}));
+
+    bool prefetched = true;
+    std::thread other([this, &prefetched]() {
+        prefetched = ops.prefetch(path, {{0, 4}});
+    });
+    other.join();
+    EXPECT_FALSE(prefetched);
+    EXPECT_TRUE(ops.prefetch(path, {{0, 4}}));
+}
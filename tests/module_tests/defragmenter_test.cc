@@ -81,11 +81,11 @@ static size_t benchmarkDefragment(VBucket& vbucket, size_t passes,
     for (size_t i = 0; i < passes; i++) {
         // Loop until we get to the end; this may take multiple chunks depending
         // on the chunk_duration.
-        HashTable::Position pos;
-        while (pos != vbucket.ht.endPosition()) {
+        bool completed = false;
+        while (!completed) {
             visitor.setDeadline(gethrtime() +
                                  (chunk_duration_ms * 1000 * 1000));
-            pos = vbucket.ht.pauseResumeVisit(visitor, pos);
+            completed = visitor.visit(vbucket.getId(), vbucket.ht);
         }
     }
     hrtime_t end = gethrtime();
@@ -0,0 +1,227 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for EphemeralVBucket's sequence list: ordering, range reads
+ * and tombstone purging.
+ */
+
+#include "config.h"
+
+#include <gtest/gtest.h>
+
+#include "../mock/mock_ephemeral_vb.h"
+#include "ep_time.h"
+#include "item.h"
+#include "makestoreddockey.h"
+#include "programs/engine_testapp/mock_server.h"
+
+class EphemeralVBucketTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        vbucket.reset(new MockEphemeralVBucket(0,
+                                               vbucket_state_active,
+                                               global_stats,
+                                               checkpoint_config,
+                                               config));
+    }
+
+    void TearDown() override {
+        vbucket.reset();
+    }
+
+    void setOne(const StoredDocKey& key, const std::string& value) {
+        Item item(key, 0, 0, value.data(), value.size());
+        EXPECT_NE(MutationStatus::InvalidCas,
+                  vbucket->public_processSet(item, 0));
+    }
+
+    /// Read the whole of the given range read.
+    std::vector<std::unique_ptr<Item>> readAll(SequenceList::RangeReadId id) {
+        std::vector<std::unique_ptr<Item>> result;
+        while (true) {
+            auto items = vbucket->rangeRead(id, 2);
+            if (items.empty()) {
+                return result;
+            }
+            for (auto& item : items) {
+                vbucket->advanceRangeRead(id, item->getBySeqno());
+                result.push_back(std::move(item));
+            }
+        }
+    }
+
+    std::unique_ptr<MockEphemeralVBucket> vbucket;
+    EPStats global_stats;
+    CheckpointConfig checkpoint_config;
+    Configuration config;
+};
+
+// Every mutation and deletion is indexed once, at its latest seqno.
+TEST_F(EphemeralVBucketTest, SeqListTracksMutations) {
+    auto k1 = makeStoredDocKey("k1");
+    auto k2 = makeStoredDocKey("k2");
+    auto k3 = makeStoredDocKey("k3");
+    setOne(k1, "v1");
+    setOne(k2, "v2");
+    setOne(k3, "v3");
+    EXPECT_EQ(3, vbucket->getSeqListNumItems());
+
+    setOne(k1, "v1.1");
+    EXPECT_EQ(3, vbucket->getSeqListNumItems());
+    EXPECT_EQ(4, vbucket->getHighSeqno());
+
+    EXPECT_EQ(MutationStatus::WasDirty, vbucket->public_softDelete(k2));
+    EXPECT_EQ(3, vbucket->getSeqListNumItems());
+    EXPECT_EQ(1, vbucket->getSeqListNumDeletedItems());
+
+    EXPECT_TRUE(vbucket->public_deleteStoredValue(k3));
+    EXPECT_EQ(2, vbucket->getSeqListNumItems());
+}
+
+// A range read returns items in seqno order, each at its latest seqno.
+TEST_F(EphemeralVBucketTest, RangeReadInSeqnoOrder) {
+    for (int ii = 0; ii < 10; ++ii) {
+        setOne(makeStoredDocKey("key" + std::to_string(ii)), "value");
+    }
+    setOne(makeStoredDocKey("key3"), "new value");
+    vbucket->public_softDelete(makeStoredDocKey("key5"));
+
+    auto id = vbucket->beginRangeRead(1, vbucket->getHighSeqno());
+    auto items = readAll(id);
+    vbucket->endRangeRead(id);
+
+    ASSERT_EQ(10, items.size());
+    int64_t lastSeqno = 0;
+    for (const auto& item : items) {
+        EXPECT_LT(lastSeqno, item->getBySeqno());
+        lastSeqno = item->getBySeqno();
+    }
+    EXPECT_EQ(makeStoredDocKey("key3"), StoredDocKey(items[8]->getKey()));
+    EXPECT_EQ("new value", items[8]->getValue()->to_s());
+    EXPECT_EQ(makeStoredDocKey("key5"), StoredDocKey(items[9]->getKey()));
+    EXPECT_TRUE(items[9]->isDeleted());
+}
+
+// Items changed during a range read are still returned as they were when
+// the read started.
+TEST_F(EphemeralVBucketTest, RangeReadIsSnapshot) {
+    auto k1 = makeStoredDocKey("k1");
+    auto k2 = makeStoredDocKey("k2");
+    auto k3 = makeStoredDocKey("k3");
+    setOne(k1, "v1");
+    setOne(k2, "v2");
+    setOne(k3, "v3");
+
+    auto id = vbucket->beginRangeRead(1, 3);
+    setOne(k1, "v1.1");
+    vbucket->public_softDelete(k2);
+    EXPECT_EQ(2, vbucket->getSeqListNumStaleItems());
+    EXPECT_EQ(3, vbucket->getSeqListNumItems());
+
+    auto items = readAll(id);
+    ASSERT_EQ(3, items.size());
+    EXPECT_EQ(1, items[0]->getBySeqno());
+    EXPECT_EQ("v1", items[0]->getValue()->to_s());
+    EXPECT_EQ(2, items[1]->getBySeqno());
+    EXPECT_FALSE(items[1]->isDeleted());
+    EXPECT_EQ("v2", items[1]->getValue()->to_s());
+    EXPECT_EQ(3, items[2]->getBySeqno());
+
+    // Stale copies are released as the read moves past them.
+    EXPECT_EQ(0, vbucket->getSeqListNumStaleItems());
+    vbucket->endRangeRead(id);
+}
+
+// Concurrent range reads each see the items as they were when they
+// started.
+TEST_F(EphemeralVBucketTest, ConcurrentRangeReads) {
+    auto k1 = makeStoredDocKey("k1");
+    auto k2 = makeStoredDocKey("k2");
+    setOne(k1, "v1");
+    setOne(k2, "v2");
+
+    auto first = vbucket->beginRangeRead(1, 10);
+    setOne(k1, "v1.1");
+    auto second = vbucket->beginRangeRead(1, 10);
+    EXPECT_EQ(2, vbucket->getSeqListNumRangeReads());
+    setOne(k2, "v2.1");
+    EXPECT_EQ(2, vbucket->getSeqListNumStaleItems());
+
+    // The first read sees k1 and k2 at their original seqnos (as well as
+    // their later versions).
+    auto items = readAll(first);
+    ASSERT_EQ(4, items.size());
+    EXPECT_EQ(1, items[0]->getBySeqno());
+    EXPECT_EQ("v1", items[0]->getValue()->to_s());
+    EXPECT_EQ(2, items[1]->getBySeqno());
+    EXPECT_EQ("v2", items[1]->getValue()->to_s());
+    vbucket->endRangeRead(first);
+    // Only the copy of k2 is still needed, by the second read.
+    EXPECT_EQ(1, vbucket->getSeqListNumStaleItems());
+
+    // The second started after k1 moved, so doesn't see it at seqno 1.
+    items = readAll(second);
+    ASSERT_EQ(3, items.size());
+    EXPECT_EQ(2, items[0]->getBySeqno());
+    EXPECT_EQ("v2", items[0]->getValue()->to_s());
+    EXPECT_EQ(3, items[1]->getBySeqno());
+    EXPECT_EQ("v1.1", items[1]->getValue()->to_s());
+    EXPECT_EQ(4, items[2]->getBySeqno());
+    EXPECT_EQ("v2.1", items[2]->getValue()->to_s());
+    vbucket->endRangeRead(second);
+    EXPECT_EQ(0, vbucket->getSeqListNumStaleItems());
+    EXPECT_EQ(0, vbucket->getSeqListNumRangeReads());
+}
+
+// Tombstones are purged once old enough, advancing the purge seqno.
+TEST_F(EphemeralVBucketTest, PurgeTombstones) {
+    auto k1 = makeStoredDocKey("k1");
+    auto k2 = makeStoredDocKey("k2");
+    setOne(k1, "v1");
+    setOne(k2, "v2");
+    vbucket->public_softDelete(k1);
+    const uint64_t deleteSeqno = vbucket->getHighSeqno();
+
+    // Not old enough.
+    EXPECT_EQ(0, vbucket->purgeTombstones(ep_current_time()));
+    EXPECT_EQ(1, vbucket->getSeqListNumDeletedItems());
+
+    mock_time_travel(1);
+    EXPECT_EQ(1, vbucket->purgeTombstones(ep_current_time()));
+    EXPECT_EQ(0, vbucket->getSeqListNumDeletedItems());
+    EXPECT_EQ(1, vbucket->getSeqListNumItems());
+    EXPECT_EQ(nullptr, vbucket->ht.find(k1, false, /*wantDeleted*/ true));
+    EXPECT_EQ(deleteSeqno, vbucket->getPurgeSeqno());
+}
+
+// A tombstone purged while a range read needs it is still returned.
+TEST_F(EphemeralVBucketTest, PurgeDuringRangeRead) {
+    auto key = makeStoredDocKey("key");
+    setOne(key, "value");
+    vbucket->public_softDelete(key);
+
+    auto id = vbucket->beginRangeRead(1, 2);
+    mock_time_travel(1);
+    EXPECT_EQ(1, vbucket->purgeTombstones(ep_current_time()));
+
+    auto items = readAll(id);
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ(2, items[0]->getBySeqno());
+    EXPECT_TRUE(items[0]->isDeleted());
+    vbucket->endRangeRead(id);
+}
@@ -0,0 +1,358 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "eviction_policy.h"
+#include "frequency_sketch.h"
+#include "hash_table.h"
+#include "item.h"
+#include "makestoreddockey.h"
+#include "stats.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+TEST(FrequencySketchTest, counters_clamped_to_power_of_two) {
+    EXPECT_EQ(FrequencySketch::minCounters,
+              FrequencySketch(0).getNumCounters());
+    EXPECT_EQ(4096u, FrequencySketch(3000).getNumCounters());
+    EXPECT_EQ(4096u, FrequencySketch(4096).getNumCounters());
+}
+
+TEST(FrequencySketchTest, estimate_counts_accesses) {
+    FrequencySketch sketch(4096);
+    const uint32_t hash = makeStoredDocKey("key").hash();
+    EXPECT_EQ(0, int(sketch.estimate(hash)));
+    for (int i = 1; i <= 5; i++) {
+        sketch.increment(hash);
+        sketch.flush();
+        EXPECT_EQ(i, int(sketch.estimate(hash)));
+    }
+}
+
+// Accesses are applied to the counters once the thread's buffer fills, or
+// it's flushed.
+TEST(FrequencySketchTest, increments_buffered) {
+    FrequencySketch sketch(4096);
+    const uint32_t hash = makeStoredDocKey("key").hash();
+    for (size_t i = 1; i < FrequencySketch::bufferSize; i++) {
+        sketch.increment(hash);
+    }
+    EXPECT_EQ(0, int(sketch.estimate(hash)));
+    sketch.increment(hash);
+    EXPECT_EQ(FrequencySketch::maxCount, sketch.estimate(hash));
+
+    sketch.increment(hash + 1);
+    EXPECT_EQ(0, int(sketch.estimate(hash + 1)));
+    sketch.flush();
+    EXPECT_EQ(1, int(sketch.estimate(hash + 1)));
+}
+
+TEST(FrequencySketchTest, estimate_saturates) {
+    FrequencySketch sketch(4096);
+    const uint32_t hash = makeStoredDocKey("key").hash();
+    for (int i = 0; i < 100; i++) {
+        sketch.increment(hash);
+    }
+    sketch.flush();
+    EXPECT_EQ(FrequencySketch::maxCount, sketch.estimate(hash));
+}
+
+/*
+ * A count-min sketch may over-estimate a key's accesses, but never
+ * under-estimate them (before the counters are halved).
+ */
+TEST(FrequencySketchTest, never_underestimates) {
+    FrequencySketch sketch(4096);
+    std::vector<uint32_t> hashes;
+    for (int i = 0; i < 1000; i++) {
+        hashes.push_back(makeStoredDocKey("key_" + std::to_string(i)).hash());
+        for (int j = 0; j < i % 4; j++) {
+            sketch.increment(hashes.back());
+        }
+    }
+    sketch.flush();
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_GE(sketch.estimate(hashes[i]), i % 4);
+    }
+}
+
+TEST(FrequencySketchTest, counters_halved_after_sample) {
+    FrequencySketch sketch(FrequencySketch::minCounters);
+    const uint32_t hot = makeStoredDocKey("hot").hash();
+    for (int i = 0; i < 12; i++) {
+        sketch.increment(hot);
+    }
+    sketch.flush();
+    ASSERT_EQ(12, sketch.estimate(hot));
+    EXPECT_FALSE(sketch.ageIfDue());
+
+    // Accesses to other keys until the sketch is due to age; they may
+    // over-count the hot key, but not past maxCount.
+    for (uint32_t i = 12; i < 10 * sketch.getNumCounters(); i++) {
+        sketch.increment(i);
+    }
+    sketch.flush();
+    EXPECT_EQ(0u, sketch.getNumAgings());
+    EXPECT_TRUE(sketch.ageIfDue());
+    EXPECT_FALSE(sketch.ageIfDue());
+    EXPECT_EQ(1u, sketch.getNumAgings());
+    EXPECT_GE(sketch.estimate(hot), 12 / 2);
+    EXPECT_LE(sketch.estimate(hot), FrequencySketch::maxCount / 2);
+}
+
+TEST(EvictionPolicyTest, type_from_string) {
+    EXPECT_EQ(EvictionPolicy::Type::NRU,
+              EvictionPolicy::typeFromString("nru"));
+    EXPECT_EQ(EvictionPolicy::Type::TinyLFU,
+              EvictionPolicy::typeFromString("tinylfu"));
+    EXPECT_THROW(EvictionPolicy::typeFromString("lru"),
+                 std::invalid_argument);
+    for (auto type : {EvictionPolicy::Type::NRU,
+                      EvictionPolicy::Type::TinyLFU}) {
+        EXPECT_EQ(type, EvictionPolicy::typeFromString(
+                                EvictionPolicy::typeToString(type)));
+    }
+}
+
+TEST(EvictionPolicyTest, tinylfu_needs_sketch) {
+    EXPECT_THROW(EvictionPolicy::create(EvictionPolicy::Type::TinyLFU,
+                                        nullptr, VALUE_ONLY),
+                 std::invalid_argument);
+    EXPECT_EQ(EvictionPolicy::Type::NRU,
+              EvictionPolicy::create(EvictionPolicy::Type::NRU, nullptr,
+                                     VALUE_ONLY)->getType());
+}
+
+/*
+ * Visits a hash table as the item pager does, ejecting the values of the
+ * items the policy picks.
+ */
+class EvictingVisitor : public HashTableVisitor {
+public:
+    EvictingVisitor(HashTable& ht, EvictionPolicy& policy,
+                    item_pager_phase phase, double percent)
+        : ht(ht), policy(policy), phase(phase), percent(percent),
+          ejected(0) {
+    }
+
+    void visit(StoredValue* v) override {
+        if (policy.shouldEvict(*v, phase, percent) &&
+            ht.unlocked_ejectItem(v, VALUE_ONLY)) {
+            ++ejected;
+        }
+    }
+
+    HashTable& ht;
+    EvictionPolicy& policy;
+    const item_pager_phase phase;
+    const double percent;
+    size_t ejected;
+};
+
+class EvictionPolicyHashTableTest : public ::testing::Test {
+protected:
+    EvictionPolicyHashTableTest()
+        : ht(stats, /*size*/ 0, /*locks*/ 1),
+          sketch(std::make_shared<FrequencySketch>(4096)) {
+        ht.setFrequencySketch(sketch);
+    }
+
+    // Store a clean (so evictable) item.
+    void store(const StoredDocKey& key) {
+        Item item(key, 0, 0, key.data(), key.size());
+        ht.set(item);
+        ht.find(key, /*trackReference*/ false)->markClean();
+    }
+
+    EPStats stats;
+    HashTable ht;
+    std::shared_ptr<FrequencySketch> sketch;
+};
+
+TEST_F(EvictionPolicyHashTableTest, finds_feed_sketch) {
+    const auto key = makeStoredDocKey("key");
+    store(key);
+    EXPECT_EQ(0, sketch->estimate(key.hash()));
+    ht.find(key);
+    ht.find(key);
+    sketch->flush();
+    EXPECT_EQ(2, sketch->estimate(key.hash()));
+    // Lookups which don't count as references aren't recorded.
+    ht.find(key, /*trackReference*/ false);
+    sketch->flush();
+    EXPECT_EQ(2, sketch->estimate(key.hash()));
+}
+
+/*
+ * TinyLFU should evict the items accessed least, whatever their NRU
+ * values.
+ */
+TEST_F(EvictionPolicyHashTableTest, tinylfu_evicts_least_frequent) {
+    const int numKeys = 1000;
+    for (int i = 0; i < numKeys; i++) {
+        store(makeStoredDocKey("key_" + std::to_string(i)));
+    }
+    // Every fourth key is hot; the cold ones are all accessed just once,
+    // after the hot ones, so are the most recently referenced.
+    for (int i = 0; i < numKeys; i += 4) {
+        const auto key = makeStoredDocKey("key_" + std::to_string(i));
+        for (int j = 0; j < 5; j++) {
+            ht.find(key);
+        }
+    }
+    for (int i = 0; i < numKeys; i++) {
+        if (i % 4 != 0) {
+            ht.find(makeStoredDocKey("key_" + std::to_string(i)));
+        }
+    }
+
+    auto policy = EvictionPolicy::create(EvictionPolicy::Type::TinyLFU,
+                                         sketch, VALUE_ONLY);
+    EvictingVisitor visitor(ht, *policy, PAGING_UNREFERENCED, 0.4);
+    ht.visit(visitor);
+
+    EXPECT_NEAR(400, visitor.ejected, 50);
+    for (int i = 0; i < numKeys; i += 4) {
+        const auto key = makeStoredDocKey("key_" + std::to_string(i));
+        EXPECT_TRUE(ht.find(key, false)->isResident()) << key.c_str();
+    }
+}
+
+/*
+ * Items which can't be evicted (here, dirty ones) shouldn't count towards
+ * the fraction to evict.
+ */
+TEST_F(EvictionPolicyHashTableTest, tinylfu_ignores_ineligible) {
+    for (int i = 0; i < 100; i++) {
+        store(makeStoredDocKey("clean_" + std::to_string(i)));
+        Item item(makeStoredDocKey("dirty_" + std::to_string(i)), 0, 0,
+                  "value", 5);
+        ht.set(item);
+    }
+
+    auto policy = EvictionPolicy::create(EvictionPolicy::Type::TinyLFU,
+                                         sketch, VALUE_ONLY);
+    EvictingVisitor visitor(ht, *policy, PAGING_UNREFERENCED, 0.5);
+    ht.visit(visitor);
+    EXPECT_NEAR(50, visitor.ejected, 15);
+}
+
+/*
+ * Replay a trace of accesses, skewed towards a set of popular keys and
+ * interleaved with a scan of keys read only once, through a hash table
+ * whose resident items are limited by running the pager whenever there
+ * are too many. Returns the hit ratio under the given policy.
+ */
+static double replayZipfWithScan(EvictionPolicy::Type type) {
+    const size_t numPopular = 20000;
+    const size_t numAccesses = 300000;
+    const size_t highWat = 2000;
+    const size_t lowWat = 1600;
+    const double scanFraction = 0.3;
+
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<double> cdf(numPopular);
+    double sum = 0;
+    for (size_t i = 0; i < numPopular; i++) {
+        sum += 1 / std::pow(i + 1, 0.9);
+        cdf[i] = sum;
+    }
+    std::vector<StoredDocKey> trace;
+    trace.reserve(numAccesses);
+    size_t scanned = 0;
+    for (size_t i = 0; i < numAccesses; i++) {
+        if (uniform(rng) < scanFraction) {
+            trace.push_back(
+                    makeStoredDocKey("scan_" + std::to_string(scanned++)));
+        } else {
+            const size_t k = std::lower_bound(cdf.begin(), cdf.end(),
+                                              uniform(rng) * sum) -
+                             cdf.begin();
+            trace.push_back(makeStoredDocKey("key_" + std::to_string(k)));
+        }
+    }
+
+    EPStats stats;
+    HashTable ht(stats, /*size*/ 0, /*locks*/ 1);
+    std::shared_ptr<FrequencySketch> sketch;
+    if (type == EvictionPolicy::Type::TinyLFU) {
+        sketch = std::make_shared<FrequencySketch>(highWat * 4);
+        ht.setFrequencySketch(sketch);
+    }
+
+    size_t hits = 0;
+    size_t passes = 0;
+    bool evicting = false;
+    item_pager_phase phase = PAGING_UNREFERENCED;
+    for (size_t i = 0; i < trace.size(); i++) {
+        const auto& key = trace[i];
+        StoredValue* v = ht.find(key);
+        if (v && v->isResident()) {
+            ++hits;
+            continue;
+        }
+        // A miss; load the value as a background fetch would.
+        Item item(key, 0, 0, key.data(), key.size());
+        ht.set(item);
+        ht.find(key, false)->markClean();
+
+        // Run the pager periodically, from the high to the low watermark,
+        // aging the sketch as its background task would.
+        if ((i + 1) % 500 != 0) {
+            continue;
+        }
+        if (sketch) {
+            sketch->ageIfDue();
+        }
+        const size_t resident =
+                ht.getNumItems() - ht.getNumInMemoryNonResItems();
+        if (resident <= lowWat) {
+            evicting = false;
+        } else if (resident > highWat) {
+            evicting = true;
+        }
+        if (!evicting) {
+            continue;
+        }
+        auto policy = EvictionPolicy::create(type, sketch, VALUE_ONLY);
+        EvictingVisitor visitor(ht, *policy, phase,
+                                double(resident - lowWat) / resident);
+        ht.visit(visitor);
+        ++passes;
+        phase = phase == PAGING_UNREFERENCED ? PAGING_RANDOM
+                                             : PAGING_UNREFERENCED;
+    }
+
+    EXPECT_GT(passes, 0u);
+    return double(hits) / numAccesses;
+}
+
+/*
+ * TinyLFU should keep more of the popular keys resident than NRU when a
+ * scan of one-hit wonders pollutes the trace.
+ */
+TEST(EvictionPolicyReplayTest, tinylfu_resists_scan) {
+    const double nru = replayZipfWithScan(EvictionPolicy::Type::NRU);
+    const double tinylfu = replayZipfWithScan(EvictionPolicy::Type::TinyLFU);
+    EXPECT_GT(tinylfu, nru + 0.03) << "NRU hit ratio " << nru;
+}
@@ -23,6 +23,7 @@
 #include "taskqueue.h"
 #include "../mock/mock_dcp_producer.h"
 #include "../mock/mock_dcp_consumer.h"
+#include "../mock/mock_stream.h"
 #include "programs/engine_testapp/mock_server.h"
 #include <string_utilities.h>
 #include <xattr/blob.h>
@@ -306,6 +307,51 @@ TEST_F(SingleThreadedEPStoreTest, MB19892_BackfillNotDeleted) {
                       dummy_dcp_add_failover_cb));
 }
 
+// Check that when a disk snapshot ends below where the stream's checkpoint
+// cursor can start only because the items in between were de-duplicated,
+// no further backfill is scheduled; only expelled items need one.
+TEST_F(SingleThreadedEPStoreTest, DiskSnapshotDedupGapNoBackfill) {
+    setVBucketStateAndRunPersistTask(vbid, vbucket_state_active);
+
+    // Move seqno 1 to disk only, as in MB19892_BackfillNotDeleted, so that
+    // a stream from zero has to backfill.
+    store_item(vbid, makeStoredDocKey("key"), "value");
+    auto vb = store->getVbMap().getBucket(vbid);
+    auto& ckpt_mgr = vb->checkpointManager;
+    ckpt_mgr.createNewCheckpoint();
+    EXPECT_EQ(1, store->flushVBucket(vbid));
+    bool new_ckpt_created;
+    EXPECT_EQ(1, ckpt_mgr.removeClosedUnrefCheckpoints(*vb, new_ckpt_created));
+
+    // Seqnos 2..4 are de-duplicated to seqno 4 in the open checkpoint.
+    for (int ii = 0; ii < 3; ++ii) {
+        store_item(vbid, makeStoredDocKey("key2"), "value");
+    }
+
+    dcp_producer_t producer = new MockDcpProducer(*engine,
+                                                  cookie,
+                                                  "test_producer",
+                                                  /*notifyOnly*/false);
+    stream_t stream = new MockActiveStream(engine.get(), producer,
+                                           producer->getName(), /*flags*/0,
+                                           /*opaque*/0, vbid,
+                                           /*st_seqno*/0,
+                                           /*en_seqno*/~0,
+                                           /*vb_uuid*/0xabcd,
+                                           /*snap_start_seqno*/0,
+                                           /*snap_end_seqno*/~0);
+    auto* mock_stream = static_cast<MockActiveStream*>(stream.get());
+    mock_stream->setActive();
+    ASSERT_EQ(STREAM_BACKFILLING, mock_stream->getState());
+
+    // A disk snapshot ending at seqno 2 leaves the cursor starting at seqno
+    // 4, but seqno 3 was never expelled from the checkpoint.
+    mock_stream->markDiskSnapshot(/*startSeqno*/0, /*endSeqno*/2);
+    EXPECT_FALSE(mock_stream->public_hasPendingBackfill());
+
+    mock_stream->setDead(END_STREAM_CLOSED);
+}
+
 /*
  * Test that the DCP processor returns a 'yield' return code when
  * working on a large enough buffer size.
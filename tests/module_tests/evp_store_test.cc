@@ -272,6 +272,53 @@ TEST_F(EPBucketTest, test_mb20751_deadlock_on_disconnect_delete) {
     frontend_thread_handling_disconnect.join();
 }
 
+class BgFetcherTasksTest : public EPBucketTest {
+    void SetUp() override {
+        config_string += "bgfetcher_tasks_per_shard=2";
+        EPBucketTest::SetUp();
+
+        store->setVBucketState(0, vbucket_state_active, false);
+        store->setVBucketState(1, vbucket_state_active, false);
+    }
+};
+
+// Check that with several tasks per shard, each task only fetches the items
+// of its own vbuckets.
+TEST_F(BgFetcherTasksTest, FetchesOwnVBuckets) {
+    const auto key = makeStoredDocKey("key");
+    get_options_t options = static_cast<get_options_t>(QUEUE_BG_FETCH |
+                                                       HONOR_STATES |
+                                                       TRACK_REFERENCE |
+                                                       DELETE_TEMP |
+                                                       HIDE_LOCKED_CAS |
+                                                       TRACK_STATISTICS);
+    for (uint16_t vb : {0, 1}) {
+        store_item(vb, key, "value");
+        flush_vbucket_to_disk(vb);
+        evict_key(vb, key);
+        EXPECT_EQ(ENGINE_EWOULDBLOCK,
+                  store->get(key, vb, cookie, options).getStatus());
+    }
+
+    BgFetcher* bgFetcher = store->getVBucket(0)->getShard()->getBgFetcher();
+    ASSERT_EQ(store->getVBucket(1)->getShard()->getBgFetcher(), bgFetcher);
+    EXPECT_EQ(2u, bgFetcher->getConcurrency());
+
+    MockGlobalTask mockTask(engine->getTaskable(), TaskId::MultiBGFetcherTask);
+    bgFetcher->run(&mockTask, 1);
+    EXPECT_TRUE(store->getVBucket(0)->hasPendingBGFetchItems());
+    EXPECT_FALSE(store->getVBucket(1)->hasPendingBGFetchItems());
+
+    bgFetcher->run(&mockTask, 0);
+    EXPECT_FALSE(store->getVBucket(0)->hasPendingBGFetchItems());
+
+    for (uint16_t vb : {0, 1}) {
+        GetValue gv = store->get(key, vb, cookie, options);
+        EXPECT_EQ(ENGINE_SUCCESS, gv.getStatus());
+        delete gv.getValue();
+    }
+}
+
 class EPStoreEvictionTest : public EPBucketTest,
                              public ::testing::WithParamInterface<std::string> {
     void SetUp() override {
@@ -0,0 +1,174 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "expiry_index.h"
+#include "hash_table.h"
+#include "item.h"
+#include "makestoreddockey.h"
+#include "stats.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+static std::vector<std::string> toStrings(
+        const std::vector<StoredDocKey>& keys) {
+    std::vector<std::string> strings;
+    for (const auto& key : keys) {
+        strings.push_back(key.c_str());
+    }
+    std::sort(strings.begin(), strings.end());
+    return strings;
+}
+
+TEST(ExpiryIndexTest, pop_returns_due_keys) {
+    ExpiryIndex index;
+    EXPECT_EQ(1, index.update(makeStoredDocKey("a"), 0, 10));
+    EXPECT_EQ(1, index.update(makeStoredDocKey("b"), 0, 20));
+    EXPECT_EQ(1, index.update(makeStoredDocKey("c"), 0, 20));
+    EXPECT_EQ(1, index.update(makeStoredDocKey("d"), 0, 30));
+    EXPECT_EQ(4u, index.size());
+
+    // As StoredValue::isExpired(), a key is due once its time has passed.
+    EXPECT_EQ(std::vector<std::string>({"a"}),
+              toStrings(index.popExpired(20)));
+    EXPECT_EQ(std::vector<std::string>({"b", "c"}),
+              toStrings(index.popExpired(21)));
+    EXPECT_TRUE(index.popExpired(21).empty());
+    EXPECT_EQ(1u, index.size());
+}
+
+TEST(ExpiryIndexTest, update_moves_key) {
+    ExpiryIndex index;
+    const auto key = makeStoredDocKey("key");
+    EXPECT_EQ(0, index.update(key, 0, 0));
+    EXPECT_EQ(1, index.update(key, 0, 10));
+    EXPECT_EQ(0, index.update(key, 10, 10));
+    EXPECT_EQ(0, index.update(key, 10, 30));
+    EXPECT_EQ(1u, index.size());
+    EXPECT_TRUE(index.popExpired(20).empty());
+
+    EXPECT_EQ(-1, index.update(key, 30, 0));
+    EXPECT_EQ(0u, index.size());
+    EXPECT_TRUE(index.popExpired(100).empty());
+
+    // Removing a key which isn't there (or is at another time) is a no-op.
+    EXPECT_EQ(1, index.update(key, 0, 10));
+    EXPECT_EQ(0, index.update(key, 40, 0));
+    EXPECT_EQ(1u, index.size());
+    EXPECT_EQ(1u, index.clear());
+    EXPECT_EQ(0u, index.size());
+}
+
+class ExpiryIndexHashTableTest : public ::testing::Test {
+protected:
+    ExpiryIndexHashTableTest()
+        : ht(stats,
+             /*size*/ 0,
+             /*locks*/ 1,
+             HashTable::Layout::Chained,
+             /*useSlabAllocator*/ false,
+             /*inlineValueSize*/ 0,
+             /*optimisticReads*/ false,
+             /*useExpiryIndex*/ true) {
+    }
+
+    void store(const std::string& key, time_t exptime) {
+        Item item(makeStoredDocKey(key), 0, exptime, "value", 5);
+        ht.set(item);
+    }
+
+    EPStats stats;
+    HashTable ht;
+};
+
+TEST_F(ExpiryIndexHashTableTest, set_indexes_items_with_exptime) {
+    ASSERT_TRUE(ht.hasExpiryIndex());
+    store("no_ttl", 0);
+    store("ttl_1", 100);
+    store("ttl_2", 200);
+    EXPECT_EQ(2u, ht.getExpiryIndexSize());
+    EXPECT_EQ(2u, stats.expiryIndexSize.load());
+
+    // Replacing an item moves it to its new expiry time.
+    store("ttl_1", 300);
+    store("no_ttl", 150);
+    store("ttl_2", 0);
+    EXPECT_EQ(2u, ht.getExpiryIndexSize());
+    EXPECT_EQ(std::vector<std::string>({"no_ttl"}),
+              toStrings(ht.popExpiredKeys(250)));
+    EXPECT_EQ(1u, stats.expiryIndexSize.load());
+}
+
+TEST_F(ExpiryIndexHashTableTest, exptime_change_reindexes) {
+    store("key", 100);
+    const auto key = makeStoredDocKey("key");
+    int bucket_num(0);
+    {
+        auto lh = ht.getLockedBucket(key, &bucket_num);
+        StoredValue* v = ht.unlocked_find(key, bucket_num, false, false);
+        ht.unlocked_setExptime(lh, *v, 500);
+    }
+    EXPECT_TRUE(ht.popExpiredKeys(200).empty());
+    EXPECT_EQ(std::vector<std::string>({"key"}),
+              toStrings(ht.popExpiredKeys(501)));
+}
+
+TEST_F(ExpiryIndexHashTableTest, delete_removes_from_index) {
+    store("soft", 100);
+    store("hard", 100);
+    ASSERT_EQ(2u, ht.getExpiryIndexSize());
+
+    int bucket_num(0);
+    const auto soft = makeStoredDocKey("soft");
+    {
+        auto lh = ht.getLockedBucket(soft, &bucket_num);
+        StoredValue* v = ht.unlocked_find(soft, bucket_num, false, false);
+        ht.unlocked_softDelete(lh, *v, /*onlyMarkDeleted*/ false);
+    }
+    EXPECT_EQ(1u, ht.getExpiryIndexSize());
+
+    const auto hard = makeStoredDocKey("hard");
+    {
+        auto lh = ht.getLockedBucket(hard, &bucket_num);
+        ht.unlocked_del(lh, hard, bucket_num);
+    }
+    EXPECT_EQ(0u, ht.getExpiryIndexSize());
+    EXPECT_EQ(0u, stats.expiryIndexSize.load());
+}
+
+TEST_F(ExpiryIndexHashTableTest, clear_empties_index) {
+    for (int i = 0; i < 10; i++) {
+        store("key_" + std::to_string(i), 100 + i);
+    }
+    EXPECT_EQ(10u, stats.expiryIndexSize.load());
+    ht.clear();
+    EXPECT_EQ(0u, ht.getExpiryIndexSize());
+    EXPECT_EQ(0u, stats.expiryIndexSize.load());
+}
+
+TEST(ExpiryIndexDisabledTest, nothing_indexed) {
+    EPStats stats;
+    HashTable ht(stats, 0, 1);
+    EXPECT_FALSE(ht.hasExpiryIndex());
+    Item item(makeStoredDocKey("key"), 0, 100, "value", 5);
+    ht.set(item);
+    EXPECT_EQ(0u, ht.getExpiryIndexSize());
+    EXPECT_TRUE(ht.popExpiredKeys(1000).empty());
+}
@@ -0,0 +1,86 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "flush_batch_sizer.h"
+
+#include <gtest/gtest.h>
+
+static const hrtime_t oneMs = 1000000;
+
+TEST(FlushBatchSizerTest, Disabled) {
+    FlushBatchSizer sizer(0);
+    EXPECT_EQ(0, sizer.getBatchSize());
+    EXPECT_FALSE(sizer.commitCompleted(1000, 1000 * oneMs));
+    EXPECT_EQ(0, sizer.getBatchSize());
+}
+
+TEST(FlushBatchSizerTest, UnlimitedUntilFirstCommit) {
+    FlushBatchSizer sizer(10);
+    EXPECT_EQ(0, sizer.getBatchSize());
+
+    // 1000 items in 20ms: 500 should commit in 10ms.
+    EXPECT_TRUE(sizer.commitCompleted(1000, 20 * oneMs));
+    EXPECT_EQ(500, sizer.getBatchSize());
+
+    // Empty commits tell us nothing.
+    EXPECT_FALSE(sizer.commitCompleted(0, 50 * oneMs));
+    EXPECT_EQ(500, sizer.getBatchSize());
+}
+
+// With a fixed cost per commit the batch size settles where a commit takes
+// the target time.
+TEST(FlushBatchSizerTest, ConvergesOnTarget) {
+    FlushBatchSizer sizer(10);
+    const hrtime_t fixedCost = 2 * oneMs;
+    const hrtime_t perItem = 10000;
+    size_t batch = 100000;
+    size_t misses = 0;
+    for (int ii = 0; ii < 100; ++ii) {
+        if (sizer.commitCompleted(batch, fixedCost + batch * perItem)) {
+            ++misses;
+        }
+        batch = sizer.getBatchSize();
+    }
+    // (10ms - 2ms) / 10us
+    EXPECT_NEAR(800, batch, 1);
+    EXPECT_GT(misses, 0);
+    EXPECT_LT(misses, 100);
+}
+
+TEST(FlushBatchSizerTest, MinBatchSize) {
+    FlushBatchSizer sizer(1);
+    for (int ii = 0; ii < 10; ++ii) {
+        sizer.commitCompleted(FlushBatchSizer::minBatchSize, 100 * oneMs);
+    }
+    EXPECT_EQ(FlushBatchSizer::minBatchSize, sizer.getBatchSize());
+}
+
+TEST(FlushBatchSizerTest, SetTarget) {
+    FlushBatchSizer sizer(10);
+    sizer.commitCompleted(1000, 10 * oneMs);
+    EXPECT_EQ(1000, sizer.getBatchSize());
+
+    // The estimate is kept across changes of target.
+    sizer.setTarget(20);
+    EXPECT_EQ(2000, sizer.getBatchSize());
+    EXPECT_FALSE(sizer.commitCompleted(2000, 20 * oneMs));
+
+    sizer.setTarget(0);
+    EXPECT_EQ(0, sizer.getBatchSize());
+}
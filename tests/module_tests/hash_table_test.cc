@@ -24,8 +24,14 @@
 #include <stats.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
+#include <thread>
+#include <valgrind/valgrind.h>
 
+#include "epoch_manager.h"
 #include "makestoreddockey.h"
 #include "threadtests.h"
 
@@ -115,7 +121,7 @@ static std::vector<StoredDocKey> generateKeys(int num, int start=0) {
  */
 static bool del(HashTable& ht, const DocKey& key) {
     int bucket_num(0);
-    std::unique_lock<std::mutex> lh = ht.getLockedBucket(key, &bucket_num);
+    HashTable::HashBucketLock lh = ht.getLockedBucket(key, &bucket_num);
     StoredValue* v = ht.unlocked_find(key,
                                       bucket_num,
                                       /*wantsDeleted*/ true,
@@ -402,6 +408,35 @@ TEST_F(HashTableTest, SizeStatsEject) {
     cb_free(someval);
 }
 
+TEST_F(HashTableTest, PinnedSeqnosBlockEjection) {
+    HashTable ht(global_stats, 5, 1);
+    std::vector<StoredValue*> values;
+    for (int seqno = 1; seqno <= 3; ++seqno) {
+        StoredDocKey key = makeStoredDocKey("key" + std::to_string(seqno));
+        Item i(key, 0, 0, "value", 5);
+        i.setBySeqno(seqno);
+        EXPECT_EQ(MutationStatus::WasClean, ht.set(i));
+        StoredValue* v(ht.find(key));
+        ASSERT_TRUE(v);
+        v->markClean();
+        values.push_back(v);
+    }
+
+    // Only the pinned seqnos are kept resident.
+    ht.setPinnedSeqnos(2, 2);
+    const size_t failedEjects = global_stats.numFailedEjects.load();
+    EXPECT_FALSE(ht.unlocked_ejectItem(values[1], VALUE_ONLY));
+    EXPECT_FALSE(ht.unlocked_ejectItem(values[1], FULL_EVICTION));
+    EXPECT_EQ(failedEjects + 2, global_stats.numFailedEjects.load());
+    EXPECT_TRUE(values[1]->isResident());
+    EXPECT_TRUE(ht.unlocked_ejectItem(values[0], VALUE_ONLY));
+    EXPECT_TRUE(ht.unlocked_ejectItem(values[2], VALUE_ONLY));
+
+    ht.clearPinnedSeqnos();
+    EXPECT_TRUE(ht.unlocked_ejectItem(values[1], VALUE_ONLY));
+    EXPECT_FALSE(values[1]->isResident());
+}
+
 TEST_F(HashTableTest, SizeStatsEjectFlush) {
     global_stats.reset();
     HashTable ht(global_stats, 5, 1);
@@ -453,7 +488,7 @@ TEST_F(HashTableTest, ItemAge) {
     EXPECT_EQ(0xff, v->getValue()->getAge());
 
     // Check reset of age after reallocation.
-    v->reallocate();
+    v->reallocate(ht);
     EXPECT_EQ(0, v->getValue()->getAge());
 
     // Check changing age when new value is used.
@@ -498,3 +533,699 @@ TEST_F(HashTableTest, NRUMinimum) {
     EXPECT_NE(nullptr, v);
     EXPECT_EQ(MIN_NRU_VALUE, v->getNRUValue());
 }
+
+// Test fixture for tests which run against each HashTable bucket layout.
+class HashTableLayoutTest
+        : public ::testing::TestWithParam<HashTable::Layout> {
+};
+
+TEST_P(HashTableLayoutTest, FindAndDelete) {
+    size_t initialSize = global_stats.currentSize.load();
+    HashTable h(global_stats, 5, 1, GetParam());
+    ASSERT_EQ(GetParam(), h.getLayout());
+    const int nkeys = 1000;
+
+    auto keys = generateKeys(nkeys);
+    storeMany(h, keys);
+    EXPECT_EQ(nkeys, count(h));
+    verifyFound(h, keys);
+
+    std::reverse(keys.begin(), keys.end());
+    for (const auto& key : keys) {
+        EXPECT_TRUE(del(h, key));
+        EXPECT_FALSE(h.find(key));
+    }
+
+    EXPECT_EQ(0, count(h));
+    EXPECT_EQ(0, h.getNumOverflowBuckets());
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+}
+
+TEST_P(HashTableLayoutTest, Resize) {
+    HashTable h(global_stats, 5, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    h.resize(6143);
+    EXPECT_EQ(6143, h.getSize());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    h.resize(97);
+    EXPECT_EQ(97, h.getSize());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+}
+
+TEST_P(HashTableLayoutTest, AutoResize) {
+    HashTable h(global_stats, 5, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    h.resize();
+    // Fingerprint buckets are sized to hold several items each.
+    if (GetParam() == HashTable::Layout::Chained) {
+        EXPECT_EQ(769, h.getSize());
+    } else {
+        EXPECT_EQ(193, h.getSize());
+    }
+    verifyFound(h, keys);
+}
+
+TEST_P(HashTableLayoutTest, PauseResumeVisit) {
+    HashTable h(global_stats, 5, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    // Visitor which pauses after every item.
+    class PausingVisitor : public PauseResumeHashTableVisitor {
+    public:
+        bool visit(StoredValue& v) override {
+            ++visited;
+            return false;
+        }
+        size_t visited = 0;
+    } visitor;
+
+    HashTable::Position pos;
+    while (pos != h.endPosition()) {
+        pos = h.pauseResumeVisit(visitor, pos);
+    }
+    // Visiting restarts from the next bucket after a pause, so some items
+    // may be skipped but none may be visited twice.
+    EXPECT_GT(visitor.visited, 0);
+    EXPECT_LE(visitor.visited, 1000);
+}
+
+TEST_P(HashTableLayoutTest, EjectFullEviction) {
+    HashTable h(global_stats, 5, 1, GetParam());
+
+    auto keys = generateKeys(100);
+    storeMany(h, keys);
+
+    for (const auto& key : keys) {
+        int bucket_num(0);
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        StoredValue* v = h.unlocked_find(key, bucket_num);
+        ASSERT_TRUE(v);
+        v->markClean();
+        EXPECT_TRUE(h.unlocked_ejectItem(v, FULL_EVICTION));
+        EXPECT_FALSE(h.unlocked_find(key, bucket_num));
+    }
+    EXPECT_EQ(0, h.getNumInMemoryItems());
+    EXPECT_EQ(0, h.getNumOverflowBuckets());
+}
+
+TEST_P(HashTableLayoutTest, Clear) {
+    size_t initialSize = global_stats.currentSize.load();
+    HashTable h(global_stats, 3, 1, GetParam());
+
+    auto keys = generateKeys(500);
+    storeMany(h, keys);
+    h.clear();
+
+    EXPECT_EQ(0, count(h));
+    EXPECT_EQ(0, h.getNumOverflowBuckets());
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+
+    // Table remains usable after being cleared.
+    storeMany(h, keys);
+    verifyFound(h, keys);
+}
+
+// Check that items remain reachable (and modifiable) while an incremental
+// resize is only partially complete.
+TEST_P(HashTableLayoutTest, IncrementalResize) {
+    HashTable h(global_stats, 5, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    ASSERT_TRUE(h.startIncrementalResize(6143));
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_EQ(6143, h.getSize());
+    EXPECT_EQ(5, h.getResizeBucketsRemaining());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    EXPECT_EQ(2, h.continueResize(2));
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_EQ(3, h.getResizeBucketsRemaining());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    // Add and delete items while the old array is still in use.
+    auto moreKeys = generateKeys(1500, 1000);
+    storeMany(h, moreKeys);
+    for (size_t ii = 0; ii < 500; ++ii) {
+        EXPECT_TRUE(del(h, keys[ii]));
+    }
+    EXPECT_EQ(1000, count(h));
+
+    EXPECT_EQ(3, h.continueResize(100));
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(0, h.getResizeBucketsRemaining());
+    EXPECT_EQ(3, h.getNumResizeSteps());
+    EXPECT_EQ(0, h.continueResize(100));
+
+    keys.erase(keys.begin(), keys.begin() + 500);
+    verifyFound(h, keys);
+    verifyFound(h, moreKeys);
+    EXPECT_EQ(1000, count(h));
+}
+
+// Check that starting a new resize finishes off one already in progress.
+TEST_P(HashTableLayoutTest, IncrementalResizeRestart) {
+    HashTable h(global_stats, 97, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    ASSERT_TRUE(h.startIncrementalResize(6143));
+    EXPECT_EQ(10, h.continueResize(10));
+    ASSERT_TRUE(h.startIncrementalResize(769));
+    EXPECT_EQ(769, h.getSize());
+    EXPECT_EQ(6143, h.getResizeBucketsRemaining());
+    EXPECT_EQ(2, h.getNumResizes());
+    verifyFound(h, keys);
+
+    // A pause-resume visit covers the buckets of both arrays.
+    class PausingVisitor : public PauseResumeHashTableVisitor {
+    public:
+        bool visit(StoredValue& v) override {
+            ++visited;
+            return visited % 100 != 0;
+        }
+        size_t visited = 0;
+    } visitor;
+    HashTable::Position pos;
+    while (pos != h.endPosition()) {
+        pos = h.pauseResumeVisit(visitor, pos);
+    }
+    EXPECT_GT(visitor.visited, 0);
+    EXPECT_LE(visitor.visited, 1000);
+
+    while (h.isResizing()) {
+        EXPECT_GT(h.continueResize(1000), 0);
+    }
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+}
+
+// Check that a pause-resume pass which is part way through holds up an
+// incremental resize, so items can't move from buckets it has yet to visit
+// into ones it has already visited.
+TEST_P(HashTableLayoutTest, PauseResumeVisitPinsResize) {
+    HashTable h(global_stats, 97, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+    ASSERT_TRUE(h.startIncrementalResize(769));
+    EXPECT_EQ(10, h.continueResize(10));
+
+    // Visitor which pauses after every item.
+    class PausingVisitor : public PauseResumeHashTableVisitor {
+    public:
+        bool visit(StoredValue& v) override {
+            return false;
+        }
+    } visitor;
+
+    HashTable::Position pos;
+    size_t pauses = 0;
+    while (pos != h.endPosition()) {
+        pos = h.pauseResumeVisit(visitor, pos);
+        if (pos != h.endPosition()) {
+            ++pauses;
+            EXPECT_EQ(0, h.continueResize(10));
+            EXPECT_FALSE(h.startIncrementalResize(6143));
+        }
+    }
+    EXPECT_GT(pauses, 0);
+    EXPECT_EQ(87, h.getResizeBucketsRemaining());
+
+    // The pass is complete, so the resize can carry on.
+    EXPECT_EQ(10, h.continueResize(10));
+    EXPECT_EQ(77, h.getResizeBucketsRemaining());
+}
+
+// Check that an atomic visit sees every item (including those still in the
+// old array of a resize), and that it stops when the visitor asks it to.
+TEST_P(HashTableLayoutTest, VisitAtomically) {
+    HashTable h(global_stats, 97, 3, GetParam());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+    ASSERT_TRUE(h.startIncrementalResize(769));
+    EXPECT_EQ(10, h.continueResize(10));
+
+    Counter counter(true);
+    h.visitAtomically(counter);
+    EXPECT_EQ(1000, counter.count);
+
+    class StoppingVisitor : public HashTableVisitor {
+    public:
+        void visit(StoredValue* v) override {
+            ++visited;
+        }
+        bool shouldContinue() override {
+            return visited < 10;
+        }
+        size_t visited = 0;
+    } stopping;
+    h.visitAtomically(stopping);
+    EXPECT_EQ(10, stopping.visited);
+}
+
+INSTANTIATE_TEST_CASE_P(
+        ChainedAndFingerprint,
+        HashTableLayoutTest,
+        ::testing::Values(HashTable::Layout::Chained,
+                          HashTable::Layout::Fingerprint),
+        [](const ::testing::TestParamInfo<HashTable::Layout>& info) {
+            return std::string(HashTable::layoutToString(info.param));
+        });
+
+// Check that Fingerprint buckets spill into overflow cache lines once full,
+// and release them again as items are removed.
+TEST_F(HashTableTest, FingerprintOverflow) {
+    HashTable h(global_stats, 1, 1, HashTable::Layout::Fingerprint);
+    const int nkeys = 20;
+
+    auto keys = generateKeys(nkeys);
+    storeMany(h, keys);
+    // 6 items per cache line, so 20 items need 3 overflow buckets.
+    EXPECT_EQ(3, h.getNumOverflowBuckets());
+    verifyFound(h, keys);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    EXPECT_EQ(nkeys, depthCounter.max);
+
+    for (const auto& key : keys) {
+        del(h, key);
+    }
+    EXPECT_EQ(0, h.getNumOverflowBuckets());
+    EXPECT_EQ(0, count(h));
+}
+
+TEST_F(HashTableTest, LayoutFromString) {
+    EXPECT_EQ(HashTable::Layout::Chained,
+              HashTable::layoutFromString("chained"));
+    EXPECT_EQ(HashTable::Layout::Fingerprint,
+              HashTable::layoutFromString("fingerprint"));
+    EXPECT_THROW(HashTable::layoutFromString("treemap"),
+                 std::invalid_argument);
+}
+
+// Check StoredValues can be allocated from (and returned to) a per-HashTable
+// SlabAllocator, and that clearing the table releases the slabs.
+TEST_F(HashTableTest, SlabAllocator) {
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Chained,
+                /*useSlabAllocator*/true);
+    const SlabAllocator* slabs = h.getSlabAllocator();
+    ASSERT_TRUE(slabs);
+    EXPECT_EQ(0, slabs->getNumSlabs());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+    EXPECT_GT(slabs->getNumSlabs(), 0);
+    const size_t usedBytes = slabs->getUsedBytes();
+    EXPECT_GE(usedBytes, 1000 * sizeof(StoredValue));
+    EXPECT_LE(usedBytes, slabs->getSlabBytes());
+
+    for (size_t ii = 0; ii < 500; ++ii) {
+        EXPECT_TRUE(del(h, keys[ii]));
+    }
+    EXPECT_LT(slabs->getUsedBytes(), usedBytes);
+    EXPECT_EQ(500, count(h));
+
+    h.clear();
+    EXPECT_EQ(0, slabs->getUsedBytes());
+    EXPECT_EQ(0, slabs->getNumSlabs());
+}
+
+// Check small values are held inline in the StoredValue, larger ones in a
+// Blob, and that inline values are materialized correctly.
+TEST_F(HashTableTest, InlineValues) {
+    global_stats.reset();
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Chained,
+                /*useSlabAllocator*/false, /*inlineValueSize*/64);
+    const size_t initialSize = global_stats.currentSize.load();
+
+    StoredDocKey key = makeStoredDocKey("key");
+    uint8_t datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+    const std::string small("{\"small\":true}");
+    Item smallItem(key, 0, 0, small.data(), small.size(), &datatype,
+                   sizeof(datatype));
+    EXPECT_EQ(MutationStatus::WasClean, h.set(smallItem));
+
+    StoredValue* v = h.find(key);
+    ASSERT_TRUE(v);
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_TRUE(v->isResident());
+    EXPECT_EQ(smallItem.getValue()->length(), v->valuelen());
+    // Only the inline copy is kept, and it's all that's accounted.
+    EXPECT_FALSE(v->getValue());
+    EXPECT_EQ(v->size(), h.cacheSize.load());
+
+    // A Blob is only created when the value is handed on in an Item.
+    std::unique_ptr<Item> itm(v->toItem(false, 0));
+    EXPECT_EQ(*smallItem.getValue(), *itm->getValue());
+    EXPECT_NE(smallItem.getValue().get(), itm->getValue().get());
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_JSON, itm->getValue()->getDataType());
+    EXPECT_EQ(small, itm->getValue()->to_s());
+    EXPECT_FALSE(v->getValue());
+
+    // Reallocating leaves an inline value where it is.
+    v->reallocate(h);
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_EQ(small, v->materializeValue()->to_s());
+
+    // Values too large for the inline storage fall back to a Blob...
+    const std::string large(100, 'x');
+    Item largeItem(key, 0, 0, large.data(), large.size());
+    EXPECT_EQ(MutationStatus::WasDirty, h.set(largeItem));
+    EXPECT_FALSE(v->isValueInline());
+    EXPECT_EQ(large, v->getValue()->to_s());
+
+    // ... and small values are inlined again, releasing the Blob.
+    EXPECT_EQ(MutationStatus::WasDirty, h.set(smallItem));
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_FALSE(v->getValue());
+    EXPECT_EQ(small, v->materializeValue()->to_s());
+
+    // Inline values can be ejected and restored.
+    {
+        int bucket_num(0);
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        v->markClean();
+        EXPECT_TRUE(h.unlocked_ejectItem(v, VALUE_ONLY));
+        EXPECT_FALSE(v->isResident());
+        EXPECT_FALSE(v->isValueInline());
+        EXPECT_TRUE(h.unlocked_restoreValue(lh, smallItem, *v));
+        EXPECT_TRUE(v->isValueInline());
+        EXPECT_EQ(small, v->materializeValue()->to_s());
+    }
+
+    EXPECT_TRUE(del(h, key));
+    EXPECT_EQ(0, h.memSize.load());
+    EXPECT_EQ(0, h.cacheSize.load());
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+
+    // Items created with a large value have no inline storage.
+    EXPECT_EQ(MutationStatus::WasClean, h.set(largeItem));
+    v = h.find(key);
+    ASSERT_TRUE(v);
+    EXPECT_EQ(MutationStatus::WasDirty, h.set(smallItem));
+    EXPECT_FALSE(v->isValueInline());
+    EXPECT_EQ(small, v->getValue()->to_s());
+}
+
+TEST_F(HashTableTest, OptimisticGet) {
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Chained,
+                /*useSlabAllocator*/false, /*inlineValueSize*/0,
+                /*optimisticReads*/true);
+    ASSERT_TRUE(h.isOptimisticReadsEnabled());
+
+    StoredDocKey key = makeStoredDocKey("key");
+    Item item(key, 0, 0, "value", strlen("value"));
+    item.setCas(42);
+    EXPECT_EQ(MutationStatus::WasClean, h.set(item));
+
+    std::unique_ptr<Item> itm(h.optimisticGet(key, 3, false, false));
+    ASSERT_TRUE(itm);
+    EXPECT_EQ(key, itm->getKey());
+    EXPECT_EQ("value", itm->getValue()->to_s());
+    EXPECT_EQ(42, itm->getCas());
+    EXPECT_EQ(3, itm->getVBucketId());
+
+    EXPECT_EQ(nullptr, h.optimisticGet(makeStoredDocKey("missing"), 0, false,
+                                       false));
+
+    // Tracking a reference needs the NRU value updating under the lock...
+    StoredValue* v = h.find(key, /*trackReference*/false);
+    ASSERT_TRUE(v);
+    v->setNRUValue(INITIAL_NRU_VALUE);
+    EXPECT_EQ(nullptr, h.optimisticGet(key, 0, true, false));
+    // ... unless it's already at the minimum.
+    v->setNRUValue(MIN_NRU_VALUE);
+    itm.reset(h.optimisticGet(key, 0, true, false));
+    EXPECT_TRUE(itm);
+
+    // Locked items report a CAS of -1 if requested.
+    v->lock(ep_current_time() + 10);
+    itm.reset(h.optimisticGet(key, 0, false, true));
+    ASSERT_TRUE(itm);
+    EXPECT_EQ(static_cast<uint64_t>(-1), itm->getCas());
+    itm.reset(h.optimisticGet(key, 0, false, false));
+    ASSERT_TRUE(itm);
+    EXPECT_EQ(42, itm->getCas());
+    v->unlock();
+
+    // Expired, non-resident and deleted items are left to the locked path.
+    v->setExptime(ep_real_time() - 1);
+    EXPECT_EQ(nullptr, h.optimisticGet(key, 0, false, false));
+    v->setExptime(0);
+    int bucket_num(0);
+    {
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        v->markClean();
+        EXPECT_TRUE(h.unlocked_ejectItem(v, VALUE_ONLY));
+    }
+    EXPECT_EQ(nullptr, h.optimisticGet(key, 0, false, false));
+    {
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        EXPECT_TRUE(h.unlocked_restoreValue(lh, item, *v));
+    }
+    itm.reset(h.optimisticGet(key, 0, false, false));
+    EXPECT_TRUE(itm);
+    {
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        h.unlocked_softDelete(lh, *v, /*onlyMarkDeleted*/false);
+    }
+    EXPECT_EQ(nullptr, h.optimisticGet(key, 0, false, false));
+
+    // The returned Item keeps its value alive after the StoredValue has
+    // gone.
+    EXPECT_EQ("value", itm->getValue()->to_s());
+    EXPECT_TRUE(del(h, key));
+    EXPECT_EQ("value", itm->getValue()->to_s());
+}
+
+// Check retired objects are accounted until reclaimed, and that visits
+// reclaim them.
+TEST_F(HashTableTest, OptimisticGetReclaimsRetired) {
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Chained,
+                /*useSlabAllocator*/false, /*inlineValueSize*/0,
+                /*optimisticReads*/true);
+    const size_t overhead = global_stats.memOverhead->load();
+    auto keys = generateKeys(10);
+    storeMany(h, keys);
+    EXPECT_EQ(0, h.getRetiredBytes());
+
+    StoredValue* v = h.find(keys[0]);
+    ASSERT_TRUE(v);
+    const size_t bytes = v->size();
+    EXPECT_TRUE(del(h, keys[0]));
+    EXPECT_EQ(bytes, h.getRetiredBytes());
+    EXPECT_EQ(overhead + bytes, global_stats.memOverhead->load());
+
+    // A reader which may have seen a StoredValue keeps it, but not those
+    // retired before the reader started.
+    {
+        EpochManager::ReadGuard guard;
+        ASSERT_TRUE(guard);
+        StoredValue* v1 = h.find(keys[1]);
+        ASSERT_TRUE(v1);
+        const size_t bytes1 = v1->size();
+        EXPECT_TRUE(del(h, keys[1]));
+        h.reclaimRetired();
+        EXPECT_EQ(bytes1, h.getRetiredBytes());
+    }
+
+    HashTableStatVisitor visitor;
+    h.visit(visitor);
+    EXPECT_EQ(0, h.getRetiredBytes());
+    EXPECT_EQ(overhead, global_stats.memOverhead->load());
+}
+
+// Check a thread which found every reader slot claimed gets one once
+// another thread releases its slot.
+TEST_F(HashTableTest, EpochManagerReclaimsReaderSlots) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t started = 0;
+    size_t claimed = 0;
+    bool release = false;
+    std::vector<std::thread> readers;
+    // Claim every remaining slot (some may be held by other threads).
+    while (claimed == started) {
+        readers.emplace_back([&mutex, &cv, &started, &claimed, &release]() {
+            EpochManager::ReadGuard guard;
+            std::unique_lock<std::mutex> lh(mutex);
+            ++started;
+            if (guard) {
+                ++claimed;
+            }
+            cv.notify_all();
+            cv.wait(lh, [&release]() { return release; });
+        });
+        std::unique_lock<std::mutex> lh(mutex);
+        const size_t expected = readers.size();
+        cv.wait(lh, [&started, expected]() { return started == expected; });
+    }
+
+    std::thread([&readers, &mutex, &cv, &release]() {
+        EXPECT_FALSE(EpochManager::ReadGuard());
+        EXPECT_FALSE(EpochManager::ReadGuard());
+        // Let the readers exit, releasing their slots.
+        {
+            std::lock_guard<std::mutex> lh(mutex);
+            release = true;
+        }
+        cv.notify_all();
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        EXPECT_TRUE(EpochManager::ReadGuard());
+    }).join();
+}
+
+TEST_F(HashTableTest, OptimisticGetInlineValue) {
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Chained,
+                /*useSlabAllocator*/true, /*inlineValueSize*/64,
+                /*optimisticReads*/true);
+    StoredDocKey key = makeStoredDocKey("key");
+    uint8_t datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+    const std::string small("{\"small\":true}");
+    Item item(key, 0, 0, small.data(), small.size(), &datatype,
+              sizeof(datatype));
+    EXPECT_EQ(MutationStatus::WasClean, h.set(item));
+    ASSERT_TRUE(h.find(key)->isValueInline());
+
+    std::unique_ptr<Item> itm(h.optimisticGet(key, 0, false, false));
+    ASSERT_TRUE(itm);
+    EXPECT_EQ(*item.getValue(), *itm->getValue());
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_JSON, itm->getValue()->getDataType());
+
+
+    // Inline values updated in place are read afresh.
+    const std::string other("{\"small\":false}");
+    Item update(key, 0, 0, other.data(), other.size(), &datatype,
+                sizeof(datatype));
+    EXPECT_EQ(MutationStatus::WasDirty, h.set(update));
+    ASSERT_TRUE(h.find(key)->isValueInline());
+    itm.reset(h.optimisticGet(key, 0, false, false));
+    ASSERT_TRUE(itm);
+    EXPECT_EQ(other, itm->getValue()->to_s());
+}
+
+// Measure the rate of gets (find and copy to an Item, under the bucket
+// lock, as VBucket::getInternal()) of small values, with and without
+// inline values.
+class HashTableGetBenchmarkTest : public HashTableTest,
+                                  public ::testing::WithParamInterface<size_t> {
+};
+
+TEST_P(HashTableGetBenchmarkTest, SmallValueGets) {
+    HashTable h(global_stats, 0, 0, HashTable::Layout::Chained,
+                /*useSlabAllocator*/true, /*inlineValueSize*/GetParam());
+    const size_t numKeys = RUNNING_ON_VALGRIND ? 100 : 1000;
+    const size_t numGets = RUNNING_ON_VALGRIND ? 1000 : 500000;
+    auto keys = generateKeys(numKeys);
+    const std::string value(32, 'x');
+    for (const auto& key : keys) {
+        Item item(key, 0, 0, value.data(), value.size());
+        h.set(item);
+    }
+    h.resize();
+
+    const hrtime_t start = gethrtime();
+    for (size_t ii = 0; ii < numGets; ++ii) {
+        const auto& key = keys[(ii * 7919) % numKeys];
+        int bucket_num(0);
+        auto lh = h.getLockedBucket(key, &bucket_num);
+        StoredValue* v = h.unlocked_find(key, bucket_num, false, true);
+        std::unique_ptr<Item> itm(v->toItem(false, 0));
+        ASSERT_EQ(value.size(), itm->getNBytes());
+    }
+    const hrtime_t elapsed = std::max(gethrtime() - start, hrtime_t(1));
+    RecordProperty("gets_per_sec",
+                   static_cast<int>(numGets * 1000000000ULL / elapsed));
+}
+
+INSTANTIATE_TEST_CASE_P(InlineValueSizes,
+                        HashTableGetBenchmarkTest,
+                        ::testing::Values(0, 64),
+                        [](const ::testing::TestParamInfo<size_t>& info) {
+                            return "Inline" + std::to_string(info.param);
+                        });
+
+TEST_F(HashTableTest, OptimisticGetDisabledForFingerprintLayout) {
+    HashTable h(global_stats, 5, 1, HashTable::Layout::Fingerprint,
+                /*useSlabAllocator*/false, /*inlineValueSize*/0,
+                /*optimisticReads*/true);
+    EXPECT_FALSE(h.isOptimisticReadsEnabled());
+    StoredDocKey key = makeStoredDocKey("key");
+    store(h, key);
+    EXPECT_EQ(nullptr, h.optimisticGet(key, 0, false, false));
+}
+
+// Optimistic readers racing with writers (updates, deletes, evictions and
+// resizes) must only ever see one of the values written.
+TEST_F(HashTableTest, OptimisticGetConcurrentWriters) {
+    HashTable h(global_stats, 5, 3, HashTable::Layout::Chained,
+                /*useSlabAllocator*/true, /*inlineValueSize*/8,
+                /*optimisticReads*/true);
+    const auto keys = generateKeys(100);
+    const std::string shortValue("short");
+    const std::string longValue(100, 'l');
+
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> hits{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                for (const auto& key : keys) {
+                    std::unique_ptr<Item> itm(
+                            h.optimisticGet(key, 0, false, false));
+                    if (itm) {
+                        const std::string value = itm->getValue()->to_s();
+                        EXPECT_TRUE(value == shortValue || value == longValue)
+                            << value;
+                        EXPECT_EQ(key, itm->getKey());
+                        ++hits;
+                    }
+                }
+            }
+        });
+    }
+
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        const std::string& value = (iteration % 2) ? longValue : shortValue;
+        for (const auto& key : keys) {
+            Item item(key, 0, 0, value.data(), value.size());
+            h.set(item);
+        }
+        if (iteration % 10 == 0) {
+            h.resize((iteration % 20) ? 5 : 97);
+        }
+        if (iteration % 7 == 0) {
+            for (size_t i = 0; i < keys.size(); i += 3) {
+                del(h, keys[i]);
+            }
+        }
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_GT(hits.load(), 0);
+}
@@ -244,6 +244,40 @@ TEST(CouchKVStoreTest, CompressedTest) {
     kvstore->destroyScanContext(scanCtx);
 }
 
+// A single transaction (group commit) may hold items for several vbuckets;
+// each vbucket's file gets its items.
+TEST(CouchKVStoreTest, MultipleVBucketCommit) {
+    std::string data_dir("/tmp/kvstore-test");
+    cb::io::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(
+            1024, 4, data_dir, "couchdb", 0, false /*persistnamespace*/);
+    auto kvstore = setup_kv_store(config);
+    std::string failoverLog("");
+    vbucket_state state(vbucket_state_active, 0, 0, 0, 0, 0, 0, 0, failoverLog);
+    kvstore->snapshotVBucket(1, state,
+                             VBStatePersist::VBSTATE_PERSIST_WITHOUT_COMMIT);
+
+    kvstore->begin();
+    WriteCallback wc;
+    for (uint16_t vb = 0; vb < 2; vb++) {
+        for (int i = 1; i <= 3; i++) {
+            Item item(makeStoredDocKey("key" + std::to_string(i)),
+                      0, 0, "value", 5, nullptr, 0, 0, i, vb);
+            kvstore->set(item, wc);
+        }
+    }
+    EXPECT_TRUE(kvstore->commit());
+
+    for (uint16_t vb = 0; vb < 2; vb++) {
+        EXPECT_EQ(3, kvstore->getLastPersistedSeqno(vb));
+        for (int i = 1; i <= 3; i++) {
+            GetCallback gc;
+            kvstore->get(makeStoredDocKey("key" + std::to_string(i)), vb, gc);
+        }
+    }
+}
+
 // Verify the stats returned from operations are accurate.
 TEST(CouchKVStoreTest, StatsTest) {
     std::string data_dir("/tmp/kvstore-test");
@@ -279,6 +313,97 @@ TEST(CouchKVStoreTest, StatsTest) {
     EXPECT_GE(io_total_write_bytes, io_write_bytes);
 }
 
+// Gets reuse cached read-only handles while the file is unchanged, and
+// reopen it to see later commits.
+TEST(CouchKVStoreTest, DbHandleCache) {
+    std::string data_dir("/tmp/kvstore-test");
+    cb::io::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(
+            1024, 4, data_dir, "couchdb", 0, false /*persistnamespace*/);
+    config.setDbHandleCacheSize(2);
+    auto kvstore = setup_kv_store(config);
+
+    auto getStats = [&kvstore]() {
+        std::map<std::string, std::string> stats;
+        kvstore->addStats(add_stat_callback, &stats);
+        return std::make_pair(stats["rw_0:db_handle_cache_hits"],
+                              stats["rw_0:db_handle_cache_misses"]);
+    };
+
+    kvstore->begin();
+    WriteCallback wc;
+    Item item(makeStoredDocKey("key"), 0, 0, "value", 5);
+    kvstore->set(item, wc);
+    EXPECT_TRUE(kvstore->commit());
+
+    GetCallback gc;
+    kvstore->get(makeStoredDocKey("key"), 0, gc);
+    kvstore->get(makeStoredDocKey("key"), 0, gc);
+    EXPECT_EQ(std::make_pair(std::string("1"), std::string("1")), getStats());
+
+    kvstore->begin();
+    Item item2(makeStoredDocKey("key2"), 0, 0, "value", 5);
+    kvstore->set(item2, wc);
+    EXPECT_TRUE(kvstore->commit());
+
+    kvstore->get(makeStoredDocKey("key2"), 0, gc);
+    EXPECT_EQ(std::make_pair(std::string("1"), std::string("2")), getStats());
+}
+
+// Exposes the number of read-only handles a CouchKVStore has cached.
+class HandleCacheCouchKVStore : public CouchKVStore {
+public:
+    HandleCacheCouchKVStore(KVStoreConfig& config, bool read_only)
+        : CouchKVStore(config, read_only) {
+    }
+
+    size_t getNumCachedDBs() {
+        LockHolder lh(dbHandleCacheMutex);
+        return dbHandleCache.size();
+    }
+};
+
+// Compaction through the read-write store leaves the read-only store's
+// cached handles on the pre-compaction file until they're invalidated.
+TEST(CouchKVStoreTest, DbHandleCacheInvalidatedAfterCompaction) {
+    std::string data_dir("/tmp/kvstore-test");
+    cb::io::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(
+            1024, 4, data_dir, "couchdb", 0, false /*persistnamespace*/);
+    config.setDbHandleCacheSize(2);
+    auto kvstore = setup_kv_store(config);
+
+    kvstore->begin();
+    WriteCallback wc;
+    Item item(makeStoredDocKey("key"), 0, 0, "value", 5);
+    kvstore->set(item, wc);
+    EXPECT_TRUE(kvstore->commit());
+
+    HandleCacheCouchKVStore roStore(config, true /*read_only*/);
+    GetCallback gc;
+    roStore.get(makeStoredDocKey("key"), 0, gc);
+    EXPECT_EQ(1, roStore.getNumCachedDBs());
+
+    compaction_ctx cctx;
+    cctx.purge_before_seq = 0;
+    cctx.purge_before_ts = 0;
+    cctx.curr_time = 0;
+    cctx.drop_deletes = 0;
+    cctx.db_file_id = 0;
+    EXPECT_TRUE(kvstore->compactDB(&cctx));
+    EXPECT_EQ(1, roStore.getNumCachedDBs());
+
+    roStore.invalidateCachedDBs(0);
+    EXPECT_EQ(0, roStore.getNumCachedDBs());
+
+    // Gets find the compacted file.
+    roStore.get(makeStoredDocKey("key"), 0, gc);
+    roStore.get(makeStoredDocKey("key"), 0, gc);
+    EXPECT_EQ(1, roStore.getNumCachedDBs());
+}
+
 // Verify the compaction stats returned from operations are accurate.
 TEST(CouchKVStoreTest, CompactStatsTest) {
     std::string data_dir("/tmp/kvstore-test");
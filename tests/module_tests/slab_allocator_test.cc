@@ -0,0 +1,176 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "slab_allocator.h"
+
+#include <cstring>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Objects of the same size class share slabs, and freed objects are reused.
+TEST(SlabAllocatorTest, AllocateAndReuse) {
+    SlabAllocator slabs;
+
+    void* a = slabs.allocate(60);
+    void* b = slabs.allocate(64);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(1, slabs.getNumSlabs());
+    EXPECT_EQ(SlabAllocator::slabSize, slabs.getSlabBytes());
+    EXPECT_EQ(128, slabs.getUsedBytes());
+
+    slabs.deallocate(a, 60);
+    EXPECT_EQ(64, slabs.getUsedBytes());
+    EXPECT_EQ(a, slabs.allocate(57));
+
+    slabs.deallocate(a, 57);
+    slabs.deallocate(b, 64);
+    EXPECT_EQ(0, slabs.getUsedBytes());
+}
+
+// Objects allocated from a class must not overlap one another, even across
+// slab boundaries.
+TEST(SlabAllocatorTest, NoOverlap) {
+    SlabAllocator slabs;
+    const size_t size = 72;
+    const size_t count = 3 * SlabAllocator::slabSize / size;
+
+    std::vector<char*> objects;
+    for (size_t ii = 0; ii < count; ++ii) {
+        char* p = static_cast<char*>(slabs.allocate(size));
+        std::memset(p, ii & 0xff, size);
+        objects.push_back(p);
+    }
+    EXPECT_GE(slabs.getNumSlabs(), 3);
+    for (size_t ii = 0; ii < count; ++ii) {
+        for (size_t jj = 0; jj < size; ++jj) {
+            ASSERT_EQ(static_cast<char>(ii & 0xff), objects[ii][jj]);
+        }
+    }
+    EXPECT_EQ(count,
+              std::set<char*>(objects.begin(), objects.end()).size());
+
+    for (auto* p : objects) {
+        slabs.deallocate(p, size);
+    }
+}
+
+// A size class keeps its last slab with space when that slab empties;
+// releaseUnusedSlabs() frees it.
+TEST(SlabAllocatorTest, ReleaseUnusedSlabs) {
+    SlabAllocator slabs;
+
+    void* small = slabs.allocate(56);
+    void* large = slabs.allocate(300);
+    EXPECT_EQ(2, slabs.getNumSlabs());
+
+    slabs.deallocate(small, 56);
+    EXPECT_EQ(SlabAllocator::slabSize, slabs.releaseUnusedSlabs());
+    EXPECT_EQ(1, slabs.getNumSlabs());
+
+    slabs.deallocate(large, 300);
+    EXPECT_EQ(SlabAllocator::slabSize, slabs.releaseUnusedSlabs());
+    EXPECT_EQ(0, slabs.getNumSlabs());
+    EXPECT_EQ(0, slabs.releaseUnusedSlabs());
+
+    // Still usable after releasing everything.
+    void* p = slabs.allocate(56);
+    EXPECT_EQ(1, slabs.getNumSlabs());
+    slabs.deallocate(p, 56);
+}
+
+// A slab is released as soon as its last object is freed, even while
+// other slabs of its size class are still in use.
+TEST(SlabAllocatorTest, ReleaseEmptySlabs) {
+    SlabAllocator slabs;
+    const size_t size = 64;
+    const size_t perSlab = SlabAllocator::slabSize / size;
+
+    std::vector<void*> objects;
+    for (size_t ii = 0; ii < 4 * perSlab; ++ii) {
+        objects.push_back(slabs.allocate(size));
+    }
+    EXPECT_EQ(4, slabs.getNumSlabs());
+
+    // Free all but one object of each slab; no slab is empty.
+    std::vector<void*> kept;
+    for (size_t ii = 0; ii < objects.size(); ++ii) {
+        if (ii % perSlab == 0) {
+            kept.push_back(objects[ii]);
+        } else {
+            slabs.deallocate(objects[ii], size);
+        }
+    }
+    EXPECT_EQ(4, slabs.getNumSlabs());
+    EXPECT_EQ(4 * size, slabs.getUsedBytes());
+
+    // Emptying slabs releases them while other slabs have space.
+    slabs.deallocate(kept[1], size);
+    EXPECT_EQ(3, slabs.getNumSlabs());
+    slabs.deallocate(kept[3], size);
+    EXPECT_EQ(2, slabs.getNumSlabs());
+
+    // New objects fill the lowest addressed slab with space first.
+    void* p = slabs.allocate(size);
+    EXPECT_EQ(2, slabs.getNumSlabs());
+    slabs.deallocate(p, size);
+
+    // The last slab with space is kept until releaseUnusedSlabs().
+    slabs.deallocate(kept[0], size);
+    EXPECT_EQ(1, slabs.getNumSlabs());
+    slabs.deallocate(kept[2], size);
+    EXPECT_EQ(1, slabs.getNumSlabs());
+    EXPECT_EQ(SlabAllocator::slabSize, slabs.releaseUnusedSlabs());
+    EXPECT_EQ(0, slabs.getNumSlabs());
+}
+
+// Requests too large for any size class bypass the slabs.
+TEST(SlabAllocatorTest, LargeObjects) {
+    SlabAllocator slabs;
+
+    void* p = slabs.allocate(SlabAllocator::maxObjectSize + 1);
+    EXPECT_EQ(1, slabs.getNumLargeObjects());
+    EXPECT_EQ(0, slabs.getNumSlabs());
+    EXPECT_EQ(0, slabs.getUsedBytes());
+    slabs.deallocate(p, SlabAllocator::maxObjectSize + 1);
+    EXPECT_EQ(0, slabs.getNumLargeObjects());
+}
+
+TEST(SlabAllocatorTest, ConcurrentAllocate) {
+    SlabAllocator slabs;
+    const size_t perThread = 10000;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&slabs, t]() {
+            std::vector<void*> objects;
+            const size_t size = 56 + (t * 8);
+            for (size_t ii = 0; ii < perThread; ++ii) {
+                objects.push_back(slabs.allocate(size));
+            }
+            for (auto* p : objects) {
+                slabs.deallocate(p, size);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(0, slabs.getUsedBytes());
+}